@@ -0,0 +1,183 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/exception_handler.h"
+
+#include <signal.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+
+#include <cstring>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/math.h"
+
+namespace xe {
+
+// Same limits and ordering as the Windows vectored handler.
+constexpr size_t kMaxHandlerCount = 8;
+
+// All custom handlers, left-aligned and null terminated.
+// Executed in order.
+std::pair<ExceptionHandler::Handler, void*> handlers_[kMaxHandlerCount];
+
+// Signals we turn into exceptions, and whatever handled them before us so
+// that faults we don't want can be passed on (usually to the default action,
+// which dumps core).
+constexpr size_t kSignalCount = 3;
+const int kSignals[kSignalCount] = {SIGSEGV, SIGBUS, SIGILL};
+struct sigaction previous_actions_[kSignalCount];
+bool signals_installed_ = false;
+
+// X64Context::int_registers order.
+const int kIntRegisterMap[16] = {
+    REG_RAX, REG_RCX, REG_RDX, REG_RBX, REG_RSP, REG_RBP, REG_RSI, REG_RDI,
+    REG_R8,  REG_R9,  REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15,
+};
+
+// Handlers run on their own stack, so that a thread that has run out of stack
+// can still be reported. xe::threading threads get one when they start; this
+// covers whichever thread installs the first handler.
+const size_t kSignalStackSize = 64 * 1024;
+void EnsureSignalStack() {
+  stack_t current;
+  if (sigaltstack(nullptr, &current) == 0 && !(current.ss_flags & SS_DISABLE)) {
+    return;
+  }
+  void* stack = mmap(nullptr, kSignalStackSize, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (stack == MAP_FAILED) {
+    return;
+  }
+  stack_t signal_stack = {0};
+  signal_stack.ss_sp = stack;
+  signal_stack.ss_size = kSignalStackSize;
+  sigaltstack(&signal_stack, nullptr);
+}
+
+void ForwardSignal(int signal, siginfo_t* info, void* context) {
+  size_t signal_index = 0;
+  while (kSignals[signal_index] != signal) {
+    ++signal_index;
+  }
+  auto& previous = previous_actions_[signal_index];
+  if (previous.sa_flags & SA_SIGINFO) {
+    if (previous.sa_sigaction) {
+      previous.sa_sigaction(signal, info, context);
+      return;
+    }
+  } else if (previous.sa_handler != SIG_DFL &&
+             previous.sa_handler != SIG_IGN) {
+    previous.sa_handler(signal);
+    return;
+  }
+  // Put the default action back and return into the faulting instruction,
+  // which faults again and takes it.
+  sigaction(signal, &previous, nullptr);
+}
+
+void SignalHandler(int signal, siginfo_t* info, void* context) {
+  auto ucontext = reinterpret_cast<ucontext_t*>(context);
+  auto& mcontext = ucontext->uc_mcontext;
+
+  // Only what X64Context holds is copied out and back in: general purpose
+  // registers, flags and the XMM registers (which live in the FXSAVE area).
+  X64Context thread_context;
+  thread_context.rip = mcontext.gregs[REG_RIP];
+  thread_context.eflags = static_cast<uint32_t>(mcontext.gregs[REG_EFL]);
+  for (size_t i = 0; i < xe::countof(kIntRegisterMap); ++i) {
+    thread_context.int_registers[i] = mcontext.gregs[kIntRegisterMap[i]];
+  }
+  if (mcontext.fpregs) {
+    std::memcpy(thread_context.xmm_registers, mcontext.fpregs->_xmm,
+                sizeof(thread_context.xmm_registers));
+  }
+
+  Exception ex;
+  if (signal == SIGILL) {
+    ex.InitializeIllegalInstruction(&thread_context);
+  } else {
+    ex.InitializeAccessViolation(&thread_context,
+                                 reinterpret_cast<uint64_t>(info->si_addr));
+  }
+
+  for (size_t i = 0; i < xe::countof(handlers_) && handlers_[i].first; ++i) {
+    if (handlers_[i].first(&ex, handlers_[i].second)) {
+      // Exception handled. Handlers may have changed any register (such as
+      // the destination of an emulated load) along with the resume address.
+      mcontext.gregs[REG_RIP] = thread_context.rip;
+      mcontext.gregs[REG_EFL] = thread_context.eflags;
+      for (size_t j = 0; j < xe::countof(kIntRegisterMap); ++j) {
+        mcontext.gregs[kIntRegisterMap[j]] = thread_context.int_registers[j];
+      }
+      if (mcontext.fpregs) {
+        std::memcpy(mcontext.fpregs->_xmm, thread_context.xmm_registers,
+                    sizeof(thread_context.xmm_registers));
+      }
+      return;
+    }
+  }
+
+  ForwardSignal(signal, info, context);
+}
+
+void ExceptionHandler::Install(Handler fn, void* data) {
+  if (!signals_installed_) {
+    EnsureSignalStack();
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_sigaction = SignalHandler;
+    // SA_NODEFER as handlers may fault themselves (while probing memory, for
+    // example), which Windows allows as well.
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    for (size_t i = 0; i < kSignalCount; ++i) {
+      sigaction(kSignals[i], &action, &previous_actions_[i]);
+    }
+    signals_installed_ = true;
+  }
+
+  for (size_t i = 0; i < xe::countof(handlers_); ++i) {
+    if (!handlers_[i].first) {
+      handlers_[i].first = fn;
+      handlers_[i].second = data;
+      return;
+    }
+  }
+  assert_always("Too many exception handlers installed");
+}
+
+void ExceptionHandler::Uninstall(Handler fn, void* data) {
+  for (size_t i = 0; i < xe::countof(handlers_); ++i) {
+    if (handlers_[i].first == fn && handlers_[i].second == data) {
+      for (; i < xe::countof(handlers_) - 1; ++i) {
+        handlers_[i] = handlers_[i + 1];
+      }
+      handlers_[i].first = nullptr;
+      handlers_[i].second = nullptr;
+      break;
+    }
+  }
+
+  bool has_any = false;
+  for (size_t i = 0; i < xe::countof(handlers_); ++i) {
+    if (handlers_[i].first) {
+      has_any = true;
+      break;
+    }
+  }
+  if (!has_any && signals_installed_) {
+    for (size_t i = 0; i < kSignalCount; ++i) {
+      sigaction(kSignals[i], &previous_actions_[i], nullptr);
+    }
+    signals_installed_ = false;
+  }
+}
+
+}  // namespace xe
@@ -0,0 +1,230 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/hierarchical_bit_map.h"
+
+#include <algorithm>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/math.h"
+
+namespace xe {
+
+namespace {
+
+size_t LowestSetBit(uint64_t bits) { return 63 - xe::lzcnt(bits & (0 - bits)); }
+
+size_t HighestSetBit(uint64_t bits) { return 63 - xe::lzcnt(bits); }
+
+// First set bit at or after index, or npos.
+size_t ScanForward(const std::vector<uint64_t>& words, size_t index) {
+  size_t word_index = index >> 6;
+  if (word_index >= words.size()) {
+    return HierarchicalBitMap::npos;
+  }
+  uint64_t bits = words[word_index] & (~0ull << (index & 63));
+  while (!bits) {
+    if (++word_index >= words.size()) {
+      return HierarchicalBitMap::npos;
+    }
+    bits = words[word_index];
+  }
+  return (word_index << 6) + LowestSetBit(bits);
+}
+
+// Last set bit at or before index, or npos.
+size_t ScanBackward(const std::vector<uint64_t>& words, size_t index) {
+  size_t word_index = index >> 6;
+  uint64_t bits = words[word_index] & (~0ull >> (63 - (index & 63)));
+  while (!bits) {
+    if (!word_index) {
+      return HierarchicalBitMap::npos;
+    }
+    bits = words[--word_index];
+  }
+  return (word_index << 6) + HighestSetBit(bits);
+}
+
+}  // namespace
+
+const size_t HierarchicalBitMap::npos;
+
+HierarchicalBitMap::HierarchicalBitMap() = default;
+
+HierarchicalBitMap::HierarchicalBitMap(size_t size) { Resize(size); }
+
+void HierarchicalBitMap::Resize(size_t size) {
+  size_ = size;
+  size_t word_count = (size + 63) / 64;
+  free_.resize(word_count);
+  any_free_.resize((word_count + 63) / 64);
+  any_used_.resize(any_free_.size());
+  Reset();
+}
+
+void HierarchicalBitMap::Reset() {
+  std::fill(free_.begin(), free_.end(), ~0ull);
+  if (size_ & 63) {
+    free_.back() = (1ull << (size_ & 63)) - 1;
+  }
+  std::fill(any_free_.begin(), any_free_.end(), 0);
+  std::fill(any_used_.begin(), any_used_.end(), 0);
+  for (size_t i = 0; i < free_.size(); ++i) {
+    UpdateSummary(i);
+  }
+}
+
+void HierarchicalBitMap::UpdateSummary(size_t word_index) {
+  uint64_t bit = 1ull << (word_index & 63);
+  size_t summary_index = word_index >> 6;
+  if (free_[word_index]) {
+    any_free_[summary_index] |= bit;
+  } else {
+    any_free_[summary_index] &= ~bit;
+  }
+  if (~free_[word_index]) {
+    any_used_[summary_index] |= bit;
+  } else {
+    any_used_[summary_index] &= ~bit;
+  }
+}
+
+void HierarchicalBitMap::Set(size_t start, size_t count, bool free) {
+  assert_true(start + count <= size_);
+  size_t end = start + count;
+  while (start < end) {
+    size_t word_index = start >> 6;
+    size_t bit_count = std::min(end - start, 64 - (start & 63));
+    uint64_t mask = bit_count == 64
+                        ? ~0ull
+                        : ((1ull << bit_count) - 1) << (start & 63);
+    if (free) {
+      free_[word_index] |= mask;
+    } else {
+      free_[word_index] &= ~mask;
+    }
+    UpdateSummary(word_index);
+    start += bit_count;
+  }
+}
+
+size_t HierarchicalBitMap::FindNextFree(size_t index) const {
+  size_t word_index = index >> 6;
+  if (word_index >= free_.size()) {
+    return npos;
+  }
+  uint64_t bits = free_[word_index] & (~0ull << (index & 63));
+  if (!bits) {
+    word_index = ScanForward(any_free_, word_index + 1);
+    if (word_index == npos) {
+      return npos;
+    }
+    bits = free_[word_index];
+  }
+  return (word_index << 6) + LowestSetBit(bits);
+}
+
+size_t HierarchicalBitMap::FindNextUsed(size_t index) const {
+  size_t word_index = index >> 6;
+  if (word_index >= free_.size()) {
+    return npos;
+  }
+  uint64_t bits = ~free_[word_index] & (~0ull << (index & 63));
+  if (!bits) {
+    word_index = ScanForward(any_used_, word_index + 1);
+    if (word_index == npos) {
+      return npos;
+    }
+    bits = ~free_[word_index];
+  }
+  return (word_index << 6) + LowestSetBit(bits);
+}
+
+size_t HierarchicalBitMap::FindPrevFree(size_t index) const {
+  size_t word_index = index >> 6;
+  uint64_t bits = free_[word_index] & (~0ull >> (63 - (index & 63)));
+  if (!bits) {
+    if (!word_index) {
+      return npos;
+    }
+    word_index = ScanBackward(any_free_, word_index - 1);
+    if (word_index == npos) {
+      return npos;
+    }
+    bits = free_[word_index];
+  }
+  return (word_index << 6) + HighestSetBit(bits);
+}
+
+size_t HierarchicalBitMap::FindPrevUsed(size_t index) const {
+  size_t word_index = index >> 6;
+  uint64_t bits = ~free_[word_index] & (~0ull >> (63 - (index & 63)));
+  if (!bits) {
+    if (!word_index) {
+      return npos;
+    }
+    word_index = ScanBackward(any_used_, word_index - 1);
+    if (word_index == npos) {
+      return npos;
+    }
+    bits = ~free_[word_index];
+  }
+  return (word_index << 6) + HighestSetBit(bits);
+}
+
+size_t HierarchicalBitMap::FindFreeRange(size_t low, size_t high,
+                                         size_t count, size_t alignment,
+                                         bool top_down) const {
+  high = std::min(high, size_);
+  if (!count || !alignment || low >= high || count > high - low) {
+    return npos;
+  }
+
+  // Each step skips a whole free or used run, found a word at a time.
+  if (top_down) {
+    size_t limit = high;
+    while (limit > low) {
+      size_t last_free = FindPrevFree(limit - 1);
+      if (last_free == npos || last_free < low + count - 1) {
+        return npos;
+      }
+      // Highest aligned start that ends at or before last_free.
+      size_t start = (last_free + 1 - count) / alignment * alignment;
+      if (start < low) {
+        return npos;
+      }
+      size_t last_used = FindPrevUsed(start + count - 1);
+      if (last_used == npos || last_used < start) {
+        return start;
+      }
+      limit = last_used;
+    }
+    return npos;
+  }
+
+  size_t next = low;
+  while (next < high) {
+    size_t first_free = FindNextFree(next);
+    if (first_free == npos || first_free >= high) {
+      return npos;
+    }
+    size_t start = (first_free + alignment - 1) / alignment * alignment;
+    if (start + count > high) {
+      return npos;
+    }
+    size_t first_used = FindNextUsed(start);
+    if (first_used == npos || first_used >= start + count) {
+      return start;
+    }
+    next = first_used + 1;
+  }
+  return npos;
+}
+
+}  // namespace xe
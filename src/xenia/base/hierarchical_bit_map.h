@@ -0,0 +1,72 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_HIERARCHICAL_BIT_MAP_H_
+#define XENIA_BASE_HIERARCHICAL_BIT_MAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace xe {
+
+// Hierarchical Bit Map: free/used state of a fixed number of entries (such as
+// pages) with a summary level on top, so that runs of free entries can be
+// found a word (64 entries) or a summary word (4096 entries) at a time instead
+// of one entry at a time.
+// Not threadsafe.
+class HierarchicalBitMap {
+ public:
+  static const size_t npos = SIZE_MAX;
+
+  HierarchicalBitMap();
+  // All entries start out free.
+  explicit HierarchicalBitMap(size_t size);
+
+  size_t size() const { return size_; }
+
+  // Resizes the map. All entries are free afterwards.
+  void Resize(size_t size);
+  // Sets all entries to free.
+  void Reset();
+
+  bool IsFree(size_t index) const {
+    return (free_[index >> 6] >> (index & 63)) & 1;
+  }
+  void SetFree(size_t start, size_t count) { Set(start, count, true); }
+  void SetUsed(size_t start, size_t count) { Set(start, count, false); }
+
+  // Finds count free entries in [low, high) starting at a multiple of
+  // alignment, preferring the lowest (or with top_down the highest) start.
+  // Returns the start or npos if there is no such range.
+  size_t FindFreeRange(size_t low, size_t high, size_t count, size_t alignment,
+                       bool top_down) const;
+
+ private:
+  void Set(size_t start, size_t count, bool free);
+  void UpdateSummary(size_t word_index);
+
+  // First free (used) entry at or after index, or npos.
+  size_t FindNextFree(size_t index) const;
+  size_t FindNextUsed(size_t index) const;
+  // Last free (used) entry at or before index, or npos.
+  size_t FindPrevFree(size_t index) const;
+  size_t FindPrevUsed(size_t index) const;
+
+  size_t size_ = 0;
+  // One bit per entry, set if free. Bits past the end are used.
+  std::vector<uint64_t> free_;
+  // One bit per word of free_, set if it has any free (used) entries.
+  std::vector<uint64_t> any_free_;
+  std::vector<uint64_t> any_used_;
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_HIERARCHICAL_BIT_MAP_H_
@@ -0,0 +1,149 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/hierarchical_bit_map.h"
+
+#include <chrono>
+#include <random>
+
+#include "third_party/catch/include/catch.hpp"
+
+using xe::HierarchicalBitMap;
+
+namespace {
+
+// The page-by-page search BaseHeap::AllocRange used to do, for comparison.
+size_t LinearFindFreeRange(const std::vector<bool>& used, size_t low,
+                           size_t high, size_t count, size_t alignment,
+                           bool top_down) {
+  high = std::min(high, used.size());
+  if (count > high - low) {
+    return HierarchicalBitMap::npos;
+  }
+  auto is_range_free = [&](size_t start) {
+    for (size_t i = start; i < start + count; ++i) {
+      if (used[i]) {
+        return false;
+      }
+    }
+    return true;
+  };
+  if (top_down) {
+    for (size_t start = (high - count) / alignment * alignment + alignment;
+         start >= alignment && start - alignment >= low;) {
+      start -= alignment;
+      if (is_range_free(start)) {
+        return start;
+      }
+    }
+  } else {
+    for (size_t start = (low + alignment - 1) / alignment * alignment;
+         start + count <= high; start += alignment) {
+      if (is_range_free(start)) {
+        return start;
+      }
+    }
+  }
+  return HierarchicalBitMap::npos;
+}
+
+}  // namespace
+
+TEST_CASE("HierarchicalBitMap_FindFreeRange", "[bit_map]") {
+  HierarchicalBitMap map(1000);
+  REQUIRE(map.FindFreeRange(0, 1000, 10, 1, false) == 0);
+  REQUIRE(map.FindFreeRange(0, 1000, 10, 1, true) == 990);
+  REQUIRE(map.FindFreeRange(0, 1000, 10, 16, true) == 976);
+  REQUIRE(map.FindFreeRange(0, 1000, 1001, 1, false) ==
+          HierarchicalBitMap::npos);
+
+  map.SetUsed(0, 100);
+  map.SetUsed(130, 500);
+  REQUIRE(!map.IsFree(99));
+  REQUIRE(map.IsFree(100));
+  REQUIRE(map.FindFreeRange(0, 1000, 30, 1, false) == 100);
+  REQUIRE(map.FindFreeRange(0, 1000, 31, 1, false) == 630);
+  REQUIRE(map.FindFreeRange(0, 1000, 30, 64, false) == 640);
+  REQUIRE(map.FindFreeRange(0, 630, 30, 1, true) == 100);
+  REQUIRE(map.FindFreeRange(0, 630, 31, 1, true) == HierarchicalBitMap::npos);
+  map.SetFree(0, 1000);
+  REQUIRE(map.FindFreeRange(0, 1000, 1000, 1, false) == 0);
+
+  // Against the simple search on random layouts.
+  std::mt19937 random(1234);
+  for (int n = 0; n < 200; ++n) {
+    size_t size = 1 + random() % 5000;
+    HierarchicalBitMap random_map(size);
+    std::vector<bool> used(size);
+    for (int i = 0; i < 40; ++i) {
+      size_t start = random() % size;
+      size_t count = 1 + random() % std::min<size_t>(size - start, 300);
+      bool is_used = random() % 3 != 0;
+      if (is_used) {
+        random_map.SetUsed(start, count);
+      } else {
+        random_map.SetFree(start, count);
+      }
+      std::fill(used.begin() + start, used.begin() + start + count, is_used);
+    }
+    for (int i = 0; i < 20; ++i) {
+      size_t low = random() % size;
+      size_t high = low + random() % (size - low + 1);
+      size_t count = 1 + random() % 200;
+      size_t alignment = size_t(1) << (random() % 7);
+      bool top_down = random() & 1;
+      REQUIRE(random_map.FindFreeRange(low, high, count, alignment, top_down) ==
+              LinearFindFreeRange(used, low, high, count, alignment, top_down));
+    }
+  }
+}
+
+// Allocation churn on a 512MB heap of 4KiB pages, with the bitmap and with a
+// page-by-page search. Run explicitly with the [benchmark] tag.
+TEST_CASE("HierarchicalBitMap_Churn", "[.][benchmark][bit_map]") {
+  const size_t kPageCount = 512 * 1024 * 1024 / 4096;
+  const int kIterations = 20000;
+
+  for (bool use_bit_map : {false, true}) {
+    HierarchicalBitMap map(kPageCount);
+    std::vector<bool> used(kPageCount);
+    std::vector<std::pair<size_t, size_t>> live;
+    std::mt19937 random(5678);
+    auto start_time = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < kIterations; ++i) {
+      // Keep around 60% of the heap in small and medium allocations, and free
+      // at random so that the heap fragments.
+      if (live.size() > 9000 || (!live.empty() && random() % 3 == 0)) {
+        size_t index = random() % live.size();
+        auto allocation = live[index];
+        live[index] = live.back();
+        live.pop_back();
+        map.SetFree(allocation.first, allocation.second);
+        std::fill(used.begin() + allocation.first,
+                  used.begin() + allocation.first + allocation.second, false);
+        continue;
+      }
+      size_t count = random() % 8 ? 1 + random() % 4 : 16 + random() % 48;
+      bool top_down = random() & 1;
+      size_t start =
+          use_bit_map
+              ? map.FindFreeRange(0, kPageCount, count, 1, top_down)
+              : LinearFindFreeRange(used, 0, kPageCount, count, 1, top_down);
+      REQUIRE(start != HierarchicalBitMap::npos);
+      map.SetUsed(start, count);
+      std::fill(used.begin() + start, used.begin() + start + count, true);
+      live.emplace_back(start, count);
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::high_resolution_clock::now() - start_time);
+    WARN((use_bit_map ? "bit map" : "linear") << ": " << kIterations
+                                              << " allocs/frees in "
+                                              << duration.count() << "us");
+  }
+}
@@ -11,6 +11,8 @@
 
 #include <algorithm>
 
+#include "xenia/base/platform.h"
+
 namespace xe {
 
 // TODO(benvanik): fancy AVX versions.
@@ -108,8 +110,8 @@ void copy_and_swap_64_unaligned(void* dest_ptr, const void* src_ptr,
 
 void copy_and_swap_16_in_32_aligned(void* dest_ptr, const void* src_ptr,
                                     size_t count) {
-  auto dest = reinterpret_cast<uint64_t*>(dest_ptr);
-  auto src = reinterpret_cast<const uint64_t*>(src_ptr);
+  auto dest = reinterpret_cast<uint32_t*>(dest_ptr);
+  auto src = reinterpret_cast<const uint32_t*>(src_ptr);
   size_t i;
   for (i = 0; i + 4 <= count; i += 4) {
     __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
@@ -122,4 +124,252 @@ void copy_and_swap_16_in_32_aligned(void* dest_ptr, const void* src_ptr,
   }
 }
 
+// Index kernels: swap, replace reset indices and accumulate the range in one
+// pass. Reset indices are or'ed to all ones (which can't lower the minimum)
+// and masked to zero for the maximum.
+
+template <bool kRestart>
+XE_AVX2_FUNCTION static void copy_and_swap_16_indices_avx2(
+    uint16_t* dest, const uint16_t* src, size_t count, uint16_t reset_index,
+    uint16_t* min_out, uint16_t* max_out) {
+  const __m256i shuffle = _mm256_setr_epi8(
+      1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14, 1, 0, 3, 2, 5, 4,
+      7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+  const __m256i reset = _mm256_set1_epi16(int16_t(reset_index));
+  __m256i min_index = _mm256_set1_epi16(-1);
+  __m256i max_index = _mm256_setzero_si256();
+  size_t i;
+  for (i = 0; i + 16 <= count; i += 16) {
+    __m256i input =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&src[i]));
+    __m256i output = _mm256_shuffle_epi8(input, shuffle);
+    if (kRestart) {
+      __m256i is_reset = _mm256_cmpeq_epi16(output, reset);
+      max_index =
+          _mm256_max_epu16(max_index, _mm256_andnot_si256(is_reset, output));
+      output = _mm256_or_si256(output, is_reset);
+    } else {
+      max_index = _mm256_max_epu16(max_index, output);
+    }
+    min_index = _mm256_min_epu16(min_index, output);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&dest[i]), output);
+  }
+  __m128i min_128 = _mm_min_epu16(_mm256_castsi256_si128(min_index),
+                                  _mm256_extracti128_si256(min_index, 1));
+  __m128i max_128 = _mm_max_epu16(_mm256_castsi256_si128(max_index),
+                                  _mm256_extracti128_si256(max_index, 1));
+  // minpos gives the minimum directly; the maximum is the inverted minimum of
+  // the inverted values.
+  uint16_t min_value = uint16_t(_mm_cvtsi128_si32(_mm_minpos_epu16(min_128)));
+  uint16_t max_value = uint16_t(~_mm_cvtsi128_si32(
+      _mm_minpos_epu16(_mm_xor_si128(max_128, _mm_set1_epi16(-1)))));
+  for (; i < count; ++i) {  // handle residual elements
+    uint16_t value = byte_swap(src[i]);
+    if (kRestart && value == reset_index) {
+      dest[i] = 0xFFFF;
+      continue;
+    }
+    dest[i] = value;
+    min_value = std::min(min_value, value);
+    max_value = std::max(max_value, value);
+  }
+  *min_out = min_value;
+  *max_out = max_value;
+}
+
+template <bool kRestart>
+static void copy_and_swap_16_indices_sse(uint16_t* dest, const uint16_t* src,
+                                         size_t count, uint16_t reset_index,
+                                         uint16_t* min_out,
+                                         uint16_t* max_out) {
+  const __m128i reset = _mm_set1_epi16(int16_t(reset_index));
+  __m128i min_index = _mm_set1_epi16(-1);
+  __m128i max_index = _mm_setzero_si128();
+  size_t i;
+  for (i = 0; i + 8 <= count; i += 8) {
+    __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
+    __m128i output =
+        _mm_or_si128(_mm_slli_epi16(input, 8), _mm_srli_epi16(input, 8));
+    if (kRestart) {
+      __m128i is_reset = _mm_cmpeq_epi16(output, reset);
+      max_index = _mm_max_epu16(max_index, _mm_andnot_si128(is_reset, output));
+      output = _mm_or_si128(output, is_reset);
+    } else {
+      max_index = _mm_max_epu16(max_index, output);
+    }
+    min_index = _mm_min_epu16(min_index, output);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
+  }
+  uint16_t min_value = uint16_t(_mm_cvtsi128_si32(_mm_minpos_epu16(min_index)));
+  uint16_t max_value = uint16_t(~_mm_cvtsi128_si32(
+      _mm_minpos_epu16(_mm_xor_si128(max_index, _mm_set1_epi16(-1)))));
+  for (; i < count; ++i) {  // handle residual elements
+    uint16_t value = byte_swap(src[i]);
+    if (kRestart && value == reset_index) {
+      dest[i] = 0xFFFF;
+      continue;
+    }
+    dest[i] = value;
+    min_value = std::min(min_value, value);
+    max_value = std::max(max_value, value);
+  }
+  *min_out = min_value;
+  *max_out = max_value;
+}
+
+void copy_and_swap_16_indices(void* dest_ptr, const void* src_ptr,
+                              size_t count, bool primitive_restart,
+                              uint16_t reset_index, uint32_t* min_out,
+                              uint32_t* max_out) {
+  auto dest = reinterpret_cast<uint16_t*>(dest_ptr);
+  auto src = reinterpret_cast<const uint16_t*>(src_ptr);
+  uint16_t min_index, max_index;
+  if (has_avx2()) {
+    if (primitive_restart) {
+      copy_and_swap_16_indices_avx2<true>(dest, src, count, reset_index,
+                                          &min_index, &max_index);
+    } else {
+      copy_and_swap_16_indices_avx2<false>(dest, src, count, reset_index,
+                                           &min_index, &max_index);
+    }
+  } else {
+    if (primitive_restart) {
+      copy_and_swap_16_indices_sse<true>(dest, src, count, reset_index,
+                                         &min_index, &max_index);
+    } else {
+      copy_and_swap_16_indices_sse<false>(dest, src, count, reset_index,
+                                          &min_index, &max_index);
+    }
+  }
+  *min_out = min_index;
+  *max_out = max_index;
+}
+
+// Horizontal min/max of 4 unsigned dwords.
+static uint32_t horizontal_min_epu32(__m128i value) {
+  value =
+      _mm_min_epu32(value, _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2)));
+  value =
+      _mm_min_epu32(value, _mm_shuffle_epi32(value, _MM_SHUFFLE(2, 3, 0, 1)));
+  return uint32_t(_mm_cvtsi128_si32(value));
+}
+static uint32_t horizontal_max_epu32(__m128i value) {
+  value =
+      _mm_max_epu32(value, _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2)));
+  value =
+      _mm_max_epu32(value, _mm_shuffle_epi32(value, _MM_SHUFFLE(2, 3, 0, 1)));
+  return uint32_t(_mm_cvtsi128_si32(value));
+}
+
+template <bool kRestart>
+XE_AVX2_FUNCTION static void copy_and_swap_32_indices_avx2(
+    uint32_t* dest, const uint32_t* src, size_t count, uint32_t reset_index,
+    uint32_t* min_out, uint32_t* max_out) {
+  const __m256i shuffle = _mm256_setr_epi8(
+      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12, 3, 2, 1, 0, 7, 6,
+      5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  const __m256i reset = _mm256_set1_epi32(int32_t(reset_index));
+  __m256i min_index = _mm256_set1_epi32(-1);
+  __m256i max_index = _mm256_setzero_si256();
+  size_t i;
+  for (i = 0; i + 8 <= count; i += 8) {
+    __m256i input =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&src[i]));
+    __m256i output = _mm256_shuffle_epi8(input, shuffle);
+    if (kRestart) {
+      __m256i is_reset = _mm256_cmpeq_epi32(output, reset);
+      max_index =
+          _mm256_max_epu32(max_index, _mm256_andnot_si256(is_reset, output));
+      output = _mm256_or_si256(output, is_reset);
+    } else {
+      max_index = _mm256_max_epu32(max_index, output);
+    }
+    min_index = _mm256_min_epu32(min_index, output);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&dest[i]), output);
+  }
+  uint32_t min_value = horizontal_min_epu32(
+      _mm_min_epu32(_mm256_castsi256_si128(min_index),
+                    _mm256_extracti128_si256(min_index, 1)));
+  uint32_t max_value = horizontal_max_epu32(
+      _mm_max_epu32(_mm256_castsi256_si128(max_index),
+                    _mm256_extracti128_si256(max_index, 1)));
+  for (; i < count; ++i) {  // handle residual elements
+    uint32_t value = byte_swap(src[i]);
+    if (kRestart && value == reset_index) {
+      dest[i] = 0xFFFFFFFF;
+      continue;
+    }
+    dest[i] = value;
+    min_value = std::min(min_value, value);
+    max_value = std::max(max_value, value);
+  }
+  *min_out = min_value;
+  *max_out = max_value;
+}
+
+template <bool kRestart>
+static void copy_and_swap_32_indices_sse(uint32_t* dest, const uint32_t* src,
+                                         size_t count, uint32_t reset_index,
+                                         uint32_t* min_out,
+                                         uint32_t* max_out) {
+  const __m128i shuffle = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8,
+                                        15, 14, 13, 12);
+  const __m128i reset = _mm_set1_epi32(int32_t(reset_index));
+  __m128i min_index = _mm_set1_epi32(-1);
+  __m128i max_index = _mm_setzero_si128();
+  size_t i;
+  for (i = 0; i + 4 <= count; i += 4) {
+    __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
+    __m128i output = _mm_shuffle_epi8(input, shuffle);
+    if (kRestart) {
+      __m128i is_reset = _mm_cmpeq_epi32(output, reset);
+      max_index = _mm_max_epu32(max_index, _mm_andnot_si128(is_reset, output));
+      output = _mm_or_si128(output, is_reset);
+    } else {
+      max_index = _mm_max_epu32(max_index, output);
+    }
+    min_index = _mm_min_epu32(min_index, output);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
+  }
+  uint32_t min_value = horizontal_min_epu32(min_index);
+  uint32_t max_value = horizontal_max_epu32(max_index);
+  for (; i < count; ++i) {  // handle residual elements
+    uint32_t value = byte_swap(src[i]);
+    if (kRestart && value == reset_index) {
+      dest[i] = 0xFFFFFFFF;
+      continue;
+    }
+    dest[i] = value;
+    min_value = std::min(min_value, value);
+    max_value = std::max(max_value, value);
+  }
+  *min_out = min_value;
+  *max_out = max_value;
+}
+
+void copy_and_swap_32_indices(void* dest_ptr, const void* src_ptr,
+                              size_t count, bool primitive_restart,
+                              uint32_t reset_index, uint32_t* min_out,
+                              uint32_t* max_out) {
+  auto dest = reinterpret_cast<uint32_t*>(dest_ptr);
+  auto src = reinterpret_cast<const uint32_t*>(src_ptr);
+  if (has_avx2()) {
+    if (primitive_restart) {
+      copy_and_swap_32_indices_avx2<true>(dest, src, count, reset_index,
+                                          min_out, max_out);
+    } else {
+      copy_and_swap_32_indices_avx2<false>(dest, src, count, reset_index,
+                                           min_out, max_out);
+    }
+  } else {
+    if (primitive_restart) {
+      copy_and_swap_32_indices_sse<true>(dest, src, count, reset_index,
+                                         min_out, max_out);
+    } else {
+      copy_and_swap_32_indices_sse<false>(dest, src, count, reset_index,
+                                          min_out, max_out);
+    }
+  }
+}
+
 }  // namespace xe
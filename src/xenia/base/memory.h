@@ -131,6 +131,17 @@ void copy_and_swap_64_aligned(void* dest, const void* src, size_t count);
 void copy_and_swap_64_unaligned(void* dest, const void* src, size_t count);
 void copy_and_swap_16_in_32_aligned(void* dest, const void* src, size_t count);
 
+// Copies and swaps primitive indices, also finding the range of indices
+// referenced. If primitive_restart is set, indices equal to reset_index (after
+// swapping) are written as the host restart index (all ones) and left out of
+// the range. If no indices are left in the range, min_out > max_out.
+void copy_and_swap_16_indices(void* dest, const void* src, size_t count,
+                              bool primitive_restart, uint16_t reset_index,
+                              uint32_t* min_out, uint32_t* max_out);
+void copy_and_swap_32_indices(void* dest, const void* src, size_t count,
+                              bool primitive_restart, uint32_t reset_index,
+                              uint32_t* min_out, uint32_t* max_out);
+
 template <typename T>
 void copy_and_swap(T* dest, const T* src, size_t count) {
   bool is_aligned = reinterpret_cast<uintptr_t>(dest) % 32 == 0 &&
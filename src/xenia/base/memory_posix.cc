@@ -0,0 +1,302 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/memory.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gflags/gflags.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <map>
+#include <mutex>
+
+#include "xenia/base/math.h"
+#include "xenia/base/string.h"
+
+DEFINE_bool(huge_page_views, true,
+            "Ask for transparent huge pages on file views (such as guest "
+            "memory) that are large and aligned enough to use them.");
+
+// Windows reserves, commits and releases address space in regions, and
+// file mappings (sections) are backed by the page file. Here:
+//   - Reserved memory is PROT_NONE anonymous memory and committing it changes
+//     the protection. Linux only backs pages once they are touched, so there
+//     is nothing else to commit.
+//   - Regions are tracked so that they can be released by base address alone
+//     like VirtualFree(MEM_RELEASE) does.
+//   - File mappings are anonymous memfds, which can be mapped any number of
+//     times (MAP_SHARED) so that a write through one view is seen through all
+//     others. This is what gives guest physical memory its aliases.
+
+namespace xe {
+namespace memory {
+
+namespace {
+
+// Transparent huge pages on x86-64.
+const size_t kHugePageSize = 2 * 1024 * 1024;
+
+std::mutex regions_mutex_;
+// Base -> length of regions allocated with AllocFixed.
+std::map<uintptr_t, size_t> regions_;
+
+int ToPosixProtectFlags(PageAccess access) {
+  switch (access) {
+    case PageAccess::kNoAccess:
+      return PROT_NONE;
+    case PageAccess::kReadOnly:
+      return PROT_READ;
+    case PageAccess::kReadWrite:
+      return PROT_READ | PROT_WRITE;
+    case PageAccess::kExecuteReadWrite:
+      return PROT_READ | PROT_WRITE | PROT_EXEC;
+    default:
+      assert_unhandled_case(access);
+      return PROT_NONE;
+  }
+}
+
+PageAccess ToXeniaProtectFlags(const char* perms) {
+  if (perms[0] != 'r') {
+    return PageAccess::kNoAccess;
+  }
+  if (perms[1] != 'w') {
+    return PageAccess::kReadOnly;
+  }
+  return perms[2] == 'x' ? PageAccess::kExecuteReadWrite
+                         : PageAccess::kReadWrite;
+}
+
+// mmap at exactly base_address (if not null) without replacing anything
+// already mapped there, like VirtualAlloc and MapViewOfFileEx do.
+void* MapAt(void* base_address, size_t length, int prot, int flags, int fd,
+            size_t offset) {
+  void* result =
+      mmap(base_address, length, prot, flags, fd, static_cast<off_t>(offset));
+  if (result == MAP_FAILED) {
+    return nullptr;
+  }
+  if (base_address && result != base_address) {
+    // Something is in the way and the kernel picked another address.
+    munmap(result, length);
+    return nullptr;
+  }
+  return result;
+}
+
+// Handles wrap fd + 1 so that a null handle means failure, as with Windows.
+FileMappingHandle ToHandle(int fd) {
+  return reinterpret_cast<FileMappingHandle>(static_cast<intptr_t>(fd) + 1);
+}
+int ToFileDescriptor(FileMappingHandle handle) {
+  return static_cast<int>(reinterpret_cast<intptr_t>(handle) - 1);
+}
+
+int CreateAnonymousFile(const std::string& name) {
+  int fd;
+#ifdef SYS_memfd_create
+  // MFD_CLOEXEC. Called directly as older C libraries have no wrapper.
+  fd = static_cast<int>(syscall(SYS_memfd_create, name.c_str(), 1u));
+  if (fd >= 0 || errno != ENOSYS) {
+    return fd;
+  }
+#endif  // SYS_memfd_create
+  // Kernels before 3.17 don't have memfd_create, so go through /dev/shm.
+  std::string shm_name = "/" + name;
+  fd = shm_open(shm_name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+                S_IRUSR | S_IWUSR);
+  if (fd >= 0) {
+    shm_unlink(shm_name.c_str());
+  }
+  return fd;
+}
+
+}  // namespace
+
+size_t page_size() {
+  static size_t value = 0;
+  if (!value) {
+    value = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  }
+  return value;
+}
+
+size_t allocation_granularity() {
+  // mmap works on single pages.
+  return page_size();
+}
+
+void* AllocFixed(void* base_address, size_t length,
+                 AllocationType allocation_type, PageAccess access) {
+  switch (allocation_type) {
+    case AllocationType::kReserve:
+    case AllocationType::kReserveCommit: {
+      int prot = allocation_type == AllocationType::kReserve
+                     ? PROT_NONE
+                     : ToPosixProtectFlags(access);
+      void* result =
+          MapAt(base_address, length, prot,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (result) {
+        std::lock_guard<std::mutex> lock(regions_mutex_);
+        regions_[reinterpret_cast<uintptr_t>(result)] = length;
+      }
+      return result;
+    }
+    case AllocationType::kCommit:
+      // Committing reserved memory or a file view.
+      if (!base_address) {
+        return nullptr;
+      }
+      if (mprotect(base_address, length, ToPosixProtectFlags(access))) {
+        return nullptr;
+      }
+      return base_address;
+    default:
+      assert_unhandled_case(allocation_type);
+      return nullptr;
+  }
+}
+
+bool DeallocFixed(void* base_address, size_t length,
+                  DeallocationType deallocation_type) {
+  switch (deallocation_type) {
+    case DeallocationType::kDecommit:
+      // Drop the contents and make the pages fault again. For file views the
+      // contents stay in the file.
+      madvise(base_address, length, MADV_DONTNEED);
+      return mprotect(base_address, length, PROT_NONE) == 0;
+    case DeallocationType::kRelease:
+    case DeallocationType::kDecommitRelease: {
+      std::lock_guard<std::mutex> lock(regions_mutex_);
+      auto it = regions_.find(reinterpret_cast<uintptr_t>(base_address));
+      if (it == regions_.end()) {
+        // Not ours (such as a file view), which VirtualFree refuses as well.
+        return false;
+      }
+      munmap(base_address, it->second);
+      regions_.erase(it);
+      return true;
+    }
+    default:
+      assert_unhandled_case(deallocation_type);
+      return false;
+  }
+}
+
+bool Protect(void* base_address, size_t length, PageAccess access,
+             PageAccess* out_old_access) {
+  if (out_old_access) {
+    size_t query_length = length;
+    if (!QueryProtect(base_address, query_length, *out_old_access)) {
+      *out_old_access = PageAccess::kNoAccess;
+    }
+  }
+  uintptr_t start = reinterpret_cast<uintptr_t>(base_address);
+  uintptr_t aligned_start = start & ~(page_size() - 1);
+  length = xe::round_up(length + (start - aligned_start), page_size());
+  return mprotect(reinterpret_cast<void*>(aligned_start), length,
+                  ToPosixProtectFlags(access)) == 0;
+}
+
+bool QueryProtect(void* base_address, size_t& length, PageAccess& access_out) {
+  access_out = PageAccess::kNoAccess;
+
+  // There's no syscall for this, so find the mapping in /proc/self/maps.
+  // mprotect splits mappings, so each line has a single protection.
+  FILE* maps = std::fopen("/proc/self/maps", "r");
+  if (!maps) {
+    return false;
+  }
+  uintptr_t address = reinterpret_cast<uintptr_t>(base_address);
+  uintptr_t page_start = address & ~(page_size() - 1);
+  bool found = false;
+  char line[512];
+  while (std::fgets(line, sizeof(line), maps)) {
+    unsigned long long start, end;
+    char perms[5];
+    if (std::sscanf(line, "%llx-%llx %4s", &start, &end, perms) != 3) {
+      continue;
+    }
+    if (page_start >= start && page_start < end) {
+      length = static_cast<size_t>(end - page_start);
+      access_out = ToXeniaProtectFlags(perms);
+      found = true;
+      break;
+    }
+  }
+  std::fclose(maps);
+  return found;
+}
+
+FileMappingHandle CreateFileMappingHandle(std::wstring path, size_t length,
+                                          PageAccess access, bool commit) {
+  // Windows object names like Local\xenia_memory_123 aren't valid here.
+  auto name = xe::to_string(path);
+  auto separator = name.find_last_of('\\');
+  if (separator != std::string::npos) {
+    name = name.substr(separator + 1);
+  }
+  int fd = CreateAnonymousFile(name);
+  if (fd < 0) {
+    return nullptr;
+  }
+  // Sparse, so this costs nothing until pages are touched (whether commit is
+  // set or not).
+  if (ftruncate(fd, static_cast<off_t>(length))) {
+    close(fd);
+    return nullptr;
+  }
+  return ToHandle(fd);
+}
+
+void CloseFileMappingHandle(FileMappingHandle handle) {
+  close(ToFileDescriptor(handle));
+}
+
+void* MapFileView(FileMappingHandle handle, void* base_address, size_t length,
+                  PageAccess access, size_t file_offset) {
+  if (access == PageAccess::kNoAccess) {
+    assert_unhandled_case(access);
+    return nullptr;
+  }
+  void* result = MapAt(base_address, length, ToPosixProtectFlags(access),
+                       MAP_SHARED, ToFileDescriptor(handle), file_offset);
+  if (!result) {
+    return nullptr;
+  }
+#ifdef MADV_HUGEPAGE
+  // The big guest views are 2MiB-aligned both in the address space and in the
+  // file, so they can use huge pages. The kernel splits them again where
+  // pages get protected individually (such as for access watches).
+  uintptr_t address = reinterpret_cast<uintptr_t>(result);
+  if (FLAGS_huge_page_views && length >= kHugePageSize &&
+      (address & (kHugePageSize - 1)) == (file_offset & (kHugePageSize - 1))) {
+    uintptr_t start = xe::round_up(address, kHugePageSize);
+    uintptr_t end = (address + length) & ~(kHugePageSize - 1);
+    if (start < end) {
+      madvise(reinterpret_cast<void*>(start), end - start, MADV_HUGEPAGE);
+    }
+  }
+#endif  // MADV_HUGEPAGE
+  return result;
+}
+
+bool UnmapFileView(FileMappingHandle handle, void* base_address,
+                   size_t length) {
+  return munmap(base_address, length) == 0;
+}
+
+}  // namespace memory
+}  // namespace xe
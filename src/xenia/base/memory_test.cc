@@ -9,9 +9,225 @@
 
 #include "xenia/base/memory.h"
 
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
 #include "third_party/catch/include/catch.hpp"
 
+namespace memory = xe::memory;
+
+namespace {
+
+// Straightforward version of copy_and_swap_*_indices to check against.
+template <typename T>
+void CopyAndSwapIndicesReference(T* dest, const T* src, size_t count,
+                                 bool primitive_restart, T reset_index,
+                                 uint32_t* min_out, uint32_t* max_out) {
+  T min_index = T(-1);
+  T max_index = 0;
+  for (size_t i = 0; i < count; ++i) {
+    T value = xe::byte_swap(src[i]);
+    if (primitive_restart && value == reset_index) {
+      dest[i] = T(-1);
+      continue;
+    }
+    dest[i] = value;
+    min_index = std::min(min_index, value);
+    max_index = std::max(max_index, value);
+  }
+  *min_out = min_index;
+  *max_out = max_index;
+}
+
+template <typename T>
+void CheckCopyAndSwapIndices(
+    void (*copy_and_swap_indices)(void*, const void*, size_t, bool, T,
+                                  uint32_t*, uint32_t*)) {
+  std::mt19937 random(0);
+  // Counts around the vector widths, to cover the residual elements.
+  for (size_t count : {0, 1, 7, 8, 15, 16, 17, 31, 33, 1000}) {
+    for (bool primitive_restart : {false, true}) {
+      std::vector<T> src(count);
+      for (auto& value : src) {
+        // Stay in a small range so that the reset index shows up.
+        value = xe::byte_swap(T(random() % 64 + 0x20));
+      }
+      const T reset_index = 0x21;
+      std::vector<T> expected(count), actual(count);
+      uint32_t expected_min, expected_max, actual_min, actual_max;
+      CopyAndSwapIndicesReference(expected.data(), src.data(), count,
+                                  primitive_restart, reset_index,
+                                  &expected_min, &expected_max);
+      copy_and_swap_indices(actual.data(), src.data(), count,
+                            primitive_restart, reset_index, &actual_min,
+                            &actual_max);
+      REQUIRE(actual == expected);
+      REQUIRE(actual_min == expected_min);
+      REQUIRE(actual_max == expected_max);
+    }
+  }
+
+  // Nothing but resets leaves an empty range.
+  std::vector<T> src(40, xe::byte_swap(T(-1))), dest(40);
+  uint32_t min_index, max_index;
+  copy_and_swap_indices(dest.data(), src.data(), src.size(), true, T(-1),
+                        &min_index, &max_index);
+  REQUIRE(min_index > max_index);
+  copy_and_swap_indices(dest.data(), src.data(), src.size(), false, T(-1),
+                        &min_index, &max_index);
+  REQUIRE(min_index == T(-1));
+  REQUIRE(max_index == T(-1));
+}
+
+}  // namespace
+
 TEST_CASE("copy_and_swap_16_aligned", "Copy and Swap") {
   // TODO(benvanik): tests.
   REQUIRE(true == true);
 }
+
+TEST_CASE("copy_and_swap_16_in_32_aligned", "[memory]") {
+  // Counts are in 32-bit elements; odd ones leave residual elements.
+  for (size_t count : {0, 1, 3, 4, 5, 17}) {
+    std::vector<uint32_t> src(count), dest(count + 1, 0xCDCDCDCD);
+    for (size_t i = 0; i < count; ++i) {
+      src[i] = 0x01020304 + uint32_t(i) * 0x10101010;
+    }
+    xe::copy_and_swap_16_in_32_aligned(dest.data(), src.data(), count);
+    for (size_t i = 0; i < count; ++i) {
+      REQUIRE(dest[i] == ((src[i] >> 16) | (src[i] << 16)));
+    }
+    REQUIRE(dest[count] == 0xCDCDCDCD);
+  }
+}
+
+TEST_CASE("copy_and_swap_16_indices", "[memory]") {
+  CheckCopyAndSwapIndices<uint16_t>(xe::copy_and_swap_16_indices);
+}
+
+TEST_CASE("copy_and_swap_32_indices", "[memory]") {
+  CheckCopyAndSwapIndices<uint32_t>(xe::copy_and_swap_32_indices);
+}
+
+TEST_CASE("copy_and_swap_indices_Rate", "[.][benchmark]") {
+  const size_t kLength = 4 * 1024 * 1024;
+  const uint32_t kIterations = 200;
+  std::vector<uint8_t> src(kLength), dest(kLength);
+  std::mt19937 random(0);
+  for (auto& value : src) {
+    value = uint8_t(random());
+  }
+  uint32_t min_index, max_index;
+  struct Variant {
+    const char* name;
+    std::function<void()> fn;
+  } variants[] = {
+      {"copy_and_swap_16_aligned",
+       [&]() {
+         xe::copy_and_swap_16_aligned(dest.data(), src.data(), kLength / 2);
+       }},
+      {"copy_and_swap_16_indices",
+       [&]() {
+         xe::copy_and_swap_16_indices(dest.data(), src.data(), kLength / 2,
+                                      true, 0xFFFF, &min_index, &max_index);
+       }},
+      {"copy_and_swap_32_aligned",
+       [&]() {
+         xe::copy_and_swap_32_aligned(dest.data(), src.data(), kLength / 4);
+       }},
+      {"copy_and_swap_32_indices",
+       [&]() {
+         xe::copy_and_swap_32_indices(dest.data(), src.data(), kLength / 4,
+                                      true, 0xFFFFFFFF, &min_index,
+                                      &max_index);
+       }},
+  };
+  for (auto& variant : variants) {
+    auto start_time = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < kIterations; ++i) {
+      variant.fn();
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now() - start_time)
+                       .count();
+    WARN(variant.name << ": "
+                      << double(kLength) * kIterations / elapsed
+                      << "MB/s");
+  }
+}
+
+TEST_CASE("AllocFixed", "[memory]") {
+  const size_t kLength = 64 * 1024;
+  auto base = reinterpret_cast<uint8_t*>(
+      memory::AllocFixed(nullptr, kLength, memory::AllocationType::kReserve,
+                         memory::PageAccess::kNoAccess));
+  REQUIRE(base);
+  // Already taken.
+  REQUIRE(!memory::AllocFixed(base, kLength,
+                              memory::AllocationType::kReserveCommit,
+                              memory::PageAccess::kReadWrite));
+
+  REQUIRE(memory::AllocFixed(base, memory::page_size(),
+                             memory::AllocationType::kCommit,
+                             memory::PageAccess::kReadWrite) == base);
+  base[0] = 0x12;
+  memory::PageAccess old_access;
+  REQUIRE(memory::Protect(base, memory::page_size(),
+                          memory::PageAccess::kReadOnly, &old_access));
+  REQUIRE(old_access == memory::PageAccess::kReadWrite);
+  size_t length = memory::page_size();
+  memory::PageAccess access;
+  REQUIRE(memory::QueryProtect(base, length, access));
+  REQUIRE(access == memory::PageAccess::kReadOnly);
+  REQUIRE(length == memory::page_size());
+  REQUIRE(base[0] == 0x12);
+
+  REQUIRE(memory::DeallocFixed(base, 0, memory::DeallocationType::kRelease));
+}
+
+TEST_CASE("MapFileView_Alias", "[memory]") {
+  // Large enough for huge pages, like guest memory.
+  const size_t kLength = 4 * 1024 * 1024;
+  const size_t kHalf = kLength / 2;
+  auto mapping = memory::CreateFileMappingHandle(
+      L"Local\\xenia_memory_test", kLength, memory::PageAccess::kReadWrite,
+      false);
+  REQUIRE(mapping);
+
+  // The whole file, and its second half again somewhere else, as with the
+  // physical memory views.
+  auto view = reinterpret_cast<uint8_t*>(memory::MapFileView(
+      mapping, nullptr, kLength, memory::PageAccess::kReadWrite, 0));
+  REQUIRE(view);
+  auto alias = reinterpret_cast<uint8_t*>(memory::MapFileView(
+      mapping, nullptr, kHalf, memory::PageAccess::kReadWrite, kHalf));
+  REQUIRE(alias);
+  REQUIRE(alias != view + kHalf);
+  REQUIRE(memory::AllocFixed(view, kLength, memory::AllocationType::kCommit,
+                             memory::PageAccess::kReadWrite));
+  REQUIRE(memory::AllocFixed(alias, kHalf, memory::AllocationType::kCommit,
+                             memory::PageAccess::kReadWrite));
+
+  view[kHalf + 0x1234] = 0xAB;
+  REQUIRE(alias[0x1234] == 0xAB);
+  alias[kHalf - 1] = 0xCD;
+  REQUIRE(view[kLength - 1] == 0xCD);
+  REQUIRE(view[0x1234] == 0);
+
+  // Views don't replace whatever is already mapped.
+  REQUIRE(!memory::MapFileView(mapping, alias, kHalf,
+                               memory::PageAccess::kReadWrite, 0));
+  REQUIRE(alias[0x1234] == 0xAB);
+
+  // Protecting one view leaves the other alone.
+  REQUIRE(memory::Protect(alias, memory::page_size(),
+                          memory::PageAccess::kReadOnly, nullptr));
+  view[kHalf + 0x10] = 0xEF;
+  REQUIRE(alias[0x10] == 0xEF);
+
+  REQUIRE(memory::UnmapFileView(mapping, alias, kHalf));
+  REQUIRE(memory::UnmapFileView(mapping, view, kLength));
+  memory::CloseFileMappingHandle(mapping);
+}
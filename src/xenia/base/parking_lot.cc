@@ -0,0 +1,117 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/parking_lot.h"
+
+#include <condition_variable>
+#include <mutex>
+
+namespace xe {
+
+namespace {
+
+// Lives on the stack of the parked thread.
+struct ParkedThread {
+  uintptr_t key = 0;
+  bool unparked = false;
+  std::condition_variable cond;
+  ParkedThread* next = nullptr;
+};
+
+// FIFO of the threads parked on the keys hashing to the bucket.
+struct alignas(64) Bucket {
+  std::mutex mutex;
+  ParkedThread* head = nullptr;
+  ParkedThread* tail = nullptr;
+};
+
+const uint32_t kBucketShift = 8;
+
+Bucket* GetBucket(uintptr_t key) {
+  static Bucket buckets[1 << kBucketShift];
+  // Keys are mostly aligned addresses close to each other, so they are
+  // scattered with a multiplicative hash.
+  uint64_t hash = uint64_t(key) * 0x9E3779B97F4A7C15ull;
+  return &buckets[hash >> (64 - kBucketShift)];
+}
+
+// Unlinks and returns the first thread parked on key, or null.
+ParkedThread* DequeueThread(Bucket* bucket, uintptr_t key) {
+  ParkedThread* previous = nullptr;
+  for (auto thread = bucket->head; thread; thread = thread->next) {
+    if (thread->key != key) {
+      previous = thread;
+      continue;
+    }
+    if (previous) {
+      previous->next = thread->next;
+    } else {
+      bucket->head = thread->next;
+    }
+    if (bucket->tail == thread) {
+      bucket->tail = previous;
+    }
+    thread->next = nullptr;
+    return thread;
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+bool ParkingLot::Park(uintptr_t key, const std::function<bool()>& validate) {
+  auto bucket = GetBucket(key);
+  ParkedThread self;
+  self.key = key;
+
+  std::unique_lock<std::mutex> lock(bucket->mutex);
+  if (!validate()) {
+    return false;
+  }
+  if (bucket->tail) {
+    bucket->tail->next = &self;
+  } else {
+    bucket->head = &self;
+  }
+  bucket->tail = &self;
+  self.cond.wait(lock, [&self]() { return self.unparked; });
+  return true;
+}
+
+bool ParkingLot::UnparkOne(uintptr_t key,
+                           const std::function<void(bool)>& callback) {
+  auto bucket = GetBucket(key);
+  std::lock_guard<std::mutex> lock(bucket->mutex);
+  auto thread = DequeueThread(bucket, key);
+  if (callback) {
+    callback(thread != nullptr);
+  }
+  if (!thread) {
+    return false;
+  }
+  // Notified with the lock held, as the thread (and its ParkedThread) may be
+  // gone as soon as it can see unparked.
+  thread->unparked = true;
+  thread->cond.notify_one();
+  return true;
+}
+
+size_t ParkingLot::UnparkAll(uintptr_t key) {
+  auto bucket = GetBucket(key);
+  std::lock_guard<std::mutex> lock(bucket->mutex);
+  size_t count = 0;
+  while (auto thread = DequeueThread(bucket, key)) {
+    thread->unparked = true;
+    thread->cond.notify_one();
+    ++count;
+  }
+  return count;
+}
+
+}  // namespace xe
@@ -0,0 +1,47 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_PARKING_LOT_H_
+#define XENIA_BASE_PARKING_LOT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace xe {
+
+// Blocks threads on arbitrary keys (usually the address of whatever they wait
+// for) and wakes them by key, without needing a wait object per key.
+// Parked threads are queued in a fixed hash table of buckets, each with its
+// own lock, much like futexes and WebKit's ParkingLot.
+//
+// The callbacks run with the key's bucket locked, so they can check and
+// update the state of a lock atomically with respect to parking and
+// unparking. They must not park or unpark themselves.
+class ParkingLot {
+ public:
+  // Parks the calling thread on key until it is woken by UnparkOne or
+  // UnparkAll. validate is called first and if it returns false the thread
+  // doesn't park. Returns whether the thread parked (and was woken).
+  static bool Park(uintptr_t key, const std::function<bool()>& validate);
+
+  // Wakes the thread that has been parked on key the longest, if any.
+  // callback (may be null) is told whether a thread was woken, so that a
+  // wakeup with nobody parked yet can be recorded by the caller.
+  // Returns whether a thread was woken.
+  static bool UnparkOne(uintptr_t key,
+                        const std::function<void(bool)>& callback);
+
+  // Wakes all threads parked on key and returns how many there were.
+  static size_t UnparkAll(uintptr_t key);
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_PARKING_LOT_H_
@@ -0,0 +1,128 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/parking_lot.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+
+using xe::ParkingLot;
+
+namespace {
+
+// A lock handed directly to the thread it wakes, the way guest critical
+// sections use the parking lot. state is -1 when free, otherwise the number
+// of threads waiting for it. permits holds wakeups that came in before the
+// woken thread parked.
+struct HandoffLock {
+  std::atomic<int32_t> state{-1};
+  int32_t permits = 0;
+
+  void Lock() {
+    if (++state == 0) {
+      return;
+    }
+    auto key = reinterpret_cast<uintptr_t>(this);
+    ParkingLot::Park(key, [this]() {
+      if (permits) {
+        --permits;
+        return false;
+      }
+      return true;
+    });
+  }
+  void Unlock() {
+    if (--state == -1) {
+      return;
+    }
+    auto key = reinterpret_cast<uintptr_t>(this);
+    ParkingLot::UnparkOne(key, [this](bool woke_thread) {
+      if (!woke_thread) {
+        ++permits;
+      }
+    });
+  }
+};
+
+}  // namespace
+
+TEST_CASE("ParkingLot_Validate", "[parking_lot]") {
+  uintptr_t key = 0x1234;
+  // Refused to park, so this doesn't block.
+  REQUIRE(!ParkingLot::Park(key, []() { return false; }));
+
+  bool woke_thread = true;
+  REQUIRE(!ParkingLot::UnparkOne(
+      key, [&woke_thread](bool woke) { woke_thread = woke; }));
+  REQUIRE(!woke_thread);
+  REQUIRE(ParkingLot::UnparkAll(key) == 0);
+}
+
+TEST_CASE("ParkingLot_Unpark", "[parking_lot]") {
+  const size_t kThreadCount = 4;
+  int key_storage = 0;
+  auto key = reinterpret_cast<uintptr_t>(&key_storage);
+  std::atomic<size_t> parked(0);
+  std::atomic<size_t> woken(0);
+
+  auto park = [&]() {
+    ParkingLot::Park(key, [&parked]() {
+      ++parked;
+      return true;
+    });
+    ++woken;
+  };
+  auto wait_parked = [&](size_t count) {
+    while (parked < count) {
+      std::this_thread::yield();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < kThreadCount; ++i) {
+    threads.emplace_back(park);
+  }
+  wait_parked(kThreadCount);
+  // Threads on other keys aren't woken.
+  REQUIRE(!ParkingLot::UnparkOne(key + 4, nullptr));
+  REQUIRE(ParkingLot::UnparkOne(key, nullptr));
+  while (woken < 1) {
+    std::this_thread::yield();
+  }
+  REQUIRE(ParkingLot::UnparkAll(key) == kThreadCount - 1);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  REQUIRE(woken == kThreadCount);
+}
+
+TEST_CASE("ParkingLot_HandoffLock", "[parking_lot]") {
+  const int kThreadCount = 4;
+  const int kIterations = 20000;
+  HandoffLock lock;
+  int counter = 0;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreadCount; ++i) {
+    threads.emplace_back([&]() {
+      for (int j = 0; j < kIterations; ++j) {
+        lock.Lock();
+        ++counter;
+        lock.Unlock();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  REQUIRE(counter == kThreadCount * kIterations);
+  REQUIRE(lock.state == -1);
+}
@@ -80,6 +80,14 @@
 #define XEPACKEDUNION(name, value) union __attribute__((packed)) name value;
 #endif  // XE_PLATFORM_WIN32
 
+// AVX2 isn't part of the baseline the project is built for, so functions
+// using it are compiled for it individually and only called if has_avx2().
+#if XE_COMPILER_MSVC
+#define XE_AVX2_FUNCTION
+#else
+#define XE_AVX2_FUNCTION __attribute__((target("avx2")))
+#endif  // XE_COMPILER_MSVC
+
 namespace xe {
 
 #if XE_PLATFORM_WIN32
@@ -95,6 +103,19 @@ const size_t kMaxPath = 1024;  // PATH_MAX
 // Launches a web browser to the given URL.
 void LaunchBrowser(const char* url);
 
+inline bool has_avx2() {
+  static const bool has_avx2 = []() {
+#if XE_COMPILER_MSVC
+    int cpu_info[4];
+    __cpuidex(cpu_info, 7, 0);
+    return (cpu_info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2") != 0;
+#endif  // XE_COMPILER_MSVC
+  }();
+  return has_avx2;
+}
+
 }  // namespace xe
 
 #endif  // XENIA_BASE_PLATFORM_H_
@@ -0,0 +1,400 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/slab_allocator.h"
+
+#include <algorithm>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/byte_stream.h"
+#include "xenia/base/math.h"
+
+namespace xe {
+
+const uint32_t SlabAllocator::kSlabSize;
+const uint32_t SlabAllocator::kMinBlockSize;
+const uint32_t SlabAllocator::kMaxBlockSize;
+const size_t SlabAllocator::kSizeClassCount;
+const uint32_t SlabAllocator::kMagazineSize;
+
+namespace {
+// 4GiB worth of slabs.
+const size_t kSlabTableSize = size_t(1) << 16;
+std::atomic<uint64_t> next_allocator_id_(1);
+}  // namespace
+
+struct SlabAllocator::ThreadCache {
+  ThreadCache(SlabAllocator* owner) : owner(owner), owner_id(owner->id_) {
+    for (size_t i = 0; i < kSizeClassCount; ++i) {
+      alloc_counts[i] = 0;
+      free_counts[i] = 0;
+    }
+  }
+
+  // Cleared once the allocator is gone, under mutex.
+  SlabAllocator* owner;
+  const uint64_t owner_id;
+  // Only taken at thread exit and allocator destruction.
+  std::mutex mutex;
+
+  struct Magazine {
+    uint32_t count = 0;
+    uint32_t blocks[kMagazineSize];
+  } magazines[kSizeClassCount];
+
+  // Only written by the owning thread.
+  std::atomic<uint64_t> alloc_counts[kSizeClassCount];
+  std::atomic<uint64_t> free_counts[kSizeClassCount];
+
+  void Clear() {
+    for (size_t i = 0; i < kSizeClassCount; ++i) {
+      magazines[i].count = 0;
+    }
+  }
+};
+
+// The caches of the current thread, one per allocator it has used.
+struct SlabAllocator::ThreadCacheList {
+  ~ThreadCacheList() {
+    for (auto& cache : caches) {
+      std::lock_guard<std::mutex> lock(cache->mutex);
+      if (cache->owner) {
+        cache->owner->FlushThreadCache(cache.get());
+      }
+    }
+  }
+
+  std::vector<std::shared_ptr<ThreadCache>> caches;
+};
+
+SlabAllocator::SlabAllocator(uint8_t* membase,
+                             std::function<uint32_t()> alloc_slab,
+                             std::function<void(uint32_t)> free_slab)
+    : membase_(membase),
+      alloc_slab_(std::move(alloc_slab)),
+      free_slab_(std::move(free_slab)),
+      id_(next_allocator_id_.fetch_add(1)),
+      slab_size_classes_(new std::atomic<uint8_t>[kSlabTableSize]) {
+  for (size_t i = 0; i < kSlabTableSize; ++i) {
+    slab_size_classes_[i] = 0;
+  }
+  for (size_t i = 0; i < kSizeClassCount; ++i) {
+    depots_[i] = 0;
+    retired_alloc_counts_[i] = 0;
+    retired_free_counts_[i] = 0;
+    refill_counts_[i] = 0;
+    flush_counts_[i] = 0;
+    slab_counts_[i] = 0;
+  }
+}
+
+SlabAllocator::~SlabAllocator() {
+  // Threads still holding caches must not touch us anymore. The slabs go
+  // away with the backing memory.
+  std::vector<std::shared_ptr<ThreadCache>> caches;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    caches.swap(thread_caches_);
+  }
+  for (auto& cache : caches) {
+    std::lock_guard<std::mutex> lock(cache->mutex);
+    cache->owner = nullptr;
+  }
+}
+
+bool SlabAllocator::CanAllocate(uint32_t size, uint32_t alignment) {
+  return SizeClassIndex(size, alignment) < kSizeClassCount;
+}
+
+size_t SlabAllocator::SizeClassIndex(uint32_t size, uint32_t alignment) {
+  if (size > kMaxBlockSize || alignment > kMaxBlockSize) {
+    return kSizeClassCount;
+  }
+  size = std::max(std::max(size, alignment), kMinBlockSize);
+  return xe::log2_ceil(size) - xe::log2_ceil(kMinBlockSize);
+}
+
+uint32_t SlabAllocator::Alloc(uint32_t size, uint32_t alignment) {
+  size_t size_class = SizeClassIndex(size, alignment);
+  if (size_class >= kSizeClassCount) {
+    return 0;
+  }
+  auto cache = GetThreadCache();
+  auto& magazine = cache->magazines[size_class];
+  if (!magazine.count && !Refill(size_class, cache)) {
+    return 0;
+  }
+  uint32_t address = magazine.blocks[--magazine.count];
+  auto& alloc_count = cache->alloc_counts[size_class];
+  alloc_count.store(alloc_count.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+  return address;
+}
+
+bool SlabAllocator::Free(uint32_t address) {
+  uint8_t slab_size_class = SlabSizeClass(address);
+  if (!slab_size_class) {
+    return false;
+  }
+  size_t size_class = slab_size_class - 1;
+  assert_zero(address & (BlockSize(size_class) - 1));
+  auto cache = GetThreadCache();
+  auto& magazine = cache->magazines[size_class];
+  if (magazine.count == kMagazineSize) {
+    Flush(size_class, cache, kMagazineSize / 2);
+  }
+  magazine.blocks[magazine.count++] = address;
+  auto& free_count = cache->free_counts[size_class];
+  free_count.store(free_count.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_relaxed);
+  return true;
+}
+
+SlabAllocator::ThreadCache* SlabAllocator::GetThreadCache() {
+  static thread_local ThreadCacheList thread_caches;
+  for (auto& cache : thread_caches.caches) {
+    if (cache->owner_id == id_) {
+      return cache.get();
+    }
+  }
+
+  // First use on this thread. Drop the caches of allocators that are gone
+  // while we're here.
+  auto& caches = thread_caches.caches;
+  caches.erase(std::remove_if(caches.begin(), caches.end(),
+                              [](const std::shared_ptr<ThreadCache>& cache) {
+                                std::lock_guard<std::mutex> lock(cache->mutex);
+                                return !cache->owner;
+                              }),
+               caches.end());
+  auto cache = std::make_shared<ThreadCache>(this);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    thread_caches_.push_back(cache);
+  }
+  caches.push_back(cache);
+  return cache.get();
+}
+
+bool SlabAllocator::Refill(size_t size_class, ThreadCache* cache) {
+  auto& magazine = cache->magazines[size_class];
+  while (magazine.count < kMagazineSize / 2) {
+    uint32_t address = PopDepot(size_class);
+    if (!address) {
+      break;
+    }
+    magazine.blocks[magazine.count++] = address;
+  }
+  if (magazine.count) {
+    refill_counts_[size_class].fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  return Grow(size_class, cache);
+}
+
+void SlabAllocator::Flush(size_t size_class, ThreadCache* cache,
+                          uint32_t count) {
+  auto& magazine = cache->magazines[size_class];
+  count = std::min(count, magazine.count);
+  if (!count) {
+    return;
+  }
+  magazine.count -= count;
+  const uint32_t* blocks = magazine.blocks + magazine.count;
+  for (uint32_t i = 0; i + 1 < count; ++i) {
+    BlockLink(blocks[i])->store(blocks[i + 1], std::memory_order_relaxed);
+  }
+  PushDepot(size_class, blocks[0], blocks[count - 1]);
+  flush_counts_[size_class].fetch_add(1, std::memory_order_relaxed);
+}
+
+void SlabAllocator::FlushThreadCache(ThreadCache* cache) {
+  for (size_t i = 0; i < kSizeClassCount; ++i) {
+    Flush(i, cache, kMagazineSize);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < kSizeClassCount; ++i) {
+    retired_alloc_counts_[i] += cache->alloc_counts[i];
+    retired_free_counts_[i] += cache->free_counts[i];
+  }
+  thread_caches_.erase(
+      std::remove_if(thread_caches_.begin(), thread_caches_.end(),
+                     [cache](const std::shared_ptr<ThreadCache>& other) {
+                       return other.get() == cache;
+                     }),
+      thread_caches_.end());
+}
+
+void SlabAllocator::FlushAllThreadCaches() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& cache : thread_caches_) {
+    for (size_t i = 0; i < kSizeClassCount; ++i) {
+      Flush(i, cache.get(), kMagazineSize);
+    }
+  }
+}
+
+bool SlabAllocator::Grow(size_t size_class, ThreadCache* cache) {
+  // The backing allocator may take the global critical region, which has to
+  // come before our lock. Racing threads may both grow, which is harmless.
+  uint32_t slab = alloc_slab_();
+  if (!slab) {
+    return false;
+  }
+  assert_zero(slab & (kSlabSize - 1));
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    slabs_.push_back(slab);
+    ++slab_counts_[size_class];
+  }
+  slab_size_classes_[slab / kSlabSize].store(uint8_t(size_class + 1),
+                                             std::memory_order_relaxed);
+
+  // Half a magazine to the caller, the rest to the depot in address order.
+  uint32_t block_size = BlockSize(size_class);
+  uint32_t block_count = kSlabSize / block_size;
+  auto& magazine = cache->magazines[size_class];
+  uint32_t taken = std::min(kMagazineSize / 2, block_count);
+  for (uint32_t i = 0; i < taken; ++i) {
+    magazine.blocks[magazine.count++] = slab + (taken - 1 - i) * block_size;
+  }
+  if (taken < block_count) {
+    uint32_t first = slab + taken * block_size;
+    uint32_t last = slab + (block_count - 1) * block_size;
+    for (uint32_t block = first; block < last; block += block_size) {
+      BlockLink(block)->store(block + block_size, std::memory_order_relaxed);
+    }
+    PushDepot(size_class, first, last);
+  }
+  return true;
+}
+
+void SlabAllocator::PushDepot(size_t size_class, uint32_t first,
+                              uint32_t last) {
+  auto& depot = depots_[size_class];
+  uint64_t head = depot.load(std::memory_order_relaxed);
+  uint64_t new_head;
+  do {
+    BlockLink(last)->store(uint32_t(head), std::memory_order_relaxed);
+    new_head = (((head >> 32) + 1) << 32) | first;
+  } while (!depot.compare_exchange_weak(head, new_head,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed));
+}
+
+uint32_t SlabAllocator::PopDepot(size_t size_class) {
+  auto& depot = depots_[size_class];
+  uint64_t head = depot.load(std::memory_order_acquire);
+  while (uint32_t(head)) {
+    // The block may be popped and reused under us, in which case the link is
+    // garbage but the counter has moved on and the exchange fails.
+    uint32_t next =
+        BlockLink(uint32_t(head))->load(std::memory_order_relaxed);
+    uint64_t new_head = (((head >> 32) + 1) << 32) | next;
+    if (depot.compare_exchange_weak(head, new_head, std::memory_order_acquire,
+                                    std::memory_order_acquire)) {
+      return uint32_t(head);
+    }
+  }
+  return 0;
+}
+
+void SlabAllocator::Reset() {
+  std::vector<uint32_t> slabs;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& cache : thread_caches_) {
+      cache->Clear();
+      for (size_t i = 0; i < kSizeClassCount; ++i) {
+        cache->alloc_counts[i] = 0;
+        cache->free_counts[i] = 0;
+      }
+    }
+    slabs.swap(slabs_);
+    for (size_t i = 0; i < kSizeClassCount; ++i) {
+      depots_[i] = 0;
+      retired_alloc_counts_[i] = 0;
+      retired_free_counts_[i] = 0;
+      refill_counts_[i] = 0;
+      flush_counts_[i] = 0;
+      slab_counts_[i] = 0;
+    }
+  }
+  // Outside of our lock, as with alloc_slab_.
+  for (uint32_t slab : slabs) {
+    slab_size_classes_[slab / kSlabSize] = 0;
+    free_slab_(slab);
+  }
+}
+
+bool SlabAllocator::Save(ByteStream* stream) {
+  FlushAllThreadCaches();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  stream->Write(uint32_t(slabs_.size()));
+  for (uint32_t slab : slabs_) {
+    stream->Write(slab);
+    stream->Write(SlabSizeClass(slab));
+  }
+  for (size_t i = 0; i < kSizeClassCount; ++i) {
+    stream->Write(uint32_t(depots_[i].load()));
+  }
+  return true;
+}
+
+bool SlabAllocator::Restore(ByteStream* stream) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& cache : thread_caches_) {
+    cache->Clear();
+  }
+  for (uint32_t slab : slabs_) {
+    slab_size_classes_[slab / kSlabSize] = 0;
+  }
+  slabs_.clear();
+  std::fill(std::begin(slab_counts_), std::end(slab_counts_), 0);
+
+  uint32_t slab_count = stream->Read<uint32_t>();
+  for (uint32_t i = 0; i < slab_count; ++i) {
+    uint32_t slab = stream->Read<uint32_t>();
+    uint8_t slab_size_class = stream->Read<uint8_t>();
+    if (!slab_size_class || slab_size_class > kSizeClassCount) {
+      return false;
+    }
+    slabs_.push_back(slab);
+    ++slab_counts_[slab_size_class - 1];
+    slab_size_classes_[slab / kSlabSize] = slab_size_class;
+  }
+  for (size_t i = 0; i < kSizeClassCount; ++i) {
+    depots_[i] = stream->Read<uint32_t>();
+  }
+  return true;
+}
+
+std::vector<SlabAllocator::SizeClassStats> SlabAllocator::GetStats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<SizeClassStats> stats(kSizeClassCount);
+  for (size_t i = 0; i < kSizeClassCount; ++i) {
+    auto& size_class_stats = stats[i];
+    size_class_stats.block_size = BlockSize(i);
+    size_class_stats.slab_count = slab_counts_[i];
+    size_class_stats.alloc_count = retired_alloc_counts_[i];
+    size_class_stats.free_count = retired_free_counts_[i];
+    for (auto& cache : thread_caches_) {
+      size_class_stats.alloc_count +=
+          cache->alloc_counts[i].load(std::memory_order_relaxed);
+      size_class_stats.free_count +=
+          cache->free_counts[i].load(std::memory_order_relaxed);
+    }
+    size_class_stats.refill_count = refill_counts_[i];
+    size_class_stats.flush_count = flush_counts_[i];
+  }
+  return stats;
+}
+
+}  // namespace xe
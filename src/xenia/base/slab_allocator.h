@@ -0,0 +1,149 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_SLAB_ALLOCATOR_H_
+#define XENIA_BASE_SLAB_ALLOCATOR_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace xe {
+class ByteStream;
+}  // namespace xe
+
+namespace xe {
+
+// Size-class allocator for small blocks of a 32-bit address space (such as
+// guest memory) that is reachable from the host at membase + address.
+//
+// Blocks are carved out of 64KiB slabs requested from a backing allocator and
+// are never returned to it until Reset. Each host thread keeps a magazine of
+// free blocks per size class, so most allocations and frees touch no shared
+// state. Magazines are refilled from (and flushed to) a per size class depot,
+// a lock-free stack linked through the first dword of the free blocks.
+//
+// Alloc and Free are threadsafe. Reset, Save and Restore must not race them.
+class SlabAllocator {
+ public:
+  static const uint32_t kSlabSize = 64 * 1024;
+  static const uint32_t kMinBlockSize = 32;
+  static const uint32_t kMaxBlockSize = 2048;
+  // 32, 64, 128, ... 2048.
+  static const size_t kSizeClassCount = 7;
+  // Free blocks each thread may hold per size class.
+  static const uint32_t kMagazineSize = 32;
+
+  struct SizeClassStats {
+    uint32_t block_size;
+    uint32_t slab_count;
+    // Blocks handed out and returned over the lifetime of the allocator.
+    uint64_t alloc_count;
+    uint64_t free_count;
+    // Magazine refills from and flushes to the shared depot.
+    uint64_t refill_count;
+    uint64_t flush_count;
+  };
+
+  // alloc_slab returns a kSlabSize-aligned address of kSlabSize bytes or 0 if
+  // out of memory. free_slab returns it again.
+  SlabAllocator(uint8_t* membase, std::function<uint32_t()> alloc_slab,
+                std::function<void(uint32_t)> free_slab);
+  ~SlabAllocator();
+
+  // Whether an allocation of the given size and alignment is served by slabs.
+  // Blocks are aligned to their size, so anything up to the block size works.
+  static bool CanAllocate(uint32_t size, uint32_t alignment);
+
+  // Allocates a block of at least size bytes. The contents are undefined.
+  // Returns 0 if CanAllocate is false or out of memory.
+  uint32_t Alloc(uint32_t size, uint32_t alignment);
+
+  // Whether the address is in one of our slabs.
+  bool Owns(uint32_t address) const { return SlabSizeClass(address) != 0; }
+
+  // Frees a block returned by Alloc, from any thread. Returns false if the
+  // address is not ours.
+  bool Free(uint32_t address);
+
+  // Returns all slabs to the backing allocator and forgets every block.
+  void Reset();
+
+  // Writes out the slabs and depots. Thread magazines are flushed first so
+  // no free block is lost. The slab contents are part of the backing memory
+  // and are not written.
+  bool Save(ByteStream* stream);
+  bool Restore(ByteStream* stream);
+
+  std::vector<SizeClassStats> GetStats();
+
+ private:
+  struct ThreadCache;
+  struct ThreadCacheList;
+
+  static size_t SizeClassIndex(uint32_t size, uint32_t alignment);
+  static uint32_t BlockSize(size_t size_class) {
+    return kMinBlockSize << size_class;
+  }
+
+  // Size class + 1 of the slab containing address, or 0 if not ours.
+  uint8_t SlabSizeClass(uint32_t address) const {
+    return slab_size_classes_[address / kSlabSize].load(
+        std::memory_order_relaxed);
+  }
+  std::atomic<uint32_t>* BlockLink(uint32_t address) const {
+    return reinterpret_cast<std::atomic<uint32_t>*>(membase_ + address);
+  }
+
+  ThreadCache* GetThreadCache();
+  bool Refill(size_t size_class, ThreadCache* cache);
+  void Flush(size_t size_class, ThreadCache* cache, uint32_t count);
+  void FlushThreadCache(ThreadCache* cache);
+  void FlushAllThreadCaches();
+  // Allocates a new slab for the size class and adds its blocks to the cache
+  // and depot.
+  bool Grow(size_t size_class, ThreadCache* cache);
+
+  // Pushes a chain of blocks already linked from first to last.
+  void PushDepot(size_t size_class, uint32_t first, uint32_t last);
+  uint32_t PopDepot(size_t size_class);
+
+  uint8_t* membase_ = nullptr;
+  std::function<uint32_t()> alloc_slab_;
+  std::function<void(uint32_t)> free_slab_;
+  // Unique across allocators so that thread caches never mix them up.
+  uint64_t id_ = 0;
+
+  // Size class + 1 per 64KiB of the address space.
+  std::unique_ptr<std::atomic<uint8_t>[]> slab_size_classes_;
+
+  // Tagged depot heads: a change counter in the high dword (against ABA) and
+  // the first free block in the low dword.
+  std::atomic<uint64_t> depots_[kSizeClassCount];
+
+  // Guards the slab list and the thread cache list.
+  std::mutex mutex_;
+  std::vector<uint32_t> slabs_;
+  std::vector<std::shared_ptr<ThreadCache>> thread_caches_;
+
+  // Stats of threads that have exited plus the rarely changing counters.
+  std::atomic<uint64_t> retired_alloc_counts_[kSizeClassCount];
+  std::atomic<uint64_t> retired_free_counts_[kSizeClassCount];
+  std::atomic<uint64_t> refill_counts_[kSizeClassCount];
+  std::atomic<uint64_t> flush_counts_[kSizeClassCount];
+  uint32_t slab_counts_[kSizeClassCount];
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_SLAB_ALLOCATOR_H_
@@ -0,0 +1,342 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/slab_allocator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <set>
+#include <thread>
+
+#include "xenia/base/byte_stream.h"
+#include "xenia/base/math.h"
+
+#include "third_party/catch/include/catch.hpp"
+
+using xe::SlabAllocator;
+
+namespace {
+
+// Hands out slabs from a host buffer, leaving the first 64KiB unused so that
+// address 0 is never valid.
+class TestBacking {
+ public:
+  explicit TestBacking(uint32_t slab_count)
+      : memory_((slab_count + 1) * size_t(SlabAllocator::kSlabSize)),
+        slab_count_(slab_count) {}
+
+  uint8_t* membase() { return memory_.data(); }
+  std::unique_ptr<SlabAllocator> CreateAllocator() {
+    return std::unique_ptr<SlabAllocator>(new SlabAllocator(
+        membase(), [this]() { return AllocSlab(); },
+        [this](uint32_t slab) { FreeSlab(slab); }));
+  }
+
+  uint32_t AllocSlab() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (uint32_t i = 0; i < slab_count_; ++i) {
+      uint32_t slab = (i + 1) * SlabAllocator::kSlabSize;
+      if (!used_.count(slab)) {
+        used_.insert(slab);
+        return slab;
+      }
+    }
+    return 0;
+  }
+  void FreeSlab(uint32_t slab) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    REQUIRE(used_.erase(slab) == 1);
+  }
+  size_t used_slab_count() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return used_.size();
+  }
+
+ private:
+  std::vector<uint8_t> memory_;
+  uint32_t slab_count_;
+  std::mutex mutex_;
+  std::set<uint32_t> used_;
+};
+
+// What SystemHeapAlloc amounted to before: one lock around the heap.
+class LockedFreeList {
+ public:
+  explicit LockedFreeList(uint32_t block_count) {
+    for (uint32_t i = block_count; i; --i) {
+      free_.push_back(i * 32);
+    }
+  }
+  uint32_t Alloc() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint32_t address = free_.back();
+    free_.pop_back();
+    return address;
+  }
+  void Free(uint32_t address) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(address);
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<uint32_t> free_;
+};
+
+// Runs thread_count threads that each allocate and free batches of blocks
+// and returns the average time per allocation + free in nanoseconds.
+template <typename AllocFn, typename FreeFn>
+int64_t MeasureChurn(int thread_count, int rounds, AllocFn alloc,
+                     FreeFn free) {
+  const int kBatch = 16;
+  auto start = std::chrono::high_resolution_clock::now();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < thread_count; ++t) {
+    threads.emplace_back([&]() {
+      uint32_t blocks[kBatch];
+      for (int round = 0; round < rounds; ++round) {
+        for (int i = 0; i < kBatch; ++i) {
+          blocks[i] = alloc();
+        }
+        for (int i = 0; i < kBatch; ++i) {
+          free(blocks[i]);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  auto duration = std::chrono::high_resolution_clock::now() - start;
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+             .count() /
+         (int64_t(rounds) * kBatch * thread_count);
+}
+
+}  // namespace
+
+TEST_CASE("SlabAllocator_SizeClasses", "[slab_allocator]") {
+  REQUIRE(SlabAllocator::CanAllocate(1, 4));
+  REQUIRE(SlabAllocator::CanAllocate(2048, 0x20));
+  REQUIRE(!SlabAllocator::CanAllocate(2049, 0x20));
+  REQUIRE(!SlabAllocator::CanAllocate(16, 4096));
+
+  TestBacking backing(16);
+  auto allocator = backing.CreateAllocator();
+  std::vector<std::pair<uint32_t, uint32_t>> blocks;
+  for (uint32_t size : {1u, 4u, 32u, 33u, 100u, 256u, 1000u, 2048u}) {
+    for (int i = 0; i < 3; ++i) {
+      uint32_t address = allocator->Alloc(size, 0x20);
+      REQUIRE(address);
+      REQUIRE(allocator->Owns(address));
+      REQUIRE(address % 0x20 == 0);
+      // Blocks are aligned to their (power of two) size.
+      uint32_t block_size = std::max(32u, size);
+      REQUIRE(address % xe::next_pow2(block_size) == 0);
+      blocks.emplace_back(address, size);
+    }
+  }
+  // Larger alignments pick larger classes.
+  uint32_t aligned = allocator->Alloc(8, 1024);
+  REQUIRE(aligned % 1024 == 0);
+  blocks.emplace_back(aligned, 8);
+  REQUIRE(!allocator->Alloc(4096, 0x20));
+
+  std::sort(blocks.begin(), blocks.end());
+  for (size_t i = 1; i < blocks.size(); ++i) {
+    REQUIRE(blocks[i - 1].first + blocks[i - 1].second <= blocks[i].first);
+  }
+
+  REQUIRE(!allocator->Owns(0));
+  REQUIRE(!allocator->Free(0));
+  REQUIRE(!allocator->Free(17 * SlabAllocator::kSlabSize));
+  for (auto& block : blocks) {
+    REQUIRE(allocator->Free(block.first));
+  }
+
+  auto stats = allocator->GetStats();
+  REQUIRE(stats.size() == SlabAllocator::kSizeClassCount);
+  uint32_t slab_count = 0;
+  for (auto& size_class_stats : stats) {
+    REQUIRE(size_class_stats.alloc_count == size_class_stats.free_count);
+    slab_count += size_class_stats.slab_count;
+  }
+  REQUIRE(stats[0].block_size == 32);
+  REQUIRE(stats[0].alloc_count == 9);
+  REQUIRE(slab_count == backing.used_slab_count());
+
+  // Frees go to the magazine and come straight back.
+  uint32_t address = allocator->Alloc(64, 0x20);
+  REQUIRE(allocator->Free(address));
+  REQUIRE(allocator->Alloc(64, 0x20) == address);
+
+  allocator->Reset();
+  REQUIRE(backing.used_slab_count() == 0);
+  REQUIRE(!allocator->Owns(address));
+  REQUIRE(allocator->GetStats()[1].alloc_count == 0);
+}
+
+TEST_CASE("SlabAllocator_OutOfMemory", "[slab_allocator]") {
+  TestBacking backing(1);
+  auto allocator = backing.CreateAllocator();
+  std::vector<uint32_t> blocks;
+  for (uint32_t i = 0; i < SlabAllocator::kSlabSize / 2048; ++i) {
+    blocks.push_back(allocator->Alloc(2048, 0x20));
+    REQUIRE(blocks.back());
+  }
+  REQUIRE(!allocator->Alloc(2048, 0x20));
+  REQUIRE(!allocator->Alloc(32, 0x20));
+  REQUIRE(allocator->Free(blocks.back()));
+  REQUIRE(allocator->Alloc(2048, 0x20) == blocks.back());
+}
+
+TEST_CASE("SlabAllocator_Threads", "[slab_allocator]") {
+  const int kThreadCount = 4;
+  const int kRounds = 2000;
+  TestBacking backing(256);
+  auto allocator = backing.CreateAllocator();
+
+  // Each thread stamps its blocks, checks nobody else wrote to them, and
+  // frees half of them on the next thread over.
+  std::mutex handoff_mutex;
+  std::vector<uint32_t> handoffs[kThreadCount];
+  std::atomic<int> failures(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreadCount; ++t) {
+    threads.emplace_back([&, t]() {
+      std::mt19937 rng(t);
+      std::vector<std::pair<uint32_t, uint32_t>> live;
+      for (int round = 0; round < kRounds; ++round) {
+        uint32_t size = 1 + rng() % 600;
+        uint32_t address = allocator->Alloc(size, 0x20);
+        if (!address) {
+          ++failures;
+          continue;
+        }
+        std::memset(backing.membase() + address, t + 1, size);
+        live.emplace_back(address, size);
+        if (live.size() > 64) {
+          auto block = live[rng() % live.size()];
+          live.erase(std::find(live.begin(), live.end(), block));
+          for (uint32_t i = 0; i < block.second; ++i) {
+            if (backing.membase()[block.first + i] != t + 1) {
+              ++failures;
+              break;
+            }
+          }
+          if (block.first & (1 << 5)) {
+            std::lock_guard<std::mutex> lock(handoff_mutex);
+            handoffs[(t + 1) % kThreadCount].push_back(block.first);
+          } else {
+            allocator->Free(block.first);
+          }
+        }
+        if (round % 100 == 0) {
+          std::vector<uint32_t> to_free;
+          {
+            std::lock_guard<std::mutex> lock(handoff_mutex);
+            to_free.swap(handoffs[t]);
+          }
+          for (uint32_t other : to_free) {
+            allocator->Free(other);
+          }
+        }
+      }
+      for (auto& block : live) {
+        allocator->Free(block.first);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (auto& handoff : handoffs) {
+    for (uint32_t address : handoff) {
+      allocator->Free(address);
+    }
+  }
+  REQUIRE(failures == 0);
+
+  // The exited threads gave their magazines back, so everything we hand out
+  // now comes from existing slabs.
+  auto slab_count = backing.used_slab_count();
+  for (auto& stats : allocator->GetStats()) {
+    REQUIRE(stats.alloc_count == stats.free_count);
+  }
+  std::set<uint32_t> blocks;
+  for (int i = 0; i < 1000; ++i) {
+    uint32_t address = allocator->Alloc(32, 0x20);
+    REQUIRE(blocks.insert(address).second);
+  }
+  REQUIRE(backing.used_slab_count() == slab_count);
+}
+
+TEST_CASE("SlabAllocator_SaveRestore", "[slab_allocator]") {
+  TestBacking backing(16);
+  auto allocator = backing.CreateAllocator();
+  std::set<uint32_t> live;
+  for (int i = 0; i < 100; ++i) {
+    live.insert(allocator->Alloc(128, 0x20));
+  }
+  std::vector<uint32_t> freed;
+  for (int i = 0; i < 10; ++i) {
+    uint32_t address = *live.begin();
+    live.erase(live.begin());
+    allocator->Free(address);
+    freed.push_back(address);
+  }
+
+  std::vector<uint8_t> buffer(64 * 1024);
+  xe::ByteStream save_stream(buffer.data(), buffer.size());
+  REQUIRE(allocator->Save(&save_stream));
+
+  // The backing memory (and with it the depot links) stays as it was.
+  auto restored = backing.CreateAllocator();
+  xe::ByteStream restore_stream(buffer.data(), buffer.size());
+  REQUIRE(restored->Restore(&restore_stream));
+  REQUIRE(restore_stream.offset() == save_stream.offset());
+  for (uint32_t address : live) {
+    REQUIRE(restored->Owns(address));
+  }
+  // Only free blocks are handed out again, without growing.
+  auto slab_count = backing.used_slab_count();
+  std::set<uint32_t> reallocated;
+  for (int i = 0; i < 400; ++i) {
+    uint32_t address = restored->Alloc(128, 0x20);
+    REQUIRE(restored->Owns(address));
+    REQUIRE(!live.count(address));
+    REQUIRE(reallocated.insert(address).second);
+  }
+  REQUIRE(backing.used_slab_count() == slab_count);
+  for (uint32_t address : freed) {
+    REQUIRE(reallocated.count(address));
+  }
+}
+
+// Alloc/free churn from several threads against a single locked free list.
+// Run explicitly with the [benchmark] tag.
+TEST_CASE("SlabAllocator_Churn", "[.][benchmark][slab_allocator]") {
+  const int kRounds = 100000;
+  TestBacking backing(256);
+  auto allocator = backing.CreateAllocator();
+  LockedFreeList locked(16 * 1024);
+  for (int thread_count : {1, 4}) {
+    auto slab_ns = MeasureChurn(
+        thread_count, kRounds, [&]() { return allocator->Alloc(64, 0x20); },
+        [&](uint32_t address) { allocator->Free(address); });
+    auto locked_ns =
+        MeasureChurn(thread_count, kRounds, [&]() { return locked.Alloc(); },
+                     [&](uint32_t address) { locked.Free(address); });
+    WARN(thread_count << " thread(s): slabs " << slab_ns << "ns, locked "
+                      << locked_ns << "ns per alloc + free");
+  }
+}
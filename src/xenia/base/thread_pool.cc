@@ -0,0 +1,262 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/thread_pool.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/math.h"
+
+namespace xe {
+
+// Pool and worker index of the calling thread, if it is a worker, so that
+// tasks it submits go on its own queue.
+thread_local ThreadPool* current_pool_ = nullptr;
+thread_local size_t current_worker_index_ = 0;
+
+ThreadPool::ThreadPool(size_t worker_count, size_t task_capacity)
+    : next_worker_(0), running_(true), ready_count_(0) {
+  assert_true(worker_count > 0);
+  assert_true(task_capacity > 0);
+  for (size_t i = 0; i < worker_count; ++i) {
+    workers_.push_back(std::make_unique<Worker>());
+  }
+  tasks_ = std::make_unique<Task[]>(task_capacity);
+  for (size_t i = task_capacity; i > 0; --i) {
+    tasks_[i - 1].next_free = free_tasks_;
+    free_tasks_ = &tasks_[i - 1];
+  }
+  std::memset(&stats_, 0, sizeof(stats_));
+}
+
+ThreadPool::~ThreadPool() { Shutdown(); }
+
+void ThreadPool::RunWorker(size_t worker_index) {
+  assert_true(worker_index < workers_.size());
+  current_pool_ = this;
+  current_worker_index_ = worker_index;
+  while (running_.load(std::memory_order_acquire)) {
+    Task* task = TakeTask(worker_index);
+    if (!task) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      auto next_due_time = ReleaseDueTasks();
+      if (ready_count_.load(std::memory_order_relaxed) ||
+          !running_.load(std::memory_order_relaxed)) {
+        continue;
+      }
+      if (next_due_time == Clock::time_point::max()) {
+        work_cond_.wait(lock);
+      } else {
+        work_cond_.wait_until(lock, next_due_time);
+      }
+      continue;
+    }
+    auto start_time = Clock::now();
+    task->invoke(task->storage);
+    task->destroy(task->storage);
+    auto end_time = Clock::now();
+    FinishTask(task, worker_index, start_time, end_time);
+  }
+  current_pool_ = nullptr;
+}
+
+void ThreadPool::Shutdown() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  running_.store(false, std::memory_order_release);
+  for (auto& worker : workers_) {
+    std::lock_guard<std::mutex> worker_lock(worker->mutex);
+    for (Task* task : worker->queue) {
+      DropTask(task);
+    }
+    ready_count_.fetch_sub(static_cast<uint32_t>(worker->queue.size()),
+                           std::memory_order_relaxed);
+    worker->queue.clear();
+  }
+  while (!delayed_tasks_.empty()) {
+    DropTask(delayed_tasks_.top());
+    delayed_tasks_.pop();
+  }
+  // Tasks still running drop whatever is queued behind them when they finish.
+  work_cond_.notify_all();
+  free_cond_.notify_all();
+}
+
+ThreadPool::Task* ThreadPool::AllocateTask() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  // Slots are held by pending tasks only, so this returns as soon as any of
+  // them finishes (or is dropped).
+  free_cond_.wait(lock, [this]() { return free_tasks_ != nullptr; });
+  Task* task = free_tasks_;
+  free_tasks_ = task->next_free;
+  task->next_free = nullptr;
+  return task;
+}
+
+void ThreadPool::SubmitTask(Task* task, uint64_t key,
+                            std::chrono::milliseconds delay) {
+  auto now = Clock::now();
+  task->key = key;
+  task->next_in_key = nullptr;
+  task->due_time = now + delay;
+  task->ready_time = now;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++stats_.queue_depth;
+  stats_.max_queue_depth =
+      std::max(stats_.max_queue_depth, stats_.queue_depth);
+  if (!running_.load(std::memory_order_relaxed)) {
+    DropTask(task);
+    return;
+  }
+  if (key) {
+    auto it = key_tails_.find(key);
+    if (it != key_tails_.end()) {
+      // Queued once the previous task with the key finishes.
+      it->second->next_in_key = task;
+      it->second = task;
+      return;
+    }
+    key_tails_.emplace(key, task);
+  }
+  if (task->due_time > now) {
+    delayed_tasks_.push(task);
+    // An idle worker may be waiting for a later due time.
+    work_cond_.notify_one();
+  } else {
+    EnqueueReady(task);
+  }
+}
+
+void ThreadPool::EnqueueReady(Task* task) {
+  size_t worker_index;
+  if (current_pool_ == this) {
+    worker_index = current_worker_index_;
+  } else {
+    worker_index = next_worker_.fetch_add(1, std::memory_order_relaxed) %
+                   workers_.size();
+  }
+  task->queued_worker = worker_index;
+  auto& worker = *workers_[worker_index];
+  {
+    std::lock_guard<std::mutex> worker_lock(worker.mutex);
+    worker.queue.push_back(task);
+  }
+  ready_count_.fetch_add(1, std::memory_order_relaxed);
+  work_cond_.notify_one();
+}
+
+ThreadPool::Task* ThreadPool::TakeTask(size_t worker_index) {
+  if (!ready_count_.load(std::memory_order_relaxed)) {
+    return nullptr;
+  }
+  // Oldest first from our own queue, newest first from the others so that
+  // owner and thief don't fight over the same end.
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    auto& worker = *workers_[(worker_index + i) % workers_.size()];
+    std::lock_guard<std::mutex> worker_lock(worker.mutex);
+    if (worker.queue.empty()) {
+      continue;
+    }
+    Task* task;
+    if (!i) {
+      task = worker.queue.front();
+      worker.queue.pop_front();
+    } else {
+      task = worker.queue.back();
+      worker.queue.pop_back();
+    }
+    ready_count_.fetch_sub(1, std::memory_order_relaxed);
+    return task;
+  }
+  return nullptr;
+}
+
+ThreadPool::Clock::time_point ThreadPool::ReleaseDueTasks() {
+  auto now = Clock::now();
+  while (!delayed_tasks_.empty()) {
+    Task* task = delayed_tasks_.top();
+    if (task->due_time > now) {
+      return task->due_time;
+    }
+    delayed_tasks_.pop();
+    // Any wait past the due time counts against the pool.
+    task->ready_time = task->due_time;
+    EnqueueReady(task);
+  }
+  return Clock::time_point::max();
+}
+
+void ThreadPool::FinishTask(Task* task, size_t worker_index,
+                            Clock::time_point start_time,
+                            Clock::time_point end_time) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++stats_.completed_count;
+  if (task->queued_worker != worker_index) {
+    ++stats_.steal_count;
+  }
+  ++stats_.wait_histogram[HistogramBucket(start_time - task->ready_time)];
+  ++stats_.run_histogram[HistogramBucket(end_time - start_time)];
+
+  Task* next_task = task->next_in_key;
+  if (next_task && !running_.load(std::memory_order_relaxed)) {
+    DropTask(next_task);
+  } else if (next_task) {
+    next_task->ready_time = end_time;
+    if (next_task->due_time > end_time) {
+      delayed_tasks_.push(next_task);
+      work_cond_.notify_one();
+    } else {
+      EnqueueReady(next_task);
+    }
+  } else if (task->key) {
+    key_tails_.erase(task->key);
+  }
+  ReleaseTask(task);
+  ReleaseDueTasks();
+}
+
+void ThreadPool::DropTask(Task* task) {
+  while (task) {
+    Task* next_task = task->next_in_key;
+    if (task->key && !next_task) {
+      key_tails_.erase(task->key);
+    }
+    task->destroy(task->storage);
+    ReleaseTask(task);
+    task = next_task;
+  }
+}
+
+void ThreadPool::ReleaseTask(Task* task) {
+  assert_true(stats_.queue_depth > 0);
+  --stats_.queue_depth;
+  task->next_in_key = nullptr;
+  task->next_free = free_tasks_;
+  free_tasks_ = task;
+  free_cond_.notify_one();
+}
+
+size_t ThreadPool::HistogramBucket(Clock::duration duration) {
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration)
+                .count();
+  if (us <= 0) {
+    return 0;
+  }
+  size_t bucket = xe::log2_floor(static_cast<uint64_t>(us)) + 1;
+  return std::min(bucket, kHistogramBucketCount - 1);
+}
+
+ThreadPool::Stats ThreadPool::GetStats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+}  // namespace xe
@@ -0,0 +1,164 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_THREAD_POOL_H_
+#define XENIA_BASE_THREAD_POOL_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <queue>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace xe {
+
+// Bounded work-stealing pool for short host tasks.
+//
+// The pool doesn't create threads: the owner runs RunWorker on as many
+// threads as it asked for (so that they can be whatever kind of thread the
+// owner needs, such as guest-visible host threads). Each worker has its own
+// queue and steals from the others when it runs dry.
+//
+// Closures are stored in a fixed set of task slots instead of allocated per
+// call, which also bounds the pool: Submit blocks while every slot is in use.
+//
+// Tasks submitted with the same non-zero key run one at a time in the order
+// they were submitted. Tasks may also be delayed, without holding up a worker
+// while they wait.
+class ThreadPool {
+ public:
+  // Largest closure a task can hold.
+  static const size_t kTaskStorageSize = 96;
+  // Histogram buckets: [0] is under 1us, [i] is under 2^i us.
+  static const size_t kHistogramBucketCount = 24;
+
+  struct Stats {
+    // Tasks submitted and not yet finished, now and at most.
+    uint32_t queue_depth;
+    uint32_t max_queue_depth;
+    uint64_t completed_count;
+    // Tasks run by a worker other than the one they were queued on.
+    uint64_t steal_count;
+    // Time from when a task could run (submitted, or its delay elapsed, or its
+    // predecessor with the same key finished) to when it started.
+    uint64_t wait_histogram[kHistogramBucketCount];
+    uint64_t run_histogram[kHistogramBucketCount];
+  };
+
+  ThreadPool(size_t worker_count, size_t task_capacity);
+  ~ThreadPool();
+
+  size_t worker_count() const { return workers_.size(); }
+
+  // Runs tasks on the calling thread until Shutdown.
+  void RunWorker(size_t worker_index);
+
+  // Makes all workers return once they finish their current task. Tasks that
+  // haven't started are dropped.
+  void Shutdown();
+
+  template <typename F>
+  void Submit(F&& fn) {
+    Submit(0, std::chrono::milliseconds(0), std::forward<F>(fn));
+  }
+  template <typename F>
+  void Submit(uint64_t key, std::chrono::milliseconds delay, F&& fn) {
+    typedef typename std::decay<F>::type Closure;
+    static_assert(sizeof(Closure) <= kTaskStorageSize,
+                  "Closure too large for a task slot");
+    static_assert(alignof(Closure) <= alignof(std::max_align_t),
+                  "Closure alignment too large for a task slot");
+    Task* task = AllocateTask();
+    new (task->storage) Closure(std::forward<F>(fn));
+    task->invoke = [](void* storage) { (*static_cast<Closure*>(storage))(); };
+    task->destroy = [](void* storage) {
+      static_cast<Closure*>(storage)->~Closure();
+    };
+    SubmitTask(task, key, delay);
+  }
+
+  Stats GetStats();
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Task {
+    alignas(std::max_align_t) uint8_t storage[kTaskStorageSize];
+    void (*invoke)(void* storage);
+    void (*destroy)(void* storage);
+    uint64_t key;
+    // Next task with the same key, submitted after this one.
+    Task* next_in_key;
+    // When the task may run, and when it could have run at the earliest
+    // (for the wait histogram).
+    Clock::time_point due_time;
+    Clock::time_point ready_time;
+    size_t queued_worker;
+    Task* next_free;
+  };
+
+  struct alignas(64) Worker {
+    std::mutex mutex;
+    std::deque<Task*> queue;
+  };
+
+  struct DelayedTaskCompare {
+    bool operator()(const Task* a, const Task* b) const {
+      return a->due_time > b->due_time;
+    }
+  };
+
+  Task* AllocateTask();
+  void SubmitTask(Task* task, uint64_t key, std::chrono::milliseconds delay);
+  // Puts a task that may run now on a worker queue and wakes a worker.
+  void EnqueueReady(Task* task);
+  Task* TakeTask(size_t worker_index);
+  // Moves delayed tasks that are due to the queues. Returns the next due time
+  // of those left. mutex_ must be held.
+  Clock::time_point ReleaseDueTasks();
+  void FinishTask(Task* task, size_t worker_index,
+                  Clock::time_point start_time, Clock::time_point end_time);
+  // Destroys a task that won't run, along with the tasks queued behind it
+  // with the same key. mutex_ must be held.
+  void DropTask(Task* task);
+  // Returns a finished or dropped task to the free list. mutex_ must be held.
+  void ReleaseTask(Task* task);
+  static size_t HistogramBucket(Clock::duration duration);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<size_t> next_worker_;
+  std::atomic<bool> running_;
+  // Tasks on worker queues.
+  std::atomic<uint32_t> ready_count_;
+
+  // Guards everything below.
+  std::mutex mutex_;
+  std::condition_variable work_cond_;
+  std::condition_variable free_cond_;
+  std::unique_ptr<Task[]> tasks_;
+  Task* free_tasks_ = nullptr;
+  std::priority_queue<Task*, std::vector<Task*>, DelayedTaskCompare>
+      delayed_tasks_;
+  // Last submitted task per key, while any task with the key is pending.
+  std::unordered_map<uint64_t, Task*> key_tails_;
+  Stats stats_;
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_THREAD_POOL_H_
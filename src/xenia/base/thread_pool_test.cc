@@ -0,0 +1,221 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+
+using xe::ThreadPool;
+
+namespace {
+
+// Runs the pool's workers on std::threads for the lifetime of the object.
+class PoolThreads {
+ public:
+  explicit PoolThreads(ThreadPool* pool) : pool_(pool) {
+    for (size_t i = 0; i < pool->worker_count(); ++i) {
+      threads_.emplace_back([pool, i]() { pool->RunWorker(i); });
+    }
+  }
+  ~PoolThreads() {
+    pool_->Shutdown();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+ private:
+  ThreadPool* pool_;
+  std::vector<std::thread> threads_;
+};
+
+void WaitForCount(const std::atomic<uint32_t>& count, uint32_t expected) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (count.load() < expected &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+uint64_t HistogramTotal(const uint64_t* histogram) {
+  uint64_t total = 0;
+  for (size_t i = 0; i < ThreadPool::kHistogramBucketCount; ++i) {
+    total += histogram[i];
+  }
+  return total;
+}
+
+}  // namespace
+
+TEST_CASE("ThreadPool_Run", "[thread_pool]") {
+  const uint32_t kTaskCount = 1000;
+  ThreadPool pool(4, 16);
+  PoolThreads threads(&pool);
+
+  std::atomic<uint32_t> ran(0);
+  for (uint32_t i = 0; i < kTaskCount; ++i) {
+    pool.Submit([&ran]() { ++ran; });
+  }
+  WaitForCount(ran, kTaskCount);
+  REQUIRE(ran == kTaskCount);
+
+  // Completion is counted just after the task returns.
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  ThreadPool::Stats stats;
+  do {
+    stats = pool.GetStats();
+  } while (stats.queue_depth && std::chrono::steady_clock::now() < deadline);
+  REQUIRE(stats.queue_depth == 0);
+  REQUIRE(stats.completed_count == kTaskCount);
+  REQUIRE(stats.max_queue_depth <= 16);
+  REQUIRE(HistogramTotal(stats.wait_histogram) == kTaskCount);
+  REQUIRE(HistogramTotal(stats.run_histogram) == kTaskCount);
+}
+
+TEST_CASE("ThreadPool_KeyOrder", "[thread_pool]") {
+  const uint32_t kKeyCount = 8;
+  const uint32_t kTasksPerKey = 200;
+  ThreadPool pool(4, 64);
+  PoolThreads threads(&pool);
+
+  // Tasks with the same key must run in order and never overlap.
+  struct KeyState {
+    std::atomic<uint32_t> running{0};
+    uint32_t next = 0;
+    bool in_order = true;
+  };
+  KeyState keys[kKeyCount];
+  std::atomic<uint32_t> ran(0);
+  for (uint32_t i = 0; i < kTasksPerKey; ++i) {
+    for (uint32_t k = 0; k < kKeyCount; ++k) {
+      KeyState* key = &keys[k];
+      pool.Submit(k + 1, std::chrono::milliseconds(0), [key, i, &ran]() {
+        if (key->running++ || key->next != i) {
+          key->in_order = false;
+        }
+        key->next = i + 1;
+        --key->running;
+        ++ran;
+      });
+    }
+  }
+  WaitForCount(ran, kKeyCount * kTasksPerKey);
+  REQUIRE(ran == kKeyCount * kTasksPerKey);
+  for (uint32_t k = 0; k < kKeyCount; ++k) {
+    REQUIRE(keys[k].in_order);
+    REQUIRE(keys[k].next == kTasksPerKey);
+  }
+}
+
+TEST_CASE("ThreadPool_Delay", "[thread_pool]") {
+  ThreadPool pool(1, 8);
+  PoolThreads threads(&pool);
+
+  // The delayed task must not hold up the worker.
+  std::atomic<uint32_t> ran(0);
+  std::atomic<uint32_t> order(0);
+  uint32_t delayed_order = 0;
+  uint32_t immediate_order = 0;
+  auto start_time = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point delayed_time;
+  pool.Submit(0, std::chrono::milliseconds(50), [&]() {
+    delayed_time = std::chrono::steady_clock::now();
+    delayed_order = ++order;
+    ++ran;
+  });
+  pool.Submit([&]() {
+    immediate_order = ++order;
+    ++ran;
+  });
+  WaitForCount(ran, 2);
+  REQUIRE(ran == 2);
+  REQUIRE(immediate_order == 1);
+  REQUIRE(delayed_order == 2);
+  REQUIRE(delayed_time - start_time >= std::chrono::milliseconds(50));
+}
+
+TEST_CASE("ThreadPool_Capacity", "[thread_pool]") {
+  ThreadPool pool(2, 2);
+  PoolThreads threads(&pool);
+
+  // Hold both slots and make sure a third submission waits for one.
+  std::mutex gate;
+  std::unique_lock<std::mutex> gate_lock(gate);
+  std::atomic<uint32_t> started(0);
+  std::atomic<uint32_t> ran(0);
+  for (int i = 0; i < 2; ++i) {
+    pool.Submit([&]() {
+      ++started;
+      std::lock_guard<std::mutex> lock(gate);
+      ++ran;
+    });
+  }
+  WaitForCount(started, 2);
+
+  std::atomic<bool> submitted(false);
+  std::thread submitter([&]() {
+    pool.Submit([&ran]() { ++ran; });
+    submitted = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  REQUIRE(!submitted);
+  gate_lock.unlock();
+  submitter.join();
+  REQUIRE(submitted);
+  WaitForCount(ran, 3);
+  REQUIRE(ran == 3);
+  REQUIRE(pool.GetStats().max_queue_depth == 2);
+}
+
+TEST_CASE("ThreadPool_ShutdownDropsPending", "[thread_pool]") {
+  // Closures that never run must still be destroyed.
+  auto token = std::make_shared<int>(0);
+  {
+    ThreadPool pool(1, 8);
+    std::atomic<uint32_t> ran(0);
+    pool.Submit(0, std::chrono::seconds(60), [token, &ran]() { ++ran; });
+    pool.Submit(1, std::chrono::milliseconds(0), [token, &ran]() { ++ran; });
+    pool.Submit(1, std::chrono::milliseconds(0), [token, &ran]() { ++ran; });
+    REQUIRE(token.use_count() == 4);
+    pool.Shutdown();
+    REQUIRE(ran == 0);
+    REQUIRE(pool.GetStats().queue_depth == 0);
+  }
+  REQUIRE(token.use_count() == 1);
+}
+
+TEST_CASE("ThreadPool_Throughput", "[.][benchmark]") {
+  const uint32_t kTaskCount = 1000000;
+  for (size_t worker_count = 1; worker_count <= 8; worker_count *= 2) {
+    ThreadPool pool(worker_count, 256);
+    PoolThreads threads(&pool);
+    std::atomic<uint32_t> ran(0);
+    auto start_time = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < kTaskCount; ++i) {
+      pool.Submit(i % 64 + 1, std::chrono::milliseconds(0),
+                  [&ran]() { ++ran; });
+    }
+    WaitForCount(ran, kTaskCount);
+    auto elapsed = std::chrono::steady_clock::now() - start_time;
+    auto stats = pool.GetStats();
+    WARN(worker_count
+         << " workers: "
+         << std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                    .count() /
+                kTaskCount
+         << "ns per task, " << stats.steal_count << " steals");
+  }
+}
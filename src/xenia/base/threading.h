@@ -10,6 +10,8 @@
 #ifndef XENIA_BASE_THREADING_H_
 #define XENIA_BASE_THREADING_H_
 
+#include <emmintrin.h>
+
 #include <algorithm>
 #include <atomic>
 #include <chrono>
@@ -73,6 +75,10 @@ void set_name(std::thread::native_handle_type handle, const std::string& name);
 // Yields the current thread to the scheduler. Maybe.
 void MaybeYield();
 
+// Hints the processor that this is a spin-wait loop, which keeps it from
+// flooding the memory system and hands its resources to a sibling thread.
+inline void SpinPause() { _mm_pause(); }
+
 // Memory barrier (request - may be ignored).
 void SyncMemory();
 
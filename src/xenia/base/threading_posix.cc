@@ -9,32 +9,1111 @@
 
 #include "xenia/base/threading.h"
 
+#include <errno.h>
+#include <linux/futex.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <time.h>
+#include <unistd.h>
+
+#include <deque>
+#include <map>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/logging.h"
+
+// All wait objects are built on futexes. Every thread has a single futex word
+// (its Waiter) that it sleeps on, no matter how many objects it is waiting
+// for. A waiting thread registers its Waiter with each object; signaling an
+// object bumps and wakes the futex of every registered waiter, which then
+// rechecks the objects it is waiting on. This makes WaitMultiple (any or all)
+// a plain futex wait with no helper threads, and a signal costs one wake per
+// waiting thread.
 
 namespace xe {
 namespace threading {
 
-// uint64_t ticks() { return mach_absolute_time(); }
+namespace {
+
+long Futex(std::atomic<uint32_t>* address, int op, uint32_t value,
+           const timespec* timeout) {
+  return syscall(SYS_futex, reinterpret_cast<uint32_t*>(address), op, value,
+                 timeout, nullptr, 0);
+}
+
+// Sleeps while *address == expected_value. Returns false on timeout. May
+// return spuriously.
+bool FutexWait(std::atomic<uint32_t>* address, uint32_t expected_value,
+               const timespec* timeout = nullptr) {
+  if (Futex(address, FUTEX_WAIT_PRIVATE, expected_value, timeout) == -1 &&
+      errno == ETIMEDOUT) {
+    return false;
+  }
+  return true;
+}
+
+void FutexWake(std::atomic<uint32_t>* address, int count) {
+  Futex(address, FUTEX_WAKE_PRIVATE, count, nullptr);
+}
+
+// A small lock guarding the state of a wait object. Held only for a few
+// instructions at a time, so it spins briefly before sleeping.
+// 0 = unlocked, 1 = locked, 2 = locked with (possible) sleepers.
+class FutexLock {
+ public:
+  void lock() {
+    for (int i = 0; i < 64; ++i) {
+      uint32_t expected = 0;
+      if (state_.compare_exchange_weak(expected, 1,
+                                       std::memory_order_acquire)) {
+        return;
+      }
+    }
+    uint32_t state = state_.exchange(2, std::memory_order_acquire);
+    while (state != 0) {
+      FutexWait(&state_, 2);
+      state = state_.exchange(2, std::memory_order_acquire);
+    }
+  }
+  void unlock() {
+    if (state_.exchange(0, std::memory_order_release) == 2) {
+      FutexWake(&state_, 1);
+    }
+  }
+
+ private:
+  std::atomic<uint32_t> state_ = {0};
+};
+
+uint32_t GetCurrentThreadTid() {
+  static thread_local uint32_t tid = 0;
+  if (!tid) {
+    tid = static_cast<uint32_t>(syscall(SYS_gettid));
+  }
+  return tid;
+}
+
+timespec DurationToTimespec(std::chrono::nanoseconds duration) {
+  timespec ts;
+  ts.tv_sec = static_cast<time_t>(duration.count() / 1000000000);
+  ts.tv_nsec = static_cast<long>(duration.count() % 1000000000);
+  return ts;
+}
+
+class WaitObject;
+
+// Per-thread wait state, shared by every object the thread waits on.
+struct Waiter {
+  static const uint32_t kNoHandoff = UINT_MAX;
+  static const uint32_t kClaimed = UINT_MAX - 1;
+
+  // Bumped and woken whenever anything the thread is waiting on changes.
+  std::atomic<uint32_t> futex = {0};
+  // Index into objects of a wait-any satisfied directly by Event::Pulse,
+  // kNoHandoff if none, or kClaimed once the wait was satisfied another way.
+  std::atomic<uint32_t> handoff = {kNoHandoff};
+  // What the thread is currently waiting on. Only read by other threads while
+  // the waiter is registered with the object they hold the lock of.
+  WaitObject* const* objects = nullptr;
+  size_t object_count = 0;
+  bool wait_all = false;
+};
+
+void WakeWaiter(Waiter* waiter) {
+  waiter->futex.fetch_add(1, std::memory_order_release);
+  FutexWake(&waiter->futex, 1);
+}
+
+class WaitObject {
+ public:
+  virtual ~WaitObject() = default;
+
+  // Whether a wait by the calling thread would be satisfied right now.
+  // The lock must be held.
+  virtual bool IsSignaled() const = 0;
+  // Consumes the signal for a satisfied wait (resetting an auto-reset event,
+  // taking a semaphore count, owning a mutant). The lock must be held.
+  virtual void Acquire() {}
+  // Signals the object for SignalAndWait. Returns false if not signalable.
+  virtual bool Signal() { return false; }
+
+  void Lock() { lock_.lock(); }
+  void Unlock() { lock_.unlock(); }
+
+  void AddWaiter(Waiter* waiter) { waiters_.push_back(waiter); }
+  void RemoveWaiter(Waiter* waiter) {
+    auto it = std::find(waiters_.begin(), waiters_.end(), waiter);
+    assert_false(it == waiters_.end());
+    if (it != waiters_.end()) {
+      *it = waiters_.back();
+      waiters_.pop_back();
+    }
+  }
+
+ protected:
+  // Wakes every waiting thread so that it rechecks. The lock must be held.
+  void WakeWaiters() {
+    for (auto waiter : waiters_) {
+      WakeWaiter(waiter);
+    }
+  }
+
+  FutexLock lock_;
+  std::vector<Waiter*> waiters_;
+};
+
+class EventObject : public WaitObject {
+ public:
+  EventObject(bool manual_reset, bool initial_state)
+      : manual_reset_(manual_reset), signaled_(initial_state) {}
+
+  bool IsSignaled() const override { return signaled_; }
+  void Acquire() override {
+    if (!manual_reset_) {
+      signaled_ = false;
+    }
+  }
+  bool Signal() override {
+    Set();
+    return true;
+  }
+
+  void Set() {
+    Lock();
+    signaled_ = true;
+    WakeWaiters();
+    Unlock();
+  }
+  void Reset() {
+    Lock();
+    signaled_ = false;
+    Unlock();
+  }
+  void Pulse() {
+    Lock();
+    // Release whoever is waiting right now without ever leaving the event
+    // signaled: each wait-any is handed the event directly. Wait-alls would
+    // need every other object signaled at the same instant, which Win32 does
+    // not guarantee either, so they are left alone.
+    for (auto waiter : waiters_) {
+      if (waiter->wait_all) {
+        continue;
+      }
+      uint32_t index = 0;
+      while (waiter->objects[index] != this) {
+        ++index;
+      }
+      uint32_t expected = Waiter::kNoHandoff;
+      if (waiter->handoff.compare_exchange_strong(expected, index)) {
+        WakeWaiter(waiter);
+        if (!manual_reset_) {
+          break;
+        }
+      }
+    }
+    signaled_ = false;
+    Unlock();
+  }
+
+ private:
+  bool manual_reset_;
+  bool signaled_;
+};
+
+class SemaphoreObject : public WaitObject {
+ public:
+  SemaphoreObject(int initial_count, int maximum_count)
+      : count_(initial_count), maximum_count_(maximum_count) {}
+
+  bool IsSignaled() const override { return count_ > 0; }
+  void Acquire() override { --count_; }
+  bool Signal() override { return Release(1, nullptr); }
+
+  bool Release(int release_count, int* out_previous_count) {
+    Lock();
+    if (release_count <= 0 || count_ + release_count > maximum_count_) {
+      Unlock();
+      return false;
+    }
+    if (out_previous_count) {
+      *out_previous_count = count_;
+    }
+    count_ += release_count;
+    WakeWaiters();
+    Unlock();
+    return true;
+  }
+
+ private:
+  int count_;
+  int maximum_count_;
+};
+
+class MutantObject : public WaitObject {
+ public:
+  explicit MutantObject(bool initial_owner) {
+    if (initial_owner) {
+      owner_ = GetCurrentThreadTid();
+      recursion_count_ = 1;
+    }
+  }
+
+  bool IsSignaled() const override {
+    return !owner_ || owner_ == GetCurrentThreadTid();
+  }
+  void Acquire() override {
+    owner_ = GetCurrentThreadTid();
+    ++recursion_count_;
+  }
+  bool Signal() override { return Release(); }
+
+  bool Release() {
+    Lock();
+    if (owner_ != GetCurrentThreadTid()) {
+      Unlock();
+      return false;
+    }
+    if (!--recursion_count_) {
+      owner_ = 0;
+      WakeWaiters();
+    }
+    Unlock();
+    return true;
+  }
+
+ private:
+  uint32_t owner_ = 0;
+  uint32_t recursion_count_ = 0;
+};
+
+class TimerObject;
+
+// Fires all timers from a single thread, as HighResolutionTimer promises.
+class TimerQueue {
+ public:
+  typedef std::chrono::steady_clock::time_point time_point;
+
+  static TimerQueue* Get() {
+    static TimerQueue timer_queue;
+    return &timer_queue;
+  }
+
+  void Schedule(std::weak_ptr<TimerObject> timer, uint64_t generation,
+                time_point due_time) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.emplace(due_time, Entry{std::move(timer), generation});
+    cond_.notify_one();
+  }
+
+ private:
+  struct Entry {
+    std::weak_ptr<TimerObject> timer;
+    uint64_t generation;
+  };
+
+  TimerQueue() : thread_([this]() { Run(); }) {}
+  ~TimerQueue() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      shutdown_ = true;
+      cond_.notify_one();
+    }
+    thread_.join();
+  }
+
+  void Run();
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::multimap<time_point, Entry> entries_;
+  bool shutdown_ = false;
+  std::thread thread_;
+};
+
+class TimerObject : public WaitObject,
+                    public std::enable_shared_from_this<TimerObject> {
+ public:
+  explicit TimerObject(bool manual_reset) : manual_reset_(manual_reset) {}
+
+  bool IsSignaled() const override { return signaled_; }
+  void Acquire() override {
+    if (!manual_reset_) {
+      signaled_ = false;
+    }
+  }
+
+  bool Set(std::chrono::nanoseconds due_time, std::chrono::milliseconds period,
+           std::function<void()> callback) {
+    Lock();
+    uint64_t generation = ++generation_;
+    signaled_ = false;
+    period_ = period;
+    callback_ = std::move(callback);
+    Unlock();
+    TimerQueue::Get()->Schedule(shared_from_this(), generation,
+                                DueTimeToTimePoint(due_time));
+    return true;
+  }
+  bool Cancel() {
+    // Stale queue entries are skipped when they come due.
+    Lock();
+    ++generation_;
+    callback_ = nullptr;
+    Unlock();
+    return true;
+  }
+
+  // Called on the timer thread when a scheduled due time arrives.
+  void Fire(uint64_t generation, TimerQueue::time_point due_time) {
+    Lock();
+    if (generation != generation_) {
+      Unlock();
+      return;
+    }
+    signaled_ = true;
+    WakeWaiters();
+    auto period = period_;
+    auto callback = callback_;
+    Unlock();
+    if (period.count()) {
+      TimerQueue::Get()->Schedule(shared_from_this(), generation,
+                                  due_time + period);
+    }
+    if (callback) {
+      callback();
+    }
+  }
+
+ private:
+  // Like SetWaitableTimer, negative due times are relative and positive ones
+  // are absolute (FILETIME, in 100ns units since 1601).
+  static TimerQueue::time_point DueTimeToTimePoint(
+      std::chrono::nanoseconds due_time) {
+    auto now = std::chrono::steady_clock::now();
+    if (due_time.count() <= 0) {
+      return now + std::chrono::duration_cast<
+                       std::chrono::steady_clock::duration>(-due_time);
+    }
+    // Absolute times don't fit in nanoseconds, so compare in ticks.
+    const int64_t kUnixEpochFileTime = 116444736000000000ll;
+    int64_t due_ticks = due_time.count() / 100;
+    int64_t now_ticks =
+        kUnixEpochFileTime +
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+                .count() /
+            100;
+    if (due_ticks <= now_ticks) {
+      return now;
+    }
+    return now + std::chrono::duration_cast<
+                     std::chrono::steady_clock::duration>(
+                     std::chrono::nanoseconds((due_ticks - now_ticks) * 100));
+  }
+
+  bool manual_reset_;
+  bool signaled_ = false;
+  uint64_t generation_ = 0;
+  std::chrono::milliseconds period_;
+  std::function<void()> callback_;
+};
+
+void TimerQueue::Run() {
+  set_name("Timer Queue");
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!shutdown_) {
+    if (entries_.empty()) {
+      cond_.wait(lock);
+      continue;
+    }
+    auto it = entries_.begin();
+    if (it->first > std::chrono::steady_clock::now()) {
+      cond_.wait_until(lock, it->first);
+      continue;
+    }
+    auto due_time = it->first;
+    auto entry = std::move(it->second);
+    entries_.erase(it);
+    lock.unlock();
+    auto timer = entry.timer.lock();
+    if (timer) {
+      timer->Fire(entry.generation, due_time);
+    }
+    lock.lock();
+  }
+}
+
+// State of a host thread, shared by every Thread object referring to it.
+// Waiting on a thread waits for it to exit.
+class ThreadControl : public WaitObject {
+ public:
+  ThreadControl() = default;
+  ThreadControl(pthread_t pthread, uint32_t tid)
+      : pthread_(pthread), tid_(tid) {}
+
+  bool IsSignaled() const override { return exited_; }
+
+  Waiter* waiter() { return &waiter_; }
+
+  pthread_t pthread() {
+    tid();
+    return pthread_;
+  }
+  uint32_t tid() {
+    // New threads fill these in themselves once they start running.
+    uint32_t tid = tid_.load(std::memory_order_acquire);
+    while (!tid) {
+      FutexWait(&tid_, 0);
+      tid = tid_.load(std::memory_order_acquire);
+    }
+    return tid;
+  }
+  void set_started(pthread_t pthread, uint32_t tid) {
+    pthread_ = pthread;
+    tid_.store(tid, std::memory_order_release);
+    FutexWake(&tid_, INT_MAX);
+  }
+
+  void MarkExited() {
+    Lock();
+    exited_ = true;
+    WakeWaiters();
+    Unlock();
+  }
+
+  void QueueCallback(std::function<void()> callback) {
+    {
+      std::lock_guard<FutexLock> lock(callback_lock_);
+      callbacks_.push_back(std::move(callback));
+      has_callbacks_.store(true, std::memory_order_release);
+    }
+    WakeWaiter(&waiter_);
+  }
+  bool HasPendingCallbacks() const {
+    return has_callbacks_.load(std::memory_order_acquire);
+  }
+  // Runs all queued callbacks in FIFO order on the calling (owning) thread.
+  void RunCallbacks() {
+    while (true) {
+      std::function<void()> callback;
+      {
+        std::lock_guard<FutexLock> lock(callback_lock_);
+        if (callbacks_.empty()) {
+          has_callbacks_.store(false, std::memory_order_release);
+          return;
+        }
+        callback = std::move(callbacks_.front());
+        callbacks_.pop_front();
+      }
+      callback();
+    }
+  }
+
+  std::atomic<uint32_t>& suspend_count() { return suspend_count_; }
+  void WaitWhileSuspended() {
+    uint32_t count = suspend_count_.load(std::memory_order_acquire);
+    while (count) {
+      FutexWait(&suspend_count_, count);
+      count = suspend_count_.load(std::memory_order_acquire);
+    }
+  }
+
+  int32_t priority() const { return priority_; }
+  void set_priority(int32_t priority) { priority_ = priority; }
+
+ private:
+  pthread_t pthread_ = 0;
+  std::atomic<uint32_t> tid_ = {0};
+  bool exited_ = false;
+  Waiter waiter_;
+  FutexLock callback_lock_;
+  std::deque<std::function<void()>> callbacks_;
+  std::atomic<bool> has_callbacks_ = {false};
+  std::atomic<uint32_t> suspend_count_ = {0};
+  int32_t priority_ = ThreadPriority::kNormal;
+};
+
+thread_local std::shared_ptr<ThreadControl> current_thread_control_;
+// Plain pointer copy for the suspend signal handler.
+thread_local ThreadControl* current_thread_control_ptr_ = nullptr;
+
+ThreadControl* GetCurrentThreadControl() {
+  if (!current_thread_control_ptr_) {
+    // A thread we didn't create (main thread, std::thread, ...).
+    current_thread_control_ =
+        std::make_shared<ThreadControl>(pthread_self(), GetCurrentThreadTid());
+    current_thread_control_ptr_ = current_thread_control_.get();
+  }
+  return current_thread_control_ptr_;
+}
+
+// Tries to satisfy the wait without blocking. With wait_all the objects must
+// already be sorted by address (the lock order).
+bool TryAcquire(WaitObject* const* objects, size_t count, bool wait_all,
+                Waiter* waiter, size_t* out_index) {
+  if (!wait_all) {
+    for (size_t i = 0; i < count; ++i) {
+      auto object = objects[i];
+      object->Lock();
+      if (object->IsSignaled()) {
+        // Lost the race against a pulse handing us another object.
+        uint32_t expected = Waiter::kNoHandoff;
+        if (!waiter->handoff.compare_exchange_strong(expected,
+                                                     Waiter::kClaimed)) {
+          object->Unlock();
+          *out_index = expected;
+          return true;
+        }
+        object->Acquire();
+        object->Unlock();
+        *out_index = i;
+        return true;
+      }
+      object->Unlock();
+    }
+    return false;
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    objects[i]->Lock();
+  }
+  bool all_signaled = true;
+  for (size_t i = 0; i < count && all_signaled; ++i) {
+    all_signaled = objects[i]->IsSignaled();
+  }
+  if (all_signaled) {
+    for (size_t i = 0; i < count; ++i) {
+      objects[i]->Acquire();
+    }
+  }
+  for (size_t i = count; i-- > 0;) {
+    objects[i]->Unlock();
+  }
+  *out_index = 0;
+  return all_signaled;
+}
+
+std::pair<WaitResult, size_t> WaitObjects(WaitObject* const* objects,
+                                          size_t count, bool wait_all,
+                                          bool is_alertable,
+                                          std::chrono::milliseconds timeout) {
+  auto thread_control = GetCurrentThreadControl();
+  auto waiter = thread_control->waiter();
+
+  // Lock (and list) the objects in address order for wait-all so that
+  // overlapping waits can't deadlock. Duplicates are only waited on once.
+  std::vector<WaitObject*> sorted_objects;
+  if (wait_all && count > 1) {
+    sorted_objects.assign(objects, objects + count);
+    std::sort(sorted_objects.begin(), sorted_objects.end());
+    sorted_objects.erase(
+        std::unique(sorted_objects.begin(), sorted_objects.end()),
+        sorted_objects.end());
+    objects = sorted_objects.data();
+    count = sorted_objects.size();
+  }
+
+  waiter->handoff.store(Waiter::kNoHandoff, std::memory_order_relaxed);
+  waiter->objects = objects;
+  waiter->object_count = count;
+  waiter->wait_all = wait_all;
+
+  bool infinite = timeout == std::chrono::milliseconds::max();
+  auto deadline = std::chrono::steady_clock::now();
+  if (!infinite) {
+    deadline += timeout;
+  }
+
+  std::pair<WaitResult, size_t> result(WaitResult::kTimeout, 0);
+  bool registered = false;
+  while (true) {
+    // Anything changing after this bumps the futex, so the wait below won't
+    // sleep through it.
+    uint32_t futex_value = waiter->futex.load(std::memory_order_acquire);
+    size_t index = 0;
+    if (TryAcquire(objects, count, wait_all, waiter, &index)) {
+      result = {WaitResult::kSuccess, index};
+      break;
+    }
+    uint32_t handoff = waiter->handoff.load(std::memory_order_acquire);
+    if (handoff < count) {
+      result = {WaitResult::kSuccess, handoff};
+      break;
+    }
+    if (is_alertable && thread_control->HasPendingCallbacks()) {
+      result = {WaitResult::kUserCallback, 0};
+      break;
+    }
+    if (!registered) {
+      if (!timeout.count()) {
+        break;
+      }
+      // Check again once registered, as signals before now didn't wake us.
+      for (size_t i = 0; i < count; ++i) {
+        objects[i]->Lock();
+        objects[i]->AddWaiter(waiter);
+        objects[i]->Unlock();
+      }
+      registered = true;
+      continue;
+    }
+    if (infinite) {
+      FutexWait(&waiter->futex, futex_value);
+    } else {
+      auto remaining = deadline - std::chrono::steady_clock::now();
+      if (remaining.count() <= 0) {
+        break;
+      }
+      auto remaining_ts = DurationToTimespec(remaining);
+      FutexWait(&waiter->futex, futex_value, &remaining_ts);
+    }
+  }
+
+  if (registered) {
+    for (size_t i = 0; i < count; ++i) {
+      objects[i]->Lock();
+      objects[i]->RemoveWaiter(waiter);
+      objects[i]->Unlock();
+    }
+    // A pulse may have come in after we gave up.
+    uint32_t handoff = waiter->handoff.exchange(Waiter::kClaimed);
+    if (result.first == WaitResult::kTimeout && handoff < count) {
+      result = {WaitResult::kSuccess, handoff};
+    }
+  }
+  waiter->objects = nullptr;
+  waiter->object_count = 0;
+
+  if (result.first == WaitResult::kUserCallback) {
+    thread_control->RunCallbacks();
+  }
+  return result;
+}
+
+int SuspendSignal() { return SIGRTMIN + 1; }
+
+void SuspendSignalHandler(int signal, siginfo_t* info, void* context) {
+  int saved_errno = errno;
+  auto thread_control = current_thread_control_ptr_;
+  if (thread_control) {
+    thread_control->WaitWhileSuspended();
+  }
+  errno = saved_errno;
+}
+
+void InstallSuspendSignalHandler() {
+  static std::once_flag once;
+  std::call_once(once, []() {
+    struct sigaction action = {};
+    action.sa_sigaction = SuspendSignalHandler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SuspendSignal(), &action, nullptr);
+  });
+}
+
+}  // namespace
+
+void EnableAffinityConfiguration() {}
 
-// uint32_t current_thread_id() {
-//   mach_port_t tid = pthread_mach_thread_np(pthread_self());
-//   return static_cast<uint32_t>(tid);
-// }
+uint32_t current_thread_system_id() { return GetCurrentThreadTid(); }
 
 void set_name(const std::string& name) {
-  pthread_setname_np(pthread_self(), name.c_str());
+  // Linux limits names to 15 characters.
+  pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
 }
 
 void set_name(std::thread::native_handle_type handle, const std::string& name) {
-  pthread_setname_np(pthread_self(), name.c_str());
+  pthread_setname_np(handle, name.substr(0, 15).c_str());
 }
 
+void SyncMemory() { std::atomic_thread_fence(std::memory_order_seq_cst); }
+
 void Sleep(std::chrono::microseconds duration) {
-  timespec rqtp = {duration.count() / 1000000, duration.count() % 1000};
-  nanosleep(&rqtp, nullptr);
-  // TODO(benvanik): spin while rmtp >0?
+  timespec rqtp = DurationToTimespec(duration);
+  timespec rmtp;
+  while (nanosleep(&rqtp, &rmtp) == -1 && errno == EINTR) {
+    rqtp = rmtp;
+  }
+}
+
+SleepResult AlertableSleep(std::chrono::microseconds duration) {
+  // Round up so that short sleeps still sleep.
+  auto result = WaitObjects(
+      nullptr, 0, false, true,
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          duration + std::chrono::microseconds(999)));
+  return result.first == WaitResult::kUserCallback ? SleepResult::kAlerted
+                                                   : SleepResult::kSuccess;
+}
+
+TlsHandle AllocateTlsHandle() {
+  pthread_key_t key;
+  if (pthread_key_create(&key, nullptr)) {
+    return kInvalidTlsHandle;
+  }
+  return static_cast<TlsHandle>(key);
+}
+
+bool FreeTlsHandle(TlsHandle handle) {
+  return pthread_key_delete(static_cast<pthread_key_t>(handle)) == 0;
+}
+
+uintptr_t GetTlsValue(TlsHandle handle) {
+  return reinterpret_cast<uintptr_t>(
+      pthread_getspecific(static_cast<pthread_key_t>(handle)));
+}
+
+bool SetTlsValue(TlsHandle handle, uintptr_t value) {
+  return pthread_setspecific(static_cast<pthread_key_t>(handle),
+                             reinterpret_cast<void*>(value)) == 0;
+}
+
+class PosixHighResolutionTimer : public HighResolutionTimer {
+ public:
+  PosixHighResolutionTimer() : timer_(std::make_shared<TimerObject>(true)) {}
+  ~PosixHighResolutionTimer() override { timer_->Cancel(); }
+
+  bool Initialize(std::chrono::milliseconds period,
+                  std::function<void()> callback) {
+    return timer_->Set(std::chrono::nanoseconds(0), period,
+                       std::move(callback));
+  }
+
+ private:
+  std::shared_ptr<TimerObject> timer_;
+};
+
+std::unique_ptr<HighResolutionTimer> HighResolutionTimer::CreateRepeating(
+    std::chrono::milliseconds period, std::function<void()> callback) {
+  auto timer = std::make_unique<PosixHighResolutionTimer>();
+  if (!timer->Initialize(period, std::move(callback))) {
+    return nullptr;
+  }
+  return std::unique_ptr<HighResolutionTimer>(timer.release());
+}
+
+template <typename T, typename O>
+class PosixHandle : public T {
+ public:
+  explicit PosixHandle(std::shared_ptr<O> object)
+      : object_(std::move(object)) {}
+  ~PosixHandle() override = default;
+
+ protected:
+  void* native_handle() const override { return object_.get(); }
+
+  std::shared_ptr<O> object_;
+};
+
+WaitObject* GetWaitObject(WaitHandle* wait_handle) {
+  return reinterpret_cast<WaitObject*>(wait_handle->native_handle());
+}
+
+WaitResult Wait(WaitHandle* wait_handle, bool is_alertable,
+                std::chrono::milliseconds timeout) {
+  auto object = GetWaitObject(wait_handle);
+  return WaitObjects(&object, 1, false, is_alertable, timeout).first;
+}
+
+WaitResult SignalAndWait(WaitHandle* wait_handle_to_signal,
+                         WaitHandle* wait_handle_to_wait_on, bool is_alertable,
+                         std::chrono::milliseconds timeout) {
+  if (!GetWaitObject(wait_handle_to_signal)->Signal()) {
+    return WaitResult::kFailed;
+  }
+  return Wait(wait_handle_to_wait_on, is_alertable, timeout);
+}
+
+std::pair<WaitResult, size_t> WaitMultiple(WaitHandle* wait_handles[],
+                                           size_t wait_handle_count,
+                                           bool wait_all, bool is_alertable,
+                                           std::chrono::milliseconds timeout) {
+  std::vector<WaitObject*> objects(wait_handle_count);
+  for (size_t i = 0; i < wait_handle_count; ++i) {
+    objects[i] = GetWaitObject(wait_handles[i]);
+  }
+  return WaitObjects(objects.data(), objects.size(), wait_all, is_alertable,
+                     timeout);
+}
+
+class PosixEvent : public PosixHandle<Event, EventObject> {
+ public:
+  explicit PosixEvent(std::shared_ptr<EventObject> object)
+      : PosixHandle(std::move(object)) {}
+  ~PosixEvent() override = default;
+  void Set() override { object_->Set(); }
+  void Reset() override { object_->Reset(); }
+  void Pulse() override { object_->Pulse(); }
+};
+
+std::unique_ptr<Event> Event::CreateManualResetEvent(bool initial_state) {
+  return std::make_unique<PosixEvent>(
+      std::make_shared<EventObject>(true, initial_state));
+}
+
+std::unique_ptr<Event> Event::CreateAutoResetEvent(bool initial_state) {
+  return std::make_unique<PosixEvent>(
+      std::make_shared<EventObject>(false, initial_state));
 }
 
+class PosixSemaphore : public PosixHandle<Semaphore, SemaphoreObject> {
+ public:
+  explicit PosixSemaphore(std::shared_ptr<SemaphoreObject> object)
+      : PosixHandle(std::move(object)) {}
+  ~PosixSemaphore() override = default;
+  bool Release(int release_count, int* out_previous_count) override {
+    return object_->Release(release_count, out_previous_count);
+  }
+};
+
+std::unique_ptr<Semaphore> Semaphore::Create(int initial_count,
+                                             int maximum_count) {
+  return std::make_unique<PosixSemaphore>(
+      std::make_shared<SemaphoreObject>(initial_count, maximum_count));
+}
+
+class PosixMutant : public PosixHandle<Mutant, MutantObject> {
+ public:
+  explicit PosixMutant(std::shared_ptr<MutantObject> object)
+      : PosixHandle(std::move(object)) {}
+  ~PosixMutant() override = default;
+  bool Release() override { return object_->Release(); }
+};
+
+std::unique_ptr<Mutant> Mutant::Create(bool initial_owner) {
+  return std::make_unique<PosixMutant>(
+      std::make_shared<MutantObject>(initial_owner));
+}
+
+class PosixTimer : public PosixHandle<Timer, TimerObject> {
+ public:
+  explicit PosixTimer(std::shared_ptr<TimerObject> object)
+      : PosixHandle(std::move(object)) {}
+  ~PosixTimer() override { object_->Cancel(); }
+  // Callbacks are called on the timer thread rather than queued to the
+  // thread that set the timer.
+  bool SetOnce(std::chrono::nanoseconds due_time,
+               std::function<void()> opt_callback) override {
+    return object_->Set(due_time, std::chrono::milliseconds(0),
+                        std::move(opt_callback));
+  }
+  bool SetRepeating(std::chrono::nanoseconds due_time,
+                    std::chrono::milliseconds period,
+                    std::function<void()> opt_callback) override {
+    return object_->Set(due_time, period, std::move(opt_callback));
+  }
+  bool Cancel() override { return object_->Cancel(); }
+};
+
+std::unique_ptr<Timer> Timer::CreateManualResetTimer() {
+  return std::make_unique<PosixTimer>(std::make_shared<TimerObject>(true));
+}
+
+std::unique_ptr<Timer> Timer::CreateSynchronizationTimer() {
+  return std::make_unique<PosixTimer>(std::make_shared<TimerObject>(false));
+}
+
+class PosixThread : public PosixHandle<Thread, ThreadControl> {
+ public:
+  explicit PosixThread(std::shared_ptr<ThreadControl> object)
+      : PosixHandle(std::move(object)) {}
+  ~PosixThread() override = default;
+
+  void set_name(std::string name) override {
+    xe::threading::set_name(object_->pthread(), name);
+    Thread::set_name(name);
+  }
+
+  uint32_t system_id() const override { return object_->tid(); }
+
+  int32_t priority() override { return object_->priority(); }
+
+  void set_priority(int32_t new_priority) override {
+    object_->set_priority(new_priority);
+    // Regular threads only have a nice value, and raising it above normal
+    // needs privileges we usually don't have. Best effort.
+    setpriority(PRIO_PROCESS, object_->tid(), -new_priority * 5);
+  }
+
+  uint64_t affinity_mask() override {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    pthread_getaffinity_np(object_->pthread(), sizeof(cpu_set), &cpu_set);
+    uint64_t value = 0;
+    for (int i = 0; i < 64; ++i) {
+      if (CPU_ISSET(i, &cpu_set)) {
+        value |= 1ull << i;
+      }
+    }
+    return value;
+  }
+
+  void set_affinity_mask(uint64_t new_affinity_mask) override {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (int i = 0; i < 64; ++i) {
+      if (new_affinity_mask & (1ull << i)) {
+        CPU_SET(i, &cpu_set);
+      }
+    }
+    pthread_setaffinity_np(object_->pthread(), sizeof(cpu_set), &cpu_set);
+  }
+
+  void QueueUserCallback(std::function<void()> callback) override {
+    object_->QueueCallback(std::move(callback));
+  }
+
+  bool Resume(uint32_t* out_new_suspend_count = nullptr) override {
+    // Like ResumeThread, reports the count from before the call.
+    auto& suspend_count = object_->suspend_count();
+    uint32_t count = suspend_count.load(std::memory_order_acquire);
+    while (count &&
+           !suspend_count.compare_exchange_weak(count, count - 1,
+                                                std::memory_order_acq_rel)) {
+    }
+    if (count == 1) {
+      FutexWake(&suspend_count, INT_MAX);
+    }
+    if (out_new_suspend_count) {
+      *out_new_suspend_count = count;
+    }
+    return true;
+  }
+
+  bool Suspend(uint32_t* out_previous_suspend_count = nullptr) override {
+    // There is no way to stop another thread from the outside, so it is sent
+    // a signal and parks itself in the handler until resumed.
+    uint32_t previous_count =
+        object_->suspend_count().fetch_add(1, std::memory_order_acq_rel);
+    if (out_previous_suspend_count) {
+      *out_previous_suspend_count = previous_count;
+    }
+    if (!previous_count) {
+      if (object_.get() == current_thread_control_ptr_) {
+        object_->WaitWhileSuspended();
+      } else {
+        InstallSuspendSignalHandler();
+        if (pthread_kill(object_->pthread(), SuspendSignal())) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  void Terminate(int exit_code) override {
+    if (object_.get() == current_thread_control_ptr_) {
+      Thread::Exit(exit_code);
+    } else {
+      pthread_cancel(object_->pthread());
+    }
+  }
+};
+
+thread_local std::unique_ptr<PosixThread> current_thread_ = nullptr;
+
+// An alternate stack for signal handlers (ExceptionHandler), so that faults
+// can still be handled once the thread has run out of its own stack.
+class SignalStack {
+ public:
+  SignalStack() {
+    void* stack = mmap(nullptr, kSize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (stack == MAP_FAILED) {
+      return;
+    }
+    stack_t signal_stack = {0};
+    signal_stack.ss_sp = stack;
+    signal_stack.ss_size = kSize;
+    if (sigaltstack(&signal_stack, nullptr)) {
+      munmap(stack, kSize);
+      return;
+    }
+    stack_ = stack;
+  }
+  ~SignalStack() {
+    if (stack_) {
+      stack_t signal_stack = {0};
+      signal_stack.ss_flags = SS_DISABLE;
+      sigaltstack(&signal_stack, nullptr);
+      munmap(stack_, kSize);
+    }
+  }
+
+ private:
+  static const size_t kSize = 64 * 1024;
+  void* stack_ = nullptr;
+};
+
+struct ThreadStartData {
+  std::shared_ptr<ThreadControl> thread_control;
+  std::function<void()> start_routine;
+};
+void* ThreadStartRoutine(void* parameter) {
+  auto start_data = reinterpret_cast<ThreadStartData*>(parameter);
+  auto thread_control = std::move(start_data->thread_control);
+  auto start_routine = std::move(start_data->start_routine);
+  delete start_data;
+
+  SignalStack signal_stack;
+  current_thread_control_ = thread_control;
+  current_thread_control_ptr_ = thread_control.get();
+  current_thread_ = std::make_unique<PosixThread>(thread_control);
+  thread_control->set_started(pthread_self(), GetCurrentThreadTid());
+
+  // Signal exit however the thread ends (return, Exit, Terminate).
+  struct ExitGuard {
+    ThreadControl* thread_control;
+    ~ExitGuard() { thread_control->MarkExited(); }
+  } exit_guard = {thread_control.get()};
+
+  thread_control->WaitWhileSuspended();
+  start_routine();
+  return nullptr;
+}
+
+std::unique_ptr<Thread> Thread::Create(CreationParameters params,
+                                       std::function<void()> start_routine) {
+  auto thread_control = std::make_shared<ThreadControl>();
+  thread_control->set_priority(params.initial_priority);
+  if (params.create_suspended) {
+    thread_control->suspend_count() = 1;
+  }
+  auto start_data =
+      new ThreadStartData({thread_control, std::move(start_routine)});
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, params.stack_size);
+  pthread_t pthread;
+  int result = pthread_create(&pthread, &attr, ThreadStartRoutine, start_data);
+  pthread_attr_destroy(&attr);
+  if (result) {
+    XELOGE("Unable to pthread_create: %d", result);
+    delete start_data;
+    return nullptr;
+  }
+  pthread_detach(pthread);
+
+  return std::make_unique<PosixThread>(thread_control);
+}
+
+Thread* Thread::GetCurrentThread() {
+  if (current_thread_) {
+    return current_thread_.get();
+  }
+
+  GetCurrentThreadControl();
+  current_thread_ = std::make_unique<PosixThread>(current_thread_control_);
+  return current_thread_.get();
+}
+
+void Thread::Exit(int exit_code) { pthread_exit(nullptr); }
+
 }  // namespace threading
 }  // namespace xe
@@ -0,0 +1,276 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/threading.h"
+
+#include "third_party/catch/include/catch.hpp"
+
+using namespace xe::threading;
+using std::chrono::milliseconds;
+
+namespace {
+
+// The obvious mutex + condition_variable event, for comparison.
+class NaiveEvent {
+ public:
+  void Set() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    signaled_ = true;
+    cond_.notify_all();
+  }
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this]() { return signaled_; });
+    signaled_ = false;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool signaled_ = false;
+};
+
+// Bounces between two auto-reset events and returns the average round trip
+// in nanoseconds.
+template <typename SetFn, typename WaitFn>
+int64_t MeasurePingPong(int round_trips, SetFn set, WaitFn wait) {
+  std::thread other([&]() {
+    for (int i = 0; i < round_trips; ++i) {
+      wait(0);
+      set(1);
+    }
+  });
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < round_trips; ++i) {
+    set(0);
+    wait(1);
+  }
+  auto duration = std::chrono::high_resolution_clock::now() - start;
+  other.join();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+             .count() /
+         round_trips;
+}
+
+}  // namespace
+
+TEST_CASE("Event", "[threading]") {
+  auto manual = Event::CreateManualResetEvent(false);
+  REQUIRE(Wait(manual.get(), false, milliseconds(0)) == WaitResult::kTimeout);
+  manual->Set();
+  REQUIRE(Wait(manual.get(), false, milliseconds(0)) == WaitResult::kSuccess);
+  REQUIRE(Wait(manual.get(), false, milliseconds(0)) == WaitResult::kSuccess);
+  manual->Reset();
+  REQUIRE(Wait(manual.get(), false, milliseconds(1)) == WaitResult::kTimeout);
+
+  auto automatic = Event::CreateAutoResetEvent(true);
+  REQUIRE(Wait(automatic.get(), false, milliseconds(0)) ==
+          WaitResult::kSuccess);
+  REQUIRE(Wait(automatic.get(), false, milliseconds(0)) ==
+          WaitResult::kTimeout);
+
+  // Set from another thread while blocked.
+  std::thread setter([&]() {
+    Sleep(milliseconds(10));
+    automatic->Set();
+  });
+  REQUIRE(Wait(automatic.get(), false) == WaitResult::kSuccess);
+  setter.join();
+}
+
+TEST_CASE("Event_Pulse", "[threading]") {
+  auto event = Event::CreateManualResetEvent(false);
+  // Nobody waiting, so nothing happens.
+  event->Pulse();
+  REQUIRE(Wait(event.get(), false, milliseconds(0)) == WaitResult::kTimeout);
+
+  // A pulse only releases the threads already blocked on the event, and there
+  // is no telling when a thread that is about to wait actually blocks, so
+  // keep pulsing until every waiter is out.
+  std::atomic<int> started(0);
+  std::atomic<int> released(0);
+  std::atomic<int> finished(0);
+  std::vector<std::thread> waiters;
+  for (int i = 0; i < 3; ++i) {
+    waiters.emplace_back([&]() {
+      ++started;
+      if (Wait(event.get(), false, milliseconds(5000)) ==
+          WaitResult::kSuccess) {
+        ++released;
+      }
+      ++finished;
+    });
+  }
+  while (started != 3) {
+    MaybeYield();
+  }
+  while (finished != 3) {
+    event->Pulse();
+    // Never left signaled, even with waiters released.
+    REQUIRE(Wait(event.get(), false, milliseconds(0)) ==
+            WaitResult::kTimeout);
+    MaybeYield();
+  }
+  for (auto& waiter : waiters) {
+    waiter.join();
+  }
+  REQUIRE(released == 3);
+}
+
+TEST_CASE("Semaphore", "[threading]") {
+  auto semaphore = Semaphore::Create(1, 2);
+  REQUIRE(Wait(semaphore.get(), false, milliseconds(0)) ==
+          WaitResult::kSuccess);
+  REQUIRE(Wait(semaphore.get(), false, milliseconds(0)) ==
+          WaitResult::kTimeout);
+  int previous_count = -1;
+  REQUIRE(semaphore->Release(2, &previous_count));
+  REQUIRE(previous_count == 0);
+  REQUIRE(!semaphore->Release(1, &previous_count));
+  REQUIRE(Wait(semaphore.get(), false, milliseconds(0)) ==
+          WaitResult::kSuccess);
+  REQUIRE(Wait(semaphore.get(), false, milliseconds(0)) ==
+          WaitResult::kSuccess);
+  REQUIRE(Wait(semaphore.get(), false, milliseconds(0)) ==
+          WaitResult::kTimeout);
+}
+
+TEST_CASE("Mutant", "[threading]") {
+  auto mutant = Mutant::Create(true);
+  // Recursive for the owner.
+  REQUIRE(Wait(mutant.get(), false, milliseconds(0)) == WaitResult::kSuccess);
+  std::thread other([&]() {
+    REQUIRE(Wait(mutant.get(), false, milliseconds(0)) ==
+            WaitResult::kTimeout);
+    REQUIRE(!mutant->Release());
+  });
+  other.join();
+  REQUIRE(mutant->Release());
+  REQUIRE(mutant->Release());
+  REQUIRE(!mutant->Release());
+}
+
+TEST_CASE("WaitMultiple", "[threading]") {
+  auto event_a = Event::CreateManualResetEvent(false);
+  auto event_b = Event::CreateAutoResetEvent(false);
+  auto semaphore = Semaphore::Create(0, 1);
+  WaitHandle* handles[] = {event_a.get(), event_b.get(), semaphore.get()};
+
+  auto result = WaitAny(handles, 3, false, milliseconds(0));
+  REQUIRE(result.first == WaitResult::kTimeout);
+
+  std::thread setter([&]() {
+    Sleep(milliseconds(10));
+    event_b->Set();
+  });
+  result = WaitAny(handles, 3, false);
+  REQUIRE(result.first == WaitResult::kSuccess);
+  REQUIRE(result.second == 1);
+  setter.join();
+
+  // Nothing is consumed until everything is signaled.
+  event_a->Set();
+  semaphore->Release(1, nullptr);
+  REQUIRE(WaitAll(handles, 3, false, milliseconds(0)) == WaitResult::kTimeout);
+  REQUIRE(Wait(semaphore.get(), false, milliseconds(0)) ==
+          WaitResult::kSuccess);
+  semaphore->Release(1, nullptr);
+  event_b->Set();
+  REQUIRE(WaitAll(handles, 3, false, milliseconds(0)) == WaitResult::kSuccess);
+  REQUIRE(Wait(event_b.get(), false, milliseconds(0)) == WaitResult::kTimeout);
+  REQUIRE(Wait(semaphore.get(), false, milliseconds(0)) ==
+          WaitResult::kTimeout);
+  REQUIRE(Wait(event_a.get(), false, milliseconds(0)) == WaitResult::kSuccess);
+}
+
+TEST_CASE("Thread", "[threading]") {
+  auto event = Event::CreateManualResetEvent(false);
+  std::atomic<int> callbacks(0);
+  std::atomic<bool> alerted(false);
+  Thread::CreationParameters params;
+  params.create_suspended = true;
+  auto thread = Thread::Create(params, [&]() {
+    event->Set();
+    alerted = AlertableSleep(milliseconds(5000)) == SleepResult::kAlerted;
+  });
+  REQUIRE(thread);
+  REQUIRE(thread->system_id() != current_thread_system_id());
+
+  REQUIRE(Wait(event.get(), false, milliseconds(50)) == WaitResult::kTimeout);
+  uint32_t suspend_count = 0;
+  REQUIRE(thread->Resume(&suspend_count));
+  REQUIRE(suspend_count == 1);
+  REQUIRE(Wait(event.get(), false, milliseconds(5000)) ==
+          WaitResult::kSuccess);
+
+  thread->QueueUserCallback([&]() { ++callbacks; });
+  REQUIRE(Wait(thread.get(), false, milliseconds(5000)) ==
+          WaitResult::kSuccess);
+  REQUIRE(callbacks == 1);
+  REQUIRE(alerted);
+}
+
+TEST_CASE("Timer", "[threading]") {
+  auto timer = Timer::CreateSynchronizationTimer();
+  std::atomic<int> fired(0);
+  REQUIRE(timer->SetOnce(std::chrono::milliseconds(-10), [&]() { ++fired; }));
+  REQUIRE(Wait(timer.get(), false, milliseconds(5000)) == WaitResult::kSuccess);
+  REQUIRE(Wait(timer.get(), false, milliseconds(0)) == WaitResult::kTimeout);
+  Sleep(milliseconds(10));
+  REQUIRE(fired == 1);
+
+  REQUIRE(timer->SetOnce(std::chrono::milliseconds(-10)));
+  REQUIRE(timer->Cancel());
+  REQUIRE(Wait(timer.get(), false, milliseconds(50)) == WaitResult::kTimeout);
+}
+
+// Signal-to-wakeup latency against a mutex + condition_variable event. Run
+// explicitly with the [benchmark] tag.
+TEST_CASE("Event_Latency", "[.][benchmark][threading]") {
+  const int kRoundTrips = 100000;
+
+  std::unique_ptr<Event> events[] = {Event::CreateAutoResetEvent(false),
+                                     Event::CreateAutoResetEvent(false)};
+  auto event_ns = MeasurePingPong(
+      kRoundTrips, [&](int i) { events[i]->Set(); },
+      [&](int i) { Wait(events[i].get(), false); });
+
+  NaiveEvent naive_events[2];
+  auto naive_ns = MeasurePingPong(
+      kRoundTrips, [&](int i) { naive_events[i].Set(); },
+      [&](int i) { naive_events[i].Wait(); });
+
+  // Wait-any on four events with the signaled one rotating.
+  std::unique_ptr<Event> many[] = {
+      Event::CreateAutoResetEvent(false), Event::CreateAutoResetEvent(false),
+      Event::CreateAutoResetEvent(false), Event::CreateAutoResetEvent(false)};
+  WaitHandle* handles[] = {many[0].get(), many[1].get(), many[2].get(),
+                           many[3].get()};
+  int round = 0;
+  auto wait_any_ns = MeasurePingPong(
+      kRoundTrips,
+      [&](int i) {
+        if (i) {
+          events[1]->Set();
+        } else {
+          many[round++ % 4]->Set();
+        }
+      },
+      [&](int i) {
+        if (i) {
+          Wait(events[1].get(), false);
+        } else {
+          WaitAny(handles, 4, false);
+        }
+      });
+
+  WARN("Round trip: Event " << event_ns << "ns, condition_variable "
+                            << naive_ns << "ns, WaitAny(4) " << wait_any_ns
+                            << "ns");
+}
@@ -41,6 +41,11 @@ class Assembler {
                         uint32_t debug_info_flags,
                         std::unique_ptr<FunctionDebugInfo> debug_info) = 0;
 
+  // Attempts to setup the function from code generated on a previous run.
+  // The function must have been scanned so that its extents are known.
+  // Returns false if no valid code was found and it must be translated.
+  virtual bool AssembleCached(GuestFunction* function) { return false; }
+
  protected:
   Backend* backend_;
 };
@@ -9,10 +9,13 @@
 
 #include "xenia/cpu/backend/x64/x64_assembler.h"
 
+#include <cinttypes>
 #include <climits>
 
 #include "third_party/capstone/include/capstone.h"
 #include "third_party/capstone/include/x86.h"
+#include "third_party/xxhash/xxhash.h"
+#include "xenia/base/logging.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/reset_scope.h"
 #include "xenia/cpu/backend/x64/x64_backend.h"
@@ -22,6 +25,7 @@
 #include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/hir/hir_builder.h"
 #include "xenia/cpu/hir/label.h"
+#include "xenia/cpu/module.h"
 #include "xenia/cpu/processor.h"
 
 namespace xe {
@@ -78,32 +82,95 @@ bool X64Assembler::Assemble(GuestFunction* function, HIRBuilder* builder,
   void* machine_code = nullptr;
   size_t code_size = 0;
   if (!emitter_->Emit(function, builder, debug_info_flags, debug_info.get(),
-                      &machine_code, &code_size, &function->source_map())) {
+                      &machine_code, &code_size,
+                      &function->pending_source_map())) {
     return false;
   }
 
   // Stash generated machine code.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmMachineCode) {
-    DumpMachineCode(machine_code, code_size, function->source_map(),
+    DumpMachineCode(machine_code, code_size, function->pending_source_map(),
                     &string_buffer_);
     debug_info->set_machine_code_disasm(string_buffer_.ToString());
     string_buffer_.Reset();
   }
 
+  // Direct calls must be linked before anything can reach the code.
+  x64_backend_->code_cache()->LinkCallSites(
+      reinterpret_cast<uint8_t*>(machine_code), emitter_->call_sites());
+
   function->set_debug_info(std::move(debug_info));
   static_cast<X64Function*>(function)->Setup(
       reinterpret_cast<uint8_t*>(machine_code), code_size);
 
-  // Install into indirection table.
+  // Install into indirection table. This also repoints direct calls to any
+  // previous code for the function.
   uint64_t host_address = reinterpret_cast<uint64_t>(machine_code);
   assert_true((host_address >> 32) == 0);
   reinterpret_cast<X64CodeCache*>(backend_->code_cache())
       ->AddIndirection(function->address(),
                        static_cast<uint32_t>(host_address));
 
+  // Persist for future runs, so long as the code doesn't reference any host
+  // state we can't relocate.
+  if (!debug_info_flags && emitter_->is_cacheable()) {
+    auto cache_path = GetCachePath(function);
+    if (!cache_path.empty()) {
+      x64_backend_->code_cache()->SaveGuestCode(
+          cache_path, x64_backend_->code_fingerprint(), HashGuestCode(function),
+          function, machine_code, code_size, emitter_->stack_size(),
+          emitter_->relocations(), emitter_->call_sites());
+    }
+  }
+
+  return true;
+}
+
+bool X64Assembler::AssembleCached(GuestFunction* function) {
+  SCOPE_profile_cpu_f("cpu");
+
+  auto cache_path = GetCachePath(function);
+  if (cache_path.empty()) {
+    return false;
+  }
+
+  size_t code_size = 0;
+  void* machine_code = x64_backend_->code_cache()->LoadGuestCode(
+      cache_path, x64_backend_->code_fingerprint(), HashGuestCode(function),
+      function, &code_size);
+  if (!machine_code) {
+    return false;
+  }
+
+  // LoadGuestCode has already linked the code and installed the indirection.
+  static_cast<X64Function*>(function)->Setup(
+      reinterpret_cast<uint8_t*>(machine_code), code_size);
   return true;
 }
 
+std::wstring X64Assembler::GetCachePath(GuestFunction* function) {
+  if (FLAGS_code_cache_dir.empty()) {
+    // Cache disabled.
+    return std::wstring();
+  }
+  uint64_t module_hash = function->module()->hash();
+  if (!module_hash) {
+    return std::wstring();
+  }
+  auto cache_dir = xe::to_absolute_path(xe::to_wstring(FLAGS_code_cache_dir));
+  auto module_dir = xe::join_paths(
+      cache_dir, xe::format_string(L"%.16" PRIX64, module_hash));
+  return xe::join_paths(module_dir,
+                        xe::format_string(L"%.8X.bin", function->address()));
+}
+
+uint64_t X64Assembler::HashGuestCode(GuestFunction* function) {
+  // end_address is the address of the last instruction.
+  auto memory = function->module()->memory();
+  return XXH64(memory->TranslateVirtual(function->address()),
+               function->end_address() - function->address() + 4, 0);
+}
+
 void X64Assembler::DumpMachineCode(
     void* machine_code, size_t code_size,
     const std::vector<SourceMapEntry>& source_map, StringBuffer* str) {
@@ -39,7 +39,14 @@ class X64Assembler : public Assembler {
                 uint32_t debug_info_flags,
                 std::unique_ptr<FunctionDebugInfo> debug_info) override;
 
+  bool AssembleCached(GuestFunction* function) override;
+
  private:
+  // Returns the persistent cache file path for the given function, or an
+  // empty string if it cannot be persisted.
+  std::wstring GetCachePath(GuestFunction* function);
+  uint64_t HashGuestCode(GuestFunction* function);
+
   void DumpMachineCode(void* machine_code, size_t code_size,
                        const std::vector<SourceMapEntry>& source_map,
                        StringBuffer* str);
@@ -11,6 +11,8 @@
 
 #include "third_party/capstone/include/capstone.h"
 #include "third_party/capstone/include/x86.h"
+#include "third_party/xxhash/xxhash.h"
+#include "build/version.h"
 #include "xenia/base/exception_handler.h"
 #include "xenia/cpu/backend/x64/x64_assembler.h"
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
@@ -18,13 +20,28 @@
 #include "xenia/cpu/backend/x64/x64_function.h"
 #include "xenia/cpu/backend/x64/x64_sequences.h"
 #include "xenia/cpu/backend/x64/x64_stack_layout.h"
+#include "xenia/cpu/backend/x64/x64_tracers.h"
 #include "xenia/cpu/breakpoint.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/cpu/stack_walker.h"
 
+DECLARE_bool(promote_context_across_blocks);
+
 DEFINE_bool(
     enable_haswell_instructions, true,
     "Uses the AVX2/FMA/etc instructions on Haswell processors, if available.");
+DEFINE_string(code_cache_dir, "",
+              "Directory to persist generated x64 code to between runs. "
+              "Disabled if empty.");
+DEFINE_bool(link_guest_calls, true,
+            "Patch direct guest calls to jump straight to the callee's code "
+            "once it has been translated, instead of going through the "
+            "indirection table.");
+DEFINE_bool(inline_mmio_checks, true,
+            "Check 32-bit loads and stores for MMIO addresses in generated "
+            "code and call the range directly, instead of trapping the "
+            "access violation.");
 
 namespace xe {
 namespace cpu {
@@ -113,12 +130,63 @@ bool X64Backend::Initialize() {
   // Allocate emitter constant data.
   emitter_data_ = X64Emitter::PlaceConstData();
 
+  code_fingerprint_ = CalculateCodeFingerprint(thunk_emitter.feature_flags());
+
   // Setup exception callback
   ExceptionHandler::Install(&ExceptionCallbackThunk, this);
 
   return true;
 }
 
+uint64_t X64Backend::CalculateCodeFingerprint(uint32_t emitter_feature_flags) {
+  // Bump this whenever the persisted code format or emitter output changes in
+  // a way not covered by the build commit.
+  static const uint32_t kCodeFingerprintVersion = 1;
+
+  // Generated code embeds the thunk and constant data addresses directly, so
+  // they must land at the same place for cached code to be valid.
+  struct {
+    uint32_t version;
+    uint32_t emitter_feature_flags;
+    uint32_t tracing_mode;
+    uint32_t codegen_flags;
+    uint64_t host_to_guest_thunk;
+    uint64_t guest_to_host_thunk;
+    uint64_t resolve_function_thunk;
+    uint64_t emitter_data;
+    uint64_t break_on_instruction;
+    uint64_t break_condition_value;
+    int32_t break_condition_gpr;
+    uint32_t reserved;
+  } key;
+  std::memset(&key, 0, sizeof(key));
+  key.version = kCodeFingerprintVersion;
+  key.emitter_feature_flags = emitter_feature_flags;
+  key.tracing_mode = GetTracingMode();
+  key.codegen_flags =
+      (machine_info_.supports_extended_load_store ? 1 << 0 : 0) |
+      (FLAGS_disable_global_lock ? 1 << 1 : 0) |
+      (FLAGS_break_condition_truncate ? 1 << 2 : 0) |
+      (FLAGS_link_guest_calls ? 1 << 3 : 0) |
+      (FLAGS_promote_context_across_blocks ? 1 << 4 : 0) |
+      (FLAGS_optimize_loops ? 1 << 5 : 0) |
+      (FLAGS_eliminate_memory_accesses ? 1 << 6 : 0) |
+      (FLAGS_inline_mmio_checks ? 1 << 7 : 0);
+  key.host_to_guest_thunk = uint64_t(host_to_guest_thunk_);
+  key.guest_to_host_thunk = uint64_t(guest_to_host_thunk_);
+  key.resolve_function_thunk = uint64_t(resolve_function_thunk_);
+  key.emitter_data = uint64_t(emitter_data_);
+  key.break_on_instruction = FLAGS_break_on_instruction;
+  key.break_condition_value = FLAGS_break_condition_value;
+  key.break_condition_gpr = FLAGS_break_condition_gpr;
+
+  uint64_t hash = XXH64(&key, sizeof(key), 0);
+  hash = XXH64(XE_BUILD_COMMIT, std::strlen(XE_BUILD_COMMIT), hash);
+  hash = XXH64(FLAGS_break_condition_op.c_str(),
+               FLAGS_break_condition_op.size(), hash);
+  return hash;
+}
+
 void X64Backend::CommitExecutableRange(uint32_t guest_low,
                                        uint32_t guest_high) {
   code_cache_->CommitExecutableRange(guest_low, guest_high);
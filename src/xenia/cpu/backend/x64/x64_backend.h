@@ -17,6 +17,9 @@
 #include "xenia/cpu/backend/backend.h"
 
 DECLARE_bool(enable_haswell_instructions);
+DECLARE_string(code_cache_dir);
+DECLARE_bool(link_guest_calls);
+DECLARE_bool(inline_mmio_checks);
 
 namespace xe {
 class Exception;
@@ -43,6 +46,10 @@ class X64Backend : public Backend {
 
   X64CodeCache* code_cache() const { return code_cache_.get(); }
   uintptr_t emitter_data() const { return emitter_data_; }
+  // Hash of everything that affects generated code across runs (feature
+  // flags, thunk locations, codegen flags/etc). Persisted code with a
+  // mismatching fingerprint is discarded.
+  uint64_t code_fingerprint() const { return code_fingerprint_; }
 
   // Call a generated function, saving all stack parameters.
   HostToGuestThunk host_to_guest_thunk() const { return host_to_guest_thunk_; }
@@ -72,11 +79,13 @@ class X64Backend : public Backend {
  private:
   static bool ExceptionCallbackThunk(Exception* ex, void* data);
   bool ExceptionCallback(Exception* ex);
+  uint64_t CalculateCodeFingerprint(uint32_t emitter_feature_flags);
 
   uintptr_t capstone_handle_ = 0;
 
   std::unique_ptr<X64CodeCache> code_cache_;
   uintptr_t emitter_data_ = 0;
+  uint64_t code_fingerprint_ = 0;
 
   HostToGuestThunk host_to_guest_thunk_;
   GuestToHostThunk guest_to_host_thunk_;
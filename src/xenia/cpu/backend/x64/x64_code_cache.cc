@@ -14,7 +14,9 @@
 
 #include "xenia/base/assert.h"
 #include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/mapped_memory.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
 #include "xenia/cpu/function.h"
@@ -97,6 +99,45 @@ void X64CodeCache::AddIndirection(uint32_t guest_address,
   uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
       indirection_table_base_ + (guest_address - kIndirectionTableBase));
   *indirection_slot = host_address;
+
+  std::lock_guard<std::mutex> lock(call_site_mutex_);
+  auto range = call_sites_.equal_range(guest_address);
+  for (auto it = range.first; it != range.second; ++it) {
+    PatchCallSite(it->second, host_address);
+  }
+}
+
+void X64CodeCache::RemoveIndirection(uint32_t guest_address) {
+  AddIndirection(guest_address, indirection_default_value_);
+}
+
+void X64CodeCache::LinkCallSites(uint8_t* code_address,
+                                 const std::vector<CallSite>& call_sites) {
+  if (!indirection_table_base_ || call_sites.empty()) {
+    return;
+  }
+
+  // Reading the slot under the lock ensures we either see the current code or
+  // a later AddIndirection patches us.
+  std::lock_guard<std::mutex> lock(call_site_mutex_);
+  for (auto& call_site : call_sites) {
+    uint8_t* rel32_address = code_address + call_site.code_offset;
+    uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
+        indirection_table_base_ +
+        (call_site.guest_address - kIndirectionTableBase));
+    PatchCallSite(rel32_address, *indirection_slot);
+    call_sites_.emplace(call_site.guest_address, rel32_address);
+  }
+}
+
+void X64CodeCache::PatchCallSite(uint8_t* rel32_address,
+                                 uint32_t host_address) {
+  assert_zero(reinterpret_cast<uintptr_t>(rel32_address) & 0x3);
+  int32_t rel32 = static_cast<int32_t>(
+      int64_t(host_address) -
+      int64_t(reinterpret_cast<uintptr_t>(rel32_address) + 4));
+  reinterpret_cast<std::atomic<int32_t>*>(rel32_address)
+      ->store(rel32, std::memory_order_release);
 }
 
 void X64CodeCache::CommitExecutableRange(uint32_t guest_low,
@@ -116,6 +157,14 @@ void X64CodeCache::CommitExecutableRange(uint32_t guest_low,
   for (uint32_t address = guest_low; address < guest_high; ++address) {
     p[(address - kIndirectionTableBase) / 4] = indirection_default_value_;
   }
+
+  // Anything linked into the range is now stale.
+  std::lock_guard<std::mutex> lock(call_site_mutex_);
+  for (auto& it : call_sites_) {
+    if (it.first >= guest_low && it.first < guest_high) {
+      PatchCallSite(it.second, indirection_default_value_);
+    }
+  }
 }
 
 void* X64CodeCache::PlaceHostCode(uint32_t guest_address, void* machine_code,
@@ -190,14 +239,9 @@ void* X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
               unwind_reservation);
   }
 
-  // Now that everything is ready, fix up the indirection table.
-  // Note that we do support code that doesn't have an indirection fixup, so
-  // ignore those when we see them.
-  if (guest_address && indirection_table_base_) {
-    uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
-        indirection_table_base_ + (guest_address - kIndirectionTableBase));
-    *indirection_slot = uint32_t(reinterpret_cast<uint64_t>(code_address));
-  }
+  // NOTE: the indirection table is not fixed up here, as call sites within the
+  // code must be linked before it becomes reachable. Callers use
+  // LinkCallSites and then AddIndirection.
 
   return code_address;
 }
@@ -236,6 +280,142 @@ uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
   return uint32_t(uintptr_t(data_address));
 }
 
+// Any address within the host image. Relocations in persisted code are stored
+// relative to this so that they survive the image being rebased.
+static void HostImageAnchor() {}
+
+bool X64CodeCache::SaveGuestCode(const std::wstring& path, uint64_t fingerprint,
+                                 uint64_t guest_code_hash,
+                                 GuestFunction* function,
+                                 const void* code_address, size_t code_size,
+                                 size_t stack_size,
+                                 const std::vector<uint32_t>& relocations,
+                                 const std::vector<CallSite>& call_sites) {
+  CachedFunctionHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.magic = kCachedFunctionMagic;
+  header.version = kCachedFunctionVersion;
+  header.fingerprint = fingerprint;
+  header.guest_code_hash = guest_code_hash;
+  header.image_base = reinterpret_cast<uint64_t>(&HostImageAnchor);
+  header.guest_address = function->address();
+  header.guest_end_address = function->end_address();
+  header.code_size = uint32_t(code_size);
+  header.stack_size = uint32_t(stack_size);
+  header.relocation_count = uint32_t(relocations.size());
+  header.call_site_count = uint32_t(call_sites.size());
+  const auto& source_map = function->source_map();
+  header.source_map_entry_count = uint32_t(source_map.size());
+
+  xe::filesystem::CreateParentFolder(path);
+  auto file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    // Not fatal, we'll just regenerate it next time.
+    return false;
+  }
+  bool result = fwrite(&header, sizeof(header), 1, file) == 1;
+  if (result && !relocations.empty()) {
+    result = fwrite(relocations.data(), sizeof(uint32_t), relocations.size(),
+                    file) == relocations.size();
+  }
+  if (result && !call_sites.empty()) {
+    result = fwrite(call_sites.data(), sizeof(CallSite), call_sites.size(),
+                    file) == call_sites.size();
+  }
+  if (result && !source_map.empty()) {
+    result = fwrite(source_map.data(), sizeof(SourceMapEntry),
+                    source_map.size(), file) == source_map.size();
+  }
+  if (result) {
+    result = fwrite(code_address, 1, code_size, file) == code_size;
+  }
+  fclose(file);
+  if (!result) {
+    // Don't leave a truncated entry behind.
+    xe::filesystem::DeleteFile(path);
+  }
+  return result;
+}
+
+void* X64CodeCache::LoadGuestCode(const std::wstring& path,
+                                  uint64_t fingerprint,
+                                  uint64_t guest_code_hash,
+                                  GuestFunction* function,
+                                  size_t* out_code_size) {
+  if (!xe::filesystem::PathExists(path)) {
+    return nullptr;
+  }
+  auto map = xe::MappedMemory::Open(path, MappedMemory::Mode::kRead);
+  if (!map || map->size() < sizeof(CachedFunctionHeader)) {
+    return nullptr;
+  }
+
+  auto header = reinterpret_cast<const CachedFunctionHeader*>(map->data());
+  if (header->magic != kCachedFunctionMagic ||
+      header->version != kCachedFunctionVersion ||
+      header->fingerprint != fingerprint ||
+      header->guest_code_hash != guest_code_hash ||
+      header->guest_address != function->address() ||
+      header->guest_end_address != function->end_address()) {
+    // Stale; the caller will regenerate and overwrite it.
+    return nullptr;
+  }
+  size_t relocations_size = header->relocation_count * sizeof(uint32_t);
+  size_t call_sites_size = header->call_site_count * sizeof(CallSite);
+  size_t source_map_size =
+      header->source_map_entry_count * sizeof(SourceMapEntry);
+  if (map->size() < sizeof(CachedFunctionHeader) + relocations_size +
+                        call_sites_size + source_map_size +
+                        header->code_size) {
+    return nullptr;
+  }
+  auto relocations = reinterpret_cast<const uint32_t*>(
+      map->data() + sizeof(CachedFunctionHeader));
+  auto call_sites_data = reinterpret_cast<const CallSite*>(
+      map->data() + sizeof(CachedFunctionHeader) + relocations_size);
+  std::vector<CallSite> call_sites(
+      call_sites_data, call_sites_data + header->call_site_count);
+  auto source_map_data = reinterpret_cast<const SourceMapEntry*>(
+      map->data() + sizeof(CachedFunctionHeader) + relocations_size +
+      call_sites_size);
+  auto code = map->data() + sizeof(CachedFunctionHeader) + relocations_size +
+              call_sites_size + source_map_size;
+
+  // Rebase host addresses into a scratch copy before placing it.
+  std::vector<uint8_t> machine_code(code, code + header->code_size);
+  uint64_t image_delta =
+      reinterpret_cast<uint64_t>(&HostImageAnchor) - header->image_base;
+  for (uint32_t i = 0; i < header->relocation_count; ++i) {
+    if (relocations[i] + sizeof(uint64_t) > machine_code.size()) {
+      return nullptr;
+    }
+    uint64_t value;
+    std::memcpy(&value, machine_code.data() + relocations[i], sizeof(value));
+    value += image_delta;
+    std::memcpy(machine_code.data() + relocations[i], &value, sizeof(value));
+  }
+  for (auto& call_site : call_sites) {
+    if (call_site.code_offset + sizeof(uint32_t) > machine_code.size()) {
+      return nullptr;
+    }
+  }
+
+  // Stack walks and the debugger map host code back to guest addresses with
+  // this.
+  function->pending_source_map().assign(
+      source_map_data, source_map_data + header->source_map_entry_count);
+
+  auto code_address = reinterpret_cast<uint8_t*>(
+      PlaceGuestCode(function->address(), machine_code.data(),
+                     machine_code.size(), header->stack_size, function));
+  LinkCallSites(code_address, call_sites);
+  AddIndirection(function->address(),
+                 uint32_t(reinterpret_cast<uint64_t>(code_address)));
+
+  *out_code_size = header->code_size;
+  return code_address;
+}
+
 GuestFunction* X64CodeCache::LookupFunction(uint64_t host_pc) {
   uint32_t key = uint32_t(host_pc - kGeneratedCodeBase);
   void* fn_entry = std::bsearch(
@@ -12,7 +12,9 @@
 
 #include <atomic>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -27,6 +29,12 @@ namespace x64 {
 
 class X64CodeCache : public CodeCache {
  public:
+  // A direct call/jmp to a guest function within generated code.
+  struct CallSite {
+    uint32_t code_offset;    // Offset of the rel32 from the code start.
+    uint32_t guest_address;  // Target guest function.
+  };
+
   ~X64CodeCache() override;
 
   static std::unique_ptr<X64CodeCache> Create();
@@ -37,13 +45,22 @@ class X64CodeCache : public CodeCache {
   uint32_t base_address() const override { return kGeneratedCodeBase; }
   uint32_t total_size() const override { return kGeneratedCodeSize; }
 
-  // TODO(benvanik): ELF serialization/etc
   // TODO(benvanik): keep track of code blocks
   // TODO(benvanik): padding/guards/etc
 
   bool has_indirection_table() { return indirection_table_base_ != nullptr; }
   void set_indirection_default(uint32_t default_value);
+  // Sets the host code for the guest function and repoints all direct call
+  // sites linked to it.
   void AddIndirection(uint32_t guest_address, uint32_t host_address);
+  // Resets the guest function to the resolver and unlinks all direct call
+  // sites to it, such as when its code is invalidated.
+  void RemoveIndirection(uint32_t guest_address);
+  // Registers the call sites within placed code so they are kept pointing at
+  // the current code of their targets. Must be done before the code becomes
+  // reachable, as the sites are only valid once linked.
+  void LinkCallSites(uint8_t* code_address,
+                     const std::vector<CallSite>& call_sites);
 
   void CommitExecutableRange(uint32_t guest_low, uint32_t guest_high);
 
@@ -54,6 +71,25 @@ class X64CodeCache : public CodeCache {
                        GuestFunction* function_info);
   uint32_t PlaceData(const void* data, size_t length);
 
+  // Writes placed guest code to the given path so that it can be reloaded on
+  // a future run with LoadGuestCode. The relocations are the code offsets of
+  // all 64-bit host addresses embedded in the code. The function's source map
+  // is saved along with it.
+  bool SaveGuestCode(const std::wstring& path, uint64_t fingerprint,
+                     uint64_t guest_code_hash, GuestFunction* function,
+                     const void* code_address, size_t code_size,
+                     size_t stack_size,
+                     const std::vector<uint32_t>& relocations,
+                     const std::vector<CallSite>& call_sites);
+  // Places guest code previously written with SaveGuestCode, rebasing any
+  // host addresses if the host image has moved, restoring its source map,
+  // relinking its call sites, and installing its indirection. Returns nullptr
+  // if the file does not exist or was generated from different guest code or
+  // with a different backend fingerprint.
+  void* LoadGuestCode(const std::wstring& path, uint64_t fingerprint,
+                      uint64_t guest_code_hash, GuestFunction* function,
+                      size_t* out_code_size);
+
   GuestFunction* LookupFunction(uint64_t host_pc) override;
 
  protected:
@@ -72,6 +108,26 @@ class X64CodeCache : public CodeCache {
   // in analysis triggering.
   static const size_t kMaximumFunctionCount = 50000;
 
+  // Serialized guest function file format.
+  // Followed by relocation_count uint32_t code offsets, call_site_count
+  // CallSites and then the code.
+  struct CachedFunctionHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t fingerprint;      // X64Backend::code_fingerprint
+    uint64_t guest_code_hash;  // XXH64 of the guest instructions
+    uint64_t image_base;       // Host image base relocations are against
+    uint32_t guest_address;
+    uint32_t guest_end_address;
+    uint32_t code_size;
+    uint32_t stack_size;
+    uint32_t relocation_count;
+    uint32_t call_site_count;
+    uint32_t source_map_entry_count;
+  };
+  static const uint32_t kCachedFunctionMagic = 'XJIT';
+  static const uint32_t kCachedFunctionVersion = 3;
+
   struct UnwindReservation {
     size_t data_size = 0;
     size_t table_slot = 0;
@@ -80,6 +136,10 @@ class X64CodeCache : public CodeCache {
 
   X64CodeCache();
 
+  // Points the rel32 of a direct call/jmp at the given host code. The rel32 is
+  // 4b aligned, so other threads see either the old or the new target.
+  static void PatchCallSite(uint8_t* rel32_address, uint32_t host_address);
+
   virtual UnwindReservation RequestUnwindReservation(uint8_t* entry_address) {
     return UnwindReservation();
   }
@@ -102,6 +162,10 @@ class X64CodeCache : public CodeCache {
   // the generated code table that correspond to the PPC functions in guest
   // space.
   uint8_t* indirection_table_base_ = nullptr;
+
+  // Direct call sites (rel32 addresses) keyed by target guest address.
+  std::mutex call_site_mutex_;
+  std::unordered_multimap<uint32_t, uint8_t*> call_sites_;
   // Fixed at kGeneratedCodeBase and holding all generated code, growing as
   // needed.
   uint8_t* generated_code_base_ = nullptr;
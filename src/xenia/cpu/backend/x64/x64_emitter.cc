@@ -99,6 +99,11 @@ bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
   debug_info_flags_ = debug_info_flags;
   trace_data_ = &function->trace_data();
   source_map_arena_.Reset();
+  cacheable_ = true;
+  relocations_.clear();
+  call_sites_.clear();
+  tier_up_function_ =
+      FLAGS_tiered_jit && function->tier() == 0 ? function : nullptr;
 
   // Fill the generator with code.
   size_t stack_size = 0;
@@ -204,6 +209,11 @@ bool X64Emitter::Emit(HIRBuilder* builder, size_t* out_stack_size) {
   mov(GetMembaseReg(),
       qword[GetContextReg() + offsetof(ppc::PPCContext, virtual_membase)]);
 
+  // Count the call towards tiering up.
+  if (tier_up_function_) {
+    EmitTierUpCounter();
+  }
+
   // Body.
   auto block = builder->first_block();
   while (block) {
@@ -214,6 +224,19 @@ bool X64Emitter::Emit(HIRBuilder* builder, size_t* out_stack_size) {
       label = label->next;
     }
 
+    // Loop headers (targets of back edges) count each iteration too, so that
+    // long-running loops in rarely called functions still tier up.
+    if (tier_up_function_) {
+      auto edge = block->incoming_edge_head;
+      while (edge) {
+        if (edge->src->ordinal >= block->ordinal) {
+          EmitTierUpCounter();
+          break;
+        }
+        edge = edge->incoming_next;
+      }
+    }
+
     // Process instructions.
     const Instr* instr = block->instr_head;
     while (instr) {
@@ -249,6 +272,30 @@ bool X64Emitter::Emit(HIRBuilder* builder, size_t* out_stack_size) {
   return true;
 }
 
+uint64_t RequestTierUpThunk(void* raw_context, uint64_t function_ptr) {
+  auto thread_state = *reinterpret_cast<ThreadState**>(raw_context);
+  thread_state->processor()->RequestTierUp(
+      reinterpret_cast<GuestFunction*>(function_ptr));
+  return 0;
+}
+
+void X64Emitter::EmitTierUpCounter() {
+  // The counter lives in the function object, so this code can't be
+  // persisted. Only the call that takes it to zero requests the
+  // retranslation; after that it keeps counting (harmlessly) negative.
+  // Allocated registers can be live here (this is emitted at loop headers as
+  // well), so only the scratch rax and r8 and the flags may be touched;
+  // CallNativeSafe's thunk preserves the allocated registers across the call.
+  MarkNotCacheable();
+  Xbyak::Label skip;
+  mov(rax, reinterpret_cast<uint64_t>(tier_up_function_->tier_up_counter()));
+  dec(dword[rax]);
+  jnz(skip);
+  mov(r8, reinterpret_cast<uint64_t>(tier_up_function_));
+  CallNativeSafe(reinterpret_cast<void*>(RequestTierUpThunk));
+  L(skip);
+}
+
 void X64Emitter::MarkSourceOffset(const Instr* i) {
   auto entry = source_map_arena_.Alloc<SourceMapEntry>();
   entry->guest_address = static_cast<uint32_t>(i->src1.offset);
@@ -356,10 +403,37 @@ extern "C" uint64_t ResolveFunction(void* raw_context,
 void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
   assert_not_null(function);
   auto fn = static_cast<X64Function*>(function);
+  if (FLAGS_link_guest_calls && code_cache_->has_indirection_table()) {
+    // Direct call/jmp that X64CodeCache keeps pointed at the callee's current
+    // code. Until the callee is translated it lands in the resolve thunk,
+    // which expects the target in ebx.
+    mov(ebx, function->address());
+    if (instr->flags & hir::CALL_TAIL) {
+      // Since we skip the prolog we need to mark the return here.
+      EmitTraceUserCallReturn();
+
+      // Pass the callers return address over.
+      mov(rcx, qword[rsp + StackLayout::GUEST_RET_ADDR]);
+
+      add(rsp, static_cast<uint32_t>(stack_size()));
+      EmitLinkedCallSite(0xE9, function->address());  // jmp rel32
+    } else {
+      // Return address is from the previous SET_RETURN_ADDRESS.
+      mov(rcx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
+
+      EmitLinkedCallSite(0xE8, function->address());  // call rel32
+    }
+    return;
+  }
+
   // Resolve address to the function to call and store in rax.
-  if (fn->machine_code()) {
+  if (fn->machine_code() && FLAGS_code_cache_dir.empty() &&
+      !FLAGS_tiered_jit) {
     // TODO(benvanik): is it worth it to do this? It removes the need for
     // a ResolveFunction call, but makes the table less useful.
+    // NOTE: not done when persisting code, as the callee may be placed
+    // elsewhere on the next run, or when tiering, as the callee may be
+    // replaced.
     assert_zero(uint64_t(fn->machine_code()) & 0xFFFFFFFF00000000);
     mov(eax, uint32_t(uint64_t(fn->machine_code())));
   } else if (code_cache_->has_indirection_table()) {
@@ -372,7 +446,7 @@ void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
     // Old-style resolve.
     // Not too important because indirection table is almost always available.
     // TODO: Overwrite the call-site with a straight call.
-    mov(rax, reinterpret_cast<uint64_t>(ResolveFunction));
+    MovHostAddress(rax, reinterpret_cast<void*>(ResolveFunction));
     mov(rcx, GetContextReg());
     mov(rdx, function->address());
     call(rax);
@@ -396,6 +470,17 @@ void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
   }
 }
 
+void X64Emitter::EmitLinkedCallSite(uint8_t opcode, uint32_t guest_address) {
+  // Keep the rel32 4b aligned so that it can be repatched while other threads
+  // are executing it. Code is always placed 16b aligned.
+  while ((getSize() + 1) & 0x3) {
+    nop();
+  }
+  db(opcode);
+  call_sites_.push_back({static_cast<uint32_t>(getSize()), guest_address});
+  dd(0);
+}
+
 void X64Emitter::CallIndirect(const hir::Instr* instr,
                               const Xbyak::Reg64& reg) {
   // Check if return.
@@ -416,7 +501,7 @@ void X64Emitter::CallIndirect(const hir::Instr* instr,
     // Old-style resolve.
     // Not too important because indirection table is almost always available.
     mov(edx, reg.cvt32());
-    mov(rax, reinterpret_cast<uint64_t>(ResolveFunction));
+    MovHostAddress(rax, reinterpret_cast<void*>(ResolveFunction));
     mov(rcx, GetContextReg());
     call(rax);
   }
@@ -456,6 +541,8 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
     auto builtin_function = static_cast<const BuiltinFunction*>(function);
     if (builtin_function->handler()) {
       undefined = false;
+      // Builtin arguments are heap pointers that differ between runs.
+      MarkNotCacheable();
       // rcx = context
       // rdx = target host function
       // r8  = arg0
@@ -476,7 +563,8 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
       // rcx = context
       // rdx = target host function
       mov(rcx, GetContextReg());
-      mov(rdx, reinterpret_cast<uint64_t>(extern_function->extern_handler()));
+      MovHostAddress(
+          rdx, reinterpret_cast<void*>(extern_function->extern_handler()));
       mov(r8, qword[GetContextReg() + offsetof(ppc::PPCContext, kernel_state)]);
       auto thunk = backend()->guest_to_host_thunk();
       mov(rax, reinterpret_cast<uint64_t>(thunk));
@@ -485,31 +573,32 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
     }
   }
   if (undefined) {
+    MarkNotCacheable();
     CallNative(UndefinedCallExtern, reinterpret_cast<uint64_t>(function));
   }
 }
 
 void X64Emitter::CallNative(void* fn) {
-  mov(rax, reinterpret_cast<uint64_t>(fn));
+  MovHostAddress(rax, fn);
   mov(rcx, GetContextReg());
   call(rax);
 }
 
 void X64Emitter::CallNative(uint64_t (*fn)(void* raw_context)) {
-  mov(rax, reinterpret_cast<uint64_t>(fn));
+  MovHostAddress(rax, reinterpret_cast<void*>(fn));
   mov(rcx, GetContextReg());
   call(rax);
 }
 
 void X64Emitter::CallNative(uint64_t (*fn)(void* raw_context, uint64_t arg0)) {
-  mov(rax, reinterpret_cast<uint64_t>(fn));
+  MovHostAddress(rax, reinterpret_cast<void*>(fn));
   mov(rcx, GetContextReg());
   call(rax);
 }
 
 void X64Emitter::CallNative(uint64_t (*fn)(void* raw_context, uint64_t arg0),
                             uint64_t arg0) {
-  mov(rax, reinterpret_cast<uint64_t>(fn));
+  MovHostAddress(rax, reinterpret_cast<void*>(fn));
   mov(rcx, GetContextReg());
   mov(rdx, arg0);
   call(rax);
@@ -524,7 +613,7 @@ void X64Emitter::CallNativeSafe(void* fn) {
   auto thunk = backend()->guest_to_host_thunk();
   mov(rax, reinterpret_cast<uint64_t>(thunk));
   mov(rcx, GetContextReg());
-  mov(rdx, reinterpret_cast<uint64_t>(fn));
+  MovHostAddress(rdx, fn);
   call(rax);
   // rax = host return
 }
@@ -534,6 +623,16 @@ void X64Emitter::SetReturnAddress(uint64_t value) {
   mov(qword[rsp + StackLayout::GUEST_CALL_RET_ADDR], rax);
 }
 
+void X64Emitter::MovHostAddress(const Xbyak::Reg64& dest,
+                                const void* address) {
+  // Always use the full imm64 form (REX.W B8+r) so that the relocation can be
+  // patched with any address, regardless of what xbyak would have picked.
+  db(0x48 | (dest.getIdx() >= 8 ? 0x01 : 0x00));
+  db(0xB8 | (dest.getIdx() & 0x07));
+  relocations_.push_back(static_cast<uint32_t>(getSize()));
+  dq(reinterpret_cast<uint64_t>(address));
+}
+
 // Important: If you change these, you must update the thunks in x64_backend.cc!
 Xbyak::Reg64 X64Emitter::GetContextReg() { return rsi; }
 Xbyak::Reg64 X64Emitter::GetMembaseReg() { return rdi; }
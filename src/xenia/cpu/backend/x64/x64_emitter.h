@@ -13,6 +13,7 @@
 #include <vector>
 
 #include "xenia/base/arena.h"
+#include "xenia/cpu/backend/x64/x64_code_cache.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/function_trace_data.h"
 #include "xenia/cpu/hir/hir_builder.h"
@@ -171,6 +172,22 @@ class X64Emitter : public Xbyak::CodeGenerator {
   void CallNativeSafe(void* fn);
   void SetReturnAddress(uint64_t value);
 
+  // Moves the address of a host function or static data into the given
+  // register, recording it as a relocation so that the code can be reloaded
+  // from the persistent code cache if the host image moves.
+  void MovHostAddress(const Xbyak::Reg64& dest, const void* address);
+  // Marks the function being emitted as referencing host state that cannot be
+  // relocated (heap pointers/etc), preventing it from being persisted.
+  void MarkNotCacheable() { cacheable_ = false; }
+  bool is_cacheable() const { return cacheable_; }
+  // Code offsets of all 64-bit host addresses recorded by MovHostAddress.
+  const std::vector<uint32_t>& relocations() const { return relocations_; }
+  // Direct guest calls in the last emitted function, to be linked by
+  // X64CodeCache once placed.
+  const std::vector<X64CodeCache::CallSite>& call_sites() const {
+    return call_sites_;
+  }
+
   Xbyak::Reg64 GetContextReg();
   Xbyak::Reg64 GetMembaseReg();
   void ReloadContext();
@@ -198,11 +215,15 @@ class X64Emitter : public Xbyak::CodeGenerator {
 
   size_t stack_size() const { return stack_size_; }
 
+  uint32_t feature_flags() const { return feature_flags_; }
+
  protected:
   void* Emplace(size_t stack_size, GuestFunction* function = nullptr);
   bool Emit(hir::HIRBuilder* builder, size_t* out_stack_size);
   void EmitGetCurrentThreadId();
   void EmitTraceUserCallReturn();
+  void EmitTierUpCounter();
+  void EmitLinkedCallSite(uint8_t opcode, uint32_t guest_address);
 
  protected:
   Processor* processor_ = nullptr;
@@ -220,9 +241,15 @@ class X64Emitter : public Xbyak::CodeGenerator {
   uint32_t debug_info_flags_ = 0;
   FunctionTraceData* trace_data_ = nullptr;
   Arena source_map_arena_;
+  // Set when emitting tier 0 code that counts towards retranslation.
+  GuestFunction* tier_up_function_ = nullptr;
 
   size_t stack_size_ = 0;
 
+  bool cacheable_ = true;
+  std::vector<uint32_t> relocations_;
+  std::vector<X64CodeCache::CallSite> call_sites_;
+
   static const uint32_t gpr_reg_map_[GPR_COUNT];
   static const uint32_t xmm_reg_map_[XMM_COUNT];
 };
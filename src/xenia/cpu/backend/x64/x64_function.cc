@@ -22,19 +22,18 @@ X64Function::X64Function(Module* module, uint32_t address)
     : GuestFunction(module, address) {}
 
 X64Function::~X64Function() {
-  // machine_code_ is freed by code cache.
+  // Machine code is freed by the code cache.
 }
 
 void X64Function::Setup(uint8_t* machine_code, size_t machine_code_length) {
-  machine_code_ = machine_code;
-  machine_code_length_ = machine_code_length;
+  PublishMachineCode(machine_code, machine_code_length);
 }
 
 bool X64Function::CallImpl(ThreadState* thread_state, uint32_t return_address) {
   auto backend =
       reinterpret_cast<X64Backend*>(thread_state->processor()->backend());
   auto thunk = backend->host_to_guest_thunk();
-  thunk(machine_code_, thread_state->context(),
+  thunk(machine_code(), thread_state->context(),
         reinterpret_cast<void*>(uintptr_t(return_address)));
   return true;
 }
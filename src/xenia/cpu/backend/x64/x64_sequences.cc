@@ -32,9 +32,13 @@
 #include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/threading.h"
+#include "xenia/cpu/backend/x64/x64_backend.h"
 #include "xenia/cpu/backend/x64/x64_emitter.h"
 #include "xenia/cpu/backend/x64/x64_tracers.h"
+#include "xenia/cpu/compiler/alias_analysis.h"
 #include "xenia/cpu/hir/hir_builder.h"
+#include "xenia/cpu/mmio_handler.h"
+#include "xenia/cpu/ppc/ppc_context.h"
 #include "xenia/cpu/processor.h"
 
 // For OPCODE_PACK/OPCODE_UNPACK
@@ -674,6 +678,7 @@ struct COMMENT : Sequence<COMMENT, I<OPCODE_COMMENT, VoidOp, OffsetOp>> {
       // TODO(benvanik): pass through.
       // TODO(benvanik): don't just leak this memory.
       auto str_copy = strdup(str);
+      e.MarkNotCacheable();
       e.mov(e.rdx, reinterpret_cast<uint64_t>(str_copy));
       e.CallNative(reinterpret_cast<void*>(TraceString));
     }
@@ -1602,14 +1607,14 @@ struct LOAD_VECTOR_SHL_I8
     if (i.src1.is_constant) {
       auto sh = i.src1.constant();
       assert_true(sh < xe::countof(lvsl_table));
-      e.mov(e.rax, (uintptr_t)&lvsl_table[sh]);
+      e.MovHostAddress(e.rax, &lvsl_table[sh]);
       e.vmovaps(i.dest, e.ptr[e.rax]);
     } else {
       // TODO(benvanik): find a cheaper way of doing this.
       e.movzx(e.rdx, i.src1);
       e.and_(e.dx, 0xF);
       e.shl(e.dx, 4);
-      e.mov(e.rax, (uintptr_t)lvsl_table);
+      e.MovHostAddress(e.rax, lvsl_table);
       e.vmovaps(i.dest, e.ptr[e.rax + e.rdx]);
       e.ReloadMembase();
     }
@@ -1644,14 +1649,14 @@ struct LOAD_VECTOR_SHR_I8
     if (i.src1.is_constant) {
       auto sh = i.src1.constant();
       assert_true(sh < xe::countof(lvsr_table));
-      e.mov(e.rax, (uintptr_t)&lvsr_table[sh]);
+      e.MovHostAddress(e.rax, &lvsr_table[sh]);
       e.vmovaps(i.dest, e.ptr[e.rax]);
     } else {
       // TODO(benvanik): find a cheaper way of doing this.
       e.movzx(e.rdx, i.src1);
       e.and_(e.dx, 0xF);
       e.shl(e.dx, 4);
-      e.mov(e.rax, (uintptr_t)lvsr_table);
+      e.MovHostAddress(e.rax, lvsr_table);
       e.vmovaps(i.dest, e.ptr[e.rax + e.rdx]);
       e.ReloadMembase();
     }
@@ -2030,6 +2035,7 @@ struct LOAD_MMIO_I32
     // uint64_t (context, addr)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto read_address = uint32_t(i.src2.value);
+    e.MarkNotCacheable();
     e.mov(e.r8, uint64_t(mmio_range->callback_context));
     e.mov(e.r9d, read_address);
     e.CallNativeSafe(reinterpret_cast<void*>(mmio_range->read));
@@ -2055,6 +2061,7 @@ struct STORE_MMIO_I32
     // void (context, addr, value)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto write_address = uint32_t(i.src2.value);
+    e.MarkNotCacheable();
     e.mov(e.r8, uint64_t(mmio_range->callback_context));
     e.mov(e.r9d, write_address);
     if (i.src3.is_constant) {
@@ -2096,6 +2103,55 @@ RegExp ComputeMemoryAddress(X64Emitter& e, const T& guest) {
     return e.GetMembaseReg() + e.rax;
   }
 }
+
+// 32-bit accesses that may hit an MMIO range check for it inline and call the
+// range directly, instead of taking (and decoding) an access violation.
+// Accesses known to be on the stack or at a constant address outside of the
+// MMIO window are left alone.
+bool NeedsMmioCheck(const Instr* instr) {
+  if (!FLAGS_inline_mmio_checks) {
+    return false;
+  }
+  auto address = instr->src1.value;
+  if (address->IsConstant()) {
+    return IsMmioWindowAddress(address->constant.i32);
+  }
+  return !compiler::MemoryLocation::FromInstr(instr).IsPlainMemory();
+}
+
+// Expects the guest address in eax, as left by ComputeMemoryAddress.
+void EmitMmioCheck(X64Emitter& e, Xbyak::Label& mmio_label) {
+  e.lea(e.ecx, e.ptr[e.rax - kMmioWindowBase]);
+  e.cmp(e.ecx, kMmioWindowSize);
+  e.jb(mmio_label, CodeGenerator::T_NEAR);
+}
+
+// Values are as the MMIO callbacks see them, which is byte swapped from what
+// is in memory.
+uint64_t LoadMmioThunk(void* raw_context, uint64_t address) {
+  auto guest_address = static_cast<uint32_t>(address);
+  auto range = MMIOHandler::global_handler()->LookupRange(guest_address);
+  if (!range) {
+    // Regular memory sharing the window (GPU writeback).
+    auto context = reinterpret_cast<ppc::PPCContext*>(raw_context);
+    return xe::load_and_swap<uint32_t>(context->virtual_membase +
+                                       guest_address);
+  }
+  return range->read(raw_context, range->callback_context, guest_address);
+}
+uint64_t StoreMmioThunk(void* raw_context, uint64_t address, uint64_t value) {
+  auto guest_address = static_cast<uint32_t>(address);
+  auto range = MMIOHandler::global_handler()->LookupRange(guest_address);
+  if (!range) {
+    auto context = reinterpret_cast<ppc::PPCContext*>(raw_context);
+    xe::store_and_swap<uint32_t>(context->virtual_membase + guest_address,
+                                 static_cast<uint32_t>(value));
+    return 0;
+  }
+  range->write(raw_context, range->callback_context, guest_address,
+               static_cast<uint32_t>(value));
+  return 0;
+}
 struct LOAD_I8 : Sequence<LOAD_I8, I<OPCODE_LOAD, I8Op, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     auto addr = ComputeMemoryAddress(e, i.src1);
@@ -2130,6 +2186,11 @@ struct LOAD_I16 : Sequence<LOAD_I16, I<OPCODE_LOAD, I16Op, I64Op>> {
 struct LOAD_I32 : Sequence<LOAD_I32, I<OPCODE_LOAD, I32Op, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     auto addr = ComputeMemoryAddress(e, i.src1);
+    bool check_mmio = NeedsMmioCheck(i.instr);
+    Xbyak::Label mmio, done;
+    if (check_mmio) {
+      EmitMmioCheck(e, mmio);
+    }
     if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
       if (e.IsFeatureEnabled(kX64EmitMovbe)) {
         e.movbe(i.dest, e.dword[addr]);
@@ -2145,6 +2206,17 @@ struct LOAD_I32 : Sequence<LOAD_I32, I<OPCODE_LOAD, I32Op, I64Op>> {
       e.lea(e.rdx, e.ptr[addr]);
       e.CallNative(reinterpret_cast<void*>(TraceMemoryLoadI32));
     }
+    if (check_mmio) {
+      e.jmp(done, CodeGenerator::T_NEAR);
+      e.L(mmio);
+      e.mov(e.r8d, e.eax);
+      e.CallNativeSafe(reinterpret_cast<void*>(LoadMmioThunk));
+      if (!(i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP)) {
+        e.bswap(e.eax);
+      }
+      e.mov(i.dest, e.eax);
+      e.L(done);
+    }
   }
 };
 struct LOAD_I64 : Sequence<LOAD_I64, I<OPCODE_LOAD, I64Op, I64Op>> {
@@ -2262,6 +2334,11 @@ struct STORE_I16 : Sequence<STORE_I16, I<OPCODE_STORE, VoidOp, I64Op, I16Op>> {
 struct STORE_I32 : Sequence<STORE_I32, I<OPCODE_STORE, VoidOp, I64Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     auto addr = ComputeMemoryAddress(e, i.src1);
+    bool check_mmio = NeedsMmioCheck(i.instr);
+    Xbyak::Label mmio, done;
+    if (check_mmio) {
+      EmitMmioCheck(e, mmio);
+    }
     if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
       assert_false(i.src2.is_constant);
       if (e.IsFeatureEnabled(kX64EmitMovbe)) {
@@ -2282,6 +2359,21 @@ struct STORE_I32 : Sequence<STORE_I32, I<OPCODE_STORE, VoidOp, I64Op, I32Op>> {
       e.lea(e.rdx, e.ptr[addr]);
       e.CallNative(reinterpret_cast<void*>(TraceMemoryStoreI32));
     }
+    if (check_mmio) {
+      e.jmp(done, CodeGenerator::T_NEAR);
+      e.L(mmio);
+      e.mov(e.r8d, e.eax);
+      if (i.src2.is_constant) {
+        e.mov(e.r9d, xe::byte_swap(static_cast<uint32_t>(i.src2.constant())));
+      } else {
+        e.mov(e.r9d, i.src2);
+        if (!(i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP)) {
+          e.bswap(e.r9d);
+        }
+      }
+      e.CallNativeSafe(reinterpret_cast<void*>(StoreMmioThunk));
+      e.L(done);
+    }
   }
 };
 struct STORE_I64 : Sequence<STORE_I64, I<OPCODE_STORE, VoidOp, I64Op, I64Op>> {
@@ -6473,7 +6565,7 @@ struct EXTRACT_I32
       e.mov(e.al, i.src2);
       e.and_(e.al, 0x03);
       e.shl(e.al, 4);
-      e.mov(e.rdx, reinterpret_cast<uint64_t>(extract_table_32));
+      e.MovHostAddress(e.rdx, extract_table_32);
       e.vmovaps(e.xmm0, e.ptr[e.rdx + e.rax]);
       e.vpshufb(e.xmm0, src1, e.xmm0);
       e.vpextrd(i.dest, e.xmm0, 0);
@@ -0,0 +1,156 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/alias_analysis.h"
+
+#include "xenia/cpu/mmio_handler.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Value;
+
+namespace {
+
+// Offsets further out than this may wrap around the 32-bit guest address
+// space, which would make comparing them meaningless.
+const int64_t kMaxOffset = 0x7FFFFFFF;
+
+// Address chains are short (ra + displacement), so don't bother going deep.
+const int kMaxChainLength = 8;
+
+bool GetSignedConstant(const Value* value, int64_t* out_value) {
+  if (!value->IsConstant()) {
+    return false;
+  }
+  switch (value->type) {
+    case INT32_TYPE:
+      *out_value = value->constant.i32;
+      return true;
+    case INT64_TYPE:
+      *out_value = value->constant.i64;
+      return true;
+    default:
+      return false;
+  }
+}
+
+}  // namespace
+
+MemoryLocation MemoryLocation::FromInstr(const Instr* i) {
+  if (i->opcode == &OPCODE_LOAD_info) {
+    return FromAddress(i->src1.value, GetTypeSize(i->dest->type));
+  } else if (i->opcode == &OPCODE_STORE_info) {
+    return FromAddress(i->src1.value, GetTypeSize(i->src2.value->type));
+  }
+  return MemoryLocation();
+}
+
+MemoryLocation MemoryLocation::FromAddress(Value* address, size_t size) {
+  MemoryLocation location;
+  location.size = size;
+
+  int64_t offset = 0;
+  Value* base = address;
+  for (int n = 0; n < kMaxChainLength; ++n) {
+    int64_t constant;
+    if (GetSignedConstant(base, &constant)) {
+      // Only the low 32 bits are used as the guest address.
+      location.kind = Kind::kAbsolute;
+      location.offset = static_cast<int64_t>(
+          static_cast<uint32_t>(static_cast<uint64_t>(offset + constant)));
+      return location;
+    }
+    auto def = base->def;
+    if (!def) {
+      break;
+    }
+    if (def->opcode == &OPCODE_ASSIGN_info) {
+      base = def->src1.value;
+    } else if (def->opcode == &OPCODE_ADD_info &&
+               GetSignedConstant(def->src2.value, &constant)) {
+      base = def->src1.value;
+      offset += constant;
+    } else if (def->opcode == &OPCODE_ADD_info &&
+               GetSignedConstant(def->src1.value, &constant)) {
+      base = def->src2.value;
+      offset += constant;
+    } else if (def->opcode == &OPCODE_SUB_info &&
+               GetSignedConstant(def->src2.value, &constant)) {
+      base = def->src1.value;
+      offset -= constant;
+    } else {
+      break;
+    }
+    if (offset > kMaxOffset || offset < -kMaxOffset) {
+      return location;
+    }
+  }
+
+  location.kind = Kind::kBased;
+  location.base = base;
+  location.offset = offset;
+  if (base->def && base->def->opcode == &OPCODE_LOAD_CONTEXT_info &&
+      base->def->src1.offset == offsetof(ppc::PPCContext, r[1])) {
+    location.kind = Kind::kStack;
+  }
+  return location;
+}
+
+bool MemoryLocation::SameBase(const MemoryLocation& other) const {
+  if (kind == Kind::kAbsolute || other.kind == Kind::kAbsolute) {
+    return kind == other.kind;
+  }
+  return base == other.base;
+}
+
+bool MemoryLocation::MayAlias(const MemoryLocation& other) const {
+  if (kind == Kind::kUnknown || other.kind == Kind::kUnknown) {
+    return true;
+  }
+  if (!SameBase(other)) {
+    // Could be anywhere relative to each other.
+    return true;
+  }
+  return offset < other.offset + static_cast<int64_t>(other.size) &&
+         other.offset < offset + static_cast<int64_t>(size);
+}
+
+bool MemoryLocation::Covers(const MemoryLocation& other) const {
+  if (kind == Kind::kUnknown || other.kind == Kind::kUnknown ||
+      !SameBase(other)) {
+    return false;
+  }
+  return offset <= other.offset &&
+         other.offset + static_cast<int64_t>(other.size) <=
+             offset + static_cast<int64_t>(size);
+}
+
+bool MemoryLocation::IsPlainMemory() const {
+  switch (kind) {
+    case Kind::kStack:
+      return true;
+    case Kind::kAbsolute:
+      // MMIO, followed by the physical memory views the GPU and other devices
+      // read and write behind our back.
+      return static_cast<uint64_t>(offset) + size <= kMmioWindowBase;
+    default:
+      return false;
+  }
+}
+
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
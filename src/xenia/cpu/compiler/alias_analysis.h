@@ -0,0 +1,73 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_ALIAS_ANALYSIS_H_
+#define XENIA_CPU_COMPILER_ALIAS_ANALYSIS_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "xenia/cpu/hir/instr.h"
+#include "xenia/cpu/hir/value.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+
+// Whether two context ranges share any bytes.
+inline bool ContextRangesOverlap(size_t a_offset, size_t a_size,
+                                 size_t b_offset, size_t b_size) {
+  return a_offset < b_offset + b_size && b_offset < a_offset + a_size;
+}
+
+// A guest memory access split into a base value and a constant offset, so
+// that accesses off the same base can be told apart without knowing what the
+// base is at runtime:
+//   v1 = load_context +r1
+//   v2 = add v1, 0x10      -> stack (v1) + 0x10
+//   v3 = add v2, 4         -> stack (v1) + 0x14
+struct MemoryLocation {
+  enum class Kind {
+    // Nothing is known about the address.
+    kUnknown,
+    // Base plus offset, where the base could point anywhere (including MMIO).
+    kBased,
+    // Base plus offset, where the base is the guest stack pointer (r1).
+    kStack,
+    // A constant address. The base is null.
+    kAbsolute,
+  };
+
+  Kind kind = Kind::kUnknown;
+  hir::Value* base = nullptr;
+  int64_t offset = 0;
+  size_t size = 0;
+
+  // Decomposes the address of a LOAD or STORE.
+  static MemoryLocation FromInstr(const hir::Instr* i);
+  static MemoryLocation FromAddress(hir::Value* address, size_t size);
+
+  // Whether the two accesses could touch any of the same bytes.
+  bool MayAlias(const MemoryLocation& other) const;
+  // Whether this access touches every byte the other one does.
+  bool Covers(const MemoryLocation& other) const;
+  // Whether accesses here can be removed or merged: the memory is known not
+  // to be MMIO (where every access has side effects) and no other thread
+  // cares about the order of accesses to it.
+  bool IsPlainMemory() const;
+
+ private:
+  bool SameBase(const MemoryLocation& other) const;
+};
+
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_ALIAS_ANALYSIS_H_
@@ -0,0 +1,321 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/loop_analysis.h"
+
+#include <algorithm>
+
+#include "xenia/base/assert.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+
+namespace {
+const uint16_t kNoDominator = UINT16_MAX;
+const uint32_t kUnreachable = UINT32_MAX;
+
+void AddUnique(std::vector<Block*>* blocks, Block* block) {
+  if (std::find(blocks->begin(), blocks->end(), block) == blocks->end()) {
+    blocks->push_back(block);
+  }
+}
+}  // namespace
+
+bool Loop::StoresContext(size_t offset, size_t size) const {
+  for (auto store : context_stores) {
+    size_t store_offset = store->src1.offset;
+    size_t store_size = GetTypeSize(store->src2.value->type);
+    if (store_offset < offset + size && offset < store_offset + store_size) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Loop::MoveToPreheader(Instr* instr) const {
+  assert_not_null(preheader);
+  auto tail = preheader->instr_tail;
+  assert_not_null(tail);
+
+  // Find the start of any trailing branches (which all lead to the header).
+  Instr* first_branch = nullptr;
+  auto branch = tail;
+  while (branch && (branch->opcode == &OPCODE_BRANCH_info ||
+                    branch->opcode == &OPCODE_BRANCH_TRUE_info ||
+                    branch->opcode == &OPCODE_BRANCH_FALSE_info)) {
+    first_branch = branch;
+    branch = branch->prev;
+  }
+  if (first_branch) {
+    instr->MoveBefore(first_branch);
+  } else {
+    instr->MoveAfter(tail);
+  }
+}
+
+void LoopAnalysis::Analyze(HIRBuilder* builder) {
+  blocks_.clear();
+  rpo_.clear();
+  loops_.clear();
+
+  uint16_t block_ordinal = 0;
+  auto block = builder->first_block();
+  while (block) {
+    block->ordinal = block_ordinal++;
+    blocks_.push_back(block);
+    block = block->next;
+  }
+  if (blocks_.empty()) {
+    return;
+  }
+
+  ComputeSuccessors();
+  ComputeDominators();
+  FindLoops();
+}
+
+void LoopAnalysis::ComputeSuccessors() {
+  successors_.assign(blocks_.size(), {});
+  predecessors_.assign(blocks_.size(), {});
+  for (auto block : blocks_) {
+    auto& successors = successors_[block->ordinal];
+
+    // Same as ControlFlowAnalysisPass: all trailing branches.
+    auto instr = block->instr_tail;
+    while (instr && instr->opcode->flags & OPCODE_FLAG_BRANCH) {
+      if (instr->opcode == &OPCODE_BRANCH_info) {
+        AddUnique(&successors, instr->src1.label->block);
+      } else if (instr->opcode == &OPCODE_BRANCH_TRUE_info ||
+                 instr->opcode == &OPCODE_BRANCH_FALSE_info) {
+        AddUnique(&successors, instr->src2.label->block);
+      }
+      instr = instr->prev;
+    }
+
+    // Plus the fall-through, which the CFG doesn't record.
+    auto tail = block->instr_tail;
+    bool falls_through = true;
+    if (tail) {
+      if (tail->opcode == &OPCODE_BRANCH_info ||
+          tail->opcode == &OPCODE_RETURN_info) {
+        falls_through = false;
+      } else if ((tail->opcode == &OPCODE_CALL_info ||
+                  tail->opcode == &OPCODE_CALL_INDIRECT_info) &&
+                 tail->flags & CALL_TAIL) {
+        falls_through = false;
+      }
+    }
+    if (falls_through && block->next) {
+      AddUnique(&successors, block->next);
+    }
+
+    for (auto successor : successors) {
+      predecessors_[successor->ordinal].push_back(block);
+    }
+  }
+}
+
+void LoopAnalysis::ComputeDominators() {
+  // Iterative dominators from Cooper, Harvey & Kennedy, "A Simple, Fast
+  // Dominance Algorithm". Blocks are visited in reverse postorder.
+  std::vector<Block*> postorder;
+  std::vector<bool> visited(blocks_.size());
+  std::vector<std::pair<Block*, size_t>> stack;
+  stack.emplace_back(blocks_[0], 0);
+  visited[0] = true;
+  while (!stack.empty()) {
+    auto& top = stack.back();
+    auto& successors = successors_[top.first->ordinal];
+    if (top.second < successors.size()) {
+      auto successor = successors[top.second++];
+      if (!visited[successor->ordinal]) {
+        visited[successor->ordinal] = true;
+        stack.emplace_back(successor, 0);
+      }
+    } else {
+      postorder.push_back(top.first);
+      stack.pop_back();
+    }
+  }
+  rpo_.assign(postorder.rbegin(), postorder.rend());
+  rpo_index_.assign(blocks_.size(), kUnreachable);
+  for (uint32_t n = 0; n < rpo_.size(); ++n) {
+    rpo_index_[rpo_[n]->ordinal] = n;
+  }
+
+  idom_.assign(blocks_.size(), kNoDominator);
+  idom_[blocks_[0]->ordinal] = blocks_[0]->ordinal;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t n = 1; n < rpo_.size(); ++n) {
+      auto block = rpo_[n];
+      uint16_t new_idom = kNoDominator;
+      for (auto predecessor : predecessors_[block->ordinal]) {
+        uint16_t p = predecessor->ordinal;
+        if (idom_[p] == kNoDominator) {
+          // Not yet processed (or unreachable).
+          continue;
+        }
+        if (new_idom == kNoDominator) {
+          new_idom = p;
+          continue;
+        }
+        // Intersect.
+        uint16_t a = p;
+        uint16_t b = new_idom;
+        while (a != b) {
+          while (rpo_index_[a] > rpo_index_[b]) {
+            a = idom_[a];
+          }
+          while (rpo_index_[b] > rpo_index_[a]) {
+            b = idom_[b];
+          }
+        }
+        new_idom = a;
+      }
+      if (idom_[block->ordinal] != new_idom) {
+        idom_[block->ordinal] = new_idom;
+        changed = true;
+      }
+    }
+  }
+}
+
+Block* LoopAnalysis::immediate_dominator(const Block* block) const {
+  if (block == blocks_[0]) {
+    return nullptr;
+  }
+  uint16_t idom = idom_[block->ordinal];
+  return idom == kNoDominator ? nullptr : blocks_[idom];
+}
+
+bool LoopAnalysis::Dominates(const Block* a, const Block* b) const {
+  if (rpo_index_[a->ordinal] == kUnreachable ||
+      rpo_index_[b->ordinal] == kUnreachable) {
+    return false;
+  }
+  uint16_t n = b->ordinal;
+  while (true) {
+    if (n == a->ordinal) {
+      return true;
+    }
+    if (n == blocks_[0]->ordinal) {
+      return false;
+    }
+    n = idom_[n];
+  }
+}
+
+void LoopAnalysis::FindLoops() {
+  // Every edge to a block that dominates its source is a back edge. The loop
+  // body is everything that reaches the source without passing the header.
+  // Back edges sharing a header form a single loop.
+  std::vector<int> loop_for_header(blocks_.size(), -1);
+  for (auto source : rpo_) {
+    for (auto header : successors_[source->ordinal]) {
+      if (!Dominates(header, source)) {
+        continue;
+      }
+      int loop_index = loop_for_header[header->ordinal];
+      if (loop_index == -1) {
+        loop_index = static_cast<int>(loops_.size());
+        loop_for_header[header->ordinal] = loop_index;
+        loops_.emplace_back();
+        auto& loop = loops_.back();
+        loop.header = header;
+        loop.contains.resize(blocks_.size());
+        loop.contains[header->ordinal] = true;
+      }
+      auto& loop = loops_[loop_index];
+      std::vector<Block*> worklist;
+      if (!loop.contains[source->ordinal]) {
+        loop.contains[source->ordinal] = true;
+        worklist.push_back(source);
+      }
+      while (!worklist.empty()) {
+        auto block = worklist.back();
+        worklist.pop_back();
+        for (auto predecessor : predecessors_[block->ordinal]) {
+          if (rpo_index_[predecessor->ordinal] == kUnreachable ||
+              loop.contains[predecessor->ordinal]) {
+            continue;
+          }
+          loop.contains[predecessor->ordinal] = true;
+          worklist.push_back(predecessor);
+        }
+      }
+    }
+  }
+
+  for (auto& loop : loops_) {
+    for (auto block : blocks_) {
+      if (loop.contains[block->ordinal]) {
+        loop.blocks.push_back(block);
+      }
+    }
+
+    // A usable preheader is the only way in and goes nowhere else.
+    Block* entry = nullptr;
+    size_t entry_count = 0;
+    for (auto predecessor : predecessors_[loop.header->ordinal]) {
+      if (!loop.Contains(predecessor) &&
+          rpo_index_[predecessor->ordinal] != kUnreachable) {
+        entry = predecessor;
+        ++entry_count;
+      }
+    }
+    if (entry_count == 1 && successors_[entry->ordinal].size() == 1) {
+      assert_true(successors_[entry->ordinal][0] == loop.header);
+      loop.preheader = entry;
+    }
+
+    ScanLoop(&loop);
+  }
+
+  std::stable_sort(loops_.begin(), loops_.end(),
+                   [](const Loop& a, const Loop& b) {
+                     return a.blocks.size() < b.blocks.size();
+                   });
+}
+
+void LoopAnalysis::ScanLoop(Loop* loop) {
+  for (auto block : loop->blocks) {
+    auto instr = block->instr_head;
+    while (instr) {
+      auto opcode = instr->opcode;
+      if (opcode == &OPCODE_STORE_CONTEXT_info) {
+        loop->context_stores.push_back(instr);
+      } else if (opcode == &OPCODE_CONTEXT_BARRIER_info) {
+        loop->clobbers_context = true;
+      } else if (opcode->flags & OPCODE_FLAG_VOLATILE) {
+        // Conditional branches are flagged volatile but are harmless here.
+        if (opcode != &OPCODE_BRANCH_TRUE_info &&
+            opcode != &OPCODE_BRANCH_FALSE_info &&
+            opcode != &OPCODE_RETURN_info &&
+            opcode != &OPCODE_RETURN_TRUE_info) {
+          loop->clobbers_context = true;
+        }
+      }
+      instr = instr->next;
+    }
+  }
+}
+
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,92 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_LOOP_ANALYSIS_H_
+#define XENIA_CPU_COMPILER_LOOP_ANALYSIS_H_
+
+#include <vector>
+
+#include "xenia/cpu/hir/block.h"
+#include "xenia/cpu/hir/hir_builder.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+
+// A natural loop: a header block that dominates every block in the loop and
+// at least one back edge into the header.
+struct Loop {
+  hir::Block* header = nullptr;
+  // The single block outside the loop that enters it, if it only flows into
+  // the header. Code placed at its end runs once before the loop is entered.
+  hir::Block* preheader = nullptr;
+  // All blocks in the loop (including the header), in block order.
+  std::vector<hir::Block*> blocks;
+  // Indexed by block ordinal.
+  std::vector<bool> contains;
+  // Whether anything in the loop may change the context behind our back
+  // (calls, traps, context barriers).
+  bool clobbers_context = false;
+  // All STORE_CONTEXTs in the loop.
+  std::vector<hir::Instr*> context_stores;
+
+  bool Contains(const hir::Block* block) const {
+    return block->ordinal < contains.size() && contains[block->ordinal];
+  }
+  // Whether any store in the loop overlaps the given context range.
+  bool StoresContext(size_t offset, size_t size) const;
+  // Moves the instruction to the end of the preheader, keeping it ahead of
+  // any terminating branches. Instructions moved in order stay in order.
+  void MoveToPreheader(hir::Instr* instr) const;
+};
+
+// Computes dominators and natural loops over the HIR blocks.
+// The CFG is derived from the branch instructions directly (including
+// fall-through), so the ControlFlowAnalysisPass edges need not be current.
+// Block ordinals are renumbered sequentially.
+class LoopAnalysis {
+ public:
+  void Analyze(hir::HIRBuilder* builder);
+
+  // Loops ordered innermost (smallest) first.
+  const std::vector<Loop>& loops() const { return loops_; }
+
+  const std::vector<hir::Block*>& successors(const hir::Block* block) const {
+    return successors_[block->ordinal];
+  }
+  const std::vector<hir::Block*>& predecessors(
+      const hir::Block* block) const {
+    return predecessors_[block->ordinal];
+  }
+  // Returns nullptr for the entry block and unreachable blocks.
+  hir::Block* immediate_dominator(const hir::Block* block) const;
+  bool Dominates(const hir::Block* a, const hir::Block* b) const;
+
+ private:
+  void ComputeSuccessors();
+  void ComputeDominators();
+  void FindLoops();
+  void ScanLoop(Loop* loop);
+
+  std::vector<hir::Block*> blocks_;
+  std::vector<std::vector<hir::Block*>> successors_;
+  std::vector<std::vector<hir::Block*>> predecessors_;
+  // Reverse postorder of reachable blocks and each block's index into it.
+  std::vector<hir::Block*> rpo_;
+  std::vector<uint32_t> rpo_index_;
+  // Indexed by block ordinal; UINT16_MAX if none.
+  std::vector<uint16_t> idom_;
+  std::vector<Loop> loops_;
+};
+
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_LOOP_ANALYSIS_H_
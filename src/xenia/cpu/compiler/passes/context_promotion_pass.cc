@@ -20,6 +20,10 @@ DECLARE_bool(debug);
 
 DEFINE_bool(store_all_context_values, false,
             "Don't strip dead context stores to aid in debugging.");
+DEFINE_bool(promote_context_across_blocks, true,
+            "Carry promoted context values into blocks that have a single "
+            "predecessor, keeping guest registers in host registers across "
+            "the edge.");
 
 namespace xe {
 namespace cpu {
@@ -66,11 +70,54 @@ bool ContextPromotionPass::Run(HIRBuilder* builder) {
   // This is more generally done by DSE, however if it could be done here
   // instead as it may be faster (at least on the block-level).
 
+  loads_eliminated_ = 0;
+  cross_block_loads_eliminated_ = 0;
+  stores_eliminated_ = 0;
+
   // Promote loads to values.
-  // Process each block independently, for now.
+  // Blocks with a single predecessor (earlier in the block order) start with
+  // whatever was valid at the end of it. Values then live across the edge and
+  // the register allocator keeps them in registers. Everything else starts
+  // empty. Requires an up-to-date CFG.
+  std::vector<Block*> predecessors;
+  std::vector<bool> needs_saved_state;
+  if (FLAGS_promote_context_across_blocks) {
+    uint16_t block_ordinal = 0;
+    auto block = builder->first_block();
+    while (block) {
+      block->ordinal = block_ordinal++;
+      block = block->next;
+    }
+    predecessors.resize(block_ordinal);
+    needs_saved_state.resize(block_ordinal);
+    block = builder->first_block();
+    while (block) {
+      auto predecessor = GetSinglePredecessor(block);
+      if (predecessor && predecessor->ordinal < block->ordinal) {
+        predecessors[block->ordinal] = predecessor;
+        if (predecessor != block->prev) {
+          needs_saved_state[predecessor->ordinal] = true;
+        }
+      }
+      block = block->next;
+    }
+  }
+  std::vector<ContextState> saved_states(needs_saved_state.size());
+
   auto block = builder->first_block();
   while (block) {
+    Block* predecessor =
+        predecessors.empty() ? nullptr : predecessors[block->ordinal];
+    if (!predecessor) {
+      context_validity_.reset();
+    } else if (predecessor != block->prev) {
+      RestoreState(saved_states[predecessor->ordinal]);
+    }
+    // Otherwise the previous block's state is still current.
     PromoteBlock(block);
+    if (!needs_saved_state.empty() && needs_saved_state[block->ordinal]) {
+      SaveState(&saved_states[block->ordinal]);
+    }
     block = block->next;
   }
 
@@ -88,9 +135,53 @@ bool ContextPromotionPass::Run(HIRBuilder* builder) {
   return true;
 }
 
+Block* ContextPromotionPass::GetSinglePredecessor(Block* block) {
+  Block* predecessor = nullptr;
+  auto edge = block->incoming_edge_head;
+  while (edge) {
+    if (predecessor && predecessor != edge->src) {
+      return nullptr;
+    }
+    predecessor = edge->src;
+    edge = edge->incoming_next;
+  }
+
+  // The CFG doesn't include fall-through edges, so add the previous block
+  // unless it definitely doesn't fall through.
+  auto prev = block->prev;
+  if (prev) {
+    auto tail = prev->instr_tail;
+    bool falls_through = !tail || (tail->opcode != &OPCODE_BRANCH_info &&
+                                   tail->opcode != &OPCODE_RETURN_info);
+    if (falls_through) {
+      if (predecessor && predecessor != prev) {
+        return nullptr;
+      }
+      predecessor = prev;
+    }
+  }
+  return predecessor;
+}
+
+void ContextPromotionPass::SaveState(ContextState* state) {
+  state->clear();
+  auto offset = context_validity_.find_first();
+  while (offset != -1) {
+    state->emplace_back(offset, context_values_[offset]);
+    offset = context_validity_.find_next(offset);
+  }
+}
+
+void ContextPromotionPass::RestoreState(const ContextState& state) {
+  context_validity_.reset();
+  for (auto& entry : state) {
+    context_values_[entry.first] = entry.second;
+    context_validity_.set(entry.first);
+  }
+}
+
 void ContextPromotionPass::PromoteBlock(Block* block) {
   auto& validity = context_validity_;
-  validity.reset();
 
   Instr* i = block->instr_head;
   while (i) {
@@ -100,9 +191,14 @@ void ContextPromotionPass::PromoteBlock(Block* block) {
       validity.reset();
     } else if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
       size_t offset = i->src1.offset;
-      if (validity.test(static_cast<uint32_t>(offset))) {
+      if (validity.test(static_cast<uint32_t>(offset)) &&
+          context_values_[offset]->type == i->dest->type) {
         // Legit previous value, reuse.
         Value* previous_value = context_values_[offset];
+        ++loads_eliminated_;
+        if (previous_value->def && previous_value->def->block != block) {
+          ++cross_block_loads_eliminated_;
+        }
         i->opcode = &hir::OPCODE_ASSIGN_info;
         i->set_src1(previous_value);
       } else {
@@ -141,6 +237,7 @@ void ContextPromotionPass::RemoveDeadStoresBlock(Block* block) {
       } else {
         // Already written to. Remove this store.
         i->Remove();
+        ++stores_eliminated_;
       }
     }
     i = prev;
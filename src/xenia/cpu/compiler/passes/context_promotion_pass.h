@@ -11,6 +11,7 @@
 #define XENIA_CPU_COMPILER_PASSES_CONTEXT_PROMOTION_PASS_H_
 
 #include <cmath>
+#include <utility>
 #include <vector>
 
 #include "xenia/base/platform.h"
@@ -40,13 +41,29 @@ class ContextPromotionPass : public CompilerPass {
 
   bool Run(hir::HIRBuilder* builder) override;
 
+  // Statistics from the last run.
+  uint32_t loads_eliminated() const { return loads_eliminated_; }
+  uint32_t cross_block_loads_eliminated() const {
+    return cross_block_loads_eliminated_;
+  }
+  uint32_t stores_eliminated() const { return stores_eliminated_; }
+
  private:
+  typedef std::vector<std::pair<uint32_t, hir::Value*>> ContextState;
+
+  hir::Block* GetSinglePredecessor(hir::Block* block);
+  void SaveState(ContextState* state);
+  void RestoreState(const ContextState& state);
   void PromoteBlock(hir::Block* block);
   void RemoveDeadStoresBlock(hir::Block* block);
 
  private:
   std::vector<hir::Value*> context_values_;
   llvm::BitVector context_validity_;
+
+  uint32_t loads_eliminated_ = 0;
+  uint32_t cross_block_loads_eliminated_ = 0;
+  uint32_t stores_eliminated_ = 0;
 };
 
 }  // namespace passes
@@ -0,0 +1,226 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/dead_store_elimination_pass.h"
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+
+DECLARE_bool(debug);
+DECLARE_bool(store_all_context_values);
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+
+namespace {
+
+// Whether the instruction may look at any part of the context. Conditional
+// branches are flagged volatile but only lead to other blocks of ours.
+bool ReadsWholeContext(const Instr* i) {
+  auto opcode = i->opcode;
+  if (opcode == &OPCODE_CONTEXT_BARRIER_info) {
+    return true;
+  }
+  return opcode->flags & OPCODE_FLAG_VOLATILE &&
+         opcode != &OPCODE_BRANCH_TRUE_info &&
+         opcode != &OPCODE_BRANCH_FALSE_info;
+}
+
+bool AnyLive(const llvm::BitVector& live, size_t offset, size_t size) {
+  for (size_t n = offset; n < offset + size; ++n) {
+    if (live.test(static_cast<unsigned>(n))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+DeadStoreEliminationPass::DeadStoreEliminationPass() : CompilerPass() {}
+
+DeadStoreEliminationPass::~DeadStoreEliminationPass() = default;
+
+bool DeadStoreEliminationPass::Run(HIRBuilder* builder) {
+  SCOPE_profile_cpu_f("cpu");
+
+  context_stores_eliminated_ = 0;
+  memory_stores_eliminated_ = 0;
+
+  // Memory stores first, as they may be what keeps a context load alive.
+  if (FLAGS_eliminate_memory_accesses) {
+    auto block = builder->first_block();
+    while (block) {
+      RemoveDeadMemoryStoresBlock(block);
+      block = block->next;
+    }
+  }
+
+  // Removed stores can't be recovered when extracting register values for
+  // the debugger.
+  if (FLAGS_debug || FLAGS_store_all_context_values) {
+    return true;
+  }
+
+  // Successors from the CFG plus fall-through, which the CFG doesn't record.
+  // Requires an up-to-date CFG.
+  std::vector<Block*> blocks;
+  auto block = builder->first_block();
+  while (block) {
+    block->ordinal = static_cast<uint16_t>(blocks.size());
+    blocks.push_back(block);
+    block = block->next;
+  }
+  successors_.assign(blocks.size(), {});
+  for (auto block : blocks) {
+    auto& successors = successors_[block->ordinal];
+    auto edge = block->outgoing_edge_head;
+    while (edge) {
+      if (std::find(successors.begin(), successors.end(), edge->dest) ==
+          successors.end()) {
+        successors.push_back(edge->dest);
+      }
+      edge = edge->outgoing_next;
+    }
+    auto tail = block->instr_tail;
+    bool falls_through = !tail || (tail->opcode != &OPCODE_BRANCH_info &&
+                                   tail->opcode != &OPCODE_RETURN_info);
+    if (falls_through && block->next &&
+        std::find(successors.begin(), successors.end(), block->next) ==
+            successors.end()) {
+      successors.push_back(block->next);
+    }
+  }
+
+  // Backwards liveness of context bytes, iterated to a fixed point for loops.
+  context_size_ = sizeof(ppc::PPCContext);
+  live_in_.assign(blocks.size(),
+                  llvm::BitVector(static_cast<unsigned>(context_size_)));
+  llvm::BitVector live(static_cast<unsigned>(context_size_));
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto it = blocks.rbegin(); it != blocks.rend(); ++it) {
+      ComputeLiveOut(*it, &live);
+      ScanContextBlock(*it, &live, false);
+      if (live != live_in_[(*it)->ordinal]) {
+        live_in_[(*it)->ordinal] = live;
+        changed = true;
+      }
+    }
+  }
+
+  for (auto block : blocks) {
+    ComputeLiveOut(block, &live);
+    ScanContextBlock(block, &live, true);
+  }
+
+  return true;
+}
+
+void DeadStoreEliminationPass::ComputeLiveOut(Block* block,
+                                              llvm::BitVector* live) {
+  auto& successors = successors_[block->ordinal];
+  if (successors.empty()) {
+    // Leaves the function.
+    live->set();
+    return;
+  }
+  live->reset();
+  for (auto successor : successors) {
+    *live |= live_in_[successor->ordinal];
+  }
+}
+
+void DeadStoreEliminationPass::ScanContextBlock(Block* block,
+                                                llvm::BitVector* live,
+                                                bool remove_dead_stores) {
+  auto i = block->instr_tail;
+  while (i) {
+    auto prev = i->prev;
+    if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+      size_t offset = i->src1.offset;
+      size_t size = GetTypeSize(i->src2.value->type);
+      if (remove_dead_stores && !AnyLive(*live, offset, size)) {
+        i->Remove();
+        ++context_stores_eliminated_;
+      } else {
+        live->reset(static_cast<unsigned>(offset),
+                    static_cast<unsigned>(offset + size));
+      }
+    } else if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+      size_t offset = i->src1.offset;
+      size_t size = GetTypeSize(i->dest->type);
+      live->set(static_cast<unsigned>(offset),
+                static_cast<unsigned>(offset + size));
+    } else if (ReadsWholeContext(i)) {
+      live->set();
+    }
+    i = prev;
+  }
+}
+
+void DeadStoreEliminationPass::RemoveDeadMemoryStoresBlock(Block* block) {
+  // Walk backwards remembering the stores that are certain to happen before
+  // anything else can look at memory.
+  pending_stores_.clear();
+  auto i = block->instr_tail;
+  while (i) {
+    auto prev = i->prev;
+    auto opcode = i->opcode;
+    if (opcode == &OPCODE_STORE_info) {
+      auto location = MemoryLocation::FromInstr(i);
+      if (location.IsPlainMemory()) {
+        bool overwritten = std::any_of(
+            pending_stores_.begin(), pending_stores_.end(),
+            [&](const MemoryLocation& pending) {
+              return pending.Covers(location);
+            });
+        if (overwritten) {
+          i->Remove();
+          ++memory_stores_eliminated_;
+        } else {
+          pending_stores_.push_back(location);
+        }
+      }
+    } else if (opcode == &OPCODE_LOAD_info) {
+      auto location = MemoryLocation::FromInstr(i);
+      pending_stores_.erase(
+          std::remove_if(pending_stores_.begin(), pending_stores_.end(),
+                         [&](const MemoryLocation& pending) {
+                           return pending.MayAlias(location);
+                         }),
+          pending_stores_.end());
+    } else if (opcode->flags & (OPCODE_FLAG_VOLATILE | OPCODE_FLAG_MEMORY) &&
+               opcode != &OPCODE_PREFETCH_info) {
+      // Calls, atomics, barriers, MMIO and memsets.
+      pending_stores_.clear();
+    }
+    i = prev;
+  }
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
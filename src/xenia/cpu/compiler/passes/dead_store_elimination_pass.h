@@ -0,0 +1,85 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
+
+#include <cmath>
+#include <vector>
+
+#include "xenia/base/platform.h"
+#include "xenia/cpu/compiler/alias_analysis.h"
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+#if XE_COMPILER_MSVC
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#pragma warning(disable : 4267)
+#include <llvm/ADT/BitVector.h>
+#pragma warning(pop)
+#else
+#include <llvm/ADT/BitVector.h>
+#endif  // XE_COMPILER_MSVC
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Removes stores whose value can never be observed.
+// Context stores are removed when every path from them overwrites the bytes
+// before anything could read them. The context is observable by everything
+// outside of the function, so all bytes are live at calls, returns and other
+// volatile instructions:
+//   store_context +100, v0   <-- removed
+//   branch_true v5, label
+//   ...
+//   store_context +100, v1   (on both paths)
+// Memory stores are only removed when overwritten later in the same block
+// with nothing in between that may read them, and only for memory known not
+// to be MMIO (see MemoryLocation::IsPlainMemory).
+class DeadStoreEliminationPass : public CompilerPass {
+ public:
+  DeadStoreEliminationPass();
+  ~DeadStoreEliminationPass() override;
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+  // Statistics from the last run.
+  uint32_t context_stores_eliminated() const {
+    return context_stores_eliminated_;
+  }
+  uint32_t memory_stores_eliminated() const {
+    return memory_stores_eliminated_;
+  }
+
+ private:
+  void ComputeLiveOut(hir::Block* block, llvm::BitVector* live);
+  // Walks the block backwards from live-out to live-in, optionally removing
+  // stores to bytes that aren't live.
+  void ScanContextBlock(hir::Block* block, llvm::BitVector* live,
+                        bool remove_dead_stores);
+  void RemoveDeadMemoryStoresBlock(hir::Block* block);
+
+  size_t context_size_ = 0;
+  // Indexed by block ordinal.
+  std::vector<std::vector<hir::Block*>> successors_;
+  std::vector<llvm::BitVector> live_in_;
+  std::vector<MemoryLocation> pending_stores_;
+
+  uint32_t context_stores_eliminated_ = 0;
+  uint32_t memory_stores_eliminated_ = 0;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
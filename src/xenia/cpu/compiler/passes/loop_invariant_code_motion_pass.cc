@@ -0,0 +1,298 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/loop_invariant_code_motion_pass.h"
+
+#include <algorithm>
+
+#include "xenia/base/profiling.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Value;
+
+namespace {
+
+// Whether the instruction has no side effects and can't fault, so that it is
+// safe to execute even when the loop (or the block it was in) wouldn't have.
+bool IsSpeculatable(const Instr* i) {
+  switch (i->opcode->num) {
+    case OPCODE_ASSIGN:
+    case OPCODE_CAST:
+    case OPCODE_ZERO_EXTEND:
+    case OPCODE_SIGN_EXTEND:
+    case OPCODE_TRUNCATE:
+    case OPCODE_BYTE_SWAP:
+    case OPCODE_LOAD_VECTOR_SHL:
+    case OPCODE_LOAD_VECTOR_SHR:
+    case OPCODE_PERMUTE:
+    case OPCODE_SWIZZLE:
+    case OPCODE_SPLAT:
+    case OPCODE_EXTRACT:
+    case OPCODE_INSERT:
+    case OPCODE_AND:
+    case OPCODE_OR:
+    case OPCODE_XOR:
+    case OPCODE_NOT:
+    case OPCODE_SELECT:
+      return true;
+    case OPCODE_ADD:
+    case OPCODE_SUB:
+    case OPCODE_MUL:
+    case OPCODE_NEG:
+    case OPCODE_SHL:
+    case OPCODE_SHR:
+    case OPCODE_SHA:
+    case OPCODE_ROTATE_LEFT:
+    case OPCODE_CNTLZ:
+      // Integer only; float results depend on the rounding mode.
+      return i->dest->type <= INT64_TYPE && !(i->flags & ARITHMETIC_SATURATE);
+    case OPCODE_IS_TRUE:
+    case OPCODE_IS_FALSE:
+    case OPCODE_COMPARE_EQ:
+    case OPCODE_COMPARE_NE:
+    case OPCODE_COMPARE_SLT:
+    case OPCODE_COMPARE_SLE:
+    case OPCODE_COMPARE_SGT:
+    case OPCODE_COMPARE_SGE:
+    case OPCODE_COMPARE_ULT:
+    case OPCODE_COMPARE_ULE:
+    case OPCODE_COMPARE_UGT:
+    case OPCODE_COMPARE_UGE:
+      return i->src1.value->type <= INT64_TYPE;
+    default:
+      return false;
+  }
+}
+
+// Whether the instruction is worth hoisting on its own. Plain loads would
+// just become loads of a local.
+bool IsProfitable(const Instr* i) {
+  return i->opcode != &OPCODE_LOAD_CONTEXT_info &&
+         i->opcode != &OPCODE_ASSIGN_info && i->opcode != &OPCODE_CAST_info;
+}
+
+}  // namespace
+
+LoopInvariantCodeMotionPass::LoopInvariantCodeMotionPass() : CompilerPass() {}
+
+LoopInvariantCodeMotionPass::~LoopInvariantCodeMotionPass() = default;
+
+bool LoopInvariantCodeMotionPass::Run(HIRBuilder* builder) {
+  SCOPE_profile_cpu_f("cpu");
+
+  instrs_hoisted_ = 0;
+
+  loop_analysis_.Analyze(builder);
+  if (loop_analysis_.loops().empty()) {
+    return true;
+  }
+
+  // Innermost loops go first so that their hoisted code can be considered
+  // again for the enclosing loop.
+  for (auto& loop : loop_analysis_.loops()) {
+    if (!loop.preheader || !loop.preheader->instr_tail) {
+      continue;
+    }
+    HoistLoop(builder, loop);
+  }
+
+  return true;
+}
+
+bool LoopInvariantCodeMotionPass::IsInvariant(const Loop& loop, Instr* i) {
+  if (i->opcode->flags & OPCODE_FLAG_PAIRED_PREV ||
+      (i->next && i->next->opcode->flags & OPCODE_FLAG_PAIRED_PREV)) {
+    // Must stay next to its partner.
+    return false;
+  }
+
+  if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+    return !loop.clobbers_context &&
+           !loop.StoresContext(i->src1.offset, GetTypeSize(i->dest->type));
+  }
+
+  if (!IsSpeculatable(i)) {
+    return false;
+  }
+  Value* srcs[] = {nullptr, nullptr, nullptr};
+  uint32_t signature = i->opcode->signature;
+  if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V) {
+    srcs[0] = i->src1.value;
+  }
+  if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V) {
+    srcs[1] = i->src2.value;
+  }
+  if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V) {
+    srcs[2] = i->src3.value;
+  }
+  for (auto src : srcs) {
+    if (!src || src->IsConstant()) {
+      continue;
+    }
+    if (!src->def || !loop.Contains(src->def->block)) {
+      // Defined before the loop.
+      continue;
+    }
+    if (src->ordinal >= invariant_values_.size() ||
+        !invariant_values_[src->ordinal]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void LoopInvariantCodeMotionPass::HoistLoop(HIRBuilder* builder,
+                                            const Loop& loop) {
+  invariant_values_.assign(builder->max_value_ordinal(), false);
+
+  // Find everything invariant. Definitions come before their uses in block
+  // order, so a single walk is enough.
+  std::vector<Instr*> invariant_instrs;
+  for (auto block : loop.blocks) {
+    auto i = block->instr_head;
+    while (i) {
+      if (i->dest && i->dest->ordinal < invariant_values_.size() &&
+          IsInvariant(loop, i)) {
+        invariant_values_[i->dest->ordinal] = true;
+        invariant_instrs.push_back(i);
+      }
+      i = i->next;
+    }
+  }
+  if (invariant_instrs.empty()) {
+    return;
+  }
+
+  // Only hoist the profitable instructions and whatever they depend on.
+  std::vector<bool> hoist(invariant_instrs.size());
+  for (size_t n = invariant_instrs.size(); n-- > 0;) {
+    auto i = invariant_instrs[n];
+    if (!hoist[n]) {
+      if (!IsProfitable(i) || !i->dest->use_head) {
+        continue;
+      }
+      hoist[n] = true;
+    }
+    uint32_t signature = i->opcode->signature;
+    Value* srcs[] = {
+        GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V
+            ? i->src1.value
+            : nullptr,
+        GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V
+            ? i->src2.value
+            : nullptr,
+        GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V
+            ? i->src3.value
+            : nullptr,
+    };
+    for (auto src : srcs) {
+      if (!src || !src->def || !loop.Contains(src->def->block)) {
+        continue;
+      }
+      auto it = std::find(invariant_instrs.begin(),
+                          invariant_instrs.begin() + n, src->def);
+      if (it != invariant_instrs.begin() + n) {
+        hoist[it - invariant_instrs.begin()] = true;
+      }
+    }
+  }
+
+  std::vector<Value*> hoisted_values;
+  for (size_t n = 0; n < invariant_instrs.size(); ++n) {
+    if (!hoist[n]) {
+      continue;
+    }
+    auto i = invariant_instrs[n];
+    loop.MoveToPreheader(i);
+    hoisted_values.push_back(i->dest);
+    ++instrs_hoisted_;
+  }
+
+  // Anything used outside of the preheader has to go through a local.
+  for (auto value : hoisted_values) {
+    auto use = value->use_head;
+    while (use) {
+      if (use->instr->block != loop.preheader) {
+        PassThroughLocal(builder, loop, value);
+        break;
+      }
+      use = use->next;
+    }
+  }
+}
+
+void LoopInvariantCodeMotionPass::PassThroughLocal(HIRBuilder* builder,
+                                                   const Loop& loop,
+                                                   Value* value) {
+  auto slot = builder->AllocLocal(value->type);
+  builder->StoreLocal(slot, value);
+  builder->last_instr()->MoveAfter(value->def);
+
+  // Group the remaining uses by block.
+  std::vector<Instr*> users;
+  auto use = value->use_head;
+  while (use) {
+    auto instr = use->instr;
+    if (instr->block != loop.preheader &&
+        std::find(users.begin(), users.end(), instr) == users.end()) {
+      users.push_back(instr);
+    }
+    use = use->next;
+  }
+  std::vector<Block*> blocks;
+  for (auto instr : users) {
+    if (std::find(blocks.begin(), blocks.end(), instr->block) ==
+        blocks.end()) {
+      blocks.push_back(instr->block);
+    }
+  }
+
+  // Reload once per block, before the first user.
+  for (auto block : blocks) {
+    auto first_user = block->instr_head;
+    while (std::find(users.begin(), users.end(), first_user) == users.end()) {
+      first_user = first_user->next;
+    }
+    while (first_user->opcode->flags & OPCODE_FLAG_PAIRED_PREV) {
+      first_user = first_user->prev;
+    }
+    auto new_value = builder->LoadLocal(slot);
+    builder->last_instr()->MoveBefore(first_user);
+
+    for (auto instr : users) {
+      if (instr->block != block) {
+        continue;
+      }
+      if (instr->src1.value == value) {
+        instr->set_src1(new_value);
+      }
+      if (instr->src2.value == value) {
+        instr->set_src2(new_value);
+      }
+      if (instr->src3.value == value) {
+        instr->set_src3(new_value);
+      }
+    }
+  }
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
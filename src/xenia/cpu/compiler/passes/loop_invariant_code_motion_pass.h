@@ -0,0 +1,53 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_LOOP_INVARIANT_CODE_MOTION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_LOOP_INVARIANT_CODE_MOTION_PASS_H_
+
+#include <vector>
+
+#include "xenia/cpu/compiler/compiler_pass.h"
+#include "xenia/cpu/compiler/loop_analysis.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Hoists side-effect free computations whose inputs don't change within a
+// loop into the loop preheader. Values are not live across blocks at loop
+// headers, so hoisted results the loop still needs are passed through locals.
+class LoopInvariantCodeMotionPass : public CompilerPass {
+ public:
+  LoopInvariantCodeMotionPass();
+  ~LoopInvariantCodeMotionPass() override;
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+  // Statistics from the last run.
+  uint32_t instrs_hoisted() const { return instrs_hoisted_; }
+
+ private:
+  bool IsInvariant(const Loop& loop, hir::Instr* i);
+  void HoistLoop(hir::HIRBuilder* builder, const Loop& loop);
+  void PassThroughLocal(hir::HIRBuilder* builder, const Loop& loop,
+                        hir::Value* value);
+
+  LoopAnalysis loop_analysis_;
+  // Indexed by value ordinal.
+  std::vector<bool> invariant_values_;
+  uint32_t instrs_hoisted_ = 0;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_LOOP_INVARIANT_CODE_MOTION_PASS_H_
@@ -0,0 +1,145 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/redundant_load_elimination_pass.h"
+
+#include <algorithm>
+
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/cpu_flags.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Value;
+
+RedundantLoadEliminationPass::RedundantLoadEliminationPass()
+    : CompilerPass() {}
+
+RedundantLoadEliminationPass::~RedundantLoadEliminationPass() = default;
+
+bool RedundantLoadEliminationPass::Run(HIRBuilder* builder) {
+  SCOPE_profile_cpu_f("cpu");
+
+  context_loads_eliminated_ = 0;
+  memory_loads_eliminated_ = 0;
+
+  auto block = builder->first_block();
+  while (block) {
+    EliminateBlock(block);
+    block = block->next;
+  }
+
+  return true;
+}
+
+void RedundantLoadEliminationPass::EliminateBlock(Block* block) {
+  context_values_.clear();
+  memory_values_.clear();
+
+  auto i = block->instr_head;
+  while (i) {
+    auto opcode = i->opcode;
+    if (opcode == &OPCODE_LOAD_CONTEXT_info) {
+      size_t offset = i->src1.offset;
+      auto it = std::find_if(context_values_.begin(), context_values_.end(),
+                             [&](const ContextValue& entry) {
+                               return entry.offset == offset &&
+                                      entry.value->type == i->dest->type;
+                             });
+      if (it != context_values_.end()) {
+        i->opcode = &OPCODE_ASSIGN_info;
+        i->set_src1(it->value);
+        ++context_loads_eliminated_;
+      } else {
+        context_values_.push_back(
+            {offset, GetTypeSize(i->dest->type), i->dest});
+      }
+    } else if (opcode == &OPCODE_STORE_CONTEXT_info) {
+      size_t offset = i->src1.offset;
+      size_t size = GetTypeSize(i->src2.value->type);
+      InvalidateContext(offset, size);
+      context_values_.push_back({offset, size, i->src2.value});
+    } else if (opcode == &OPCODE_CONTEXT_BARRIER_info) {
+      context_values_.clear();
+    } else if (opcode == &OPCODE_LOAD_info) {
+      auto location = MemoryLocation::FromInstr(i);
+      if (!FLAGS_eliminate_memory_accesses || !location.IsPlainMemory()) {
+        i = i->next;
+        continue;
+      }
+      auto it = std::find_if(
+          memory_values_.begin(), memory_values_.end(),
+          [&](const MemoryValue& entry) {
+            return entry.flags == i->flags &&
+                   entry.value->type == i->dest->type &&
+                   entry.location.Covers(location) &&
+                   entry.location.offset == location.offset;
+          });
+      if (it != memory_values_.end()) {
+        // Byte swapped stores and loads cancel out, so matching flags is
+        // enough.
+        i->Replace(&OPCODE_ASSIGN_info, 0);
+        i->set_src1(it->value);
+        ++memory_loads_eliminated_;
+      } else {
+        memory_values_.push_back({location, i->flags, i->dest});
+      }
+    } else if (opcode == &OPCODE_STORE_info) {
+      auto location = MemoryLocation::FromInstr(i);
+      InvalidateMemory(location);
+      if (FLAGS_eliminate_memory_accesses && location.IsPlainMemory()) {
+        memory_values_.push_back({location, i->flags, i->src2.value});
+      }
+    } else if (opcode->flags & OPCODE_FLAG_VOLATILE) {
+      // Calls, traps, atomics, barriers: anything may have changed.
+      context_values_.clear();
+      memory_values_.clear();
+    } else if (opcode->flags & OPCODE_FLAG_MEMORY &&
+               opcode != &OPCODE_PREFETCH_info) {
+      // MMIO accesses and memsets.
+      memory_values_.clear();
+    }
+    i = i->next;
+  }
+}
+
+void RedundantLoadEliminationPass::InvalidateContext(size_t offset,
+                                                     size_t size) {
+  context_values_.erase(
+      std::remove_if(context_values_.begin(), context_values_.end(),
+                     [&](const ContextValue& entry) {
+                       return ContextRangesOverlap(entry.offset, entry.size,
+                                                   offset, size);
+                     }),
+      context_values_.end());
+}
+
+void RedundantLoadEliminationPass::InvalidateMemory(
+    const MemoryLocation& location) {
+  memory_values_.erase(
+      std::remove_if(memory_values_.begin(), memory_values_.end(),
+                     [&](const MemoryValue& entry) {
+                       return entry.location.MayAlias(location);
+                     }),
+      memory_values_.end());
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,73 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_REDUNDANT_LOAD_ELIMINATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_REDUNDANT_LOAD_ELIMINATION_PASS_H_
+
+#include <vector>
+
+#include "xenia/cpu/compiler/alias_analysis.h"
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Replaces loads of context slots and guest memory that were already loaded
+// or stored earlier in the block with the value that is known to be there:
+//   store_context +100, v0
+//   v1 = load_context +100   <-- v1 = v0
+//   v2 = load v10             (stack)
+//   v3 = load v10             <-- v3 = v2
+// Unlike ContextPromotionPass this tracks the size of each access, so a
+// store to part of a slot invalidates it. Memory is only handled when it is
+// known not to be MMIO (see MemoryLocation::IsPlainMemory).
+class RedundantLoadEliminationPass : public CompilerPass {
+ public:
+  RedundantLoadEliminationPass();
+  ~RedundantLoadEliminationPass() override;
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+  // Statistics from the last run.
+  uint32_t context_loads_eliminated() const {
+    return context_loads_eliminated_;
+  }
+  uint32_t memory_loads_eliminated() const { return memory_loads_eliminated_; }
+
+ private:
+  struct ContextValue {
+    size_t offset;
+    size_t size;
+    hir::Value* value;
+  };
+  struct MemoryValue {
+    MemoryLocation location;
+    uint32_t flags;
+    hir::Value* value;
+  };
+
+  void EliminateBlock(hir::Block* block);
+  void InvalidateContext(size_t offset, size_t size);
+  void InvalidateMemory(const MemoryLocation& location);
+
+  std::vector<ContextValue> context_values_;
+  std::vector<MemoryValue> memory_values_;
+
+  uint32_t context_loads_eliminated_ = 0;
+  uint32_t memory_loads_eliminated_ = 0;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_REDUNDANT_LOAD_ELIMINATION_PASS_H_
@@ -71,32 +71,38 @@ RegisterAllocationPass::~RegisterAllocationPass() {
 }
 
 bool RegisterAllocationPass::Run(HIRBuilder* builder) {
-  // Simple per-block allocator that operates on SSA form.
-  // Registers do not move across blocks, though this could be
-  // optimized with some intra-block analysis (dominators/etc).
+  // Simple linear scan allocator that operates on SSA form.
+  // Allocation runs over the whole function in block order, so values that
+  // are live across blocks (such as context values promoted into a single
+  // successor) stay in the same register. A value is considered live from its
+  // definition to its last use in block order, which is conservative but
+  // correct as long as definitions dominate their uses.
   // Really, it'd just be nice to have someone who knew what they
   // were doing lower SSA and do this right.
 
+  // Renumber all instructions up front. This is required so that we can sort
+  // the usage pointers below, which may point into later blocks.
   uint16_t block_ordinal = 0;
   uint32_t instr_ordinal = 0;
   auto block = builder->first_block();
   while (block) {
     // Sequential block ordinals.
     block->ordinal = block_ordinal++;
-
-    // Reset all state.
-    PrepareBlockState();
-
-    // Renumber all instructions in the block. This is required so that
-    // we can sort the usage pointers below.
     auto instr = block->instr_head;
     while (instr) {
       // Sequential global instruction ordinals.
       instr->ordinal = instr_ordinal++;
       instr = instr->next;
     }
+    block = block->next;
+  }
+
+  // Reset all state.
+  PrepareBlockState();
 
-    instr = block->instr_head;
+  block = builder->first_block();
+  while (block) {
+    auto instr = block->instr_head;
     while (instr) {
       const auto info = instr->opcode;
       uint32_t signature = info->signature;
@@ -247,8 +253,6 @@ void RegisterAllocationPass::AdvanceUses(Instr* instr) {
         // Remove the iterator.
         auto value = upcoming_use.value;
         upcoming_uses.erase(upcoming_uses.begin() + j);
-        assert_true(next_use->instr->block == instr->block);
-        assert_true(value->def->block == instr->block);
         upcoming_uses.emplace_back(value, next_use);
         // i remains the same.
         continue;
@@ -350,8 +354,6 @@ bool RegisterAllocationPass::SpillOneRegister(HIRBuilder* builder, Block* block,
   auto furthest_usage = std::max_element(usage_set->upcoming_uses.begin(),
                                          usage_set->upcoming_uses.end(),
                                          RegisterUsage::Comparer());
-  assert_true(furthest_usage->value->def->block == block);
-  assert_true(furthest_usage->use->instr->block == block);
   auto spill_value = furthest_usage->value;
   Value::Use* prev_use = furthest_usage->use->prev;
   Value::Use* next_use = furthest_usage->use;
@@ -380,7 +382,21 @@ bool RegisterAllocationPass::SpillOneRegister(HIRBuilder* builder, Block* block,
     auto spill_store = builder->last_instr();
     auto spill_store_use = spill_store->src2_use;
     assert_null(spill_store_use->prev);
-    if (prev_use && prev_use->instr->opcode->flags & OPCODE_FLAG_PAIRED_PREV) {
+    if (next_use->instr->block != spill_value->def->block) {
+      // The next use is in a later block. Any previous use may be on a path
+      // that doesn't reach it, so store right after the define (which
+      // dominates all uses) instead.
+      auto insert_after = spill_value->def;
+      while (insert_after->next &&
+             insert_after->next->opcode->flags & OPCODE_FLAG_PAIRED_PREV) {
+        insert_after = insert_after->next;
+      }
+      spill_store->MoveAfter(insert_after);
+
+      // Update last use.
+      spill_value->last_use = prev_use ? prev_use->instr : spill_store;
+    } else if (prev_use &&
+               prev_use->instr->opcode->flags & OPCODE_FLAG_PAIRED_PREV) {
       // Instruction is paired. This is bad. We will insert the spill after the
       // paired instruction.
       assert_not_null(prev_use->instr->next);
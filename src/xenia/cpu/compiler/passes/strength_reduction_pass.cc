@@ -0,0 +1,292 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/strength_reduction_pass.h"
+
+#include "xenia/base/profiling.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::TypeName;
+using xe::cpu::hir::Value;
+
+namespace {
+
+Value* LoadConstantOfType(HIRBuilder* builder, TypeName type,
+                          uint64_t value) {
+  switch (type) {
+    case INT8_TYPE:
+      return builder->LoadConstantUint8(static_cast<uint8_t>(value));
+    case INT16_TYPE:
+      return builder->LoadConstantUint16(static_cast<uint16_t>(value));
+    case INT32_TYPE:
+      return builder->LoadConstantUint32(static_cast<uint32_t>(value));
+    default:
+      return builder->LoadConstantUint64(value);
+  }
+}
+
+uint64_t TruncateToType(TypeName type, uint64_t value) {
+  size_t size = GetTypeSize(type);
+  return size < 8 ? value & ((1ull << (size * 8)) - 1) : value;
+}
+
+}  // namespace
+
+StrengthReductionPass::StrengthReductionPass() : CompilerPass() {}
+
+StrengthReductionPass::~StrengthReductionPass() = default;
+
+bool StrengthReductionPass::Run(HIRBuilder* builder) {
+  SCOPE_profile_cpu_f("cpu");
+
+  instrs_reduced_ = 0;
+
+  loop_analysis_.Analyze(builder);
+  for (auto& loop : loop_analysis_.loops()) {
+    if (!loop.preheader || !loop.preheader->instr_tail ||
+        loop.clobbers_context) {
+      continue;
+    }
+    ReduceLoop(builder, loop);
+  }
+
+  return true;
+}
+
+void StrengthReductionPass::FindInductionVariables(const Loop& loop) {
+  induction_variables_.clear();
+  for (auto store : loop.context_stores) {
+    size_t offset = store->src1.offset;
+    Value* value = store->src2.value;
+    if (value->type > INT64_TYPE) {
+      continue;
+    }
+
+    // Must be the only store touching the slot.
+    size_t size = GetTypeSize(value->type);
+    size_t store_count = 0;
+    for (auto other : loop.context_stores) {
+      size_t other_offset = other->src1.offset;
+      size_t other_size = GetTypeSize(other->src2.value->type);
+      if (other_offset < offset + size && offset < other_offset + other_size) {
+        ++store_count;
+      }
+    }
+    if (store_count != 1) {
+      continue;
+    }
+
+    // Stores the loaded value plus or minus a constant.
+    auto def = value->def;
+    if (!def || def->flags & ARITHMETIC_SATURATE) {
+      continue;
+    }
+    Value* base = nullptr;
+    Value* step = nullptr;
+    bool negate = false;
+    if (def->opcode == &OPCODE_ADD_info) {
+      if (def->src2.value->IsConstant()) {
+        base = def->src1.value;
+        step = def->src2.value;
+      } else if (def->src1.value->IsConstant()) {
+        base = def->src2.value;
+        step = def->src1.value;
+      }
+    } else if (def->opcode == &OPCODE_SUB_info) {
+      if (def->src2.value->IsConstant()) {
+        base = def->src1.value;
+        step = def->src2.value;
+        negate = true;
+      }
+    }
+    if (!base || base->IsConstant() || !base->def ||
+        base->def->opcode != &OPCODE_LOAD_CONTEXT_info ||
+        base->def->src1.offset != offset || base->type != value->type ||
+        !loop.Contains(base->def->block)) {
+      continue;
+    }
+
+    InductionVariable iv;
+    iv.offset = offset;
+    iv.type = value->type;
+    iv.store = store;
+    iv.step = negate ? 0 - step->AsUint64() : step->AsUint64();
+    induction_variables_.push_back(iv);
+  }
+}
+
+const StrengthReductionPass::InductionVariable*
+StrengthReductionPass::GetInductionVariableLoad(const Loop& loop,
+                                                Value* value) {
+  if (value->IsConstant() || !value->def ||
+      value->def->opcode != &OPCODE_LOAD_CONTEXT_info ||
+      !loop.Contains(value->def->block)) {
+    return nullptr;
+  }
+  for (auto& iv : induction_variables_) {
+    if (iv.offset == value->def->src1.offset && iv.type == value->type) {
+      return &iv;
+    }
+  }
+  return nullptr;
+}
+
+bool StrengthReductionPass::MatchDerived(const Loop& loop, Instr* i,
+                                         DerivedVariable* derived) {
+  if (!i->dest || i->dest->type > INT64_TYPE) {
+    return false;
+  }
+
+  Value* x = nullptr;
+  uint64_t multiplier = 0;
+  if (i->opcode == &OPCODE_MUL_info) {
+    if (i->flags & ARITHMETIC_SATURATE) {
+      return false;
+    }
+    if (i->src2.value->IsConstant()) {
+      x = i->src1.value;
+      multiplier = i->src2.value->AsUint64();
+    } else if (i->src1.value->IsConstant()) {
+      x = i->src2.value;
+      multiplier = i->src1.value->AsUint64();
+    }
+  } else if (i->opcode == &OPCODE_SHL_info) {
+    if (i->src2.value->IsConstant()) {
+      uint64_t shift = i->src2.value->AsUint64();
+      if (shift < GetTypeSize(i->dest->type) * 8) {
+        x = i->src1.value;
+        multiplier = 1ull << shift;
+      }
+    }
+  }
+  if (!x || x->IsConstant()) {
+    return false;
+  }
+
+  Value* base = x;
+  bool truncated = false;
+  if (x->def && x->def->opcode == &OPCODE_TRUNCATE_info) {
+    base = x->def->src1.value;
+    truncated = true;
+  }
+  auto iv = GetInductionVariableLoad(loop, base);
+  if (!iv || (!truncated && iv->type != i->dest->type)) {
+    return false;
+  }
+
+  // The local is stepped right after the store, so it only matches the loaded
+  // value if the store isn't between the load and us.
+  auto load = base->def;
+  if (load->block != i->block) {
+    return false;
+  }
+  auto walk = load->next;
+  while (walk && walk != i) {
+    if (walk == iv->store) {
+      return false;
+    }
+    walk = walk->next;
+  }
+  if (!walk) {
+    return false;
+  }
+
+  derived->base = iv;
+  derived->type = i->dest->type;
+  derived->truncated = truncated;
+  derived->multiplier = TruncateToType(i->dest->type, multiplier);
+  derived->instr = i;
+  derived->slot = nullptr;
+  return true;
+}
+
+void StrengthReductionPass::ReduceLoop(HIRBuilder* builder,
+                                       const Loop& loop) {
+  FindInductionVariables(loop);
+  if (induction_variables_.empty()) {
+    return;
+  }
+
+  std::vector<DerivedVariable> derived_variables;
+  for (auto block : loop.blocks) {
+    auto i = block->instr_head;
+    while (i) {
+      DerivedVariable derived;
+      if (!MatchDerived(loop, i, &derived)) {
+        i = i->next;
+        continue;
+      }
+
+      // Share the local with identical derived variables.
+      Value* slot = nullptr;
+      for (auto& existing : derived_variables) {
+        if (existing.base == derived.base && existing.type == derived.type &&
+            existing.truncated == derived.truncated &&
+            existing.multiplier == derived.multiplier) {
+          slot = existing.slot;
+          break;
+        }
+      }
+      if (!slot) {
+        auto iv = derived.base;
+        slot = builder->AllocLocal(derived.type);
+        derived.slot = slot;
+        derived_variables.push_back(derived);
+
+        // Initialize from the induction variable on the way in.
+        auto value = builder->LoadContext(iv->offset, iv->type);
+        loop.MoveToPreheader(value->def);
+        if (derived.truncated) {
+          value = builder->Truncate(value, derived.type);
+          loop.MoveToPreheader(value->def);
+        }
+        value = builder->Mul(
+            value,
+            LoadConstantOfType(builder, derived.type, derived.multiplier));
+        loop.MoveToPreheader(value->def);
+        builder->StoreLocal(slot, value);
+        loop.MoveToPreheader(builder->last_instr());
+
+        // Step alongside the induction variable.
+        uint64_t delta =
+            TruncateToType(derived.type, iv->step * derived.multiplier);
+        if (delta) {
+          auto current = builder->LoadLocal(slot);
+          current->def->MoveAfter(iv->store);
+          auto next = builder->Add(
+              current, LoadConstantOfType(builder, derived.type, delta));
+          next->def->MoveAfter(current->def);
+          builder->StoreLocal(slot, next);
+          builder->last_instr()->MoveAfter(next->def);
+        }
+      }
+
+      // Replace the multiply with a load of the local.
+      i->Replace(&OPCODE_LOAD_LOCAL_info, 0);
+      i->set_src1(slot);
+      ++instrs_reduced_;
+
+      i = i->next;
+    }
+  }
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
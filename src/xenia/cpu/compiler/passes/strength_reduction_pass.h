@@ -0,0 +1,76 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_STRENGTH_REDUCTION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_STRENGTH_REDUCTION_PASS_H_
+
+#include <vector>
+
+#include "xenia/cpu/compiler/compiler_pass.h"
+#include "xenia/cpu/compiler/loop_analysis.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Replaces multiplies (and shifts) of a loop induction variable by a constant
+// with a second induction variable kept in a local and stepped alongside it:
+//   loop:                          preheader:
+//     v0 = load_context +r3          t = mul (load_context +r3), 4
+//     v1 = mul v0, 4           =>  loop:
+//     ...                            v1 = load_local t
+//     store_context +r3, v0 + 1      store_context +r3, v0 + 1
+//                                    store_local t, (load_local t) + 4
+// An induction variable is a context slot that is stored exactly once in the
+// loop, with its own value plus a constant.
+class StrengthReductionPass : public CompilerPass {
+ public:
+  StrengthReductionPass();
+  ~StrengthReductionPass() override;
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+  // Statistics from the last run.
+  uint32_t instrs_reduced() const { return instrs_reduced_; }
+
+ private:
+  struct InductionVariable {
+    size_t offset;
+    hir::TypeName type;
+    hir::Instr* store;
+    uint64_t step;
+  };
+  struct DerivedVariable {
+    const InductionVariable* base;
+    hir::TypeName type;
+    bool truncated;
+    uint64_t multiplier;
+    // The original multiply; rebuilt in the preheader.
+    hir::Instr* instr;
+    hir::Value* slot;
+  };
+
+  void FindInductionVariables(const Loop& loop);
+  const InductionVariable* GetInductionVariableLoad(const Loop& loop,
+                                                    hir::Value* value);
+  bool MatchDerived(const Loop& loop, hir::Instr* i, DerivedVariable* derived);
+  void ReduceLoop(hir::HIRBuilder* builder, const Loop& loop);
+
+  LoopAnalysis loop_analysis_;
+  std::vector<InductionVariable> induction_variables_;
+  uint32_t instrs_reduced_ = 0;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_STRENGTH_REDUCTION_PASS_H_
@@ -75,9 +75,15 @@ bool ValidationPass::ValidateInstruction(Block* block, Instr* instr) {
 
   if (instr->dest) {
     assert_true(instr->dest->def == instr);
+    // Values may be used in later blocks (context promotion carries them
+    // into single-predecessor successors), but never in earlier ones.
     auto use = instr->dest->use_head;
     while (use) {
-      assert_true(use->instr->block == block);
+      auto use_block = use->instr->block;
+      while (use_block && use_block != block) {
+        use_block = use_block->prev;
+      }
+      assert_true(use_block == block);
       use = use->next;
     }
   }
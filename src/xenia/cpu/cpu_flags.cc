@@ -34,6 +34,25 @@ DEFINE_bool(
 
 DEFINE_bool(validate_hir, false,
             "Perform validation checks on the HIR during compilation.");
+DEFINE_bool(optimize_loops, true,
+            "Hoist loop-invariant code and strength-reduce induction "
+            "variables.");
+DEFINE_bool(eliminate_memory_accesses, true,
+            "Remove redundant loads and dead stores to guest memory that is "
+            "known not to be MMIO (the stack and low constant addresses).");
+DEFINE_bool(log_context_promotion, false,
+            "Log the number of context loads and stores each function had "
+            "eliminated by register promotion.");
+
+DEFINE_int32(pretranslate_threads, 0,
+             "Number of background threads translating discovered guest "
+             "functions ahead of time. 0 to only translate on demand.");
+DEFINE_bool(tiered_jit, false,
+            "Translate functions with minimal optimization first and "
+            "retranslate hot ones with all passes in the background.");
+DEFINE_int32(tier_up_threshold, 2000,
+             "Number of calls and loop iterations after which a tier 0 "
+             "function is queued for retranslation.");
 
 // Breakpoints:
 DEFINE_uint64(break_on_instruction, 0,
@@ -26,6 +26,13 @@ DECLARE_bool(trace_function_data);
 DECLARE_bool(disable_global_lock);
 
 DECLARE_bool(validate_hir);
+DECLARE_bool(optimize_loops);
+DECLARE_bool(eliminate_memory_accesses);
+DECLARE_bool(log_context_promotion);
+
+DECLARE_int32(pretranslate_threads);
+DECLARE_bool(tiered_jit);
+DECLARE_int32(tier_up_threshold);
 
 DECLARE_uint64(break_on_instruction);
 DECLARE_int32(break_condition_gpr);
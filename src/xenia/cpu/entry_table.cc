@@ -15,23 +15,59 @@
 namespace xe {
 namespace cpu {
 
-EntryTable::EntryTable() = default;
+EntryTable::EntryTable() {
+  for (auto& page : pages_) {
+    page.store(nullptr, std::memory_order_relaxed);
+  }
+}
 
 EntryTable::~EntryTable() {
-  auto global_lock = global_critical_region_.Acquire();
-  for (auto it : map_) {
-    Entry* entry = it.second;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto entry : entries_) {
     delete entry;
   }
+  for (auto& page : pages_) {
+    delete[] page.load(std::memory_order_relaxed);
+  }
+}
+
+std::atomic<Entry*>* EntryTable::LookupSlot(uint32_t address, bool create) {
+  if (address < kCodeBase || address - kCodeBase >= kCodeSize ||
+      (address & 0x3)) {
+    return nullptr;
+  }
+  uint32_t offset = address - kCodeBase;
+  auto& page_ptr = pages_[offset >> kPageShift];
+  auto page = page_ptr.load(std::memory_order_acquire);
+  if (!page) {
+    if (!create) {
+      return nullptr;
+    }
+    // Race to install a zeroed page; losers discard theirs.
+    auto new_page = new std::atomic<Entry*>[kSlotsPerPage]();
+    if (page_ptr.compare_exchange_strong(page, new_page,
+                                         std::memory_order_acq_rel)) {
+      page = new_page;
+    } else {
+      delete[] new_page;
+    }
+  }
+  return &page[(offset & ((1 << kPageShift) - 1)) >> 2];
 }
 
 Entry* EntryTable::Get(uint32_t address) {
-  auto global_lock = global_critical_region_.Acquire();
-  const auto& it = map_.find(address);
-  Entry* entry = it != map_.end() ? it->second : nullptr;
+  Entry* entry;
+  auto slot = LookupSlot(address, false);
+  if (slot) {
+    entry = slot->load(std::memory_order_acquire);
+  } else {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto& it = map_.find(address);
+    entry = it != map_.end() ? it->second : nullptr;
+  }
   if (entry) {
     // TODO(benvanik): wait if needed?
-    if (entry->status != Entry::STATUS_READY) {
+    if (entry->status.load(std::memory_order_acquire) != Entry::STATUS_READY) {
       entry = nullptr;
     }
   }
@@ -39,49 +75,70 @@ Entry* EntryTable::Get(uint32_t address) {
 }
 
 Entry::Status EntryTable::GetOrCreate(uint32_t address, Entry** out_entry) {
-  // TODO(benvanik): replace with a map with wait-free for find.
-  // https://github.com/facebook/folly/blob/master/folly/AtomicHashMap.h
+  Entry* entry = nullptr;
+  auto slot = LookupSlot(address, true);
+  if (slot) {
+    entry = slot->load(std::memory_order_acquire);
+  } else {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto& it = map_.find(address);
+    entry = it != map_.end() ? it->second : nullptr;
+  }
 
-  auto global_lock = global_critical_region_.Acquire();
-  const auto& it = map_.find(address);
-  Entry* entry = it != map_.end() ? it->second : nullptr;
-  Entry::Status status;
-  if (entry) {
-    // If we aren't ready yet spin and wait.
-    if (entry->status == Entry::STATUS_COMPILING) {
-      // Still compiling, so spin.
-      do {
-        global_lock.unlock();
-        // TODO(benvanik): sleep for less time?
-        xe::threading::Sleep(std::chrono::microseconds(10));
-        global_lock.lock();
-      } while (entry->status == Entry::STATUS_COMPILING);
+  if (!entry) {
+    // Create and try to publish for initialization. Whoever installs it owns
+    // compilation; anyone else waits on the winner below.
+    auto new_entry = new Entry();
+    new_entry->address = address;
+    new_entry->end_address = 0;
+    new_entry->status.store(Entry::STATUS_COMPILING, std::memory_order_relaxed);
+    new_entry->function = nullptr;
+    bool created = false;
+    if (slot) {
+      created = slot->compare_exchange_strong(entry, new_entry,
+                                              std::memory_order_acq_rel);
+    } else {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto& map_entry = map_[address];
+      if (!map_entry) {
+        map_entry = new_entry;
+        created = true;
+      } else {
+        entry = map_entry;
+      }
     }
-    status = entry->status;
-  } else {
-    // Create and return for initialization.
-    entry = new Entry();
-    entry->address = address;
-    entry->end_address = 0;
-    entry->status = Entry::STATUS_COMPILING;
-    entry->function = 0;
-    map_[address] = entry;
-    status = Entry::STATUS_NEW;
+    if (created) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      entries_.push_back(new_entry);
+      *out_entry = new_entry;
+      return Entry::STATUS_NEW;
+    }
+    delete new_entry;
+  }
+
+  // If we aren't ready yet spin and wait.
+  Entry::Status status = entry->status.load(std::memory_order_acquire);
+  while (status == Entry::STATUS_COMPILING) {
+    // TODO(benvanik): sleep for less time?
+    xe::threading::Sleep(std::chrono::microseconds(10));
+    status = entry->status.load(std::memory_order_acquire);
   }
-  global_lock.unlock();
   *out_entry = entry;
   return status;
 }
 
 std::vector<Function*> EntryTable::FindWithAddress(uint32_t address) {
-  auto global_lock = global_critical_region_.Acquire();
+  std::lock_guard<std::mutex> lock(mutex_);
   std::vector<Function*> fns;
-  for (auto& it : map_) {
-    Entry* entry = it.second;
+  for (auto entry : entries_) {
+    // end_address is written by the compiling thread before it publishes the
+    // status, so it can only be read once the entry is ready.
+    if (entry->status.load(std::memory_order_acquire) !=
+        Entry::STATUS_READY) {
+      continue;
+    }
     if (address >= entry->address && address <= entry->end_address) {
-      if (entry->status == Entry::STATUS_READY) {
-        fns.push_back(entry->function);
-      }
+      fns.push_back(entry->function);
     }
   }
   return fns;
@@ -10,11 +10,11 @@
 #ifndef XENIA_CPU_ENTRY_TABLE_H_
 #define XENIA_CPU_ENTRY_TABLE_H_
 
+#include <atomic>
+#include <mutex>
 #include <unordered_map>
 #include <vector>
 
-#include "xenia/base/mutex.h"
-
 namespace xe {
 namespace cpu {
 
@@ -30,10 +30,17 @@ typedef struct Entry_t {
 
   uint32_t address;
   uint32_t end_address;
-  Status status;
+  // Written last (release) once address/function are valid, so lock-free
+  // readers that observe STATUS_READY also see the function.
+  std::atomic<Status> status;
   Function* function;
 } Entry;
 
+// Maps guest function addresses to entries.
+// Addresses in the guest code range (0x80000000-0x9FFFFFFF) are stored in a
+// lazily-populated two-level table of atomic slots indexed directly by
+// address, so lookups never take a lock. Anything else (builtins, odd
+// addresses) falls back to a locked map.
 class EntryTable {
  public:
   EntryTable();
@@ -45,9 +52,24 @@ class EntryTable {
   std::vector<Function*> FindWithAddress(uint32_t address);
 
  private:
-  xe::global_critical_region global_critical_region_;
-  // TODO(benvanik): replace with a better data structure.
+  static const uint32_t kCodeBase = 0x80000000;
+  static const uint32_t kCodeSize = 0x20000000;
+  static const uint32_t kPageShift = 16;
+  static const uint32_t kPageCount = kCodeSize >> kPageShift;
+  // One slot per 4b instruction in the page.
+  static const uint32_t kSlotsPerPage = (1 << kPageShift) >> 2;
+
+  // Returns the slot for the given address, allocating its page if needed.
+  // Returns nullptr if the address is not in the directly-mapped range.
+  std::atomic<Entry*>* LookupSlot(uint32_t address, bool create);
+
+  std::atomic<std::atomic<Entry*>*> pages_[kPageCount];
+
+  // Guards the fallback map and the list of all entries (used for iteration
+  // and cleanup). Only taken when creating entries or for slow queries.
+  std::mutex mutex_;
   std::unordered_map<uint32_t, Entry*> map_;
+  std::vector<Entry*> entries_;
 };
 
 }  // namespace cpu
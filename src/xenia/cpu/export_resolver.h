@@ -68,7 +68,7 @@ class Export {
       : ordinal(ordinal),
         type(type),
         tags(tags),
-        function_data({nullptr, nullptr, 0}) {
+        function_data({nullptr, nullptr, nullptr, 0}) {
     std::strncpy(this->name, name, xe::countof(this->name));
   }
 
@@ -81,6 +81,15 @@ class Export {
     return (tags & ExportTag::kImplemented) == ExportTag::kImplemented;
   }
 
+  // Trampoline to call the export with, skipping the logging code when calls
+  // aren't logged.
+  ExportTrampoline GetTrampoline() const {
+    if (!(tags & ExportTag::kLog) && function_data.quiet_trampoline) {
+      return function_data.quiet_trampoline;
+    }
+    return function_data.trampoline;
+  }
+
   union {
     // Variable data. Only valid when kXEKernelExportFlagVariable is set.
     // This is an address in the client memory space that the variable can
@@ -94,6 +103,9 @@ class Export {
       // Trampoline that is called from the guest-to-host thunk.
       // Expects only PPC context as first arg.
       ExportTrampoline trampoline;
+      // The same without any call logging, used instead of trampoline when
+      // calls to the export won't be logged.
+      ExportTrampoline quiet_trampoline;
       uint64_t call_count;
     } function_data;
   };
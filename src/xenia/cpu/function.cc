@@ -9,6 +9,7 @@
 
 #include "xenia/cpu/function.h"
 
+#include "xenia/base/assert.h"
 #include "xenia/base/logging.h"
 #include "xenia/cpu/symbol.h"
 #include "xenia/cpu/thread_state.h"
@@ -66,11 +67,22 @@ void GuestFunction::SetupExtern(ExternHandler handler, Export* export_data) {
   export_data_ = export_data;
 }
 
+void GuestFunction::PublishMachineCode(uint8_t* machine_code,
+                                       size_t machine_code_length) {
+  uint32_t slot = pending_code_slot();
+  // The current code must never change under readers.
+  assert_null(code_slots_[slot].machine_code);
+  code_slots_[slot].machine_code = machine_code;
+  code_slots_[slot].machine_code_length = machine_code_length;
+  current_code_slot_.store(slot, std::memory_order_release);
+}
+
 const SourceMapEntry* GuestFunction::LookupGuestAddress(
     uint32_t guest_address) const {
+  auto& source_map = current_code_slot().source_map;
   // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (size_t i = 0; i < source_map_.size(); ++i) {
-    const auto& entry = source_map_[i];
+  for (size_t i = 0; i < source_map.size(); ++i) {
+    const auto& entry = source_map[i];
     if (entry.guest_address == guest_address) {
       return &entry;
     }
@@ -79,9 +91,10 @@ const SourceMapEntry* GuestFunction::LookupGuestAddress(
 }
 
 const SourceMapEntry* GuestFunction::LookupHIROffset(uint32_t offset) const {
+  auto& source_map = current_code_slot().source_map;
   // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (size_t i = 0; i < source_map_.size(); ++i) {
-    const auto& entry = source_map_[i];
+  for (size_t i = 0; i < source_map.size(); ++i) {
+    const auto& entry = source_map[i];
     if (entry.hir_offset >= offset) {
       return &entry;
     }
@@ -89,16 +102,21 @@ const SourceMapEntry* GuestFunction::LookupHIROffset(uint32_t offset) const {
   return nullptr;
 }
 
-const SourceMapEntry* GuestFunction::LookupMachineCodeOffset(
-    uint32_t offset) const {
+static const SourceMapEntry* LookupCodeOffset(
+    const std::vector<SourceMapEntry>& source_map, uint32_t offset) {
   // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (int64_t i = source_map_.size() - 1; i >= 0; --i) {
-    const auto& entry = source_map_[i];
+  for (int64_t i = source_map.size() - 1; i >= 0; --i) {
+    const auto& entry = source_map[i];
     if (entry.code_offset <= offset) {
       return &entry;
     }
   }
-  return source_map_.empty() ? nullptr : &source_map_[0];
+  return source_map.empty() ? nullptr : &source_map[0];
+}
+
+const SourceMapEntry* GuestFunction::LookupMachineCodeOffset(
+    uint32_t offset) const {
+  return LookupCodeOffset(current_code_slot().source_map, offset);
 }
 
 uint32_t GuestFunction::MapGuestAddressToMachineCodeOffset(
@@ -116,8 +134,22 @@ uintptr_t GuestFunction::MapGuestAddressToMachineCode(
 
 uint32_t GuestFunction::MapMachineCodeToGuestAddress(
     uintptr_t host_address) const {
-  auto entry = LookupMachineCodeOffset(static_cast<uint32_t>(
-      host_address - reinterpret_cast<uintptr_t>(machine_code())));
+  uint32_t current_slot = current_code_slot_.load(std::memory_order_acquire);
+  const CodeSlot* code_slot = &code_slots_[current_slot];
+  if (current_slot) {
+    // Threads may still be running the code from before the retranslation.
+    auto& first_slot = code_slots_[0];
+    auto first_code = reinterpret_cast<uintptr_t>(first_slot.machine_code);
+    if (host_address >= first_code &&
+        host_address < first_code + first_slot.machine_code_length) {
+      code_slot = &first_slot;
+    }
+  }
+  auto entry = LookupCodeOffset(
+      code_slot->source_map,
+      static_cast<uint32_t>(host_address -
+                            reinterpret_cast<uintptr_t>(
+                                code_slot->machine_code)));
   return entry ? entry->guest_address : address();
 }
 
@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_FUNCTION_H_
 #define XENIA_CPU_FUNCTION_H_
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
@@ -111,17 +112,36 @@ class GuestFunction : public Function {
   virtual uint8_t* machine_code() const = 0;
   virtual size_t machine_code_length() const = 0;
 
-  FunctionDebugInfo* debug_info() const { return debug_info_.get(); }
+  // Debug info and source map of the current machine code.
+  FunctionDebugInfo* debug_info() const {
+    return current_code_slot().debug_info.get();
+  }
+  const std::vector<SourceMapEntry>& source_map() const {
+    return current_code_slot().source_map;
+  }
+  // Debug info and source map of the machine code being generated, which
+  // become current once the backend sets the code up.
   void set_debug_info(std::unique_ptr<FunctionDebugInfo> debug_info) {
-    debug_info_ = std::move(debug_info);
+    code_slots_[pending_code_slot()].debug_info = std::move(debug_info);
+  }
+  std::vector<SourceMapEntry>& pending_source_map() {
+    return code_slots_[pending_code_slot()].source_map;
   }
   FunctionTraceData& trace_data() { return trace_data_; }
-  std::vector<SourceMapEntry>& source_map() { return source_map_; }
 
   ExternHandler extern_handler() const { return extern_handler_; }
   Export* export_data() const { return export_data_; }
   void SetupExtern(ExternHandler handler, Export* export_data = nullptr);
 
+  // Optimization tier the machine code was (or is being) generated at when
+  // --tiered_jit is enabled. Tier 0 code counts calls and loop iterations
+  // down in tier_up_counter and requests tier 1 once it reaches zero.
+  // Retranslating at tier 1 generates into a second code slot, leaving the
+  // tier 0 code and its metadata untouched for threads still running it.
+  uint32_t tier() const { return tier_; }
+  void set_tier(uint32_t value) { tier_ = value; }
+  int32_t* tier_up_counter() { return &tier_up_counter_; }
+
   const SourceMapEntry* LookupGuestAddress(uint32_t guest_address) const;
   const SourceMapEntry* LookupHIROffset(uint32_t offset) const;
   const SourceMapEntry* LookupMachineCodeOffset(uint32_t offset) const;
@@ -135,12 +155,34 @@ class GuestFunction : public Function {
  protected:
   virtual bool CallImpl(ThreadState* thread_state, uint32_t return_address) = 0;
 
+  // Machine code (placed by the backend) and what describes it. Nothing in a
+  // slot changes once it's current, so readers need no locking.
+  struct CodeSlot {
+    uint8_t* machine_code = nullptr;
+    size_t machine_code_length = 0;
+    std::vector<SourceMapEntry> source_map;
+    std::unique_ptr<FunctionDebugInfo> debug_info;
+  };
+  const CodeSlot& current_code_slot() const {
+    return code_slots_[current_code_slot_.load(std::memory_order_acquire)];
+  }
+  // The first code goes into the first slot, as nothing can look at it yet,
+  // and retranslated code into the second. Functions are retranslated at most
+  // once (when moving up to tier 1).
+  uint32_t pending_code_slot() const {
+    return code_slots_[0].machine_code ? 1 : 0;
+  }
+  // Fills in the machine code of the pending slot and makes it current.
+  void PublishMachineCode(uint8_t* machine_code, size_t machine_code_length);
+
  protected:
-  std::unique_ptr<FunctionDebugInfo> debug_info_;
   FunctionTraceData trace_data_;
-  std::vector<SourceMapEntry> source_map_;
+  CodeSlot code_slots_[2];
+  std::atomic<uint32_t> current_code_slot_ = {0};
   ExternHandler extern_handler_ = nullptr;
   Export* export_data_ = nullptr;
+  uint32_t tier_ = 0;
+  int32_t tier_up_counter_ = 0;
 };
 
 }  // namespace cpu
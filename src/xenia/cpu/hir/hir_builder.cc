@@ -284,6 +284,22 @@ void HIRBuilder::Dump(StringBuffer* str) {
   }
 }
 
+uint32_t HIRBuilder::CountInstrs() const {
+  uint32_t count = 0;
+  auto block = block_head_;
+  while (block) {
+    auto i = block->instr_head;
+    while (i) {
+      if (!(i->opcode->flags & (OPCODE_FLAG_HIDE | OPCODE_FLAG_IGNORE))) {
+        ++count;
+      }
+      i = i->next;
+    }
+    block = block->next;
+  }
+  return count;
+}
+
 void HIRBuilder::AssertNoCycles() {
   Block* hare = block_head_;
   Block* tortoise = block_head_;
@@ -40,6 +40,10 @@ class HIRBuilder {
   void Dump(StringBuffer* str);
   void AssertNoCycles();
 
+  // Number of instructions that will be emitted, not counting comments and
+  // other hidden ones.
+  uint32_t CountInstrs() const;
+
   Arena* arena() const { return arena_; }
 
   uint32_t attributes() const { return attributes_; }
@@ -9,6 +9,9 @@
 
 #include "xenia/cpu/mmio_handler.h"
 
+#include <algorithm>
+#include <cstring>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_order.h"
 #include "xenia/base/exception_handler.h"
@@ -16,11 +19,32 @@
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
 
+DEFINE_bool(batch_access_watch_faults, false,
+            "Leave pages that hit a write watch writable until the end of the "
+            "frame, firing watches added on them at the end of the frame. "
+            "Data rewritten every frame then faults once per frame, but "
+            "invalidation lags by up to a frame.");
+
 namespace xe {
 namespace cpu {
 
 MMIOHandler* MMIOHandler::global_handler_ = nullptr;
 
+MMIOHandler::MMIOHandler(uint8_t* virtual_membase, uint8_t* physical_membase,
+                         uint8_t* membase_end)
+    : virtual_membase_(virtual_membase),
+      physical_membase_(physical_membase),
+      memory_end_(membase_end),
+      access_watch_buckets_(kWatchBucketCount) {
+  page_shift_ = xe::log2_floor(uint32_t(xe::memory::page_size()));
+  // Pages can't straddle watch buckets.
+  assert_true(page_shift_ <= kWatchBucketShift);
+  page_count_ = 0x20000000 >> page_shift_;
+  page_access_.resize(page_count_, kWatchInvalid);
+  held_open_pages_.resize(xe::round_up(page_count_, 64u) / 64);
+  unwatched_pages_.resize(held_open_pages_.size());
+}
+
 std::unique_ptr<MMIOHandler> MMIOHandler::Install(uint8_t* virtual_membase,
                                                   uint8_t* physical_membase,
                                                   uint8_t* membase_end) {
@@ -43,6 +67,16 @@ std::unique_ptr<MMIOHandler> MMIOHandler::Install(uint8_t* virtual_membase,
 MMIOHandler::~MMIOHandler() {
   ExceptionHandler::Uninstall(ExceptionCallbackThunk, this);
 
+  // Watches still outstanding are owned by us; each is deleted from the first
+  // bucket it is in.
+  for (uint32_t i = 0; i < kWatchBucketCount; ++i) {
+    for (auto entry : access_watch_buckets_[i]) {
+      if (entry->address >> kWatchBucketShift == i) {
+        delete entry;
+      }
+    }
+  }
+
   assert_true(global_handler_ == this);
   global_handler_ = nullptr;
 }
@@ -51,6 +85,9 @@ bool MMIOHandler::RegisterRange(uint32_t virtual_address, uint32_t mask,
                                 uint32_t size, void* context,
                                 MMIOReadCallback read_callback,
                                 MMIOWriteCallback write_callback) {
+  // Generated code only checks the window for MMIO.
+  assert_true(IsMmioWindowAddress(virtual_address));
+  assert_true(IsMmioWindowAddress(virtual_address + size - 1));
   mapped_ranges_.push_back({
       virtual_address, mask, size, context, read_callback, write_callback,
   });
@@ -109,13 +146,24 @@ uintptr_t MMIOHandler::AddPhysicalAccessWatch(uint32_t guest_address,
   auto entry = new AccessWatchEntry();
   entry->address = base_address;
   entry->length = uint32_t(length);
+  entry->type = type;
   entry->callback = callback;
   entry->callback_context = callback_context;
   entry->callback_data = callback_data;
-  access_watches_.push_back(entry);
+  InsertAccessWatch(entry);
+
+  UpdatePageProtection(entry->address >> page_shift_,
+                       (entry->address + entry->length) >> page_shift_);
 
-  auto page_access = memory::PageAccess::kNoAccess;
-  switch (type) {
+  return reinterpret_cast<uintptr_t>(entry);
+}
+
+void MMIOHandler::ProtectPages(uint32_t first_page, uint32_t page_count,
+                               WatchType access) {
+  auto page_access = memory::PageAccess::kReadWrite;
+  switch (access) {
+    case kWatchInvalid:
+      break;
     case kWatchWrite:
       page_access = memory::PageAccess::kReadOnly;
       break;
@@ -123,48 +171,193 @@ uintptr_t MMIOHandler::AddPhysicalAccessWatch(uint32_t guest_address,
       page_access = memory::PageAccess::kNoAccess;
       break;
     default:
-      assert_unhandled_case(type);
+      assert_unhandled_case(access);
       break;
   }
 
   // Protect the range under all address spaces
-  memory::Protect(physical_membase_ + entry->address, entry->length,
-                  page_access, nullptr);
-  memory::Protect(virtual_membase_ + 0xA0000000 + entry->address, entry->length,
+  uint32_t address = first_page << page_shift_;
+  size_t length = size_t(page_count) << page_shift_;
+  memory::Protect(physical_membase_ + address, length, page_access, nullptr);
+  memory::Protect(virtual_membase_ + 0xA0000000 + address, length,
                   page_access, nullptr);
-  memory::Protect(virtual_membase_ + 0xC0000000 + entry->address, entry->length,
+  memory::Protect(virtual_membase_ + 0xC0000000 + address, length,
                   page_access, nullptr);
-  memory::Protect(virtual_membase_ + 0xE0000000 + entry->address, entry->length,
+  memory::Protect(virtual_membase_ + 0xE0000000 + address, length,
                   page_access, nullptr);
+  ++frame_stats_.protect_runs;
+}
 
-  return reinterpret_cast<uintptr_t>(entry);
+void MMIOHandler::UpdatePageProtection(uint32_t first_page,
+                                       uint32_t end_page) {
+  end_page = std::min(end_page, page_count_);
+  const uint32_t bucket_page_shift = kWatchBucketShift - page_shift_;
+  const uint32_t bucket_page_count = 1u << bucket_page_shift;
+  // Pages are at least 4KiB, so a bucket has up to 16.
+  uint8_t wanted_access[16];
+  assert_true(bucket_page_count <= xe::countof(wanted_access));
+
+  uint32_t run_start = first_page;
+  uint32_t run_length = 0;
+  uint8_t run_access = kWatchInvalid;
+  uint32_t page = first_page;
+  while (page < end_page) {
+    // Work out what the pages of the bucket need from the watches in it.
+    uint32_t bucket_first_page = page & ~(bucket_page_count - 1);
+    uint32_t bucket_end_page = bucket_first_page + bucket_page_count;
+    std::memset(wanted_access, kWatchInvalid, sizeof(wanted_access));
+    for (auto entry : access_watch_buckets_[page >> bucket_page_shift]) {
+      uint32_t entry_first_page =
+          std::max(entry->address >> page_shift_, bucket_first_page);
+      uint32_t entry_end_page = std::min(
+          (entry->address + entry->length) >> page_shift_, bucket_end_page);
+      for (uint32_t i = entry_first_page; i < entry_end_page; ++i) {
+        auto& access = wanted_access[i - bucket_first_page];
+        access = std::max(access, uint8_t(entry->type));
+      }
+    }
+
+    for (; page < std::min(end_page, bucket_end_page); ++page) {
+      uint8_t access = wanted_access[page - bucket_first_page];
+      if (access != kWatchReadWrite && IsPageHeldOpen(page)) {
+        // Read watches added since the page was opened still need it
+        // protected.
+        access = kWatchInvalid;
+      }
+      if (access == page_access_[page]) {
+        if (run_length) {
+          ProtectPages(run_start, run_length, WatchType(run_access));
+          run_length = 0;
+        }
+        continue;
+      }
+      uint64_t page_bit = uint64_t(1) << (page % 64);
+      if (access == kWatchInvalid) {
+        unwatched_pages_[page / 64] |= page_bit;
+      } else {
+        unwatched_pages_[page / 64] &= ~page_bit;
+      }
+      page_access_[page] = access;
+      if (run_length && access == run_access) {
+        ++run_length;
+        continue;
+      }
+      if (run_length) {
+        ProtectPages(run_start, run_length, WatchType(run_access));
+      }
+      run_start = page;
+      run_length = 1;
+      run_access = access;
+    }
+  }
+  if (run_length) {
+    ProtectPages(run_start, run_length, WatchType(run_access));
+  }
 }
 
-void MMIOHandler::ClearAccessWatch(AccessWatchEntry* entry) {
-  memory::Protect(physical_membase_ + entry->address, entry->length,
-                  xe::memory::PageAccess::kReadWrite, nullptr);
-  memory::Protect(virtual_membase_ + 0xA0000000 + entry->address, entry->length,
-                  xe::memory::PageAccess::kReadWrite, nullptr);
-  memory::Protect(virtual_membase_ + 0xC0000000 + entry->address, entry->length,
-                  xe::memory::PageAccess::kReadWrite, nullptr);
-  memory::Protect(virtual_membase_ + 0xE0000000 + entry->address, entry->length,
-                  xe::memory::PageAccess::kReadWrite, nullptr);
+void MMIOHandler::InsertAccessWatch(AccessWatchEntry* entry) {
+  uint32_t first_bucket = entry->address >> kWatchBucketShift;
+  uint32_t last_bucket = std::min(
+      (entry->address + entry->length - 1) >> kWatchBucketShift,
+      kWatchBucketCount - 1);
+  for (uint32_t i = first_bucket; i <= last_bucket; ++i) {
+    access_watch_buckets_[i].push_back(entry);
+  }
 }
 
-void MMIOHandler::CancelAccessWatch(uintptr_t watch_handle) {
-  auto entry = reinterpret_cast<AccessWatchEntry*>(watch_handle);
-  auto lock = global_critical_region_.Acquire();
+void MMIOHandler::RemoveAccessWatch(AccessWatchEntry* entry) {
+  uint32_t first_bucket = entry->address >> kWatchBucketShift;
+  uint32_t last_bucket = std::min(
+      (entry->address + entry->length - 1) >> kWatchBucketShift,
+      kWatchBucketCount - 1);
+  for (uint32_t i = first_bucket; i <= last_bucket; ++i) {
+    auto& bucket = access_watch_buckets_[i];
+    auto it = std::find(bucket.begin(), bucket.end(), entry);
+    assert_false(it == bucket.end());
+    if (it != bucket.end()) {
+      // Order within a bucket doesn't matter.
+      *it = bucket.back();
+      bucket.pop_back();
+    }
+  }
+}
+
+void MMIOHandler::FindAccessWatches(
+    uint32_t physical_address, size_t length,
+    std::vector<AccessWatchEntry*>* out_entries) {
+  if (!length) {
+    return;
+  }
+  physical_address &= 0x1FFFFFFF;
+  uint64_t end_address =
+      std::min(uint64_t(physical_address) + length, uint64_t(0x20000000));
+  uint32_t first_bucket = physical_address >> kWatchBucketShift;
+  uint32_t last_bucket = uint32_t((end_address - 1) >> kWatchBucketShift);
+  size_t first_entry = out_entries->size();
+  for (uint32_t i = first_bucket; i <= last_bucket; ++i) {
+    for (auto entry : access_watch_buckets_[i]) {
+      if (entry->address < end_address &&
+          entry->address + entry->length > physical_address) {
+        out_entries->push_back(entry);
+      }
+    }
+  }
+  if (first_bucket != last_bucket) {
+    // Watches spanning several buckets were found in each of them.
+    std::sort(out_entries->begin() + first_entry, out_entries->end());
+    out_entries->erase(
+        std::unique(out_entries->begin() + first_entry, out_entries->end()),
+        out_entries->end());
+  }
+}
 
-  // Allow access to the range again.
-  ClearAccessWatch(entry);
+void MMIOHandler::FireAccessWatches(std::vector<AccessWatchEntry*>* entries,
+                                    const uint32_t* fault_address) {
+  if (entries->empty()) {
+    return;
+  }
+
+  // Unlink everything first so that callbacks see a consistent table.
+  for (auto entry : *entries) {
+    RemoveAccessWatch(entry);
+  }
 
-  // Remove from table.
-  auto it = std::find(access_watches_.begin(), access_watches_.end(), entry);
-  assert_false(it == access_watches_.end());
+  // Textures tend to be packed together, so invalidating a range usually hits
+  // runs of adjacent watches that can be unprotected with one call each.
+  // Pages other watches still cover stay protected.
+  std::sort(entries->begin(), entries->end(),
+            [](const AccessWatchEntry* a, const AccessWatchEntry* b) {
+              return a->address < b->address;
+            });
+  uint32_t run_first_page = entries->front()->address >> page_shift_;
+  uint32_t run_end_page = run_first_page;
+  for (auto entry : *entries) {
+    uint32_t first_page = entry->address >> page_shift_;
+    uint32_t end_page = (entry->address + entry->length) >> page_shift_;
+    if (first_page > run_end_page) {
+      UpdatePageProtection(run_first_page, run_end_page);
+      run_first_page = first_page;
+    }
+    run_end_page = std::max(run_end_page, end_page);
+  }
+  UpdatePageProtection(run_first_page, run_end_page);
 
-  if (it != access_watches_.end()) {
-    access_watches_.erase(it);
+  for (auto entry : *entries) {
+    entry->callback(entry->callback_context, entry->callback_data,
+                    fault_address ? *fault_address : entry->address);
+    delete entry;
   }
+  frame_stats_.watches_fired += uint32_t(entries->size());
+}
+
+void MMIOHandler::CancelAccessWatch(uintptr_t watch_handle) {
+  auto entry = reinterpret_cast<AccessWatchEntry*>(watch_handle);
+  auto lock = global_critical_region_.Acquire();
+
+  // Remove from table and allow access to the range again.
+  RemoveAccessWatch(entry);
+  UpdatePageProtection(entry->address >> page_shift_,
+                       (entry->address + entry->length) >> page_shift_);
 
   delete entry;
 }
@@ -172,73 +365,87 @@ void MMIOHandler::CancelAccessWatch(uintptr_t watch_handle) {
 void MMIOHandler::InvalidateRange(uint32_t physical_address, size_t length) {
   auto lock = global_critical_region_.Acquire();
 
-  for (auto it = access_watches_.begin(); it != access_watches_.end();) {
-    auto entry = *it;
-    if ((entry->address <= physical_address &&
-         entry->address + entry->length > physical_address) ||
-        (entry->address >= physical_address &&
-         entry->address < physical_address + length)) {
-      // This watch lies within the range. End it.
-      ClearAccessWatch(entry);
-      entry->callback(entry->callback_context, entry->callback_data,
-                      entry->address);
-
-      it = access_watches_.erase(it);
-      delete entry;
-      continue;
-    }
-
-    ++it;
-  }
+  // End every watch that lies within the range.
+  std::vector<AccessWatchEntry*> entries;
+  FindAccessWatches(physical_address, length, &entries);
+  FireAccessWatches(&entries, nullptr);
 }
 
 bool MMIOHandler::IsRangeWatched(uint32_t physical_address, size_t length) {
   auto lock = global_critical_region_.Acquire();
 
-  for (auto it = access_watches_.begin(); it != access_watches_.end(); ++it) {
-    auto entry = *it;
-    if ((entry->address <= physical_address &&
-         entry->address + entry->length > physical_address) ||
-        (entry->address >= physical_address &&
-         entry->address < physical_address + length)) {
-      // This watch lies within the range.
-      return true;
-    }
-  }
-
-  return false;
+  std::vector<AccessWatchEntry*> entries;
+  FindAccessWatches(physical_address, length, &entries);
+  return !entries.empty();
 }
 
 bool MMIOHandler::CheckAccessWatch(uint32_t physical_address) {
   auto lock = global_critical_region_.Acquire();
 
-  bool hit = false;
-  for (auto it = access_watches_.begin(); it != access_watches_.end();) {
-    auto entry = *it;
-    if (entry->address <= physical_address &&
-        entry->address + entry->length > physical_address) {
-      // Hit! Remove the watch.
-      hit = true;
-      ClearAccessWatch(entry);
-      entry->callback(entry->callback_context, entry->callback_data,
-                      physical_address);
-
-      it = access_watches_.erase(it);
-      delete entry;
-      continue;
-    }
-    ++it;
-  }
-
-  if (!hit) {
+  std::vector<AccessWatchEntry*> entries;
+  FindAccessWatches(physical_address, 1, &entries);
+  if (entries.empty()) {
     // Rethrow access violation - range was not being watched.
     return false;
   }
 
+  ++frame_stats_.faults;
+  if (FLAGS_batch_access_watch_faults) {
+    // Keep the page writable for the rest of the frame, unless something on it
+    // watches reads too - those would go unnoticed while it's open.
+    uint32_t page = (physical_address & 0x1FFFFFFF) >> page_shift_;
+    if (!IsPageHeldOpen(page)) {
+      std::vector<AccessWatchEntry*> page_entries;
+      FindAccessWatches(page << page_shift_, size_t(1) << page_shift_,
+                        &page_entries);
+      bool write_watches_only = std::all_of(
+          page_entries.begin(), page_entries.end(),
+          [](const AccessWatchEntry* entry) {
+            return entry->type == kWatchWrite;
+          });
+      if (write_watches_only) {
+        held_open_pages_[page / 64] |= uint64_t(1) << (page % 64);
+        ++frame_stats_.pages_held_open;
+      }
+    }
+  }
+
+  // Hit! Remove the watches.
+  FireAccessWatches(&entries, &physical_address);
+
   // Range was watched, so lets eat this access violation.
   return true;
 }
 
+MMIOHandler::AccessWatchStats MMIOHandler::EndAccessWatchFrame() {
+  auto lock = global_critical_region_.Acquire();
+
+  // Anything watched on a page held open may have been written since, so all
+  // those watches fire. Their pages are protected again once watched again.
+  std::vector<AccessWatchEntry*> entries;
+  for (size_t i = 0; i < held_open_pages_.size(); ++i) {
+    uint64_t bits = held_open_pages_[i];
+    held_open_pages_[i] = 0;
+    while (bits) {
+      uint32_t bit = xe::log2_floor(bits & (~bits + 1));
+      bits &= bits - 1;
+      uint32_t page = uint32_t(i * 64 + bit);
+      FindAccessWatches(page << page_shift_, size_t(1) << page_shift_,
+                        &entries);
+    }
+  }
+  if (!entries.empty()) {
+    // Watches on several pages were found once per page.
+    std::sort(entries.begin(), entries.end());
+    entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+    FireAccessWatches(&entries, nullptr);
+  }
+
+  last_frame_stats_ = frame_stats_;
+  frame_stats_ = {0};
+  return last_frame_stats_;
+}
+
 struct DecodedMov {
   size_t length;
   // Inidicates this is a load (or conversely a store).
@@ -438,22 +645,28 @@ bool MMIOHandler::ExceptionCallback(Exception* ex) {
       guest_address = static_cast<uint32_t>(ex->fault_address());
     }
 
-    // HACK: Recheck if the pages are still protected (race condition - another
-    // thread clears the writewatch we just hit)
-    // Do this under the lock so we don't introduce another race condition.
     auto lock = global_critical_region_.Acquire();
-    memory::PageAccess cur_access;
-    size_t page_length = memory::page_size();
-    memory::QueryProtect((void*)fault_address, page_length, cur_access);
-    if (cur_access != memory::PageAccess::kReadOnly &&
-        cur_access != memory::PageAccess::kNoAccess) {
+    if (CheckAccessWatch(guest_address)) {
+      return true;
+    }
+
+    // HACK: Recheck if the page was unwatched in the meantime (race
+    // condition - another thread clears the writewatch we just hit)
+    // Do this under the lock so we don't introduce another race condition.
+    // This runs in a signal handler on POSIX, where querying the host
+    // protection isn't safe (it reads /proc/self/maps), so what was tracked
+    // when the page was unprotected is used instead. Pages that were never
+    // watched fault for real.
+    uint32_t page = (guest_address & 0x1FFFFFFF) >> page_shift_;
+    if (page < page_count_ && page_access_[page] == kWatchInvalid &&
+        ConsumePageUnwatched(page)) {
       // Another thread has cleared this write watch. Abort.
       return true;
     }
 
     // Access is not found within any range, so fail and let the caller handle
     // it (likely by aborting).
-    return CheckAccessWatch(guest_address);
+    return false;
   }
 
   auto rip = ex->pc();
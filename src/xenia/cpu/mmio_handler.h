@@ -10,12 +10,15 @@
 #ifndef XENIA_CPU_MMIO_HANDLER_H_
 #define XENIA_CPU_MMIO_HANDLER_H_
 
-#include <list>
+#include <gflags/gflags.h>
+
 #include <memory>
 #include <vector>
 
 #include "xenia/base/mutex.h"
 
+DECLARE_bool(batch_access_watch_faults);
+
 namespace xe {
 class Exception;
 class X64Context;
@@ -31,6 +34,16 @@ typedef void (*MMIOWriteCallback)(void* ppc_context, void* callback_context,
 typedef void (*AccessWatchCallback)(void* context_ptr, void* data_ptr,
                                     uint32_t address);
 
+// All ranges live in this 16mb block of guest virtual memory (which is
+// otherwise only GPU writeback), so generated code can tell whether an access
+// may need a callback by looking at the top byte of the address alone.
+const uint32_t kMmioWindowBase = 0x7F000000;
+const uint32_t kMmioWindowSize = 0x01000000;
+
+inline bool IsMmioWindowAddress(uint32_t address) {
+  return address - kMmioWindowBase < kMmioWindowSize;
+}
+
 struct MMIORange {
   uint32_t address;
   uint32_t mask;
@@ -76,6 +89,28 @@ class MMIOHandler {
   void InvalidateRange(uint32_t physical_address, size_t length);
   bool IsRangeWatched(uint32_t physical_address, size_t length);
 
+  struct AccessWatchStats {
+    // Access violations that hit a watch.
+    uint32_t faults;
+    // Watches fired by faults, invalidation and the end of the frame.
+    uint32_t watches_fired;
+    // Runs of pages whose protection changed, one Protect call per view each.
+    uint32_t protect_runs;
+    // Pages left writable after a fault until the end of the frame.
+    uint32_t pages_held_open;
+  };
+
+  // Ends a frame (called on swap) and returns its stats.
+  // With --batch_access_watch_faults a page that faulted stays writable for
+  // the rest of the frame, so that data rewritten every frame faults once per
+  // frame instead of once per upload. Watches added on such a page during the
+  // frame can't see writes and are conservatively fired here instead. Pages
+  // with read watches on them are never left open.
+  AccessWatchStats EndAccessWatchFrame();
+  const AccessWatchStats& last_frame_access_watch_stats() const {
+    return last_frame_stats_;
+  }
+
  protected:
   struct AccessWatchEntry {
     uint32_t address;
@@ -86,18 +121,48 @@ class MMIOHandler {
     void* callback_data;
   };
 
+  // Watches are filed under every 64kb block of physical memory they touch,
+  // so a lookup only has to look at the few watches near the address instead
+  // of all of them (there is one per cached texture, easily thousands).
+  static const uint32_t kWatchBucketShift = 16;
+  static const uint32_t kWatchBucketCount = 0x20000000 >> kWatchBucketShift;
+
   MMIOHandler(uint8_t* virtual_membase, uint8_t* physical_membase,
-              uint8_t* membase_end)
-      : virtual_membase_(virtual_membase),
-        physical_membase_(physical_membase),
-        memory_end_(membase_end) {}
+              uint8_t* membase_end);
 
   static bool ExceptionCallbackThunk(Exception* ex, void* data);
   bool ExceptionCallback(Exception* ex);
 
-  void ClearAccessWatch(AccessWatchEntry* entry);
   bool CheckAccessWatch(uint32_t guest_address);
 
+  void InsertAccessWatch(AccessWatchEntry* entry);
+  void RemoveAccessWatch(AccessWatchEntry* entry);
+  // Appends every watch overlapping the range to out_entries, once each.
+  void FindAccessWatches(uint32_t physical_address, size_t length,
+                         std::vector<AccessWatchEntry*>* out_entries);
+  // Unlinks and unprotects the watches, then fires and deletes them. Runs of
+  // adjacent watches are unprotected together. The callbacks get the faulting
+  // address if there is one, or the start of their own range.
+  void FireAccessWatches(std::vector<AccessWatchEntry*>* entries,
+                         const uint32_t* fault_address);
+
+  // Brings the protection of pages [first_page, end_page) in line with the
+  // watches on them (the strictest watch type wins), skipping pages that are
+  // already right and protecting runs of pages with one call per view.
+  void UpdatePageProtection(uint32_t first_page, uint32_t end_page);
+  void ProtectPages(uint32_t first_page, uint32_t page_count,
+                    WatchType access);
+  bool IsPageHeldOpen(uint32_t page) const {
+    return (held_open_pages_[page / 64] >> (page % 64)) & 1;
+  }
+  // Clears the page's bit in unwatched_pages_, returning whether it was set.
+  bool ConsumePageUnwatched(uint32_t page) {
+    uint64_t bit = uint64_t(1) << (page % 64);
+    bool unwatched = (unwatched_pages_[page / 64] & bit) != 0;
+    unwatched_pages_[page / 64] &= ~bit;
+    return unwatched;
+  }
+
   uint8_t* virtual_membase_;
   uint8_t* physical_membase_;
   uint8_t* memory_end_;
@@ -105,8 +170,22 @@ class MMIOHandler {
   std::vector<MMIORange> mapped_ranges_;
 
   xe::global_critical_region global_critical_region_;
-  // TODO(benvanik): data structure magic.
-  std::list<AccessWatchEntry*> access_watches_;
+  std::vector<std::vector<AccessWatchEntry*>> access_watch_buckets_;
+
+  // Host pages of physical memory.
+  uint32_t page_shift_;
+  uint32_t page_count_;
+  // Applied protection per page as the WatchType it was protected for, with
+  // kWatchInvalid for unprotected.
+  std::vector<uint8_t> page_access_;
+  // Bitmap of pages that faulted this frame and stay writable until its end.
+  std::vector<uint64_t> held_open_pages_;
+  // Bitmap of pages unprotected since they were last protected for a watch,
+  // so that a thread that faulted on one just before can retry its access.
+  std::vector<uint64_t> unwatched_pages_;
+
+  AccessWatchStats frame_stats_ = {0};
+  AccessWatchStats last_frame_stats_ = {0};
 
   static MMIOHandler* global_handler_;
 };
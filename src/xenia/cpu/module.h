@@ -35,6 +35,9 @@ class Module {
 
   virtual const std::string& name() const = 0;
   virtual bool is_executable() const = 0;
+  // Hash identifying the module contents, used to key persistent caches.
+  // 0 if the module cannot be reliably identified across runs.
+  virtual uint64_t hash() const { return 0; }
 
   virtual bool ContainsAddress(uint32_t address);
 
@@ -11,8 +11,11 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_order.h"
+#include "xenia/base/logging.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/reset_scope.h"
@@ -47,11 +50,16 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   // The CFG is required for simplification and dirtied by it.
   compiler_->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
   compiler_->AddPass(std::make_unique<passes::ControlFlowSimplificationPass>());
+  // Context promotion follows edges across blocks.
+  compiler_->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
 
   // Passes are executed in the order they are added. Multiple of the same
   // pass type may be used.
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  compiler_->AddPass(std::make_unique<passes::ContextPromotionPass>());
+  auto context_promotion_pass =
+      std::make_unique<passes::ContextPromotionPass>();
+  context_promotion_pass_ = context_promotion_pass.get();
+  compiler_->AddPass(std::move(context_promotion_pass));
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
   compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
@@ -67,9 +75,20 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   }
   compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  // compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
-  // if (validate)
-  // compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  if (FLAGS_optimize_loops) {
+    // Leaves dead code behind for DCE.
+    compiler_->AddPass(std::make_unique<passes::LoopInvariantCodeMotionPass>());
+    if (validate)
+      compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+    compiler_->AddPass(std::make_unique<passes::StrengthReductionPass>());
+    if (validate)
+      compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
+  // Picks up the loads loop optimization moved into preheaders.
+  compiler_->AddPass(std::make_unique<passes::RedundantLoadEliminationPass>());
+  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
+  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
   compiler_->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
@@ -87,10 +106,29 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
 
   // Must come last. The HIR is not really HIR after this.
   compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
+
+  if (FLAGS_tiered_jit) {
+    tier0_compiler_.reset(new Compiler(frontend->processor()));
+    AddTier0Passes(tier0_compiler_.get(), validate);
+  }
 }
 
 PPCTranslator::~PPCTranslator() = default;
 
+void PPCTranslator::AddTier0Passes(Compiler* compiler, bool validate) {
+  Backend* backend = frontend_->processor()->backend();
+
+  // Only what is required to get code out the door: the CFG (used by the
+  // emitter to find loop headers for tier-up counters), register allocation,
+  // and finalization.
+  compiler->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  compiler->AddPass(std::make_unique<passes::RegisterAllocationPass>(
+      backend->machine_info()));
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  compiler->AddPass(std::make_unique<passes::FinalizationPass>());
+}
+
 bool PPCTranslator::Translate(GuestFunction* function,
                               uint32_t debug_info_flags) {
   SCOPE_profile_cpu_f("cpu");
@@ -98,6 +136,7 @@ bool PPCTranslator::Translate(GuestFunction* function,
   // Reset() all caching when we leave.
   xe::make_reset_scope(builder_);
   xe::make_reset_scope(compiler_);
+  xe::make_reset_scope(tier0_compiler_);
   xe::make_reset_scope(assembler_);
   xe::make_reset_scope(&string_buffer_);
 
@@ -127,6 +166,23 @@ bool PPCTranslator::Translate(GuestFunction* function,
     return false;
   }
 
+  // Reuse code persisted by a previous run, if any. This skips HIR generation
+  // and compilation entirely. Only the source map is persisted with the code,
+  // so functions that want debug info or tracing are always translated.
+  // Only fully optimized code is persisted, so this is always tier 1.
+  if (!debug_info_flags && assembler_->AssembleCached(function)) {
+    function->set_tier(1);
+    return true;
+  }
+
+  // Functions start at tier 0 and are moved to tier 1 by the processor once
+  // their counters run out.
+  Compiler* compiler = compiler_.get();
+  if (tier0_compiler_ && function->tier() == 0) {
+    compiler = tier0_compiler_.get();
+    *function->tier_up_counter() = std::max(FLAGS_tier_up_threshold, 1);
+  }
+
   // Setup trace data, if needed.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoTraceFunctions) {
     // Base trace data.
@@ -165,6 +221,10 @@ bool PPCTranslator::Translate(GuestFunction* function,
   }
 
   // Stash raw HIR.
+  uint32_t raw_instr_count = 0;
+  if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmHir) {
+    raw_instr_count = builder_->CountInstrs();
+  }
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmRawHir) {
     builder_->Dump(&string_buffer_);
     debug_info->set_raw_hir_disasm(string_buffer_.ToString());
@@ -172,12 +232,20 @@ bool PPCTranslator::Translate(GuestFunction* function,
   }
 
   // Compile/optimize/etc.
-  if (!compiler_->Compile(builder_.get())) {
+  if (!compiler->Compile(builder_.get())) {
     return false;
   }
+  if (FLAGS_log_context_promotion && compiler == compiler_.get()) {
+    XELOGI("%.8X: %u context loads eliminated (%u across blocks), %u stores",
+           function->address(), context_promotion_pass_->loads_eliminated(),
+           context_promotion_pass_->cross_block_loads_eliminated(),
+           context_promotion_pass_->stores_eliminated());
+  }
 
   // Stash optimized HIR.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmHir) {
+    string_buffer_.AppendFormat("; %u instructions, %u before optimization\n",
+                                builder_->CountInstrs(), raw_instr_count);
     builder_->Dump(&string_buffer_);
     debug_info->set_hir_disasm(string_buffer_.ToString());
     string_buffer_.Reset();
@@ -15,6 +15,7 @@
 #include "xenia/base/string_buffer.h"
 #include "xenia/cpu/backend/assembler.h"
 #include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/compiler/passes/context_promotion_pass.h"
 #include "xenia/cpu/function.h"
 
 namespace xe {
@@ -33,12 +34,17 @@ class PPCTranslator {
   bool Translate(GuestFunction* function, uint32_t debug_info_flags);
 
  private:
+  void AddTier0Passes(compiler::Compiler* compiler, bool validate);
   void DumpSource(GuestFunction* function, StringBuffer* string_buffer);
 
   PPCFrontend* frontend_;
   std::unique_ptr<PPCScanner> scanner_;
   std::unique_ptr<PPCHIRBuilder> builder_;
   std::unique_ptr<compiler::Compiler> compiler_;
+  // Owned by compiler_; kept for statistics.
+  compiler::passes::ContextPromotionPass* context_promotion_pass_ = nullptr;
+  // Baseline pipeline for cold code, only present with --tiered_jit.
+  std::unique_ptr<compiler::Compiler> tier0_compiler_;
   std::unique_ptr<backend::Assembler> assembler_;
 
   StringBuffer string_buffer_;
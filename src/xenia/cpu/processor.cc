@@ -11,6 +11,8 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/atomic.h"
 #include "xenia/base/byte_order.h"
@@ -79,6 +81,25 @@ Processor::Processor(xe::Memory* memory, ExportResolver* export_resolver)
     : memory_(memory), export_resolver_(export_resolver) {}
 
 Processor::~Processor() {
+  if (pretranslate_running_) {
+    {
+      std::lock_guard<std::mutex> lock(pretranslate_mutex_);
+      pretranslate_running_ = false;
+      pretranslate_queue_.clear();
+      tier_up_queue_.clear();
+    }
+    pretranslate_cond_.notify_all();
+    for (auto& thread : pretranslate_threads_) {
+      xe::threading::Wait(thread.get(), false);
+    }
+    pretranslate_threads_.clear();
+    XELOGI(
+        "Pretranslated %u functions; guest threads translated %u; %u "
+        "functions retranslated at tier 1",
+        pretranslate_count_.load(), jit_hitch_count_.load(),
+        tier_up_count_.load());
+  }
+
   {
     auto global_lock = global_critical_region_.Acquire();
     modules_.clear();
@@ -159,6 +180,30 @@ bool Processor::Setup() {
         functions_trace_path_, 32 * 1024 * 1024, true);
   }
 
+  // Spin up background translation threads. Each pulls its own translator
+  // from the frontend pool when defining a function. Tiered compilation needs
+  // at least one to perform tier 1 retranslation.
+  int32_t thread_count = FLAGS_pretranslate_threads;
+  if (FLAGS_tiered_jit) {
+    thread_count = std::max(thread_count, 1);
+  }
+  if (thread_count > 0) {
+    pretranslate_running_ = true;
+    for (int32_t i = 0; i < thread_count; ++i) {
+      xe::threading::Thread::CreationParameters params;
+      params.stack_size = 16 * 1024 * 1024;
+      auto thread = xe::threading::Thread::Create(
+          params, [this]() { PretranslateThreadMain(); });
+      if (!thread) {
+        XELOGE("Unable to create pretranslation thread");
+        break;
+      }
+      thread->set_name(xe::format_string("Pretranslation Thread %d", i));
+      thread->set_priority(xe::threading::ThreadPriority::kBelowNormal);
+      pretranslate_threads_.push_back(std::move(thread));
+    }
+  }
+
   return true;
 }
 
@@ -175,8 +220,21 @@ void Processor::PreLaunch() {
 }
 
 bool Processor::AddModule(std::unique_ptr<Module> module) {
-  auto global_lock = global_critical_region_.Acquire();
-  modules_.push_back(std::move(module));
+  auto module_ptr = module.get();
+  {
+    auto global_lock = global_critical_region_.Acquire();
+    modules_.push_back(std::move(module));
+  }
+
+  // Queue up everything the module loader found (imports, save/restore
+  // helpers, map symbols). Callees are discovered as these are translated.
+  if (pretranslate_running_) {
+    module_ptr->ForEachFunction([this](Function* function) {
+      if (function->is_guest()) {
+        QueueFunctionTranslation(function->address());
+      }
+    });
+  }
   return true;
 }
 
@@ -234,6 +292,10 @@ Function* Processor::ResolveFunction(uint32_t address) {
   Entry::Status status = entry_table_.GetOrCreate(address, &entry);
   if (status == Entry::STATUS_NEW) {
     // Needs to be generated. We have the 'lock' on it and must do so now.
+    if (ThreadState::Get()) {
+      // A guest thread is stalling on the JIT.
+      COUNT_profile_cpu("cpu/jit_hitches", ++jit_hitch_count_);
+    }
 
     // Grab symbol declaration.
     auto function = LookupFunction(address);
@@ -296,10 +358,92 @@ Function* Processor::LookupFunction(Module* module, uint32_t address) {
       return nullptr;
     }
     function->set_status(Symbol::Status::kDeclared);
+    QueueFunctionTranslation(address);
   }
   return function;
 }
 
+void Processor::RequestTierUp(GuestFunction* function) {
+  {
+    std::lock_guard<std::mutex> lock(pretranslate_mutex_);
+    // Counters racing across threads may request more than once.
+    if (!pretranslate_running_ || function->tier() != 0) {
+      return;
+    }
+    function->set_tier(1);
+    tier_up_queue_.push_back(function);
+  }
+  pretranslate_cond_.notify_one();
+}
+
+void Processor::QueueFunctionTranslation(uint32_t address) {
+  if (!pretranslate_running_ || FLAGS_pretranslate_threads <= 0) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(pretranslate_mutex_);
+    pretranslate_queue_.push_back(address);
+  }
+  pretranslate_cond_.notify_one();
+}
+
+void Processor::PretranslateThreadMain() {
+  xe::Profiler::ThreadEnter("Pretranslation");
+  while (true) {
+    uint32_t address = 0;
+    size_t queue_depth = 0;
+    GuestFunction* tier_up_function = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(pretranslate_mutex_);
+      pretranslate_cond_.wait(lock, [this]() {
+        return !pretranslate_running_ || !pretranslate_queue_.empty() ||
+               !tier_up_queue_.empty();
+      });
+      if (!pretranslate_running_) {
+        break;
+      }
+      if (!tier_up_queue_.empty()) {
+        tier_up_function = tier_up_queue_.front();
+        tier_up_queue_.pop_front();
+      } else {
+        address = pretranslate_queue_.front();
+        pretranslate_queue_.pop_front();
+        queue_depth = pretranslate_queue_.size();
+      }
+    }
+
+    if (tier_up_function) {
+      // Retranslating replaces the indirection table entry; callers already
+      // running the tier 0 code finish there, as it is never freed. The new
+      // code and its metadata go into a code slot of their own, leaving those
+      // of the tier 0 code intact for them.
+      SCOPE_profile_cpu_i("cpu", "TierUp");
+      if (frontend_->DefineFunction(tier_up_function, debug_info_flags_)) {
+        COUNT_profile_cpu("cpu/tier_up_count", ++tier_up_count_);
+      } else {
+        XELOGE("Failed to retranslate function %.8X at tier 1",
+               tier_up_function->address());
+      }
+      continue;
+    }
+
+    COUNT_profile_cpu("cpu/pretranslate_queue_depth", queue_depth);
+
+    // Skip anything a guest thread (or another worker) already got to.
+    Entry* entry = entry_table_.Get(address);
+    if (entry) {
+      continue;
+    }
+
+    // Goes through the entry table so that racing guest threads wait on us
+    // instead of translating it again.
+    if (ResolveFunction(address)) {
+      ++pretranslate_count_;
+    }
+  }
+  xe::Profiler::ThreadExit();
+}
+
 bool Processor::DemandFunction(Function* function) {
   // Lock function for generation. If it's already being generated
   // by another thread this will block and return DECLARED.
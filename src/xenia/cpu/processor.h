@@ -12,13 +12,18 @@
 
 #include <gflags/gflags.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
 #include "xenia/base/mapped_memory.h"
 #include "xenia/base/mutex.h"
+#include "xenia/base/threading.h"
 #include "xenia/cpu/backend/backend.h"
 #include "xenia/cpu/debug_listener.h"
 #include "xenia/cpu/entry_table.h"
@@ -115,6 +120,9 @@ class Processor {
   Function* LookupFunction(uint32_t address);
   Function* LookupFunction(Module* module, uint32_t address);
   Function* ResolveFunction(uint32_t address);
+  // Queues a hot tier 0 function for retranslation at tier 1 on the
+  // background threads. Called from generated code (--tiered_jit).
+  void RequestTierUp(GuestFunction* function);
 
   bool Execute(ThreadState* thread_state, uint32_t address);
   bool ExecuteRaw(ThreadState* thread_state, uint32_t address);
@@ -237,6 +245,11 @@ class Processor {
 
   bool DemandFunction(Function* function);
 
+  // Queues the guest function at the given address to be translated by the
+  // background pretranslation threads, if enabled.
+  void QueueFunctionTranslation(uint32_t address);
+  void PretranslateThreadMain();
+
   Memory* memory_ = nullptr;
   std::unique_ptr<StackWalker> stack_walker_;
 
@@ -267,6 +280,21 @@ class Processor {
   // TODO(benvanik): cleanup/change structures.
   std::vector<Breakpoint*> breakpoints_;
 
+  // Background translation of functions ahead of guest threads hitting them.
+  // Functions flow through the entry table like any other, so guest threads
+  // only wait if they race a function that is still being translated.
+  std::vector<std::unique_ptr<xe::threading::Thread>> pretranslate_threads_;
+  std::atomic<bool> pretranslate_running_ = {false};
+  std::mutex pretranslate_mutex_;
+  std::condition_variable pretranslate_cond_;
+  std::deque<uint32_t> pretranslate_queue_;
+  // Hot functions waiting for tier 1; serviced before pretranslation.
+  std::deque<GuestFunction*> tier_up_queue_;
+  std::atomic<uint32_t> pretranslate_count_ = {0};
+  std::atomic<uint32_t> tier_up_count_ = {0};
+  // Number of times a guest thread had to translate a function itself.
+  std::atomic<uint32_t> jit_hitch_count_ = {0};
+
   Irql irql_;
 };
 
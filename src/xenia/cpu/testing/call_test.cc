@@ -0,0 +1,108 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/testing/util.h"
+
+#include <chrono>
+
+#include "xenia/cpu/backend/x64/x64_backend.h"
+
+using namespace xe::cpu::hir;
+using namespace xe::cpu;
+using namespace xe::cpu::testing;
+using xe::cpu::ppc::PPCContext;
+
+namespace {
+
+const uint32_t kCallerAddress = 0x80000000;
+const uint32_t kCalleeAddress = 0x80001000;
+
+// Runs a guest loop that calls a trivial function r4 times, with the callee
+// incrementing r3. Returns the time taken in microseconds.
+int64_t RunCallLoop(uint64_t iterations, bool link_guest_calls,
+                    uint64_t* out_call_count) {
+  bool old_link_guest_calls = FLAGS_link_guest_calls;
+  FLAGS_link_guest_calls = link_guest_calls;
+
+  auto memory = std::make_unique<xe::Memory>();
+  memory->Initialize();
+  auto processor = std::make_unique<Processor>(memory.get(), nullptr);
+  processor->Setup();
+  auto processor_ptr = processor.get();
+
+  processor->AddModule(std::make_unique<TestModule>(
+      processor_ptr, "Callee",
+      [](uint32_t address) { return address == kCalleeAddress; },
+      [](HIRBuilder& b) {
+        StoreGPR(b, 3, b.Add(LoadGPR(b, 3), b.LoadConstantInt64(1)));
+        b.Return();
+        return true;
+      }));
+  processor->AddModule(std::make_unique<TestModule>(
+      processor_ptr, "Caller",
+      [](uint32_t address) { return address == kCallerAddress; },
+      [processor_ptr](HIRBuilder& b) {
+        auto callee = processor_ptr->LookupFunction(kCalleeAddress);
+        auto loop_label = b.NewLabel();
+        auto done_label = b.NewLabel();
+        b.MarkLabel(loop_label);
+        b.BranchTrue(b.CompareEQ(LoadGPR(b, 4), b.LoadZeroInt64()),
+                     done_label);
+        b.Call(callee);
+        StoreGPR(b, 4, b.Sub(LoadGPR(b, 4), b.LoadConstantInt64(1)));
+        b.Branch(loop_label);
+        b.MarkLabel(done_label);
+        b.Return();
+        return true;
+      }));
+  processor->backend()->CommitExecutableRange(0x80000000, 0x80010000);
+
+  auto fn = processor->ResolveFunction(kCallerAddress);
+  auto thread_state = std::make_unique<ThreadState>(processor.get(), 0x100);
+  auto ctx = thread_state->context();
+  ctx->lr = 0xBCBCBCBC;
+  ctx->r[3] = 0;
+  ctx->r[4] = iterations;
+
+  auto start = std::chrono::high_resolution_clock::now();
+  fn->Call(thread_state.get(), uint32_t(ctx->lr));
+  auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::high_resolution_clock::now() - start);
+
+  *out_call_count = ctx->r[3];
+  thread_state.reset();
+  processor.reset();
+  memory.reset();
+  FLAGS_link_guest_calls = old_link_guest_calls;
+  return duration.count();
+}
+
+}  // namespace
+
+TEST_CASE("CALL_LINKED", "[call]") {
+  uint64_t call_count = 0;
+  RunCallLoop(1000, true, &call_count);
+  REQUIRE(call_count == 1000);
+  RunCallLoop(1000, false, &call_count);
+  REQUIRE(call_count == 1000);
+}
+
+// Guest-to-guest call throughput with and without call site linking.
+// Run explicitly with the [benchmark] tag.
+TEST_CASE("CALL_THROUGHPUT", "[.][benchmark][call]") {
+  const uint64_t kIterations = 100000000;
+  for (bool link_guest_calls : {false, true}) {
+    uint64_t call_count = 0;
+    auto duration = RunCallLoop(kIterations, link_guest_calls, &call_count);
+    REQUIRE(call_count == kIterations);
+    WARN((link_guest_calls ? "linked" : "indirect")
+         << ": " << kIterations << " calls in " << duration << "us ("
+         << (kIterations * 1000000 / (duration + 1)) << "/s)");
+  }
+}
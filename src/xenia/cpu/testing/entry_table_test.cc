@@ -0,0 +1,111 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/entry_table.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+
+using xe::cpu::Entry;
+using xe::cpu::EntryTable;
+
+namespace {
+
+const uint32_t kBaseAddress = 0x82000000;
+const uint32_t kFunctionCount = 4096;
+const int kThreadCount = 8;
+
+// Each thread races to create every entry; exactly one must win each.
+// Catch assertions aren't thread-safe, so failures are counted instead.
+void PopulateConcurrently(EntryTable* table, std::atomic<uint32_t>* new_count,
+                          std::atomic<uint32_t>* error_count) {
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreadCount; ++t) {
+    threads.emplace_back([table, new_count, error_count]() {
+      for (uint32_t i = 0; i < kFunctionCount; ++i) {
+        Entry* entry = nullptr;
+        auto status = table->GetOrCreate(kBaseAddress + i * 16, &entry);
+        if (status == Entry::STATUS_NEW) {
+          ++*new_count;
+          entry->end_address = entry->address + 12;
+          entry->status = Entry::STATUS_READY;
+        } else if (status != Entry::STATUS_READY) {
+          ++*error_count;
+        }
+        if (entry->address != kBaseAddress + i * 16) {
+          ++*error_count;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+}  // namespace
+
+TEST_CASE("ENTRY_TABLE_CONCURRENT_CREATE", "[entry_table]") {
+  EntryTable table;
+  std::atomic<uint32_t> new_count(0);
+  std::atomic<uint32_t> error_count(0);
+  PopulateConcurrently(&table, &new_count, &error_count);
+  REQUIRE(new_count == kFunctionCount);
+  REQUIRE(error_count == 0);
+
+  REQUIRE(table.Get(kBaseAddress) != nullptr);
+  REQUIRE(table.Get(kBaseAddress + 4) == nullptr);
+  REQUIRE(table.Get(0x90000000) == nullptr);
+
+  // Outside of the directly-mapped code range.
+  Entry* entry = nullptr;
+  REQUIRE(table.GetOrCreate(0xFFFF0000, &entry) == Entry::STATUS_NEW);
+  entry->status = Entry::STATUS_READY;
+  REQUIRE(table.Get(0xFFFF0000) == entry);
+}
+
+// Lookup throughput with all threads hitting the table at once.
+// Run explicitly with the [benchmark] tag.
+TEST_CASE("ENTRY_TABLE_LOOKUP_THROUGHPUT", "[.][benchmark][entry_table]") {
+  EntryTable table;
+  std::atomic<uint32_t> new_count(0);
+  std::atomic<uint32_t> error_count(0);
+  PopulateConcurrently(&table, &new_count, &error_count);
+
+  const uint32_t kIterations = 64;
+  for (int thread_count = 1; thread_count <= kThreadCount; thread_count *= 2) {
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; ++t) {
+      threads.emplace_back([&table, t]() {
+        for (uint32_t n = 0; n < kIterations; ++n) {
+          for (uint32_t i = 0; i < kFunctionCount; ++i) {
+            uint32_t index = (i * 7 + t) % kFunctionCount;
+            Entry* entry = nullptr;
+            table.GetOrCreate(kBaseAddress + index * 16, &entry);
+          }
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::high_resolution_clock::now() - start);
+    uint64_t lookups = uint64_t(thread_count) * kIterations * kFunctionCount;
+    WARN(thread_count << " threads: " << lookups << " lookups in "
+                      << duration.count() << "us ("
+                      << (lookups * 1000000 / (duration.count() + 1))
+                      << "/s)");
+  }
+}
@@ -0,0 +1,153 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <cstddef>
+
+#include "xenia/cpu/compiler/compiler_passes.h"
+#include "xenia/cpu/hir/hir_builder.h"
+#include "xenia/cpu/hir/label.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+
+#include "third_party/catch/include/catch.hpp"
+
+using namespace xe::cpu::hir;
+using xe::cpu::ppc::PPCContext;
+namespace passes = xe::cpu::compiler::passes;
+
+namespace {
+
+size_t GPR(int n) { return offsetof(PPCContext, r) + n * sizeof(uint64_t); }
+
+int CountOpcode(HIRBuilder& b, const OpcodeInfo& opcode) {
+  int count = 0;
+  for (auto block = b.first_block(); block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (i->opcode == &opcode) {
+        ++count;
+      }
+    }
+  }
+  return count;
+}
+
+// entry:
+//   r3 = 1
+//   if (r4) goto other
+//   [r5 = r3]
+//   r3 = 2
+//   return
+// other:
+//   r3 = 3
+//   return
+void BuildDiamond(HIRBuilder& b, bool read_r3) {
+  b.StoreContext(GPR(3), b.LoadConstantUint64(1));
+  auto other_label = b.NewLabel();
+  b.BranchTrue(b.LoadContext(GPR(4), INT64_TYPE), other_label);
+  if (read_r3) {
+    b.StoreContext(GPR(5), b.LoadContext(GPR(3), INT64_TYPE));
+  }
+  b.StoreContext(GPR(3), b.LoadConstantUint64(2));
+  b.Return();
+  b.MarkLabel(other_label);
+  b.StoreContext(GPR(3), b.LoadConstantUint64(3));
+  b.Return();
+
+  passes::ControlFlowAnalysisPass cfa;
+  cfa.Run(&b);
+}
+
+}  // namespace
+
+TEST_CASE("DSE_CONTEXT_ACROSS_BLOCKS", "[hir][dse]") {
+  HIRBuilder b;
+  BuildDiamond(b, false);
+
+  passes::DeadStoreEliminationPass dse;
+  REQUIRE(dse.Run(&b));
+  // Overwritten on both paths, and the final stores are visible to the
+  // caller.
+  REQUIRE(dse.context_stores_eliminated() == 1);
+  REQUIRE(CountOpcode(b, OPCODE_STORE_CONTEXT_info) == 2);
+}
+
+TEST_CASE("DSE_CONTEXT_LIVE_ON_ONE_PATH", "[hir][dse]") {
+  HIRBuilder b;
+  BuildDiamond(b, true);
+
+  passes::DeadStoreEliminationPass dse;
+  REQUIRE(dse.Run(&b));
+  REQUIRE(dse.context_stores_eliminated() == 0);
+  REQUIRE(CountOpcode(b, OPCODE_STORE_CONTEXT_info) == 4);
+}
+
+TEST_CASE("RLE_CONTEXT_PARTIAL_STORE", "[hir][rle]") {
+  HIRBuilder b;
+  auto v0 = b.LoadContext(GPR(3), INT64_TYPE);
+  auto v1 = b.LoadContext(GPR(3), INT64_TYPE);
+  b.StoreContext(GPR(3) + 4, b.Truncate(v0, INT32_TYPE));
+  auto v2 = b.LoadContext(GPR(3), INT64_TYPE);
+  b.StoreContext(GPR(5), b.Add(v1, v2));
+  b.Return();
+
+  passes::RedundantLoadEliminationPass rle;
+  REQUIRE(rle.Run(&b));
+  // v1 reuses v0, but the store to half of r3 means v2 has to load.
+  REQUIRE(rle.context_loads_eliminated() == 1);
+  REQUIRE(v1->def->opcode == &OPCODE_ASSIGN_info);
+  REQUIRE(v2->def->opcode == &OPCODE_LOAD_CONTEXT_info);
+}
+
+TEST_CASE("LOAD_STORE_ELIMINATION_STACK", "[hir][rle][dse]") {
+  HIRBuilder b;
+  // stw r3, 0x10(r1); lwz r4, 0x10(r1); stw r5, 0x14(r1); stw r4, 0x10(r1)
+  auto sp = b.LoadContext(GPR(1), INT64_TYPE);
+  auto slot = b.Add(sp, b.LoadConstantUint64(0x10));
+  auto next_slot = b.Add(sp, b.LoadConstantUint64(0x14));
+  b.Store(slot, b.LoadContext(GPR(3), INT32_TYPE), LOAD_STORE_BYTE_SWAP);
+  auto loaded = b.Load(slot, INT32_TYPE, LOAD_STORE_BYTE_SWAP);
+  b.Store(next_slot, b.LoadContext(GPR(5), INT32_TYPE), LOAD_STORE_BYTE_SWAP);
+  b.Store(slot, loaded, LOAD_STORE_BYTE_SWAP);
+  b.Return();
+
+  passes::RedundantLoadEliminationPass rle;
+  REQUIRE(rle.Run(&b));
+  REQUIRE(rle.memory_loads_eliminated() == 1);
+  REQUIRE(loaded->def->opcode == &OPCODE_ASSIGN_info);
+
+  // With the load gone the first store is overwritten before anything reads
+  // it.
+  passes::DeadStoreEliminationPass dse;
+  REQUIRE(dse.Run(&b));
+  REQUIRE(dse.memory_stores_eliminated() == 1);
+  REQUIRE(CountOpcode(b, OPCODE_STORE_info) == 2);
+}
+
+TEST_CASE("LOAD_STORE_ELIMINATION_MMIO", "[hir][rle][dse]") {
+  HIRBuilder b;
+  // GPU registers: every access has to happen.
+  auto reg = b.LoadConstantUint32(0x7FC80000);
+  b.Store(reg, b.LoadConstantUint32(1));
+  b.StoreContext(GPR(3), b.Load(reg, INT32_TYPE));
+  b.StoreContext(GPR(4), b.Load(reg, INT32_TYPE));
+  b.Store(reg, b.LoadConstantUint32(2));
+  // Unknown pointers could be MMIO too.
+  auto ptr = b.LoadContext(GPR(5), INT64_TYPE);
+  b.Store(ptr, b.LoadConstantUint32(1));
+  b.Store(ptr, b.LoadConstantUint32(2));
+  b.Return();
+
+  passes::RedundantLoadEliminationPass rle;
+  REQUIRE(rle.Run(&b));
+  REQUIRE(rle.memory_loads_eliminated() == 0);
+  passes::DeadStoreEliminationPass dse;
+  REQUIRE(dse.Run(&b));
+  REQUIRE(dse.memory_stores_eliminated() == 0);
+  REQUIRE(CountOpcode(b, OPCODE_LOAD_info) == 2);
+  REQUIRE(CountOpcode(b, OPCODE_STORE_info) == 4);
+}
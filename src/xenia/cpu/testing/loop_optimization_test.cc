@@ -0,0 +1,221 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <cstddef>
+
+#include "xenia/cpu/compiler/compiler_passes.h"
+#include "xenia/cpu/compiler/loop_analysis.h"
+#include "xenia/cpu/hir/hir_builder.h"
+#include "xenia/cpu/hir/label.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+
+#include "third_party/catch/include/catch.hpp"
+
+using namespace xe::cpu::hir;
+using xe::cpu::compiler::Loop;
+using xe::cpu::compiler::LoopAnalysis;
+using xe::cpu::ppc::PPCContext;
+namespace passes = xe::cpu::compiler::passes;
+
+namespace {
+
+size_t GPR(int n) { return offsetof(PPCContext, r) + n * sizeof(uint64_t); }
+
+// Roughly what a guest copy loop looks like after context promotion:
+//   entry:
+//     r6 = 0
+//   loop:
+//     r5 = byte_swap(r4 + 0x100) + (r3 << 2)
+//     r3 = r3 + 1
+//     if (r3 < r7) goto loop
+//   return
+// r4 is invariant and r3 is an induction variable. If clobber_r4 is set the
+// loop also writes r4, and if barrier is set it ends with a context barrier.
+Label* BuildLoop(HIRBuilder& b, bool clobber_r4 = false,
+                 bool barrier = false) {
+  b.StoreContext(GPR(6), b.LoadZeroInt64());
+  auto loop_label = b.NewLabel();
+  b.MarkLabel(loop_label);
+  auto r3 = b.LoadContext(GPR(3), INT64_TYPE);
+  auto r4 = b.LoadContext(GPR(4), INT64_TYPE);
+  auto base = b.ByteSwap(b.Add(r4, b.LoadConstantUint64(0x100)));
+  auto offset = b.Shl(r3, 2);
+  b.StoreContext(GPR(5), b.Add(base, offset));
+  if (clobber_r4) {
+    b.StoreContext(GPR(4), offset);
+  }
+  if (barrier) {
+    b.ContextBarrier();
+  }
+  auto next = b.Add(r3, b.LoadConstantUint64(1));
+  b.StoreContext(GPR(3), next);
+  b.BranchTrue(b.CompareULT(next, b.LoadContext(GPR(7), INT64_TYPE)),
+               loop_label);
+  b.Return();
+  return loop_label;
+}
+
+int CountOpcode(Block* block, const OpcodeInfo& opcode) {
+  int count = 0;
+  for (auto i = block->instr_head; i; i = i->next) {
+    if (i->opcode == &opcode) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+}  // namespace
+
+TEST_CASE("LOOP_ANALYSIS", "[hir][loop]") {
+  HIRBuilder b;
+  auto loop_label = BuildLoop(b);
+
+  LoopAnalysis analysis;
+  analysis.Analyze(&b);
+  REQUIRE(analysis.loops().size() == 1);
+  auto& loop = analysis.loops()[0];
+  REQUIRE(loop.header == loop_label->block);
+  REQUIRE(loop.preheader == b.first_block());
+  REQUIRE(loop.blocks.size() == 1);
+  REQUIRE(!loop.clobbers_context);
+  REQUIRE(loop.context_stores.size() == 2);
+  REQUIRE(analysis.Dominates(b.first_block(), loop.header));
+  REQUIRE(!analysis.Dominates(loop.header, b.first_block()));
+  REQUIRE(analysis.immediate_dominator(loop.header) == b.first_block());
+}
+
+TEST_CASE("LOOP_ANALYSIS_NESTED", "[hir][loop]") {
+  HIRBuilder b;
+  // outer: r3 = 0; inner: r3 += 1; if (r3 < r7) goto inner;
+  //        r4 += 1; if (r4 < r8) goto outer;
+  b.StoreContext(GPR(4), b.LoadZeroInt64());
+  auto outer_label = b.NewLabel();
+  b.MarkLabel(outer_label);
+  b.StoreContext(GPR(3), b.LoadZeroInt64());
+  auto inner_label = b.NewLabel();
+  b.MarkLabel(inner_label);
+  auto r3 = b.Add(b.LoadContext(GPR(3), INT64_TYPE), b.LoadConstantUint64(1));
+  b.StoreContext(GPR(3), r3);
+  b.BranchTrue(b.CompareULT(r3, b.LoadContext(GPR(7), INT64_TYPE)),
+               inner_label);
+  auto r4 = b.Add(b.LoadContext(GPR(4), INT64_TYPE), b.LoadConstantUint64(1));
+  b.StoreContext(GPR(4), r4);
+  b.BranchTrue(b.CompareULT(r4, b.LoadContext(GPR(8), INT64_TYPE)),
+               outer_label);
+  b.Return();
+
+  LoopAnalysis analysis;
+  analysis.Analyze(&b);
+  REQUIRE(analysis.loops().size() == 2);
+  // Innermost first.
+  auto& inner = analysis.loops()[0];
+  auto& outer = analysis.loops()[1];
+  REQUIRE(inner.header == inner_label->block);
+  REQUIRE(outer.header == outer_label->block);
+  REQUIRE(inner.blocks.size() == 1);
+  REQUIRE(outer.blocks.size() == 3);
+  REQUIRE(outer.Contains(inner.header));
+  REQUIRE(!inner.Contains(outer.header));
+  REQUIRE(inner.preheader == outer.header);
+  REQUIRE(outer.preheader == b.first_block());
+}
+
+TEST_CASE("LICM_HOISTS_INVARIANT", "[hir][loop]") {
+  HIRBuilder b;
+  auto loop_label = BuildLoop(b);
+  auto preheader = b.first_block();
+  auto header = loop_label->block;
+
+  passes::LoopInvariantCodeMotionPass licm;
+  REQUIRE(licm.Run(&b));
+  // load_context r4, add and byte_swap.
+  REQUIRE(licm.instrs_hoisted() == 3);
+  REQUIRE(CountOpcode(header, OPCODE_BYTE_SWAP_info) == 0);
+  REQUIRE(CountOpcode(header, OPCODE_LOAD_LOCAL_info) == 1);
+  REQUIRE(CountOpcode(preheader, OPCODE_BYTE_SWAP_info) == 1);
+  REQUIRE(CountOpcode(preheader, OPCODE_STORE_LOCAL_info) == 1);
+  // The induction variable and loop bound stay put.
+  REQUIRE(CountOpcode(header, OPCODE_LOAD_CONTEXT_info) == 2);
+  REQUIRE(CountOpcode(header, OPCODE_SHL_info) == 1);
+
+  passes::ValidationPass validation;
+  REQUIRE(validation.Run(&b));
+}
+
+TEST_CASE("LICM_RESPECTS_STORES", "[hir][loop]") {
+  {
+    HIRBuilder b;
+    auto loop_label = BuildLoop(b, true, false);
+    passes::LoopInvariantCodeMotionPass licm;
+    REQUIRE(licm.Run(&b));
+    REQUIRE(licm.instrs_hoisted() == 0);
+    REQUIRE(CountOpcode(loop_label->block, OPCODE_BYTE_SWAP_info) == 1);
+  }
+  {
+    HIRBuilder b;
+    auto loop_label = BuildLoop(b, false, true);
+    passes::LoopInvariantCodeMotionPass licm;
+    REQUIRE(licm.Run(&b));
+    REQUIRE(licm.instrs_hoisted() == 0);
+    REQUIRE(CountOpcode(loop_label->block, OPCODE_BYTE_SWAP_info) == 1);
+  }
+}
+
+TEST_CASE("STRENGTH_REDUCTION", "[hir][loop]") {
+  HIRBuilder b;
+  auto loop_label = BuildLoop(b);
+  auto preheader = b.first_block();
+  auto header = loop_label->block;
+
+  passes::StrengthReductionPass strength_reduction;
+  REQUIRE(strength_reduction.Run(&b));
+  REQUIRE(strength_reduction.instrs_reduced() == 1);
+  REQUIRE(CountOpcode(header, OPCODE_SHL_info) == 0);
+  REQUIRE(CountOpcode(preheader, OPCODE_MUL_info) == 1);
+  REQUIRE(CountOpcode(preheader, OPCODE_STORE_LOCAL_info) == 1);
+
+  // The local is stepped by 4 right after r3 is.
+  Instr* store = header->instr_head;
+  while (store && !(store->opcode == &OPCODE_STORE_CONTEXT_info &&
+                    store->src1.offset == GPR(3))) {
+    store = store->next;
+  }
+  REQUIRE(store);
+  REQUIRE(store->next->opcode == &OPCODE_LOAD_LOCAL_info);
+  auto step = store->next->next;
+  REQUIRE(step->opcode == &OPCODE_ADD_info);
+  REQUIRE(step->src2.value->IsConstant());
+  REQUIRE(step->src2.value->AsUint64() == 4);
+  REQUIRE(step->next->opcode == &OPCODE_STORE_LOCAL_info);
+
+  passes::ValidationPass validation;
+  REQUIRE(validation.Run(&b));
+}
+
+TEST_CASE("STRENGTH_REDUCTION_AFTER_STORE", "[hir][loop]") {
+  // The multiply sees the value from before the store, so the local (which
+  // is stepped at the store) can't be used.
+  HIRBuilder b;
+  b.StoreContext(GPR(6), b.LoadZeroInt64());
+  auto loop_label = b.NewLabel();
+  b.MarkLabel(loop_label);
+  auto r3 = b.LoadContext(GPR(3), INT64_TYPE);
+  auto next = b.Add(r3, b.LoadConstantUint64(1));
+  b.StoreContext(GPR(3), next);
+  b.StoreContext(GPR(5), b.Mul(r3, b.LoadConstantUint64(12)));
+  b.BranchTrue(b.CompareULT(next, b.LoadContext(GPR(7), INT64_TYPE)),
+               loop_label);
+  b.Return();
+
+  passes::StrengthReductionPass strength_reduction;
+  REQUIRE(strength_reduction.Run(&b));
+  REQUIRE(strength_reduction.instrs_reduced() == 0);
+  REQUIRE(CountOpcode(loop_label->block, OPCODE_MUL_info) == 1);
+}
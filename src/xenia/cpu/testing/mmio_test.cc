@@ -0,0 +1,520 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/testing/util.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "xenia/base/exception_handler.h"
+#include "xenia/base/memory.h"
+#include "xenia/cpu/backend/x64/x64_backend.h"
+#include "xenia/cpu/mmio_handler.h"
+
+using namespace xe::cpu::hir;
+using namespace xe::cpu;
+using namespace xe::cpu::testing;
+using xe::cpu::ppc::PPCContext;
+
+namespace {
+
+const uint32_t kFunctionAddress = 0x80000000;
+const uint32_t kRegisterAddress = 0x7FC80100;
+const uint32_t kRegisterValue = 0x12345678;
+
+struct RegisterCounters {
+  uint64_t reads;
+  uint64_t writes;
+  uint32_t last_write;
+};
+
+uint32_t ReadRegister(void* ppc_context, void* callback_context,
+                      uint32_t addr) {
+  auto counters = reinterpret_cast<RegisterCounters*>(callback_context);
+  ++counters->reads;
+  return kRegisterValue;
+}
+
+void WriteRegister(void* ppc_context, void* callback_context, uint32_t addr,
+                   uint32_t value) {
+  auto counters = reinterpret_cast<RegisterCounters*>(callback_context);
+  ++counters->writes;
+  counters->last_write = value;
+}
+
+// Runs a guest loop that reads the register at r5 and writes the value back,
+// r4 times. The address comes from the context so that it isn't constant.
+// Returns the time taken in microseconds.
+int64_t RunRegisterLoop(uint64_t iterations, bool inline_mmio_checks,
+                        RegisterCounters* counters, uint64_t* out_value) {
+  bool old_inline_mmio_checks = FLAGS_inline_mmio_checks;
+  FLAGS_inline_mmio_checks = inline_mmio_checks;
+
+  auto memory = std::make_unique<xe::Memory>();
+  memory->Initialize();
+  memory->AddVirtualMappedRange(kRegisterAddress & 0xFFFF0000, 0xFFFF0000,
+                                0x0000FFFF, counters, ReadRegister,
+                                WriteRegister);
+  auto processor = std::make_unique<Processor>(memory.get(), nullptr);
+  processor->Setup();
+
+  processor->AddModule(std::make_unique<TestModule>(
+      processor.get(), "Registers",
+      [](uint32_t address) { return address == kFunctionAddress; },
+      [](HIRBuilder& b) {
+        auto loop_label = b.NewLabel();
+        auto done_label = b.NewLabel();
+        b.MarkLabel(loop_label);
+        b.BranchTrue(b.CompareEQ(LoadGPR(b, 4), b.LoadZeroInt64()),
+                     done_label);
+        auto address = LoadGPR(b, 5);
+        auto value = b.Load(address, INT32_TYPE);
+        b.Store(address, value);
+        StoreGPR(b, 3, b.ZeroExtend(value, INT64_TYPE));
+        StoreGPR(b, 4, b.Sub(LoadGPR(b, 4), b.LoadConstantInt64(1)));
+        b.Branch(loop_label);
+        b.MarkLabel(done_label);
+        b.Return();
+        return true;
+      }));
+  processor->backend()->CommitExecutableRange(0x80000000, 0x80010000);
+
+  auto fn = processor->ResolveFunction(kFunctionAddress);
+  auto thread_state = std::make_unique<ThreadState>(processor.get(), 0x100);
+  auto ctx = thread_state->context();
+  ctx->lr = 0xBCBCBCBC;
+  ctx->r[3] = 0;
+  ctx->r[4] = iterations;
+  ctx->r[5] = kRegisterAddress;
+
+  auto start = std::chrono::high_resolution_clock::now();
+  fn->Call(thread_state.get(), uint32_t(ctx->lr));
+  auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::high_resolution_clock::now() - start);
+
+  *out_value = ctx->r[3];
+  thread_state.reset();
+  processor.reset();
+  memory.reset();
+  FLAGS_inline_mmio_checks = old_inline_mmio_checks;
+  return duration.count();
+}
+
+}  // namespace
+
+TEST_CASE("MMIO_REGISTER_ACCESS", "[mmio]") {
+  for (bool inline_mmio_checks : {false, true}) {
+    RegisterCounters counters = {0};
+    uint64_t value = 0;
+    RunRegisterLoop(100, inline_mmio_checks, &counters, &value);
+    REQUIRE(counters.reads == 100);
+    REQUIRE(counters.writes == 100);
+    // Guest memory is big endian, so a plain load sees the swapped value and
+    // storing it back swaps it again.
+    REQUIRE(value == xe::byte_swap(kRegisterValue));
+    REQUIRE(counters.last_write == kRegisterValue);
+  }
+}
+
+// Register read/write throughput through the access violation handler and
+// through the inline check. Run explicitly with the [benchmark] tag.
+TEST_CASE("MMIO_REGISTER_THROUGHPUT", "[.][benchmark][mmio]") {
+  const uint64_t kIterations = 1000000;
+  for (bool inline_mmio_checks : {false, true}) {
+    RegisterCounters counters = {0};
+    uint64_t value = 0;
+    auto duration =
+        RunRegisterLoop(kIterations, inline_mmio_checks, &counters, &value);
+    REQUIRE(counters.reads == kIterations);
+    REQUIRE(counters.writes == kIterations);
+    WARN((inline_mmio_checks ? "inline" : "fault")
+         << ": " << kIterations << " reads+writes in " << duration << "us ("
+         << (kIterations * 2 * 1000000 / (duration + 1)) << " accesses/s)");
+  }
+}
+
+namespace {
+
+struct WatchCounters {
+  uint32_t fired;
+  uint32_t last_address;
+};
+
+void WatchCallback(void* context_ptr, void* data_ptr, uint32_t address) {
+  auto counters = reinterpret_cast<WatchCounters*>(context_ptr);
+  ++counters->fired;
+  counters->last_address = address;
+}
+
+}  // namespace
+
+TEST_CASE("MMIO_ACCESS_WATCHES", "[mmio]") {
+  auto memory = std::make_unique<xe::Memory>();
+  memory->Initialize();
+  auto handler = MMIOHandler::global_handler();
+
+  WatchCounters counters = {0};
+  auto a = handler->AddPhysicalAccessWatch(0x00100000, 0x1000,
+                                           MMIOHandler::kWatchWrite,
+                                           WatchCallback, &counters, nullptr);
+  // Spans a few buckets.
+  auto b = handler->AddPhysicalAccessWatch(0x00101000, 0x20000,
+                                           MMIOHandler::kWatchWrite,
+                                           WatchCallback, &counters, nullptr);
+  auto c = handler->AddPhysicalAccessWatch(0x00200000, 0x1000,
+                                           MMIOHandler::kWatchWrite,
+                                           WatchCallback, &counters, nullptr);
+  REQUIRE(a);
+  REQUIRE(b);
+  REQUIRE(c);
+  REQUIRE(handler->IsRangeWatched(0x00110000, 4));
+  REQUIRE(handler->IsRangeWatched(0x00120FFC, 4));
+  REQUIRE(!handler->IsRangeWatched(0x00121000, 4));
+  REQUIRE(!handler->IsRangeWatched(0x00180000, 0x10000));
+
+  // Overlaps the end of a and the start of b, each fires once.
+  handler->InvalidateRange(0x00100800, 0x1000);
+  REQUIRE(counters.fired == 2);
+  REQUIRE(!handler->IsRangeWatched(0x00100000, 0x21000));
+  REQUIRE(handler->IsRangeWatched(0x00200000, 0x1000));
+
+  handler->CancelAccessWatch(c);
+  REQUIRE(!handler->IsRangeWatched(0x00200000, 0x1000));
+  handler->InvalidateRange(0x00000000, 0x20000000);
+  REQUIRE(counters.fired == 2);
+}
+
+// Lookups and invalidation with as many watches as a texture heavy title has
+// textures. Run explicitly with the [benchmark] tag.
+TEST_CASE("MMIO_ACCESS_WATCH_STRESS", "[.][benchmark][mmio]") {
+  const uint32_t kWatchCount = 10000;
+  const uint32_t kWatchStride = 0x8000;
+  const uint32_t kWatchLength = 0x4000;
+  const uint32_t kQueryCount = 1000000;
+
+  auto memory = std::make_unique<xe::Memory>();
+  memory->Initialize();
+  auto handler = MMIOHandler::global_handler();
+  WatchCounters counters = {0};
+
+  auto add_watches = [&]() {
+    std::vector<uintptr_t> handles;
+    for (uint32_t i = 0; i < kWatchCount; ++i) {
+      handles.push_back(handler->AddPhysicalAccessWatch(
+          i * kWatchStride, kWatchLength, MMIOHandler::kWatchWrite,
+          WatchCallback, &counters, nullptr));
+    }
+    return handles;
+  };
+  auto elapsed_us = [](std::chrono::high_resolution_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::high_resolution_clock::now() - start)
+        .count();
+  };
+
+  auto start = std::chrono::high_resolution_clock::now();
+  auto handles = add_watches();
+  auto add_time = elapsed_us(start);
+
+  start = std::chrono::high_resolution_clock::now();
+  uint32_t hits = 0;
+  for (uint32_t i = 0; i < kQueryCount; ++i) {
+    // Every other query lands in the gap between two watches.
+    uint32_t address = (i % kWatchCount) * kWatchStride + (i & 1) * 0x6000;
+    hits += handler->IsRangeWatched(address, 4) ? 1 : 0;
+  }
+  auto query_time = elapsed_us(start);
+  REQUIRE(hits == kQueryCount / 2);
+
+  start = std::chrono::high_resolution_clock::now();
+  for (auto handle : handles) {
+    handler->CancelAccessWatch(handle);
+  }
+  auto cancel_time = elapsed_us(start);
+
+  add_watches();
+  start = std::chrono::high_resolution_clock::now();
+  handler->InvalidateRange(0, kWatchCount * kWatchStride);
+  auto invalidate_time = elapsed_us(start);
+  REQUIRE(counters.fired == kWatchCount);
+
+  WARN(kWatchCount << " watches: add " << add_time << "us, " << kQueryCount
+                   << " queries " << query_time << "us, cancel all "
+                   << cancel_time << "us, invalidate all " << invalidate_time
+                   << "us");
+}
+
+namespace {
+
+// Written from the exception handler, so re-read after every faulting access.
+struct FaultCounters {
+  std::atomic<uint32_t> reads;
+  std::atomic<uint32_t> writes;
+  std::atomic<uint32_t> last_write;
+  std::atomic<uint32_t> watch_fired;
+};
+
+uint32_t ReadFaultRegister(void* ppc_context, void* callback_context,
+                           uint32_t addr) {
+  auto counters = reinterpret_cast<FaultCounters*>(callback_context);
+  ++counters->reads;
+  return kRegisterValue;
+}
+
+void WriteFaultRegister(void* ppc_context, void* callback_context,
+                        uint32_t addr, uint32_t value) {
+  auto counters = reinterpret_cast<FaultCounters*>(callback_context);
+  ++counters->writes;
+  counters->last_write = value;
+}
+
+void FaultWatchCallback(void* context_ptr, void* data_ptr, uint32_t address) {
+  auto counters = reinterpret_cast<FaultCounters*>(context_ptr);
+  ++counters->watch_fired;
+}
+
+}  // namespace
+
+// Host accesses that fault into the exception handler, as the backend's
+// loads and stores do when inline_mmio_checks is off.
+TEST_CASE("MMIO_FAULT_DISPATCH", "[mmio]") {
+  auto memory = std::make_unique<xe::Memory>();
+  memory->Initialize();
+  FaultCounters counters;
+  counters.reads = 0;
+  counters.writes = 0;
+  counters.last_write = 0;
+  counters.watch_fired = 0;
+  memory->AddVirtualMappedRange(kRegisterAddress & 0xFFFF0000, 0xFFFF0000,
+                                0x0000FFFF, &counters, ReadFaultRegister,
+                                WriteFaultRegister);
+  auto handler = MMIOHandler::global_handler();
+
+  auto reg = memory->TranslateVirtual<volatile uint32_t*>(kRegisterAddress);
+  uint32_t value = *reg;
+  REQUIRE(counters.reads == 1);
+  REQUIRE(value == xe::byte_swap(kRegisterValue));
+  // Through a volatile so that it's stored from a register.
+  volatile uint32_t store_value = 0xAABBCCDD;
+  *reg = store_value;
+  REQUIRE(counters.writes == 1);
+  REQUIRE(counters.last_write == 0xDDCCBBAA);
+
+  uint32_t guest_address =
+      memory->SystemHeapAlloc(0x2000, 0x1000, xe::kSystemHeapPhysical);
+  REQUIRE(guest_address);
+  auto watch = handler->AddPhysicalAccessWatch(
+      guest_address & 0x1FFFFFFF, 0x1000, MMIOHandler::kWatchWrite,
+      FaultWatchCallback, &counters, nullptr);
+  REQUIRE(watch);
+  auto data = memory->TranslateVirtual<volatile uint32_t*>(guest_address);
+  // Reads don't trigger write watches.
+  value = data[0];
+  REQUIRE(counters.watch_fired == 0);
+  // The first write fires the watch and is then retried, the second goes
+  // straight through.
+  data[1] = store_value;
+  REQUIRE(counters.watch_fired == 1);
+  data[2] = store_value;
+  REQUIRE(counters.watch_fired == 1);
+  REQUIRE(data[1] == 0xAABBCCDD);
+  REQUIRE(!handler->IsRangeWatched(guest_address & 0x1FFFFFFF, 0x1000));
+  memory->SystemHeapFree(guest_address);
+}
+
+namespace {
+
+// Stands in for the crash handler behind the MMIO one, letting the access
+// through once it has seen the fault.
+struct UnwatchedFault {
+  uint64_t page_address;
+  size_t page_length;
+  std::atomic<uint32_t> count;
+};
+
+bool UnwatchedFaultHandler(xe::Exception* ex, void* data) {
+  auto fault = reinterpret_cast<UnwatchedFault*>(data);
+  if (ex->code() != xe::Exception::Code::kAccessViolation ||
+      ex->fault_address() - fault->page_address >= fault->page_length) {
+    return false;
+  }
+  ++fault->count;
+  xe::memory::Protect(reinterpret_cast<void*>(fault->page_address),
+                      fault->page_length, xe::memory::PageAccess::kReadWrite,
+                      nullptr);
+  return true;
+}
+
+}  // namespace
+
+// Faults on pages that were never watched are real access violations, and
+// must be passed on rather than retried.
+TEST_CASE("MMIO_UNWATCHED_FAULT", "[mmio]") {
+  auto memory = std::make_unique<xe::Memory>();
+  memory->Initialize();
+  size_t page_length = xe::memory::page_size();
+  uint32_t guest_address = memory->SystemHeapAlloc(
+      uint32_t(page_length), uint32_t(page_length), xe::kSystemHeapPhysical);
+  REQUIRE(guest_address);
+  auto data = memory->TranslateVirtual<volatile uint32_t*>(guest_address);
+  UnwatchedFault fault;
+  fault.page_address = reinterpret_cast<uint64_t>(data);
+  fault.page_length = page_length;
+  fault.count = 0;
+  REQUIRE(xe::memory::Protect(const_cast<uint32_t*>(data), page_length,
+                              xe::memory::PageAccess::kNoAccess, nullptr));
+  xe::ExceptionHandler::Install(UnwatchedFaultHandler, &fault);
+
+  std::atomic<bool> done(false);
+  std::thread reader([&]() {
+    uint32_t value = data[0];
+    (void)value;
+    done = true;
+  });
+  // Were the fault swallowed, the read would be retried forever - let it
+  // through so that the test fails instead of hanging.
+  for (int i = 0; i < 1000 && !done; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  if (!done) {
+    xe::memory::Protect(const_cast<uint32_t*>(data), page_length,
+                        xe::memory::PageAccess::kReadWrite, nullptr);
+  }
+  reader.join();
+  xe::ExceptionHandler::Uninstall(UnwatchedFaultHandler, &fault);
+  REQUIRE(fault.count == 1);
+  memory->SystemHeapFree(guest_address);
+}
+
+// Cost of a single fault for a register load and for a write watch (including
+// re-arming the watch). Run explicitly with the [benchmark] tag.
+TEST_CASE("MMIO_FAULT_LATENCY", "[.][benchmark][mmio]") {
+  const uint32_t kIterations = 10000;
+  auto memory = std::make_unique<xe::Memory>();
+  memory->Initialize();
+  FaultCounters counters;
+  counters.reads = 0;
+  counters.writes = 0;
+  counters.last_write = 0;
+  counters.watch_fired = 0;
+  memory->AddVirtualMappedRange(kRegisterAddress & 0xFFFF0000, 0xFFFF0000,
+                                0x0000FFFF, &counters, ReadFaultRegister,
+                                WriteFaultRegister);
+  auto handler = MMIOHandler::global_handler();
+  auto elapsed_ns = [](std::chrono::high_resolution_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::high_resolution_clock::now() - start)
+        .count();
+  };
+
+  auto reg = memory->TranslateVirtual<volatile uint32_t*>(kRegisterAddress);
+  auto start = std::chrono::high_resolution_clock::now();
+  for (uint32_t i = 0; i < kIterations; ++i) {
+    *reg;
+  }
+  auto load_time = elapsed_ns(start);
+  REQUIRE(counters.reads == kIterations);
+
+  uint32_t guest_address =
+      memory->SystemHeapAlloc(0x1000, 0x1000, xe::kSystemHeapPhysical);
+  auto data = memory->TranslateVirtual<volatile uint32_t*>(guest_address);
+  start = std::chrono::high_resolution_clock::now();
+  for (uint32_t i = 0; i < kIterations; ++i) {
+    handler->AddPhysicalAccessWatch(guest_address & 0x1FFFFFFF, 0x1000,
+                                    MMIOHandler::kWatchWrite,
+                                    FaultWatchCallback, &counters, nullptr);
+    data[0] = i;
+  }
+  auto watch_time = elapsed_ns(start);
+  REQUIRE(counters.watch_fired == kIterations);
+  memory->SystemHeapFree(guest_address);
+
+  WARN("register load fault " << load_time / kIterations
+                              << "ns, write watch arm+fault "
+                              << watch_time / kIterations << "ns");
+}
+
+TEST_CASE("MMIO_ACCESS_WATCH_BATCHING", "[mmio]") {
+  auto memory = std::make_unique<xe::Memory>();
+  memory->Initialize();
+  auto handler = MMIOHandler::global_handler();
+  FaultCounters counters;
+  counters.watch_fired = 0;
+
+  uint32_t guest_address =
+      memory->SystemHeapAlloc(0x4000, 0x1000, xe::kSystemHeapPhysical);
+  REQUIRE(guest_address);
+  uint32_t physical_address = guest_address & 0x1FFFFFFF;
+  auto data = memory->TranslateVirtual<volatile uint32_t*>(guest_address);
+  volatile uint32_t store_value = 1;
+  handler->EndAccessWatchFrame();
+
+  // Pages already protected by another watch aren't protected again.
+  handler->AddPhysicalAccessWatch(physical_address, 0x3000,
+                                  MMIOHandler::kWatchWrite, FaultWatchCallback,
+                                  &counters, nullptr);
+  handler->AddPhysicalAccessWatch(physical_address + 0x1000, 0x3000,
+                                  MMIOHandler::kWatchWrite, FaultWatchCallback,
+                                  &counters, nullptr);
+  auto stats = handler->EndAccessWatchFrame();
+  REQUIRE(stats.protect_runs == 2);
+
+  // Pages still covered by the second watch stay protected when the first
+  // one fires.
+  data[0] = store_value;
+  REQUIRE(counters.watch_fired == 1);
+  data[0x1000 / 4] = store_value;
+  REQUIRE(counters.watch_fired == 2);
+  stats = handler->EndAccessWatchFrame();
+  REQUIRE(stats.faults == 2);
+  REQUIRE(stats.watches_fired == 2);
+
+  // Batched, a page rewritten after every upload faults once per frame.
+  bool old_batch_access_watch_faults = FLAGS_batch_access_watch_faults;
+  FLAGS_batch_access_watch_faults = true;
+  counters.watch_fired = 0;
+  for (uint32_t i = 0; i < 10; ++i) {
+    handler->AddPhysicalAccessWatch(physical_address, 0x1000,
+                                    MMIOHandler::kWatchWrite,
+                                    FaultWatchCallback, &counters, nullptr);
+    data[i] = store_value;
+  }
+  REQUIRE(counters.watch_fired == 1);
+  stats = handler->EndAccessWatchFrame();
+  REQUIRE(stats.faults == 1);
+  REQUIRE(stats.pages_held_open == 1);
+  // The watches added since couldn't see writes, so they fire now.
+  REQUIRE(counters.watch_fired == 10);
+  REQUIRE(!handler->IsRangeWatched(physical_address, 0x1000));
+
+  // Reads would go unnoticed on an open page, so read watches protect it again
+  // and pages with read watches aren't left open.
+  counters.watch_fired = 0;
+  handler->AddPhysicalAccessWatch(physical_address, 0x1000,
+                                  MMIOHandler::kWatchWrite, FaultWatchCallback,
+                                  &counters, nullptr);
+  data[0] = store_value;
+  handler->AddPhysicalAccessWatch(physical_address, 0x1000,
+                                  MMIOHandler::kWatchReadWrite,
+                                  FaultWatchCallback, &counters, nullptr);
+  volatile uint32_t load_value = data[0];
+  REQUIRE(counters.watch_fired == 2);
+  handler->AddPhysicalAccessWatch(physical_address + 0x1000, 0x1000,
+                                  MMIOHandler::kWatchReadWrite,
+                                  FaultWatchCallback, &counters, nullptr);
+  data[0x1000 / 4] = store_value;
+  REQUIRE(counters.watch_fired == 3);
+  stats = handler->EndAccessWatchFrame();
+  REQUIRE(stats.pages_held_open == 1);
+  (void)load_value;
+  FLAGS_batch_access_watch_faults = old_batch_access_watch_faults;
+
+  memory->SystemHeapFree(guest_address);
+}
@@ -22,6 +22,7 @@
 #include "xenia/kernel/xmodule.h"
 
 #include "third_party/crypto/rijndael-alg-fst.h"
+#include "third_party/xxhash/xxhash.h"
 
 namespace xe {
 namespace cpu {
@@ -196,6 +197,7 @@ bool XexModule::Load(const std::string& name, const std::string& path,
   xex_header_mem_.resize(src_header->header_size);
 
   std::memcpy(xex_header_mem_.data(), src_header, src_header->header_size);
+  hash_ = XXH64(xex_header_mem_.data(), xex_header_mem_.size(), 0);
 
   return Load(name, path, xex_);
 }
@@ -467,7 +469,7 @@ bool XexModule::SetupLibraryImports(const char* name,
         if (kernel_export) {
           if (kernel_export->function_data.trampoline) {
             handler = (GuestFunction::ExternHandler)
-                          kernel_export->function_data.trampoline;
+                          kernel_export->GetTrampoline();
           } else {
             handler =
                 (GuestFunction::ExternHandler)kernel_export->function_data.shim;
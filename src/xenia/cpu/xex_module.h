@@ -78,6 +78,7 @@ class XexModule : public xe::cpu::Module {
   bool is_executable() const override {
     return (xex_header()->module_flags & XEX_MODULE_TITLE) != 0;
   }
+  uint64_t hash() const override { return hash_; }
 
   bool ContainsAddress(uint32_t address) override;
 
@@ -96,6 +97,7 @@ class XexModule : public xe::cpu::Module {
   xe_xex2_ref xex_ = nullptr;
   std::vector<uint8_t> xex_header_mem_;  // Holds the xex header
   bool loaded_ = false;                  // Loaded into memory?
+  uint64_t hash_ = 0;                    // XXH64 of the xex header
 
   uint32_t base_address_ = 0;
   uint32_t low_address_ = 0;
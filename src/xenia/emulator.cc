@@ -45,6 +45,10 @@ DEFINE_double(time_scalar, 1.0,
 
 namespace xe {
 
+// Bumped whenever the layout of a save state changes, as older ones can't be
+// read back. 1: system heap pools ahead of the memory heaps.
+const uint32_t kSaveStateVersion = 1;
+
 Emulator::Emulator(const std::wstring& command_line)
     : command_line_(command_line) {}
 
@@ -362,6 +366,7 @@ bool Emulator::SaveToFile(const std::wstring& path) {
   // Save the emulator state to a file
   ByteStream stream(map->data(), map->size());
   stream.Write('XSAV');
+  stream.Write(kSaveStateVersion);
   stream.Write(title_id_);
 
   // It's important we don't hold the global lock here! XThreads need to step
@@ -396,6 +401,13 @@ bool Emulator::RestoreFromFile(const std::wstring& path) {
     return false;
   }
 
+  auto version = stream.Read<uint32_t>();
+  if (version != kSaveStateVersion) {
+    XELOGE("Unsupported save state version %u (expected %u)", version,
+           kSaveStateVersion);
+    return false;
+  }
+
   auto title_id = stream.Read<uint32_t>();
   if (title_id != title_id_) {
     // Swapping between titles is unsupported at the moment.
@@ -616,6 +628,11 @@ X_STATUS Emulator::CompleteLaunch(const std::wstring& path,
     }
   }
 
+  // Warm up with the shaders the title used in previous runs.
+  if (title_id_) {
+    graphics_system_->InitializeShaderStorage(title_id_);
+  }
+
   auto main_xthread = kernel_state_->LaunchModule(module);
   if (!main_xthread) {
     return X_STATUS_UNSUCCESSFUL;
@@ -16,6 +16,7 @@
 #include "xenia/base/math.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/ring_buffer.h"
+#include "xenia/cpu/mmio_handler.h"
 #include "xenia/gpu/gpu_flags.h"
 #include "xenia/gpu/graphics_system.h"
 #include "xenia/gpu/sampler_info.h"
@@ -345,6 +346,9 @@ void CommandProcessor::IssueSwap(uint32_t frontbuffer_ptr,
 
   PerformSwap(frontbuffer_ptr, frontbuffer_width, frontbuffer_height);
 
+  // Releases pages held open by write watch faults and rolls the stats.
+  cpu::MMIOHandler::global_handler()->EndAccessWatchFrame();
+
   {
     // Set pending so that the display will swap the next time it can.
     std::lock_guard<std::mutex> lock(swap_state_.mutex);
@@ -77,6 +77,11 @@ class CommandProcessor {
 
   virtual void ClearCaches();
 
+  // Opens the persistent shader storage for the title, if the backend keeps
+  // one. Must be called on the worker thread.
+  virtual void InitializeShaderStorage(const std::wstring& storage_root,
+                                       uint32_t title_id) {}
+
   SwapState& swap_state() { return swap_state_; }
   void set_swap_mode(SwapMode swap_mode) { swap_mode_ = swap_mode; }
   void IssueSwap(uint32_t frontbuffer_ptr, uint32_t frontbuffer_width,
@@ -151,10 +151,15 @@ TextureCache::~TextureCache() { Shutdown(); }
 bool TextureCache::Initialize(Memory* memory, CircularBuffer* scratch_buffer) {
   memory_ = memory;
   scratch_buffer_ = scratch_buffer;
+  texture_converter_ = std::make_unique<TextureConverter>(
+      std::max(FLAGS_texture_conversion_threads, 0));
   return true;
 }
 
-void TextureCache::Shutdown() { Clear(); }
+void TextureCache::Shutdown() {
+  Clear();
+  texture_converter_.reset();
+}
 
 void TextureCache::Scavenge() {
   invalidated_textures_mutex_.lock();
@@ -687,25 +692,6 @@ void TextureCache::EvictTexture(TextureEntry* entry) {
   delete entry;
 }
 
-void TextureSwap(Endian endianness, void* dest, const void* src,
-                 size_t length) {
-  switch (endianness) {
-    case Endian::k8in16:
-      xe::copy_and_swap_16_aligned(dest, src, length / 2);
-      break;
-    case Endian::k8in32:
-      xe::copy_and_swap_32_aligned(dest, src, length / 4);
-      break;
-    case Endian::k16in32:  // Swap high and low 16 bits within a 32 bit word
-      xe::copy_and_swap_16_in_32_aligned(dest, src, length);
-      break;
-    default:
-    case Endian::kUnspecified:
-      std::memcpy(dest, src, length);
-      break;
-  }
-}
-
 bool TextureCache::UploadTexture2D(GLuint texture,
                                    const TextureInfo& texture_info) {
   SCOPE_profile_cpu_f("gpu");
@@ -725,66 +711,9 @@ bool TextureCache::UploadTexture2D(GLuint texture,
                      texture_info.size_2d.output_height);
 
   auto allocation = scratch_buffer_->Acquire(unpack_length);
-
-  if (!texture_info.is_tiled) {
-    if (texture_info.size_2d.input_pitch == texture_info.size_2d.output_pitch) {
-      // Fast path copy entire image.
-      TextureSwap(texture_info.endianness, allocation.host_ptr, host_address,
-                  unpack_length);
-    } else {
-      // Slow path copy row-by-row because strides differ.
-      // UNPACK_ROW_LENGTH only works for uncompressed images, and likely does
-      // this exact thing under the covers, so we just always do it here.
-      const uint8_t* src = host_address;
-      uint8_t* dest = reinterpret_cast<uint8_t*>(allocation.host_ptr);
-      uint32_t pitch = std::min(texture_info.size_2d.input_pitch,
-                                texture_info.size_2d.output_pitch);
-      for (uint32_t y = 0; y < std::min(texture_info.size_2d.block_height,
-                                        texture_info.size_2d.logical_height);
-           y++) {
-        TextureSwap(texture_info.endianness, dest, src, pitch);
-        src += texture_info.size_2d.input_pitch;
-        dest += texture_info.size_2d.output_pitch;
-      }
-    }
-  } else {
-    // Untile image.
-    // We could do this in a shader to speed things up, as this is pretty slow.
-
-    // TODO(benvanik): optimize this inner loop (or work by tiles).
-    const uint8_t* src = host_address;
-    uint8_t* dest = reinterpret_cast<uint8_t*>(allocation.host_ptr);
-    uint32_t bytes_per_block = texture_info.format_info->block_width *
-                               texture_info.format_info->block_height *
-                               texture_info.format_info->bits_per_pixel / 8;
-
-    // Tiled textures can be packed; get the offset into the packed texture.
-    uint32_t offset_x;
-    uint32_t offset_y;
-    TextureInfo::GetPackedTileOffset(texture_info, &offset_x, &offset_y);
-
-    auto bpp = (bytes_per_block >> 2) +
-               ((bytes_per_block >> 1) >> (bytes_per_block >> 2));
-    for (uint32_t y = 0, output_base_offset = 0;
-         y < std::min(texture_info.size_2d.block_height,
-                      texture_info.size_2d.logical_height);
-         y++, output_base_offset += texture_info.size_2d.output_pitch) {
-      auto input_base_offset = TextureInfo::TiledOffset2DOuter(
-          offset_y + y, (texture_info.size_2d.input_width /
-                         texture_info.format_info->block_width),
-          bpp);
-      for (uint32_t x = 0, output_offset = output_base_offset;
-           x < texture_info.size_2d.block_width;
-           x++, output_offset += bytes_per_block) {
-        auto input_offset =
-            TextureInfo::TiledOffset2DInner(offset_x + x, offset_y + y, bpp,
-                                            input_base_offset) >>
-            bpp;
-        TextureSwap(texture_info.endianness, dest + output_offset,
-                    src + input_offset * bytes_per_block, bytes_per_block);
-      }
-    }
-  }
+  texture_converter_->ConvertTexture(
+      reinterpret_cast<uint8_t*>(allocation.host_ptr), host_address,
+      texture_info);
   size_t unpack_offset = allocation.offset;
   scratch_buffer_->Commit(std::move(allocation));
   // TODO(benvanik): avoid flush on entire buffer by using another texture
@@ -832,64 +761,9 @@ bool TextureCache::UploadTextureCube(GLuint texture,
                      texture_info.size_cube.output_height);
 
   auto allocation = scratch_buffer_->Acquire(unpack_length);
-  if (!texture_info.is_tiled) {
-    if (texture_info.size_cube.input_pitch ==
-        texture_info.size_cube.output_pitch) {
-      // Fast path copy entire image.
-      TextureSwap(texture_info.endianness, allocation.host_ptr, host_address,
-                  unpack_length);
-    } else {
-      // Slow path copy row-by-row because strides differ.
-      // UNPACK_ROW_LENGTH only works for uncompressed images, and likely does
-      // this exact thing under the covers, so we just always do it here.
-      const uint8_t* src = host_address;
-      uint8_t* dest = reinterpret_cast<uint8_t*>(allocation.host_ptr);
-      for (int face = 0; face < 6; ++face) {
-        uint32_t pitch = std::min(texture_info.size_cube.input_pitch,
-                                  texture_info.size_cube.output_pitch);
-        for (uint32_t y = 0; y < texture_info.size_cube.block_height; y++) {
-          TextureSwap(texture_info.endianness, dest, src, pitch);
-          src += texture_info.size_cube.input_pitch;
-          dest += texture_info.size_cube.output_pitch;
-        }
-      }
-    }
-  } else {
-    // TODO(benvanik): optimize this inner loop (or work by tiles).
-    const uint8_t* src = host_address;
-    uint8_t* dest = reinterpret_cast<uint8_t*>(allocation.host_ptr);
-    uint32_t bytes_per_block = texture_info.format_info->block_width *
-                               texture_info.format_info->block_height *
-                               texture_info.format_info->bits_per_pixel / 8;
-    // Tiled textures can be packed; get the offset into the packed texture.
-    uint32_t offset_x;
-    uint32_t offset_y;
-    TextureInfo::GetPackedTileOffset(texture_info, &offset_x, &offset_y);
-    auto bpp = (bytes_per_block >> 2) +
-               ((bytes_per_block >> 1) >> (bytes_per_block >> 2));
-    for (int face = 0; face < 6; ++face) {
-      for (uint32_t y = 0, output_base_offset = 0;
-           y < texture_info.size_cube.block_height;
-           y++, output_base_offset += texture_info.size_cube.output_pitch) {
-        auto input_base_offset = TextureInfo::TiledOffset2DOuter(
-            offset_y + y, (texture_info.size_cube.input_width /
-                           texture_info.format_info->block_width),
-            bpp);
-        for (uint32_t x = 0, output_offset = output_base_offset;
-             x < texture_info.size_cube.block_width;
-             x++, output_offset += bytes_per_block) {
-          auto input_offset =
-              TextureInfo::TiledOffset2DInner(offset_x + x, offset_y + y, bpp,
-                                              input_base_offset) >>
-              bpp;
-          TextureSwap(texture_info.endianness, dest + output_offset,
-                      src + input_offset * bytes_per_block, bytes_per_block);
-        }
-      }
-      src += texture_info.size_cube.input_face_length;
-      dest += texture_info.size_cube.output_face_length;
-    }
-  }
+  texture_converter_->ConvertTexture(
+      reinterpret_cast<uint8_t*>(allocation.host_ptr), host_address,
+      texture_info);
   size_t unpack_offset = allocation.offset;
   scratch_buffer_->Commit(std::move(allocation));
   // TODO(benvanik): avoid flush on entire buffer by using another texture
@@ -10,11 +10,13 @@
 #ifndef XENIA_GPU_GL4_TEXTURE_CACHE_H_
 #define XENIA_GPU_GL4_TEXTURE_CACHE_H_
 
+#include <memory>
 #include <mutex>
 #include <unordered_map>
 #include <vector>
 
 #include "xenia/gpu/sampler_info.h"
+#include "xenia/gpu/texture_conversion.h"
 #include "xenia/gpu/texture_info.h"
 #include "xenia/memory.h"
 #include "xenia/ui/gl/blitter.h"
@@ -101,6 +103,7 @@ class TextureCache {
 
   Memory* memory_;
   CircularBuffer* scratch_buffer_;
+  std::unique_ptr<TextureConverter> texture_converter_;
   std::unordered_map<uint64_t, SamplerEntry*> sampler_entries_;
   std::unordered_map<uint64_t, TextureEntry*> texture_entries_;
 
@@ -15,5 +15,12 @@ DEFINE_bool(trace_gpu_stream, false, "Trace all GPU packets.");
 
 DEFINE_string(dump_shaders, "",
               "Path to write GPU shaders to as they are compiled.");
+DEFINE_string(shader_storage_root, "cache",
+              "Path to keep translated shaders and pipelines in between runs, "
+              "per title. Empty to disable.");
 
 DEFINE_bool(vsync, true, "Enable VSYNC.");
+
+DEFINE_int32(texture_conversion_threads, 2,
+             "Threads helping untile large textures, on top of the thread "
+             "uploading them. 0 to convert on the uploading thread only.");
@@ -16,7 +16,10 @@ DECLARE_string(trace_gpu_prefix);
 DECLARE_bool(trace_gpu_stream);
 
 DECLARE_string(dump_shaders);
+DECLARE_string(shader_storage_root);
 
 DECLARE_bool(vsync);
 
+DECLARE_int32(texture_conversion_threads);
+
 #endif  // XENIA_GPU_GPU_FLAGS_H_
@@ -236,6 +236,13 @@ void GraphicsSystem::ClearCaches() {
       [&]() { command_processor_->ClearCaches(); });
 }
 
+void GraphicsSystem::InitializeShaderStorage(uint32_t title_id) {
+  auto storage_root = xe::to_wstring(FLAGS_shader_storage_root);
+  command_processor_->CallInThread([this, storage_root, title_id]() {
+    command_processor_->InitializeShaderStorage(storage_root, title_id);
+  });
+}
+
 void GraphicsSystem::RequestFrameTrace() {
   command_processor_->RequestFrameTrace(xe::to_wstring(FLAGS_trace_gpu_prefix));
 }
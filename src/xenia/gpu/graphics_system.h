@@ -57,6 +57,9 @@ class GraphicsSystem {
 
   virtual void ClearCaches();
 
+  // Loads the shaders and pipelines stored for the title by previous runs.
+  void InitializeShaderStorage(uint32_t title_id);
+
   void RequestFrameTrace();
   void BeginTracing();
   void EndTracing();
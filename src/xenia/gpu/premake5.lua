@@ -25,6 +25,18 @@ project("xenia-gpu")
   local_platform_files("spirv")
   local_platform_files("spirv/passes")
 
+test_suite("xenia-gpu-tests", project_root, ".", {
+  includedirs = {
+    project_root.."/third_party/gflags/src",
+  },
+  links = {
+    "xenia-base",
+    "xenia-gpu",
+    "xenia-ui",
+    "xxhash",
+  },
+})
+
 group("src")
 project("xenia-gpu-shader-compiler")
   uuid("ad76d3e4-4c62-439b-a0f6-f83fcf0e83c5")
@@ -0,0 +1,485 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/texture_conversion.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/base/memory.h"
+#include "xenia/base/platform.h"
+#include "xenia/base/string.h"
+
+namespace xe {
+namespace gpu {
+
+void TextureSwap(Endian endianness, void* dest, const void* src,
+                 size_t length) {
+  switch (endianness) {
+    case Endian::k8in16:
+      xe::copy_and_swap_16_aligned(dest, src, length / 2);
+      break;
+    case Endian::k8in32:
+      xe::copy_and_swap_32_aligned(dest, src, length / 4);
+      break;
+    case Endian::k16in32:  // Swap high and low 16 bits within a 32 bit word
+      xe::copy_and_swap_16_in_32_aligned(dest, src, length / 4);
+      break;
+    default:
+    case Endian::kUnspecified:
+      std::memcpy(dest, src, length);
+      break;
+  }
+}
+
+namespace {
+
+// Bytes of guest memory in which consecutive blocks of a row are contiguous.
+constexpr uint32_t TilingRunLength(uint32_t log_bpp) {
+  return log_bpp ? 16 : 8;
+}
+constexpr uint32_t TilingRunBlocks(uint32_t log_bpp) {
+  return TilingRunLength(log_bpp) >> log_bpp;
+}
+// Blocks, both across and down, after which the tiling pattern repeats
+// (moved along by a fixed number of bytes), for any width that is a whole
+// number of tiles.
+constexpr uint32_t TilingPeriod(uint32_t log_bpp) {
+  return log_bpp >= 2 ? 32 : 128 >> log_bpp;
+}
+
+// Everything the row kernels need to convert a tiled texture.
+struct TiledLayout {
+  const uint8_t* src;
+  uint8_t* dest;
+  Endian endianness;
+  uint32_t log_bpp;
+  // Rows converted per face, and in total.
+  uint32_t face_rows;
+  uint32_t row_count;
+  // Blocks converted per row.
+  uint32_t columns;
+  uint32_t output_pitch;
+  uint32_t input_face_length;
+  uint32_t output_face_length;
+  // Position of the texture within a packed tile.
+  uint32_t offset_x;
+  uint32_t offset_y;
+  // Byte offset of each run within one repetition of the pattern, a row of
+  // TilingPeriod / TilingRunBlocks runs for each of TilingPeriod rows.
+  std::vector<uint32_t> run_offsets;
+  // How far the pattern moves each time it repeats across and down.
+  uint32_t period_step_x;
+  uint32_t period_step_y;
+};
+
+bool PrepareTiledLayout(uint8_t* dest, const uint8_t* src,
+                        const TextureInfo& info, TiledLayout* layout) {
+  if (!info.is_tiled) {
+    return false;
+  }
+  bool is_cube = info.dimension == Dimension::kCube;
+  if (info.dimension != Dimension::k2D && !is_cube) {
+    return false;
+  }
+  uint32_t bytes_per_block = info.format_info->block_width *
+                             info.format_info->block_height *
+                             info.format_info->bits_per_pixel / 8;
+  if (!bytes_per_block || bytes_per_block > 16 ||
+      (bytes_per_block & (bytes_per_block - 1))) {
+    return false;
+  }
+  uint32_t log_bpp = xe::log2_floor(bytes_per_block);
+  uint32_t offset_x, offset_y;
+  TextureInfo::GetPackedTileOffset(info, &offset_x, &offset_y);
+  if (offset_x % TilingRunBlocks(log_bpp)) {
+    return false;
+  }
+
+  // size_cube starts with the same members as size_2d.
+  auto& size = info.size_2d;
+  layout->src = src;
+  layout->dest = dest;
+  layout->endianness = info.endianness;
+  layout->log_bpp = log_bpp;
+  layout->columns = size.output_pitch / bytes_per_block;
+  layout->output_pitch = size.output_pitch;
+  if (is_cube) {
+    layout->input_face_length = info.size_cube.input_face_length;
+    layout->output_face_length = info.size_cube.output_face_length;
+    layout->face_rows =
+        std::min(size.block_height,
+                 info.size_cube.output_face_length / size.output_pitch);
+    layout->row_count = layout->face_rows * 6;
+  } else {
+    layout->input_face_length = 0;
+    layout->output_face_length = 0;
+    layout->face_rows =
+        std::min({size.block_height, size.logical_height,
+                  info.output_length / size.output_pitch});
+    layout->row_count = layout->face_rows;
+  }
+  layout->offset_x = offset_x;
+  layout->offset_y = offset_y;
+
+  uint32_t input_width = size.input_width / info.format_info->block_width;
+  uint32_t period = TilingPeriod(log_bpp);
+  uint32_t run_blocks = TilingRunBlocks(log_bpp);
+  uint32_t runs_per_row = period / run_blocks;
+  layout->run_offsets.resize(period * runs_per_row);
+  for (uint32_t y = 0; y < period; ++y) {
+    uint32_t base_offset =
+        TextureInfo::TiledOffset2DOuter(y, input_width, log_bpp);
+    for (uint32_t i = 0; i < runs_per_row; ++i) {
+      layout->run_offsets[y * runs_per_row + i] =
+          TextureInfo::TiledOffset2DInner(i * run_blocks, y, log_bpp,
+                                          base_offset);
+    }
+  }
+  layout->period_step_x =
+      TextureInfo::TiledOffset2DInner(period, 0, log_bpp, 0);
+  layout->period_step_y = TextureInfo::TiledOffset2DInner(
+      0, period, log_bpp,
+      TextureInfo::TiledOffset2DOuter(period, input_width, log_bpp));
+  return true;
+}
+
+// One row of blocks being converted.
+struct TiledRow {
+  // Guest data of the pattern repetition the row is in, in the first column.
+  const uint8_t* src;
+  // Run offsets of the row's line of the pattern.
+  const uint32_t* run_offsets;
+  uint32_t period_step_x;
+  uint8_t* dest;
+};
+
+template <uint32_t kLogBpp>
+inline TiledRow GetTiledRow(const TiledLayout& layout, uint32_t row) {
+  const uint32_t kPeriod = TilingPeriod(kLogBpp);
+  uint32_t face = row / layout.face_rows;
+  uint32_t y = row % layout.face_rows;
+  uint32_t tiled_y = layout.offset_y + y;
+  TiledRow tiled_row;
+  tiled_row.src = layout.src + face * layout.input_face_length +
+                  (tiled_y / kPeriod) * layout.period_step_y;
+  tiled_row.run_offsets =
+      layout.run_offsets.data() +
+      (tiled_y % kPeriod) * (kPeriod / TilingRunBlocks(kLogBpp));
+  tiled_row.period_step_x = layout.period_step_x;
+  tiled_row.dest =
+      layout.dest + face * layout.output_face_length + y * layout.output_pitch;
+  return tiled_row;
+}
+
+// Guest address of the run starting at column x of the tiled image.
+template <uint32_t kLogBpp>
+inline const uint8_t* GetTiledRun(const TiledRow& row, uint32_t x) {
+  const uint32_t kPeriod = TilingPeriod(kLogBpp);
+  return row.src + (x / kPeriod) * row.period_step_x +
+         row.run_offsets[(x % kPeriod) / TilingRunBlocks(kLogBpp)];
+}
+
+__m128i GetSwapShuffle(Endian endianness) {
+  switch (endianness) {
+    case Endian::k8in16:
+      return _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15,
+                           14);
+    case Endian::k8in32:
+      return _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13,
+                           12);
+    case Endian::k16in32:
+      return _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12,
+                           13);
+    default:
+    case Endian::kUnspecified:
+      return _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+                           15);
+  }
+}
+
+// Loads the 16 bytes of guest data for the blocks starting at column x,
+// which must start a run.
+template <uint32_t kLogBpp>
+inline __m128i LoadTiledChunk(const TiledRow& row, uint32_t x) {
+  if (kLogBpp) {
+    return _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(GetTiledRun<kLogBpp>(row, x)));
+  }
+  // Single-byte blocks come in two 8-byte runs.
+  return _mm_unpacklo_epi64(
+      _mm_loadl_epi64(
+          reinterpret_cast<const __m128i*>(GetTiledRun<kLogBpp>(row, x))),
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(
+          GetTiledRun<kLogBpp>(row, x + 8))));
+}
+
+// Converts the blocks at the end of a row that don't fill 16 bytes.
+template <uint32_t kLogBpp>
+inline void ConvertTiledRowTail(const TiledRow& row, uint32_t x,
+                                uint8_t* dest, uint32_t block_count,
+                                __m128i shuffle) {
+  if (!block_count) {
+    return;
+  }
+  const uint32_t kRunBlocks = TilingRunBlocks(kLogBpp);
+  alignas(16) uint8_t chunk[16] = {0};
+  for (uint32_t i = 0; i < block_count; ++i) {
+    uint32_t block_x = x + i;
+    const uint8_t* run =
+        GetTiledRun<kLogBpp>(row, block_x - block_x % kRunBlocks);
+    std::memcpy(chunk + (i << kLogBpp),
+                run + ((block_x % kRunBlocks) << kLogBpp),
+                size_t(1) << kLogBpp);
+  }
+  __m128i* chunk_vector = reinterpret_cast<__m128i*>(chunk);
+  _mm_store_si128(chunk_vector,
+                  _mm_shuffle_epi8(_mm_load_si128(chunk_vector), shuffle));
+  std::memcpy(dest, chunk, block_count << kLogBpp);
+}
+
+template <uint32_t kLogBpp>
+void ConvertTiledRowsSSE(const TiledLayout& layout, uint32_t row_begin,
+                         uint32_t row_end) {
+  const uint32_t kChunkBlocks = 16 >> kLogBpp;
+  __m128i shuffle = GetSwapShuffle(layout.endianness);
+  uint32_t chunk_count = layout.columns / kChunkBlocks;
+  uint32_t tail_blocks = layout.columns % kChunkBlocks;
+  for (uint32_t row = row_begin; row < row_end; ++row) {
+    TiledRow tiled_row = GetTiledRow<kLogBpp>(layout, row);
+    uint32_t x = layout.offset_x;
+    uint8_t* dest = tiled_row.dest;
+    for (uint32_t i = 0; i < chunk_count; ++i) {
+      __m128i input = LoadTiledChunk<kLogBpp>(tiled_row, x);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dest),
+                       _mm_shuffle_epi8(input, shuffle));
+      x += kChunkBlocks;
+      dest += 16;
+    }
+    ConvertTiledRowTail<kLogBpp>(tiled_row, x, dest, tail_blocks, shuffle);
+  }
+}
+
+template <uint32_t kLogBpp>
+XE_AVX2_FUNCTION void ConvertTiledRowsAVX2(const TiledLayout& layout,
+                                           uint32_t row_begin,
+                                           uint32_t row_end) {
+  const uint32_t kChunkBlocks = 16 >> kLogBpp;
+  __m128i shuffle = GetSwapShuffle(layout.endianness);
+  __m256i shuffle_256 = _mm256_broadcastsi128_si256(shuffle);
+  uint32_t chunk_count = layout.columns / kChunkBlocks;
+  uint32_t tail_blocks = layout.columns % kChunkBlocks;
+  for (uint32_t row = row_begin; row < row_end; ++row) {
+    TiledRow tiled_row = GetTiledRow<kLogBpp>(layout, row);
+    uint32_t x = layout.offset_x;
+    uint8_t* dest = tiled_row.dest;
+    uint32_t i = 0;
+    for (; i + 2 <= chunk_count; i += 2) {
+      __m256i input = _mm256_inserti128_si256(
+          _mm256_castsi128_si256(LoadTiledChunk<kLogBpp>(tiled_row, x)),
+          LoadTiledChunk<kLogBpp>(tiled_row, x + kChunkBlocks), 1);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest),
+                          _mm256_shuffle_epi8(input, shuffle_256));
+      x += kChunkBlocks * 2;
+      dest += 32;
+    }
+    if (i < chunk_count) {
+      __m128i input = LoadTiledChunk<kLogBpp>(tiled_row, x);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dest),
+                       _mm_shuffle_epi8(input, shuffle));
+      x += kChunkBlocks;
+      dest += 16;
+    }
+    ConvertTiledRowTail<kLogBpp>(tiled_row, x, dest, tail_blocks, shuffle);
+  }
+}
+
+template <uint32_t kLogBpp>
+void ConvertTiledRowsForBpp(const TiledLayout& layout, uint32_t row_begin,
+                            uint32_t row_end) {
+  if (xe::has_avx2()) {
+    ConvertTiledRowsAVX2<kLogBpp>(layout, row_begin, row_end);
+  } else {
+    ConvertTiledRowsSSE<kLogBpp>(layout, row_begin, row_end);
+  }
+}
+
+void ConvertTiledRows(const TiledLayout& layout, uint32_t row_begin,
+                      uint32_t row_end) {
+  switch (layout.log_bpp) {
+    case 0:
+      ConvertTiledRowsForBpp<0>(layout, row_begin, row_end);
+      break;
+    case 1:
+      ConvertTiledRowsForBpp<1>(layout, row_begin, row_end);
+      break;
+    case 2:
+      ConvertTiledRowsForBpp<2>(layout, row_begin, row_end);
+      break;
+    case 3:
+      ConvertTiledRowsForBpp<3>(layout, row_begin, row_end);
+      break;
+    case 4:
+      ConvertTiledRowsForBpp<4>(layout, row_begin, row_end);
+      break;
+  }
+}
+
+// Fewest rows worth handing to another thread.
+const uint32_t kMinRowsPerTask = 32;
+
+}  // namespace
+
+TextureConverter::TextureConverter(size_t worker_count) {
+  if (!worker_count) {
+    return;
+  }
+  pool_ = std::make_unique<xe::ThreadPool>(worker_count, 64);
+  for (size_t i = 0; i < worker_count; ++i) {
+    xe::threading::Thread::CreationParameters params;
+    auto thread = xe::threading::Thread::Create(
+        params, [this, i]() { pool_->RunWorker(i); });
+    if (!thread) {
+      XELOGE("Unable to create texture conversion thread %d", int(i));
+      break;
+    }
+    thread->set_name(
+        xe::format_string("Texture Conversion Thread %d", int(i)));
+    threads_.push_back(std::move(thread));
+  }
+  if (threads_.empty()) {
+    pool_.reset();
+  }
+}
+
+TextureConverter::~TextureConverter() {
+  if (pool_) {
+    pool_->Shutdown();
+    for (auto& thread : threads_) {
+      xe::threading::Wait(thread.get(), false);
+    }
+  }
+}
+
+void TextureConverter::ConvertTexture(uint8_t* dest, const uint8_t* src,
+                                      const TextureInfo& info) {
+  TiledLayout layout;
+  if (!PrepareTiledLayout(dest, src, info, &layout)) {
+    // Linear textures are a straight (SIMD) swap already.
+    ConvertTextureScalar(dest, src, info);
+    return;
+  }
+
+  uint32_t task_count = 1;
+  if (pool_ && info.output_length >= kParallelMinLength) {
+    task_count = std::min(uint32_t(threads_.size() + 1),
+                          layout.row_count / kMinRowsPerTask);
+  }
+  if (task_count <= 1) {
+    ConvertTiledRows(layout, 0, layout.row_count);
+    return;
+  }
+
+  // The calling thread converts the first band while the workers take the
+  // rest.
+  uint32_t rows_per_task = (layout.row_count + task_count - 1) / task_count;
+  task_count = (layout.row_count + rows_per_task - 1) / rows_per_task;
+  std::mutex mutex;
+  std::condition_variable done_cond;
+  uint32_t pending_count = task_count - 1;
+  for (uint32_t i = 1; i < task_count; ++i) {
+    uint32_t row_begin = i * rows_per_task;
+    uint32_t row_end = std::min(row_begin + rows_per_task, layout.row_count);
+    pool_->Submit([&layout, &mutex, &done_cond, &pending_count, row_begin,
+                   row_end]() {
+      ConvertTiledRows(layout, row_begin, row_end);
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!--pending_count) {
+        done_cond.notify_one();
+      }
+    });
+  }
+  ConvertTiledRows(layout, 0, rows_per_task);
+  std::unique_lock<std::mutex> lock(mutex);
+  done_cond.wait(lock, [&pending_count]() { return !pending_count; });
+}
+
+void TextureConverter::ConvertTextureScalar(uint8_t* dest, const uint8_t* src,
+                                            const TextureInfo& info) {
+  bool is_cube = info.dimension == Dimension::kCube;
+  // size_cube starts with the same members as size_2d.
+  auto& size = info.size_2d;
+  uint32_t face_count = is_cube ? 6 : 1;
+  uint32_t input_face_length = is_cube ? info.size_cube.input_face_length : 0;
+  uint32_t output_face_length =
+      is_cube ? info.size_cube.output_face_length : info.output_length;
+  // Rows are rounded up to whole tiles, which may be more than dest holds.
+  uint32_t row_count =
+      std::min(size.block_height, output_face_length / size.output_pitch);
+  if (!is_cube) {
+    row_count = std::min(row_count, size.logical_height);
+  }
+
+  if (!info.is_tiled) {
+    if (size.input_pitch == size.output_pitch) {
+      // Fast path copy entire image.
+      TextureSwap(info.endianness, dest, src, info.output_length);
+    } else {
+      // Slow path copy row-by-row because strides differ.
+      // UNPACK_ROW_LENGTH only works for uncompressed images, and likely does
+      // this exact thing under the covers, so we just always do it here.
+      uint32_t pitch = std::min(size.input_pitch, size.output_pitch);
+      for (uint32_t face = 0; face < face_count; ++face) {
+        for (uint32_t y = 0; y < row_count; y++) {
+          TextureSwap(info.endianness, dest, src, pitch);
+          src += size.input_pitch;
+          dest += size.output_pitch;
+        }
+      }
+    }
+    return;
+  }
+
+  uint32_t bytes_per_block = info.format_info->block_width *
+                             info.format_info->block_height *
+                             info.format_info->bits_per_pixel / 8;
+  // Tiled textures can be packed; get the offset into the packed texture.
+  uint32_t offset_x;
+  uint32_t offset_y;
+  TextureInfo::GetPackedTileOffset(info, &offset_x, &offset_y);
+  auto bpp = (bytes_per_block >> 2) +
+             ((bytes_per_block >> 1) >> (bytes_per_block >> 2));
+  uint32_t input_width = size.input_width / info.format_info->block_width;
+  uint32_t column_count = size.output_pitch / bytes_per_block;
+  for (uint32_t face = 0; face < face_count; ++face) {
+    for (uint32_t y = 0, output_base_offset = 0; y < row_count;
+         y++, output_base_offset += size.output_pitch) {
+      auto input_base_offset =
+          TextureInfo::TiledOffset2DOuter(offset_y + y, input_width, bpp);
+      for (uint32_t x = 0, output_offset = output_base_offset;
+           x < column_count; x++, output_offset += bytes_per_block) {
+        auto input_offset =
+            TextureInfo::TiledOffset2DInner(offset_x + x, offset_y + y, bpp,
+                                            input_base_offset) >>
+            bpp;
+        TextureSwap(info.endianness, dest + output_offset,
+                    src + input_offset * bytes_per_block, bytes_per_block);
+      }
+    }
+    src += input_face_length;
+    dest += output_face_length;
+  }
+}
+
+}  // namespace gpu
+}  // namespace xe
@@ -0,0 +1,66 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_TEXTURE_CONVERSION_H_
+#define XENIA_GPU_TEXTURE_CONVERSION_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "xenia/base/thread_pool.h"
+#include "xenia/base/threading.h"
+#include "xenia/gpu/texture_info.h"
+#include "xenia/gpu/xenos.h"
+
+namespace xe {
+namespace gpu {
+
+// Byte swaps texture data as described by endianness.
+void TextureSwap(Endian endianness, void* dest, const void* src,
+                 size_t length);
+
+// Converts guest texture data into the linear, host endian layout the
+// texture caches upload.
+//
+// Tiled textures are untiled a run of blocks at a time: the blocks of a
+// 16-byte run (8 bytes for single-byte blocks) are contiguous in guest memory
+// as well. Where each run starts comes from a table built per texture, which
+// covers one repetition of the tiling pattern. Runs are byte swapped with
+// SIMD shuffles as they are copied, using AVX2 where the CPU has it.
+// Large textures are split into bands of rows converted in parallel.
+class TextureConverter {
+ public:
+  // Textures at least this large (output bytes) are split across threads.
+  static const uint32_t kParallelMinLength = 256 * 1024;
+
+  // Creates worker_count threads for converting large textures, 0 converting
+  // everything on the calling thread.
+  explicit TextureConverter(size_t worker_count);
+  ~TextureConverter();
+
+  // Converts a 2D texture, or all faces of a cube texture, from the guest
+  // data in src into dest, which must hold info.output_length bytes.
+  void ConvertTexture(uint8_t* dest, const uint8_t* src,
+                      const TextureInfo& info);
+
+  // Converts one block at a time. Handles every block size, if slowly; also
+  // what the tests check ConvertTexture against.
+  static void ConvertTextureScalar(uint8_t* dest, const uint8_t* src,
+                                   const TextureInfo& info);
+
+ private:
+  std::unique_ptr<xe::ThreadPool> pool_;
+  std::vector<std::unique_ptr<xe::threading::Thread>> threads_;
+};
+
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_TEXTURE_CONVERSION_H_
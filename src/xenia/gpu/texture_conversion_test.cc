@@ -0,0 +1,178 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/texture_conversion.h"
+
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace gpu {
+namespace test {
+
+// A format of each block size, with an endianness the per-block swap of the
+// scalar path can apply to it.
+struct TestFormat {
+  const char* name;
+  TextureFormat format;
+  Endian endianness;
+};
+const TestFormat kTestFormats[] = {
+    {"8", TextureFormat::k_8, Endian::kUnspecified},
+    {"5_6_5", TextureFormat::k_5_6_5, Endian::k8in16},
+    {"8_8_8_8", TextureFormat::k_8_8_8_8, Endian::k8in32},
+    {"8_8_8_8 16in32", TextureFormat::k_8_8_8_8, Endian::k16in32},
+    {"DXT1", TextureFormat::k_DXT1, Endian::k8in32},
+    {"32_32_FLOAT", TextureFormat::k_32_32_FLOAT, Endian::k8in32},
+    {"32_32_32_32_FLOAT", TextureFormat::k_32_32_32_32_FLOAT, Endian::k8in32},
+};
+
+// Bytes past the end of the output that must be left alone.
+const size_t kGuardLength = 64;
+const uint8_t kGuardValue = 0xCD;
+
+TextureInfo MakeTextureInfo(const TestFormat& format, Dimension dimension,
+                            uint32_t width, uint32_t height, bool tiled) {
+  xenos::xe_gpu_texture_fetch_t fetch;
+  std::memset(&fetch, 0, sizeof(fetch));
+  fetch.format = static_cast<uint32_t>(format.format);
+  fetch.endianness = static_cast<uint32_t>(format.endianness);
+  fetch.tiled = tiled ? 1 : 0;
+  fetch.dimension = static_cast<uint32_t>(dimension);
+  if (dimension == Dimension::kCube) {
+    fetch.size_stack.width = width - 1;
+    fetch.size_stack.height = height - 1;
+    fetch.size_stack.depth = 5;
+  } else {
+    fetch.size_2d.width = width - 1;
+    fetch.size_2d.height = height - 1;
+  }
+  TextureInfo info;
+  REQUIRE(TextureInfo::Prepare(fetch, &info));
+  return info;
+}
+
+// Tiling of small textures with small blocks reaches past input_length.
+const size_t kGuestPadding = 4096;
+
+std::vector<uint8_t> MakeGuestData(const TextureInfo& info) {
+  std::mt19937 random(info.output_length);
+  std::vector<uint8_t> data(info.input_length + kGuestPadding);
+  for (auto& value : data) {
+    value = static_cast<uint8_t>(random());
+  }
+  return data;
+}
+
+std::vector<uint8_t> Convert(TextureConverter* converter,
+                             const std::vector<uint8_t>& src,
+                             const TextureInfo& info) {
+  std::vector<uint8_t> dest(info.output_length + kGuardLength, kGuardValue);
+  if (converter) {
+    converter->ConvertTexture(dest.data(), src.data(), info);
+  } else {
+    TextureConverter::ConvertTextureScalar(dest.data(), src.data(), info);
+  }
+  for (size_t i = info.output_length; i < dest.size(); ++i) {
+    REQUIRE(dest[i] == kGuardValue);
+  }
+  return dest;
+}
+
+void CheckConversion(TextureConverter* converter, const TestFormat& format,
+                     Dimension dimension, uint32_t width, uint32_t height,
+                     bool tiled) {
+  INFO(format.name << " " << width << "x" << height
+                   << (dimension == Dimension::kCube ? " cube" : "")
+                   << (tiled ? " tiled" : " linear"));
+  auto info = MakeTextureInfo(format, dimension, width, height, tiled);
+  auto src = MakeGuestData(info);
+  auto expected = Convert(nullptr, src, info);
+  auto result = Convert(converter, src, info);
+  REQUIRE(result == expected);
+}
+
+TEST_CASE("TextureConverter_2D", "[texture_conversion]") {
+  // Packed, partial tiles, whole tiles and pattern periods, and large enough
+  // to be split across threads.
+  const uint32_t kSizes[][2] = {
+      {4, 4},    {16, 8},   {8, 16},    {13, 7},     {32, 32},
+      {40, 24},  {100, 60}, {256, 256}, {300, 1000}, {1024, 512},
+  };
+  TextureConverter converter(0);
+  TextureConverter threaded_converter(3);
+  for (auto& format : kTestFormats) {
+    for (auto& size : kSizes) {
+      CheckConversion(&converter, format, Dimension::k2D, size[0], size[1],
+                      true);
+      CheckConversion(&threaded_converter, format, Dimension::k2D, size[0],
+                      size[1], true);
+      CheckConversion(&converter, format, Dimension::k2D, size[0], size[1],
+                      false);
+    }
+  }
+}
+
+TEST_CASE("TextureConverter_Cube", "[texture_conversion]") {
+  const uint32_t kSizes[] = {16, 40, 128, 512};
+  TextureConverter converter(0);
+  TextureConverter threaded_converter(3);
+  for (auto& format : kTestFormats) {
+    for (uint32_t size : kSizes) {
+      CheckConversion(&converter, format, Dimension::kCube, size, size, true);
+      CheckConversion(&threaded_converter, format, Dimension::kCube, size,
+                      size, true);
+    }
+  }
+}
+
+TEST_CASE("TextureConverter_Rate", "[.][benchmark]") {
+  const uint32_t kSize = 2048;
+  const uint32_t kIterations = 20;
+  TextureConverter converter(0);
+  TextureConverter threaded_converter(3);
+  struct Variant {
+    const char* name;
+    TextureConverter* converter;
+  } variants[] = {
+      {"scalar", nullptr},
+      {"converter", &converter},
+      {"threaded", &threaded_converter},
+  };
+  for (auto& format : kTestFormats) {
+    auto info = MakeTextureInfo(format, Dimension::k2D, kSize, kSize, true);
+    auto src = MakeGuestData(info);
+    std::vector<uint8_t> dest(info.output_length);
+    for (auto& variant : variants) {
+      auto start_time = std::chrono::steady_clock::now();
+      for (uint32_t i = 0; i < kIterations; ++i) {
+        if (variant.converter) {
+          variant.converter->ConvertTexture(dest.data(), src.data(), info);
+        } else {
+          TextureConverter::ConvertTextureScalar(dest.data(), src.data(),
+                                                 info);
+        }
+      }
+      auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                         std::chrono::steady_clock::now() - start_time)
+                         .count();
+      WARN(format.name << " " << variant.name << ": "
+                       << double(info.output_length) * kIterations / elapsed
+                       << "MB/s");
+    }
+  }
+}
+
+}  // namespace test
+}  // namespace gpu
+}  // namespace xe
@@ -171,6 +171,11 @@ bool TraceDump::Load(std::wstring trace_file_path) {
     return false;
   }
 
+  // Replaying the same trace twice shows what the shader storage saves.
+  if (player_->header()->title_id) {
+    graphics_system_->InitializeShaderStorage(player_->header()->title_id);
+  }
+
   return true;
 }
 
@@ -9,6 +9,9 @@
 
 #include "xenia/gpu/vulkan/buffer_cache.h"
 
+#include <cinttypes>
+
+#include "third_party/xxhash/xxhash.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
@@ -25,9 +28,21 @@ using xe::ui::vulkan::CheckResult;
 constexpr VkDeviceSize kConstantRegisterUniformRange =
     512 * 4 * 4 + 8 * 4 + 32 * 4;
 
-BufferCache::BufferCache(RegisterFile* register_file,
+// Smaller data isn't worth a buffer and allocation of its own.
+constexpr uint32_t kMinCachedBufferLength = 1024;
+// Limits on cached copies, keeping well within the driver's allocation count
+// limit (4096 at minimum) with the texture cache allocating as well.
+constexpr uint32_t kMaxCachedCopyCount = 1024;
+constexpr VkDeviceSize kMaxCachedCopyBytes = 256 * 1024 * 1024;
+// Cached buffers not drawn from for this many frames are dropped.
+constexpr uint64_t kCachedBufferMaxIdleFrames = 120;
+
+BufferCache::BufferCache(RegisterFile* register_file, Memory* memory,
                          ui::vulkan::VulkanDevice* device, size_t capacity)
-    : register_file_(register_file), device_(*device) {
+    : register_file_(register_file),
+      memory_(memory),
+      vulkan_device_(device),
+      device_(*device) {
   transient_buffer_ = std::make_unique<ui::vulkan::CircularBuffer>(
       device,
       VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
@@ -135,6 +150,18 @@ BufferCache::BufferCache(RegisterFile* register_file,
 }
 
 BufferCache::~BufferCache() {
+  if (frame_count_) {
+    XELOGI("Buffer cache: %" PRIu64 " bytes uploaded, %" PRIu64
+           " bytes reused from cached copies over %" PRIu64
+           " frames (%" PRIu64 " bytes uploaded per frame)",
+           total_upload_stats_.uploaded_bytes,
+           total_upload_stats_.reused_bytes, frame_count_,
+           total_upload_stats_.uploaded_bytes / frame_count_);
+  }
+  // VulkanCommandProcessor::ShutdownContext waits for the queue to be idle
+  // before destroying the cache, so no buffer is in use anymore.
+  ClearCache();
+
   vkFreeDescriptorSets(device_, descriptor_pool_, 1,
                        &transient_descriptor_set_);
   vkDestroyDescriptorSetLayout(device_, descriptor_set_layout_, nullptr);
@@ -229,51 +256,266 @@ std::pair<VkDeviceSize, VkDeviceSize> BufferCache::UploadConstantRegisters(
 }
 
 std::pair<VkBuffer, VkDeviceSize> BufferCache::UploadIndexBuffer(
-    const void* source_ptr, size_t source_length, IndexFormat format,
-    VkFence fence) {
-  // Allocate space in the buffer for our data.
-  auto offset = AllocateTransientData(source_length, fence);
-  if (offset == VK_WHOLE_SIZE) {
-    // OOM.
-    return {nullptr, VK_WHOLE_SIZE};
-  }
+    VkCommandBuffer setup_buffer, uint32_t source_addr, uint32_t source_length,
+    IndexFormat format, bool primitive_restart, uint32_t reset_index,
+    VkFence fence, uint32_t* min_index_out, uint32_t* max_index_out) {
+  // TODO(benvanik): memcpy then use compute shaders to swap?
+  // Endian::k8in16 for 16-bit indices, Endian::k8in32 for 32-bit.
+  UploadFormat upload_format;
+  upload_format.swap_size = format == IndexFormat::kInt16 ? 2 : 4;
+  upload_format.is_index = true;
+  upload_format.primitive_restart = primitive_restart;
+  // Only as many bits as the indices have are compared.
+  upload_format.reset_index =
+      format == IndexFormat::kInt16 ? reset_index & 0xFFFF : reset_index;
+  return UploadGuestBuffer(setup_buffer, source_addr, source_length,
+                           upload_format, fence, min_index_out, max_index_out);
+}
 
-  // Copy data into the buffer.
-  // TODO(benvanik): get min/max indices and pass back?
+std::pair<VkBuffer, VkDeviceSize> BufferCache::UploadVertexBuffer(
+    VkCommandBuffer setup_buffer, uint32_t source_addr, uint32_t source_length,
+    Endian endian, VkFence fence) {
   // TODO(benvanik): memcpy then use compute shaders to swap?
-  if (format == IndexFormat::kInt16) {
-    // Endian::k8in16, swap half-words.
-    xe::copy_and_swap_16_aligned(transient_buffer_->host_base() + offset,
-                                 source_ptr, source_length / 2);
-  } else if (format == IndexFormat::kInt32) {
-    // Endian::k8in32, swap words.
-    xe::copy_and_swap_32_aligned(transient_buffer_->host_base() + offset,
-                                 source_ptr, source_length / 4);
+  assert_true(endian == Endian::k8in32);
+  UploadFormat upload_format;
+  upload_format.swap_size = 4;
+  upload_format.is_index = false;
+  upload_format.primitive_restart = false;
+  upload_format.reset_index = 0;
+  return UploadGuestBuffer(setup_buffer, source_addr, source_length,
+                           upload_format, fence, nullptr, nullptr);
+}
+
+std::pair<VkBuffer, VkDeviceSize> BufferCache::UploadGuestBuffer(
+    VkCommandBuffer setup_buffer, uint32_t source_addr, uint32_t source_length,
+    const UploadFormat& format, VkFence fence, uint32_t* min_index_out,
+    uint32_t* max_index_out) {
+  const void* source_ptr = memory_->TranslatePhysical(source_addr);
+  if (!FLAGS_vulkan_cache_buffers || source_length < kMinCachedBufferLength) {
+    auto offset = UploadTransientData(source_ptr, source_length, format, fence,
+                                      min_index_out, max_index_out);
+    if (offset == VK_WHOLE_SIZE) {
+      // OOM.
+      return {nullptr, VK_WHOLE_SIZE};
+    }
+    return {transient_buffer_->gpu_buffer(), offset};
   }
 
+  // Vertex data is clamped to the vertices each draw references, so the same
+  // buffer arrives with varying lengths. It's cached by start address only,
+  // covering the longest range seen. The index range found for index data
+  // only holds for its exact range, so that's cached per range.
+  uint64_t key = uint64_t(source_addr) << 32;
+  if (format.is_index) {
+    key |= source_length;
+  }
+  auto it = cached_buffers_.find(key);
+  CachedBuffer* cached;
+  if (it == cached_buffers_.end()) {
+    cached = &cached_buffers_[key];
+    cached->guest_address = source_addr;
+    cached->length = source_length;
+    cached->format = format;
+    cached->content_hash = XXH64(source_ptr, source_length, 0);
+    cached->buffer = nullptr;
+    cached->buffer_memory = nullptr;
+    cached->access_watch_handle = 0;
+    cached->in_flight_fence = nullptr;
+  } else if (source_length > it->second.length) {
+    // Reaches past what's cached - start over with the longer range.
+    cached = &it->second;
+    if (cached->buffer) {
+      RetireCachedCopy(cached);
+    }
+    cached->length = source_length;
+    cached->format = format;
+    cached->content_hash = XXH64(source_ptr, source_length, 0);
+  } else {
+    cached = &it->second;
+    if (cached->buffer && cached->access_watch_handle &&
+        cached->format == format) {
+      // Untouched since it was uploaded.
+      cached->in_flight_fence = fence;
+      cached->last_use_frame = frame_count_;
+      frame_upload_stats_.reused_bytes += source_length;
+      if (format.is_index) {
+        *min_index_out = cached->min_index;
+        *max_index_out = cached->max_index;
+      }
+      return {cached->buffer, 0};
+    }
+    // Written by the guest (or used with another format) since it was last
+    // seen - the contents may still be the same.
+    uint64_t content_hash = XXH64(source_ptr, cached->length, 0);
+    bool content_matches =
+        content_hash == cached->content_hash && cached->format == format;
+    cached->content_hash = content_hash;
+    cached->format = format;
+    cached->last_use_frame = frame_count_;
+    if (content_matches && cached->buffer) {
+      WatchCachedBuffer(cached);
+      cached->in_flight_fence = fence;
+      frame_upload_stats_.reused_bytes += source_length;
+      if (format.is_index) {
+        *min_index_out = cached->min_index;
+        *max_index_out = cached->max_index;
+      }
+      return {cached->buffer, 0};
+    }
+    if (cached->buffer) {
+      RetireCachedCopy(cached);
+    }
+    // Seen twice with the same contents, so likely static.
+    if (content_matches &&
+        CreateCachedCopy(setup_buffer, cached, source_ptr, fence)) {
+      if (format.is_index) {
+        *min_index_out = cached->min_index;
+        *max_index_out = cached->max_index;
+      }
+      return {cached->buffer, 0};
+    }
+  }
+  cached->last_use_frame = frame_count_;
+
+  auto offset = UploadTransientData(source_ptr, source_length, format, fence,
+                                    min_index_out, max_index_out);
+  if (offset == VK_WHOLE_SIZE) {
+    // OOM.
+    return {nullptr, VK_WHOLE_SIZE};
+  }
   return {transient_buffer_->gpu_buffer(), offset};
 }
 
-std::pair<VkBuffer, VkDeviceSize> BufferCache::UploadVertexBuffer(
-    const void* source_ptr, size_t source_length, Endian endian,
-    VkFence fence) {
+VkDeviceSize BufferCache::UploadTransientData(const void* source_ptr,
+                                              uint32_t source_length,
+                                              const UploadFormat& format,
+                                              VkFence fence,
+                                              uint32_t* min_index_out,
+                                              uint32_t* max_index_out) {
   // Allocate space in the buffer for our data.
   auto offset = AllocateTransientData(source_length, fence);
   if (offset == VK_WHOLE_SIZE) {
-    // OOM.
-    return {nullptr, VK_WHOLE_SIZE};
+    return VK_WHOLE_SIZE;
   }
 
-  // Copy data into the buffer.
-  // TODO(benvanik): memcpy then use compute shaders to swap?
-  assert_true(endian == Endian::k8in32);
-  if (endian == Endian::k8in32) {
-    // Endian::k8in32, swap words.
-    xe::copy_and_swap_32_aligned(transient_buffer_->host_base() + offset,
-                                 source_ptr, source_length / 4);
+  // Copy data into the buffer, finding the index range on the way for index
+  // data.
+  void* dest_ptr = transient_buffer_->host_base() + offset;
+  if (format.is_index && format.swap_size == 2) {
+    xe::copy_and_swap_16_indices(dest_ptr, source_ptr, source_length / 2,
+                                 format.primitive_restart,
+                                 uint16_t(format.reset_index), min_index_out,
+                                 max_index_out);
+  } else if (format.is_index) {
+    xe::copy_and_swap_32_indices(dest_ptr, source_ptr, source_length / 4,
+                                 format.primitive_restart, format.reset_index,
+                                 min_index_out, max_index_out);
+  } else if (format.swap_size == 2) {
+    xe::copy_and_swap_16_aligned(dest_ptr, source_ptr, source_length / 2);
+  } else {
+    xe::copy_and_swap_32_aligned(dest_ptr, source_ptr, source_length / 4);
   }
+  frame_upload_stats_.uploaded_bytes += source_length;
+  return offset;
+}
 
-  return {transient_buffer_->gpu_buffer(), offset};
+bool BufferCache::CreateCachedCopy(VkCommandBuffer setup_buffer,
+                                   CachedBuffer* cached,
+                                   const void* source_ptr, VkFence fence) {
+  if (cached_copy_count_ >= kMaxCachedCopyCount ||
+      cached_copy_bytes_ + cached->length > kMaxCachedCopyBytes) {
+    return false;
+  }
+
+  // Stage through the transient buffer.
+  auto offset =
+      UploadTransientData(source_ptr, cached->length, cached->format, fence,
+                          &cached->min_index, &cached->max_index);
+  if (offset == VK_WHOLE_SIZE) {
+    return false;
+  }
+
+  VkBufferCreateInfo buffer_info;
+  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.pNext = nullptr;
+  buffer_info.flags = 0;
+  buffer_info.size = cached->length;
+  buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                      VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+                      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+  buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  buffer_info.queueFamilyIndexCount = 0;
+  buffer_info.pQueueFamilyIndices = nullptr;
+  VkBuffer buffer = nullptr;
+  auto err = vkCreateBuffer(device_, &buffer_info, nullptr, &buffer);
+  if (err != VK_SUCCESS) {
+    return false;
+  }
+  VkMemoryRequirements buffer_reqs;
+  vkGetBufferMemoryRequirements(device_, buffer, &buffer_reqs);
+  VkDeviceMemory buffer_memory = vulkan_device_->AllocateMemory(
+      buffer_reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  if (!buffer_memory) {
+    vkDestroyBuffer(device_, buffer, nullptr);
+    return false;
+  }
+  err = vkBindBufferMemory(device_, buffer, buffer_memory, 0);
+  CheckResult(err, "vkBindBufferMemory");
+
+  VkBufferCopy region;
+  region.srcOffset = offset;
+  region.dstOffset = 0;
+  region.size = cached->length;
+  vkCmdCopyBuffer(setup_buffer, transient_buffer_->gpu_buffer(), buffer, 1,
+                  &region);
+  VkBufferMemoryBarrier barrier;
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.pNext = nullptr;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask =
+      VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.buffer = buffer;
+  barrier.offset = 0;
+  barrier.size = VK_WHOLE_SIZE;
+  vkCmdPipelineBarrier(setup_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 0, nullptr, 1,
+                       &barrier, 0, nullptr);
+
+  cached->buffer = buffer;
+  cached->buffer_memory = buffer_memory;
+  cached->in_flight_fence = fence;
+  cached_copy_bytes_ += cached->length;
+  ++cached_copy_count_;
+  WatchCachedBuffer(cached);
+  return true;
+}
+
+void BufferCache::WatchCachedBuffer(CachedBuffer* cached) {
+  // If the guest touches the data, it has to be checked again.
+  cached->access_watch_handle = memory_->AddPhysicalAccessWatch(
+      cached->guest_address, cached->length, cpu::MMIOHandler::kWatchWrite,
+      [](void* context_ptr, void* data_ptr, uint32_t address) {
+        auto touched_buffer = reinterpret_cast<CachedBuffer*>(data_ptr);
+        // The watch is gone once fired, so this is all that needs doing -
+        // the next upload of the range checks the contents again.
+        touched_buffer->access_watch_handle = 0;
+      },
+      this, cached);
+}
+
+void BufferCache::RetireCachedCopy(CachedBuffer* cached) {
+  if (cached->access_watch_handle) {
+    memory_->CancelAccessWatch(cached->access_watch_handle);
+    cached->access_watch_handle = 0;
+  }
+  retired_buffers_.push_back(
+      {cached->buffer, cached->buffer_memory, cached->in_flight_fence});
+  cached->buffer = nullptr;
+  cached->buffer_memory = nullptr;
+  cached_copy_bytes_ -= cached->length;
+  --cached_copy_count_;
 }
 
 VkDeviceSize BufferCache::AllocateTransientData(VkDeviceSize length,
@@ -329,9 +571,60 @@ void BufferCache::InvalidateCache() {
   // TODO(benvanik): caching.
 }
 
-void BufferCache::ClearCache() { transient_cache_.clear(); }
+void BufferCache::ClearCache() {
+  transient_cache_.clear();
+
+  // The GPU must be done with everything by now.
+  for (auto& it : cached_buffers_) {
+    if (it.second.buffer) {
+      RetireCachedCopy(&it.second);
+    }
+  }
+  cached_buffers_.clear();
+  for (auto& retired : retired_buffers_) {
+    vkDestroyBuffer(device_, retired.buffer, nullptr);
+    vkFreeMemory(device_, retired.buffer_memory, nullptr);
+  }
+  retired_buffers_.clear();
+}
+
+void BufferCache::Scavenge() {
+  transient_buffer_->Scavenge();
 
-void BufferCache::Scavenge() { transient_buffer_->Scavenge(); }
+  COUNT_profile_cpu("gpu/buffer_uploaded_bytes",
+                    frame_upload_stats_.uploaded_bytes);
+  COUNT_profile_cpu("gpu/buffer_reused_bytes",
+                    frame_upload_stats_.reused_bytes);
+  total_upload_stats_.uploaded_bytes += frame_upload_stats_.uploaded_bytes;
+  total_upload_stats_.reused_bytes += frame_upload_stats_.reused_bytes;
+  frame_upload_stats_ = {0};
+  ++frame_count_;
+
+  // Drop data that isn't being drawn with anymore, so that the cached copies
+  // go to what is.
+  for (auto it = cached_buffers_.begin(); it != cached_buffers_.end();) {
+    if (frame_count_ - it->second.last_use_frame > kCachedBufferMaxIdleFrames) {
+      if (it->second.buffer) {
+        RetireCachedCopy(&it->second);
+      }
+      it = cached_buffers_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  for (auto it = retired_buffers_.begin(); it != retired_buffers_.end();) {
+    if (it->in_flight_fence &&
+        vkGetFenceStatus(device_, it->in_flight_fence) != VK_SUCCESS) {
+      // Still in flight.
+      ++it;
+      continue;
+    }
+    vkDestroyBuffer(device_, it->buffer, nullptr);
+    vkFreeMemory(device_, it->buffer_memory, nullptr);
+    it = retired_buffers_.erase(it);
+  }
+}
 
 }  // namespace vulkan
 }  // namespace gpu
@@ -13,11 +13,13 @@
 #include "xenia/gpu/register_file.h"
 #include "xenia/gpu/shader.h"
 #include "xenia/gpu/xenos.h"
+#include "xenia/memory.h"
 #include "xenia/ui/vulkan/circular_buffer.h"
 #include "xenia/ui/vulkan/vulkan.h"
 #include "xenia/ui/vulkan/vulkan_device.h"
 
 #include <unordered_map>
+#include <vector>
 
 namespace xe {
 namespace gpu {
@@ -28,8 +30,8 @@ namespace vulkan {
 // transient data like shader constants.
 class BufferCache {
  public:
-  BufferCache(RegisterFile* register_file, ui::vulkan::VulkanDevice* device,
-              size_t capacity);
+  BufferCache(RegisterFile* register_file, Memory* memory,
+              ui::vulkan::VulkanDevice* device, size_t capacity);
   ~BufferCache();
 
   // Descriptor set containing the dynamic uniform buffer used for constant
@@ -58,21 +60,29 @@ class BufferCache {
 
   // Uploads index buffer data from guest memory, possibly eliding with
   // recently uploaded data or cached copies.
+  // Copies into cached copies are recorded in setup_buffer, which must be
+  // submitted before any command buffer using the result.
+  // If primitive_restart is set, indices equal to reset_index are replaced
+  // with the host primitive restart index (all ones).
+  // The range of indices referenced (other than restarts) is returned in
+  // min_index_out/max_index_out, with min > max if there are none.
   // Returns a buffer and offset that can be used with vkCmdBindIndexBuffer.
   // Size will be VK_WHOLE_SIZE if the data could not be uploaded (OOM).
-  std::pair<VkBuffer, VkDeviceSize> UploadIndexBuffer(const void* source_ptr,
-                                                      size_t source_length,
-                                                      IndexFormat format,
-                                                      VkFence fence);
+  std::pair<VkBuffer, VkDeviceSize> UploadIndexBuffer(
+      VkCommandBuffer setup_buffer, uint32_t source_addr,
+      uint32_t source_length, IndexFormat format, bool primitive_restart,
+      uint32_t reset_index, VkFence fence, uint32_t* min_index_out,
+      uint32_t* max_index_out);
 
   // Uploads vertex buffer data from guest memory, possibly eliding with
   // recently uploaded data or cached copies.
+  // Copies into cached copies are recorded in setup_buffer, which must be
+  // submitted before any command buffer using the result.
   // Returns a buffer and offset that can be used with vkCmdBindVertexBuffers.
   // Size will be VK_WHOLE_SIZE if the data could not be uploaded (OOM).
-  std::pair<VkBuffer, VkDeviceSize> UploadVertexBuffer(const void* source_ptr,
-                                                       size_t source_length,
-                                                       Endian endian,
-                                                       VkFence fence);
+  std::pair<VkBuffer, VkDeviceSize> UploadVertexBuffer(
+      VkCommandBuffer setup_buffer, uint32_t source_addr,
+      uint32_t source_length, Endian endian, VkFence fence);
 
   // Flushes all pending data to the GPU.
   // Until this is called the GPU is not guaranteed to see any data.
@@ -89,9 +99,81 @@ class BufferCache {
   void ClearCache();
 
   // Wipes all data no longer needed.
+  // Called once per frame.
   void Scavenge();
 
  private:
+  // How guest data is converted on upload.
+  struct UploadFormat {
+    // Size of the words being byte swapped (2 or 4).
+    uint32_t swap_size;
+    // Indices are also scanned for the range they reference, and have reset
+    // indices replaced if primitive_restart is set.
+    bool is_index;
+    bool primitive_restart;
+    uint32_t reset_index;
+
+    bool operator==(const UploadFormat& other) const {
+      return swap_size == other.swap_size && is_index == other.is_index &&
+             primitive_restart == other.primitive_restart &&
+             reset_index == other.reset_index;
+    }
+    bool operator!=(const UploadFormat& other) const {
+      return !(*this == other);
+    }
+  };
+
+  // Guest index or vertex data converted into device-local memory, kept
+  // across frames until the guest writes to it. Data only gets a cached copy
+  // once it's been seen twice with the same content, so that data rewritten
+  // every frame goes straight through the transient buffer.
+  struct CachedBuffer {
+    uint32_t guest_address;
+    // Longest length uploaded from the address for vertex data, which draws
+    // then use as much of as they need.
+    uint32_t length;
+    UploadFormat format;
+    // Hash of the guest data when it was last uploaded.
+    uint64_t content_hash;
+    // Range of indices referenced by the cached copy, for index data.
+    uint32_t min_index;
+    uint32_t max_index;
+    // Null until the cached copy is made.
+    VkBuffer buffer;
+    VkDeviceMemory buffer_memory;
+    // Cleared (by the watch callback) when the guest writes to the range, at
+    // which point the contents have to be hashed again before reuse.
+    uintptr_t access_watch_handle;
+    // Pointer to the latest usage fence.
+    VkFence in_flight_fence;
+    uint64_t last_use_frame;
+  };
+  // Buffers replaced or evicted while possibly still in use.
+  struct RetiredBuffer {
+    VkBuffer buffer;
+    VkDeviceMemory buffer_memory;
+    VkFence in_flight_fence;
+  };
+
+  // Uploads guest data through the transient buffer or the persistent cache.
+  // The index range is only written for index data.
+  std::pair<VkBuffer, VkDeviceSize> UploadGuestBuffer(
+      VkCommandBuffer setup_buffer, uint32_t source_addr,
+      uint32_t source_length, const UploadFormat& format, VkFence fence,
+      uint32_t* min_index_out, uint32_t* max_index_out);
+  // Copies and converts guest data into the transient buffer.
+  // Returns VK_WHOLE_SIZE on OOM.
+  VkDeviceSize UploadTransientData(const void* source_ptr,
+                                   uint32_t source_length,
+                                   const UploadFormat& format, VkFence fence,
+                                   uint32_t* min_index_out,
+                                   uint32_t* max_index_out);
+  // Creates the device-local copy of a cached buffer and records the upload.
+  bool CreateCachedCopy(VkCommandBuffer setup_buffer, CachedBuffer* cached,
+                        const void* source_ptr, VkFence fence);
+  void WatchCachedBuffer(CachedBuffer* cached);
+  void RetireCachedCopy(CachedBuffer* cached);
+
   // Allocates a block of memory in the transient buffer.
   // When memory is not available fences are checked and space is reclaimed.
   // Returns VK_WHOLE_SIZE if requested amount of memory is not available.
@@ -101,6 +183,8 @@ class BufferCache {
   VkDeviceSize TryAllocateTransientData(VkDeviceSize length, VkFence fence);
 
   RegisterFile* register_file_ = nullptr;
+  Memory* memory_ = nullptr;
+  ui::vulkan::VulkanDevice* vulkan_device_ = nullptr;
   VkDevice device_ = nullptr;
 
   VkDeviceMemory gpu_memory_pool_ = nullptr;
@@ -110,6 +194,22 @@ class BufferCache {
   std::unique_ptr<ui::vulkan::CircularBuffer> transient_buffer_ = nullptr;
   std::unordered_map<uint64_t, VkDeviceSize> transient_cache_;
 
+  // Cached buffers by guest address, and length for index data.
+  std::unordered_map<uint64_t, CachedBuffer> cached_buffers_;
+  VkDeviceSize cached_copy_bytes_ = 0;
+  uint32_t cached_copy_count_ = 0;
+  std::vector<RetiredBuffer> retired_buffers_;
+
+  // Bytes of guest data uploaded (through the transient buffer or into new
+  // cached copies) and reused from cached copies, this frame and in total.
+  struct UploadStats {
+    uint64_t uploaded_bytes;
+    uint64_t reused_bytes;
+  };
+  uint64_t frame_count_ = 0;
+  UploadStats frame_upload_stats_ = {0};
+  UploadStats total_upload_stats_ = {0};
+
   VkDescriptorPool descriptor_pool_ = nullptr;
   VkDescriptorSetLayout descriptor_set_layout_ = nullptr;
   VkDescriptorSet transient_descriptor_set_ = nullptr;
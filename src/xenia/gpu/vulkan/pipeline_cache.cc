@@ -9,15 +9,20 @@
 
 #include "xenia/gpu/vulkan/pipeline_cache.h"
 
+#include "build/version.h"
 #include "third_party/xxhash/xxhash.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
+#include "xenia/base/string.h"
 #include "xenia/gpu/gpu_flags.h"
 #include "xenia/gpu/vulkan/vulkan_gpu_flags.h"
 
+#include <chrono>
 #include <cinttypes>
+#include <cstring>
 #include <string>
 
 namespace xe {
@@ -33,15 +38,61 @@ using xe::ui::vulkan::CheckResult;
 #include "xenia/gpu/vulkan/shaders/bin/quad_list_geom.h"
 #include "xenia/gpu/vulkan/shaders/bin/rect_list_geom.h"
 
+// Shader storage file layout: a header, then entries of translated SPIR-V
+// appended as shaders are first translated. Files written by other builds are
+// discarded, as the translator output may have changed.
+constexpr uint32_t kShaderStorageMagic = 'XSPV';
+constexpr uint32_t kShaderStorageVersion = 1;
+struct ShaderStorageFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  char build_commit_sha[40];
+};
+// Far more SPIR-V than any guest shader translates to; longer entries are
+// taken as damage.
+constexpr uint32_t kShaderStorageMaxSpirvLength = 16 * 1024 * 1024;
+struct ShaderStorageEntryHeader {
+  uint64_t ucode_data_hash;
+  uint32_t sq_program_cntl;
+  uint32_t shader_type;
+  uint32_t spirv_length;
+  uint32_t spirv_hash;
+};
+
+// Runs the analysis passes of a translation (bindings, constant register
+// usage, color target writes) without generating any code, and completes
+// the translation with SPIR-V from the shader storage.
+class StoredShaderTranslator : public ShaderTranslator {
+ public:
+  StoredShaderTranslator() = default;
+
+  void set_spirv(const std::vector<uint8_t>* spirv) { spirv_ = spirv; }
+
+ protected:
+  std::vector<uint8_t> CompleteTranslation() override { return *spirv_; }
+
+ private:
+  const std::vector<uint8_t>* spirv_ = nullptr;
+};
+
+// Compiles queued at once before GetPipeline blocks.
+const size_t kPipelineCompileCapacity = 256;
+
+uint64_t GetMicroseconds(std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(duration)
+      .count();
+}
+
 PipelineCache::PipelineCache(
     RegisterFile* register_file, ui::vulkan::VulkanDevice* device,
     VkDescriptorSetLayout uniform_descriptor_set_layout,
     VkDescriptorSetLayout texture_descriptor_set_layout)
-    : register_file_(register_file), device_(*device) {
+    : register_file_(register_file),
+      device_(*device),
+      device_properties_(device->device_info().properties) {
   // Initialize the shared driver pipeline cache.
-  // We'll likely want to serialize this and reuse it, if that proves to be
-  // useful. If the shaders are expensive and this helps we could do it per
-  // game, otherwise a single shared cache for render state/etc.
+  // Once the title is known this is merged into the one saved by previous
+  // runs of it, if any (see InitializeShaderStorage).
   VkPipelineCacheCreateInfo pipeline_cache_info;
   pipeline_cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
   pipeline_cache_info.pNext = nullptr;
@@ -122,9 +173,71 @@ PipelineCache::PipelineCache(
 
   // We can also use the GLSL translator with a Vulkan dialect.
   shader_translator_.reset(new SpirvShaderTranslator());
+  stored_shader_translator_.reset(new StoredShaderTranslator());
+
+  // Compile threads, so that pipeline cache misses don't stall the command
+  // stream.
+  if (FLAGS_vulkan_pending_pipeline_draws == "wait") {
+    wait_for_pending_pipelines_ = true;
+  } else if (FLAGS_vulkan_pending_pipeline_draws != "skip") {
+    // Waiting never drops draws, so it's the safe guess.
+    XELOGW("Unknown --vulkan_pending_pipeline_draws value '%s', using wait",
+           FLAGS_vulkan_pending_pipeline_draws.c_str());
+    wait_for_pending_pipelines_ = true;
+  }
+  if (FLAGS_vulkan_pipeline_threads > 0) {
+    compile_pool_ = std::make_unique<xe::ThreadPool>(
+        FLAGS_vulkan_pipeline_threads, kPipelineCompileCapacity);
+    for (int32_t i = 0; i < FLAGS_vulkan_pipeline_threads; ++i) {
+      xe::threading::Thread::CreationParameters params;
+      auto thread = xe::threading::Thread::Create(params, [this, i]() {
+        xe::Profiler::ThreadEnter("Pipeline Compile");
+        compile_pool_->RunWorker(i);
+        xe::Profiler::ThreadExit();
+      });
+      if (!thread) {
+        XELOGE("Unable to create pipeline compile thread");
+        break;
+      }
+      thread->set_name(xe::format_string("Pipeline Compile Thread %d", i));
+      compile_threads_.push_back(std::move(thread));
+    }
+    if (compile_threads_.empty()) {
+      compile_pool_.reset();
+    }
+  }
 }
 
 PipelineCache::~PipelineCache() {
+  // Compiles that haven't started are dropped.
+  if (compile_pool_) {
+    compile_pool_->Shutdown();
+    for (auto& thread : compile_threads_) {
+      xe::threading::Wait(thread.get(), false);
+    }
+    compile_threads_.clear();
+    compile_pool_.reset();
+  }
+  for (auto& it : pending_pipelines_) {
+    if (it.second->done && it.second->pipeline) {
+      vkDestroyPipeline(device_, it.second->pipeline, nullptr);
+    }
+  }
+  pending_pipelines_.clear();
+  if (skipped_draw_count_) {
+    XELOGI("Skipped %u draws while their pipelines were compiling",
+           skipped_draw_count_);
+  }
+
+  ShutdownShaderStorage();
+  XELOGI(
+      "Pipeline cache: %u shaders translated, %u loaded from storage in "
+      "%.3fms; %u pipelines created in %.3fms",
+      creation_stats_.shaders_translated, creation_stats_.shaders_loaded,
+      creation_stats_.shader_time_us / 1000.0,
+      creation_stats_.pipelines_created,
+      creation_stats_.pipeline_time_us / 1000.0);
+
   // Destroy all pipelines.
   for (auto it : cached_pipelines_) {
     vkDestroyPipeline(device_, it.second, nullptr);
@@ -205,12 +318,21 @@ PipelineCache::UpdateStatus PipelineCache::ConfigurePipeline(
   if (!pipeline) {
     // Should have a hash key produced by the UpdateState pass.
     uint64_t hash_key = XXH64_digest(&hash_state_);
-    pipeline = GetPipeline(render_state, hash_key);
+    bool pending = false;
+    pipeline = GetPipeline(render_state, hash_key, &pending);
     current_pipeline_ = pipeline;
+    if (pending) {
+      // Looked up again on the next draw, whether the state changes or not.
+      COUNT_profile_cpu("gpu/pipeline_skipped_draws", ++skipped_draw_count_);
+      return UpdateStatus::kPending;
+    }
     if (!pipeline) {
       // Unable to create pipeline.
       return UpdateStatus::kError;
     }
+    // Not bound yet, even if the state matches the previous draw (which
+    // didn't have a pipeline).
+    update_status = UpdateStatus::kMismatch;
   }
 
   *pipeline_out = pipeline;
@@ -219,10 +341,225 @@ PipelineCache::UpdateStatus PipelineCache::ConfigurePipeline(
 
 void PipelineCache::ClearCache() {
   // TODO(benvanik): caching.
+  // Render passes are about to be destroyed.
+  WaitForPipelineCompiles();
+}
+
+void PipelineCache::InitializeShaderStorage(const std::wstring& storage_root,
+                                            uint32_t title_id) {
+  ShutdownShaderStorage();
+  if (storage_root.empty()) {
+    return;
+  }
+  if (!xe::filesystem::PathExists(storage_root) &&
+      !xe::filesystem::CreateFolder(storage_root)) {
+    XELOGE("Unable to create the shader storage folder %S",
+           storage_root.c_str());
+    return;
+  }
+  auto title_path =
+      xe::join_paths(storage_root, xe::format_string(L"%.8X", title_id));
+  LoadStoredShaders(title_path + L".vk_spirv");
+  LoadStoredPipelines(title_path + L".vk_pipelines");
+}
+
+void PipelineCache::ShutdownShaderStorage() {
+  if (shader_storage_file_) {
+    fclose(shader_storage_file_);
+    shader_storage_file_ = nullptr;
+  }
+  stored_shaders_.clear();
+
+  if (pipeline_storage_path_.empty()) {
+    return;
+  }
+  std::vector<uint8_t> pipeline_data;
+  size_t data_size = 0;
+  auto err =
+      vkGetPipelineCacheData(device_, pipeline_cache_, &data_size, nullptr);
+  if (err == VK_SUCCESS && data_size) {
+    pipeline_data.resize(data_size);
+    err = vkGetPipelineCacheData(device_, pipeline_cache_, &data_size,
+                                 pipeline_data.data());
+  }
+  if (err == VK_SUCCESS && data_size) {
+    auto file = xe::filesystem::OpenFile(pipeline_storage_path_, "wb");
+    if (file) {
+      fwrite(pipeline_data.data(), 1, data_size, file);
+      fclose(file);
+    } else {
+      XELOGE("Unable to write the pipeline storage %S",
+             pipeline_storage_path_.c_str());
+    }
+  }
+  pipeline_storage_path_.clear();
+}
+
+uint64_t PipelineCache::GetStoredShaderKey(uint64_t ucode_data_hash,
+                                           uint32_t sq_program_cntl) {
+  return XXH64(&sq_program_cntl, sizeof(sq_program_cntl), ucode_data_hash);
+}
+
+void PipelineCache::LoadStoredShaders(const std::wstring& path) {
+  ShaderStorageFileHeader file_header;
+  // Whether the file holds exactly the shaders read from it, so that new
+  // ones can be appended. Otherwise it's rewritten.
+  bool file_valid = false;
+  auto file = xe::filesystem::OpenFile(path, "rb");
+  if (file) {
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    file_valid =
+        fread(&file_header, sizeof(file_header), 1, file) == 1 &&
+        file_header.magic == kShaderStorageMagic &&
+        file_header.version == kShaderStorageVersion &&
+        !std::memcmp(file_header.build_commit_sha, XE_BUILD_COMMIT,
+                     sizeof(file_header.build_commit_sha));
+    while (file_valid) {
+      ShaderStorageEntryHeader entry_header;
+      size_t header_read =
+          fread(&entry_header, 1, sizeof(entry_header), file);
+      if (header_read != sizeof(entry_header)) {
+        // Either the end of the file or a partially written entry.
+        file_valid = !header_read;
+        break;
+      }
+      StoredShader shader;
+      shader.ucode_data_hash = entry_header.ucode_data_hash;
+      shader.sq_program_cntl = entry_header.sq_program_cntl;
+      shader.shader_type = ShaderType(entry_header.shader_type);
+      // Check the length before allocating for it.
+      if (entry_header.spirv_length < sizeof(uint32_t) ||
+          entry_header.spirv_length % sizeof(uint32_t) ||
+          entry_header.spirv_length > kShaderStorageMaxSpirvLength ||
+          long(entry_header.spirv_length) > file_size - ftell(file)) {
+        file_valid = false;
+        break;
+      }
+      shader.spirv.resize(entry_header.spirv_length);
+      if (fread(shader.spirv.data(), entry_header.spirv_length, 1, file) != 1 ||
+          uint32_t(XXH64(shader.spirv.data(), shader.spirv.size(), 0)) !=
+              entry_header.spirv_hash) {
+        file_valid = false;
+        break;
+      }
+      stored_shaders_.emplace(GetStoredShaderKey(shader.ucode_data_hash,
+                                                 shader.sq_program_cntl),
+                              std::move(shader));
+    }
+    fclose(file);
+  }
+  XELOGI("Loaded %zu stored shaders from %S", stored_shaders_.size(),
+         path.c_str());
+
+  if (file_valid) {
+    shader_storage_file_ = xe::filesystem::OpenFile(path, "ab");
+  } else {
+    shader_storage_file_ = xe::filesystem::OpenFile(path, "wb");
+    if (shader_storage_file_) {
+      std::memset(&file_header, 0, sizeof(file_header));
+      file_header.magic = kShaderStorageMagic;
+      file_header.version = kShaderStorageVersion;
+      std::memcpy(file_header.build_commit_sha, XE_BUILD_COMMIT,
+                  sizeof(file_header.build_commit_sha));
+      fwrite(&file_header, sizeof(file_header), 1, shader_storage_file_);
+      // Keep what was read before the damaged part.
+      for (auto& it : stored_shaders_) {
+        WriteStoredShader(it.second);
+      }
+      fflush(shader_storage_file_);
+    }
+  }
+  if (!shader_storage_file_) {
+    XELOGE("Unable to open the shader storage %S for writing", path.c_str());
+  }
+}
+
+void PipelineCache::WriteStoredShader(const StoredShader& shader) {
+  ShaderStorageEntryHeader entry_header;
+  entry_header.ucode_data_hash = shader.ucode_data_hash;
+  entry_header.sq_program_cntl = shader.sq_program_cntl;
+  entry_header.shader_type = uint32_t(shader.shader_type);
+  entry_header.spirv_length = uint32_t(shader.spirv.size());
+  entry_header.spirv_hash =
+      uint32_t(XXH64(shader.spirv.data(), shader.spirv.size(), 0));
+  fwrite(&entry_header, sizeof(entry_header), 1, shader_storage_file_);
+  fwrite(shader.spirv.data(), shader.spirv.size(), 1, shader_storage_file_);
+}
+
+void PipelineCache::LoadStoredPipelines(const std::wstring& path) {
+  pipeline_storage_path_ = path;
+
+  std::vector<uint8_t> pipeline_data;
+  auto file = xe::filesystem::OpenFile(path, "rb");
+  if (!file) {
+    return;
+  }
+  fseek(file, 0, SEEK_END);
+  long file_size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  if (file_size > 0) {
+    pipeline_data.resize(file_size);
+    if (fread(pipeline_data.data(), file_size, 1, file) != 1) {
+      pipeline_data.clear();
+    }
+  }
+  fclose(file);
+
+  // Drivers should reject data from other devices or driver versions on their
+  // own, but not all of them do, so check the header (VkPipelineCacheHeader
+  // version one) first.
+  const auto& properties = device_properties_;
+  struct {
+    uint32_t length;
+    uint32_t version;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint8_t uuid[VK_UUID_SIZE];
+  } header;
+  if (pipeline_data.size() < sizeof(header)) {
+    return;
+  }
+  std::memcpy(&header, pipeline_data.data(), sizeof(header));
+  if (header.length < sizeof(header) ||
+      header.version != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+      header.vendor_id != properties.vendorID ||
+      header.device_id != properties.deviceID ||
+      std::memcmp(header.uuid, properties.pipelineCacheUUID, VK_UUID_SIZE)) {
+    XELOGI("Ignoring pipeline storage %S from another device or driver",
+           path.c_str());
+    return;
+  }
+
+  // Pipelines may already have been created, so keep them in the new cache.
+  // Compile threads mustn't be using the old one when it's destroyed.
+  WaitForPipelineCompiles();
+  VkPipelineCacheCreateInfo pipeline_cache_info;
+  pipeline_cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  pipeline_cache_info.pNext = nullptr;
+  pipeline_cache_info.flags = 0;
+  pipeline_cache_info.initialDataSize = pipeline_data.size();
+  pipeline_cache_info.pInitialData = pipeline_data.data();
+  VkPipelineCache pipeline_cache = nullptr;
+  auto err = vkCreatePipelineCache(device_, &pipeline_cache_info, nullptr,
+                                   &pipeline_cache);
+  if (err != VK_SUCCESS) {
+    XELOGE("Unable to load pipeline storage %S: vkCreatePipelineCache failed "
+           "with code %d",
+           path.c_str(), err);
+    return;
+  }
+  err = vkMergePipelineCaches(device_, pipeline_cache, 1, &pipeline_cache_);
+  CheckResult(err, "vkMergePipelineCaches");
+  vkDestroyPipelineCache(device_, pipeline_cache_, nullptr);
+  pipeline_cache_ = pipeline_cache;
+  XELOGI("Loaded %zu bytes of pipeline storage from %S", pipeline_data.size(),
+         path.c_str());
 }
 
 VkPipeline PipelineCache::GetPipeline(const RenderState* render_state,
-                                      uint64_t hash_key) {
+                                      uint64_t hash_key, bool* pending_out) {
   // Lookup the pipeline in the cache.
   auto it = cached_pipelines_.find(hash_key);
   if (it != cached_pipelines_.end()) {
@@ -230,12 +567,56 @@ VkPipeline PipelineCache::GetPipeline(const RenderState* render_state,
     return it->second;
   }
 
-  VkPipelineDynamicStateCreateInfo dynamic_state_info;
-  dynamic_state_info.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-  dynamic_state_info.pNext = nullptr;
-  dynamic_state_info.flags = 0;
-  VkDynamicState dynamic_states[] = {
+  auto pending_it = pending_pipelines_.find(hash_key);
+  if (pending_it == pending_pipelines_.end()) {
+    auto compile = CapturePipelineState(render_state);
+    if (compile_pool_) {
+      PipelineCompile* compile_ptr = compile.get();
+      compile_pool_->Submit([this, compile_ptr]() {
+        SCOPE_profile_cpu_i("gpu", "CompilePipeline");
+        CompilePipeline(compile_ptr);
+      });
+    } else {
+      CompilePipeline(compile.get());
+    }
+    pending_it =
+        pending_pipelines_.emplace(hash_key, std::move(compile)).first;
+  }
+  PipelineCompile* compile = pending_it->second.get();
+  if (!compile->done.load(std::memory_order_acquire)) {
+    if (!wait_for_pending_pipelines_) {
+      COUNT_profile_cpu("gpu/pipeline_compiles_pending",
+                        pending_pipelines_.size());
+      *pending_out = true;
+      return nullptr;
+    }
+    SCOPE_profile_cpu_i("gpu", "WaitForPipelineCompile");
+    std::unique_lock<std::mutex> lock(compile_mutex_);
+    compile_cond_.wait(lock, [compile]() { return compile->done.load(); });
+  }
+
+  VkResult result = compile->result;
+  VkPipeline pipeline = compile->pipeline;
+  creation_stats_.pipeline_time_us += compile->compile_time_us;
+  pending_pipelines_.erase(pending_it);
+  COUNT_profile_cpu("gpu/pipeline_compiles_pending",
+                    pending_pipelines_.size());
+  if (result != VK_SUCCESS) {
+    // Tried again the next time it's needed.
+    XELOGE("vkCreateGraphicsPipelines failed with code %d", result);
+    return nullptr;
+  }
+  ++creation_stats_.pipelines_created;
+
+  // Add to cache with the hash key for reuse.
+  cached_pipelines_.insert({hash_key, pipeline});
+
+  return pipeline;
+}
+
+std::unique_ptr<PipelineCache::PipelineCompile>
+PipelineCache::CapturePipelineState(const RenderState* render_state) {
+  static const VkDynamicState dynamic_states[] = {
       VK_DYNAMIC_STATE_VIEWPORT,
       VK_DYNAMIC_STATE_SCISSOR,
       VK_DYNAMIC_STATE_LINE_WIDTH,
@@ -246,64 +627,166 @@ VkPipeline PipelineCache::GetPipeline(const RenderState* render_state,
       VK_DYNAMIC_STATE_STENCIL_WRITE_MASK,
       VK_DYNAMIC_STATE_STENCIL_REFERENCE,
   };
+
+  // The update state points into our own members, which will have changed by
+  // the time a compile thread gets to it, so everything is copied.
+  auto compile = std::make_unique<PipelineCompile>();
+  std::memcpy(compile->shader_stages, update_shader_stages_info_,
+              sizeof(compile->shader_stages));
+
+  compile->vertex_input_state = update_vertex_input_state_info_;
+  std::memcpy(compile->vertex_binding_descrs,
+              update_vertex_input_state_binding_descrs_,
+              sizeof(compile->vertex_binding_descrs));
+  std::memcpy(compile->vertex_attrib_descrs,
+              update_vertex_input_state_attrib_descrs_,
+              sizeof(compile->vertex_attrib_descrs));
+  compile->vertex_input_state.pVertexBindingDescriptions =
+      compile->vertex_binding_descrs;
+  compile->vertex_input_state.pVertexAttributeDescriptions =
+      compile->vertex_attrib_descrs;
+
+  compile->input_assembly_state = update_input_assembly_state_info_;
+  compile->viewport_state = update_viewport_state_info_;
+  compile->rasterization_state = update_rasterization_state_info_;
+  compile->multisample_state = update_multisample_state_info_;
+  compile->depth_stencil_state = update_depth_stencil_state_info_;
+
+  compile->color_blend_state = update_color_blend_state_info_;
+  std::memcpy(compile->color_blend_attachment_states,
+              update_color_blend_attachment_states_,
+              sizeof(compile->color_blend_attachment_states));
+  compile->color_blend_state.pAttachments =
+      compile->color_blend_attachment_states;
+
+  auto& dynamic_state_info = compile->dynamic_state;
+  dynamic_state_info.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  dynamic_state_info.pNext = nullptr;
+  dynamic_state_info.flags = 0;
   dynamic_state_info.dynamicStateCount =
       static_cast<uint32_t>(xe::countof(dynamic_states));
   dynamic_state_info.pDynamicStates = dynamic_states;
 
-  VkGraphicsPipelineCreateInfo pipeline_info;
+  auto& pipeline_info = compile->pipeline_info;
   pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
   pipeline_info.pNext = nullptr;
   pipeline_info.flags = VK_PIPELINE_CREATE_DISABLE_OPTIMIZATION_BIT;
   pipeline_info.stageCount = update_shader_stages_stage_count_;
-  pipeline_info.pStages = update_shader_stages_info_;
-  pipeline_info.pVertexInputState = &update_vertex_input_state_info_;
-  pipeline_info.pInputAssemblyState = &update_input_assembly_state_info_;
+  pipeline_info.pStages = compile->shader_stages;
+  pipeline_info.pVertexInputState = &compile->vertex_input_state;
+  pipeline_info.pInputAssemblyState = &compile->input_assembly_state;
   pipeline_info.pTessellationState = nullptr;
-  pipeline_info.pViewportState = &update_viewport_state_info_;
-  pipeline_info.pRasterizationState = &update_rasterization_state_info_;
-  pipeline_info.pMultisampleState = &update_multisample_state_info_;
-  pipeline_info.pDepthStencilState = &update_depth_stencil_state_info_;
-  pipeline_info.pColorBlendState = &update_color_blend_state_info_;
-  pipeline_info.pDynamicState = &dynamic_state_info;
+  pipeline_info.pViewportState = &compile->viewport_state;
+  pipeline_info.pRasterizationState = &compile->rasterization_state;
+  pipeline_info.pMultisampleState = &compile->multisample_state;
+  pipeline_info.pDepthStencilState = &compile->depth_stencil_state;
+  pipeline_info.pColorBlendState = &compile->color_blend_state;
+  pipeline_info.pDynamicState = &compile->dynamic_state;
   pipeline_info.layout = pipeline_layout_;
   pipeline_info.renderPass = render_state->render_pass_handle;
   pipeline_info.subpass = 0;
   pipeline_info.basePipelineHandle = nullptr;
   pipeline_info.basePipelineIndex = -1;
+
+  compile->result = VK_NOT_READY;
+  compile->pipeline = nullptr;
+  compile->compile_time_us = 0;
+  compile->done = false;
+  return compile;
+}
+
+void PipelineCache::CompilePipeline(PipelineCompile* compile) {
   VkPipeline pipeline = nullptr;
-  auto result = vkCreateGraphicsPipelines(device_, pipeline_cache_, 1,
-                                          &pipeline_info, nullptr, &pipeline);
-  if (result != VK_SUCCESS) {
-    XELOGE("vkCreateGraphicsPipelines failed with code %d", result);
-    return nullptr;
-  }
+  auto start_time = std::chrono::steady_clock::now();
+  auto result = vkCreateGraphicsPipelines(
+      device_, pipeline_cache_, 1, &compile->pipeline_info, nullptr, &pipeline);
+  compile->compile_time_us =
+      GetMicroseconds(std::chrono::steady_clock::now() - start_time);
 
   // Dump shader disassembly.
-  if (FLAGS_vulkan_dump_disasm) {
-    DumpShaderDisasmNV(pipeline_info);
+  if (result == VK_SUCCESS && FLAGS_vulkan_dump_disasm) {
+    DumpShaderDisasmNV(compile->pipeline_info);
   }
 
-  // Add to cache with the hash key for reuse.
-  cached_pipelines_.insert({hash_key, pipeline});
+  compile->result = result;
+  compile->pipeline = result == VK_SUCCESS ? pipeline : nullptr;
+  {
+    std::lock_guard<std::mutex> lock(compile_mutex_);
+    compile->done.store(true, std::memory_order_release);
+  }
+  compile_cond_.notify_all();
+}
 
-  return pipeline;
+void PipelineCache::WaitForPipelineCompiles() {
+  if (pending_pipelines_.empty()) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(compile_mutex_);
+  for (auto& it : pending_pipelines_) {
+    PipelineCompile* compile = it.second.get();
+    compile_cond_.wait(lock, [compile]() { return compile->done.load(); });
+  }
 }
 
 bool PipelineCache::TranslateShader(VulkanShader* shader,
                                     xenos::xe_gpu_program_cntl_t cntl) {
-  // Perform translation.
-  // If this fails the shader will be marked as invalid and ignored later.
-  if (!shader_translator_->Translate(shader, cntl)) {
-    XELOGE("Shader translation failed; marking shader as ignored");
-    return false;
+  auto start_time = std::chrono::steady_clock::now();
+
+  // Reuse the SPIR-V from the shader storage if the shader was translated
+  // with the same program control before.
+  bool from_storage = false;
+  auto stored_it = stored_shaders_.find(
+      GetStoredShaderKey(shader->ucode_data_hash(), cntl.dword_0));
+  if (stored_it != stored_shaders_.end() &&
+      stored_it->second.ucode_data_hash == shader->ucode_data_hash() &&
+      stored_it->second.sq_program_cntl == cntl.dword_0 &&
+      stored_it->second.shader_type == shader->type()) {
+    stored_shader_translator_->set_spirv(&stored_it->second.spirv);
+    from_storage = stored_shader_translator_->Translate(shader, cntl) &&
+                   shader->Prepare();
+    if (!from_storage) {
+      XELOGW("Stored shader %.16" PRIX64 " could not be used; translating it",
+             shader->ucode_data_hash());
+    }
   }
 
-  // Prepare the shader for use (creates our VkShaderModule).
-  // It could still fail at this point.
-  if (!shader->Prepare()) {
-    XELOGE("Shader preparation failed; marking shader as ignored");
-    return false;
+  if (!from_storage) {
+    // Perform translation.
+    // If this fails the shader will be marked as invalid and ignored later.
+    if (!shader_translator_->Translate(shader, cntl)) {
+      XELOGE("Shader translation failed; marking shader as ignored");
+      return false;
+    }
+
+    // Prepare the shader for use (creates our VkShaderModule).
+    // It could still fail at this point.
+    if (!shader->Prepare()) {
+      XELOGE("Shader preparation failed; marking shader as ignored");
+      return false;
+    }
+
+    if (shader->is_valid() && shader_storage_file_) {
+      StoredShader stored_shader;
+      stored_shader.ucode_data_hash = shader->ucode_data_hash();
+      stored_shader.sq_program_cntl = cntl.dword_0;
+      stored_shader.shader_type = shader->type();
+      stored_shader.spirv = shader->translated_binary();
+      WriteStoredShader(stored_shader);
+      fflush(shader_storage_file_);
+      stored_shaders_[GetStoredShaderKey(stored_shader.ucode_data_hash,
+                                         stored_shader.sq_program_cntl)] =
+          std::move(stored_shader);
+    }
+  }
+
+  if (from_storage) {
+    ++creation_stats_.shaders_loaded;
+  } else {
+    ++creation_stats_.shaders_translated;
   }
+  creation_stats_.shader_time_us +=
+      GetMicroseconds(std::chrono::steady_clock::now() - start_time);
 
   if (shader->is_valid()) {
     XELOGGPU("Generated %s shader (%db) - hash %.16" PRIX64 ":\n%s\n",
@@ -1072,10 +1555,8 @@ PipelineCache::UpdateStatus PipelineCache::UpdateInputAssemblyState(
   } else {
     state_info.primitiveRestartEnable = VK_FALSE;
   }
-  // TODO(benvanik): no way to specify in Vulkan?
-  assert_true(regs.multi_prim_ib_reset_index == 0xFFFF ||
-              regs.multi_prim_ib_reset_index == 0xFFFFFFFF);
-  // glPrimitiveRestartIndex(regs.multi_prim_ib_reset_index);
+  // Vulkan always restarts on all ones - the buffer cache replaces the guest
+  // reset index with that when uploading indices.
 
   return UpdateStatus::kMismatch;
 }
@@ -10,10 +10,19 @@
 #ifndef XENIA_GPU_VULKAN_PIPELINE_CACHE_H_
 #define XENIA_GPU_VULKAN_PIPELINE_CACHE_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "third_party/xxhash/xxhash.h"
 
+#include "xenia/base/thread_pool.h"
+#include "xenia/base/threading.h"
 #include "xenia/gpu/glsl_shader_translator.h"
 #include "xenia/gpu/register_file.h"
 #include "xenia/gpu/spirv_shader_translator.h"
@@ -28,6 +37,8 @@ namespace xe {
 namespace gpu {
 namespace vulkan {
 
+class StoredShaderTranslator;
+
 // Configures and caches pipelines based on render state.
 // This is responsible for properly setting all state required for a draw
 // including shaders, various blend/etc options, and input configuration.
@@ -37,6 +48,9 @@ class PipelineCache {
     kCompatible,
     kMismatch,
     kError,
+    // The pipeline is still being compiled in the background; the draw
+    // should be skipped.
+    kPending,
   };
 
   PipelineCache(RegisterFile* register_file, ui::vulkan::VulkanDevice* device,
@@ -71,14 +85,74 @@ class PipelineCache {
   // Clears all cached content.
   void ClearCache();
 
+  // Opens the persistent shader storage for the given title, saving and
+  // closing any that was open. Translated SPIR-V is kept per guest shader and
+  // program control so that later runs skip translation, and the driver
+  // pipeline cache is kept so that pipeline creation can skip compilation.
+  // An empty storage root disables the storage.
+  void InitializeShaderStorage(const std::wstring& storage_root,
+                               uint32_t title_id);
+  // Writes out the driver pipeline cache and closes the shader storage.
+  void ShutdownShaderStorage();
+
  private:
+  // Pipeline state captured when a pipeline is first needed, so that it can
+  // be compiled away from the command processor thread.
+  struct PipelineCompile {
+    VkPipelineShaderStageCreateInfo shader_stages[3];
+    VkPipelineVertexInputStateCreateInfo vertex_input_state;
+    VkVertexInputBindingDescription vertex_binding_descrs[64];
+    VkVertexInputAttributeDescription vertex_attrib_descrs[64];
+    VkPipelineInputAssemblyStateCreateInfo input_assembly_state;
+    VkPipelineViewportStateCreateInfo viewport_state;
+    VkPipelineRasterizationStateCreateInfo rasterization_state;
+    VkPipelineMultisampleStateCreateInfo multisample_state;
+    VkPipelineDepthStencilStateCreateInfo depth_stencil_state;
+    VkPipelineColorBlendStateCreateInfo color_blend_state;
+    VkPipelineColorBlendAttachmentState color_blend_attachment_states[4];
+    VkPipelineDynamicStateCreateInfo dynamic_state;
+    VkGraphicsPipelineCreateInfo pipeline_info;
+
+    // Results, valid once done is set.
+    VkResult result;
+    VkPipeline pipeline;
+    uint64_t compile_time_us;
+    std::atomic<bool> done;
+  };
+
   // Creates or retrieves an existing pipeline for the currently configured
-  // state.
-  VkPipeline GetPipeline(const RenderState* render_state, uint64_t hash_key);
+  // state. If the pipeline is being compiled in the background and draws
+  // don't wait for it, returns nullptr and sets pending_out.
+  VkPipeline GetPipeline(const RenderState* render_state, uint64_t hash_key,
+                         bool* pending_out);
+  std::unique_ptr<PipelineCompile> CapturePipelineState(
+      const RenderState* render_state);
+  // Creates the pipeline and marks the compile as done. Runs on either the
+  // command processor thread or a compile thread.
+  void CompilePipeline(PipelineCompile* compile);
+  // Blocks until all background compiles have finished, for when the render
+  // passes or the driver pipeline cache they use are about to go away.
+  void WaitForPipelineCompiles();
 
   bool TranslateShader(VulkanShader* shader, xenos::xe_gpu_program_cntl_t cntl);
   void DumpShaderDisasmNV(const VkGraphicsPipelineCreateInfo& info);
 
+  // Key of a shader in the shader storage. Translation depends on the program
+  // control (register counts) as well as the ucode.
+  static uint64_t GetStoredShaderKey(uint64_t ucode_data_hash,
+                                     uint32_t sq_program_cntl);
+  void LoadStoredShaders(const std::wstring& path);
+  // Translated SPIR-V in the shader storage.
+  struct StoredShader {
+    uint64_t ucode_data_hash;
+    uint32_t sq_program_cntl;
+    ShaderType shader_type;
+    std::vector<uint8_t> spirv;
+  };
+  // Appends a shader to the open shader storage file.
+  void WriteStoredShader(const StoredShader& shader);
+  void LoadStoredPipelines(const std::wstring& path);
+
   // Gets a geometry shader used to emulate the given primitive type.
   // Returns nullptr if the primitive doesn't need to be emulated.
   VkShaderModule GetGeometryShader(PrimitiveType primitive_type,
@@ -86,6 +160,8 @@ class PipelineCache {
 
   RegisterFile* register_file_ = nullptr;
   VkDevice device_ = nullptr;
+  // Identifies the driver that produced stored pipeline cache data.
+  VkPhysicalDeviceProperties device_properties_;
 
   // Reusable shader translator.
   std::unique_ptr<ShaderTranslator> shader_translator_ = nullptr;
@@ -95,8 +171,29 @@ class PipelineCache {
   std::unordered_map<uint64_t, VulkanShader*> shader_map_;
 
   // Vulkan pipeline cache, which in theory helps us out.
-  // This can be serialized to disk and reused, if we want.
+  // Serialized to the shader storage, per title.
   VkPipelineCache pipeline_cache_ = nullptr;
+
+  // Translated SPIR-V read from the shader storage, by GetStoredShaderKey.
+  std::unordered_map<uint64_t, StoredShader> stored_shaders_;
+  // Translator that only gathers bindings and register usage, for shaders
+  // whose SPIR-V comes from the storage.
+  std::unique_ptr<StoredShaderTranslator> stored_shader_translator_;
+  // Newly translated shaders are appended as they are created, so that they
+  // survive a crash.
+  FILE* shader_storage_file_ = nullptr;
+  // Where the driver pipeline cache is written on shutdown.
+  std::wstring pipeline_storage_path_;
+
+  // Time spent creating shaders and pipelines, for comparing runs with and
+  // without the storage.
+  struct {
+    uint32_t shaders_translated;
+    uint32_t shaders_loaded;
+    uint64_t shader_time_us;
+    uint32_t pipelines_created;
+    uint64_t pipeline_time_us;
+  } creation_stats_ = {0};
   // Layout used for all pipelines describing our uniforms, textures, and push
   // constants.
   VkPipelineLayout pipeline_layout_ = nullptr;
@@ -119,6 +216,20 @@ class PipelineCache {
   // All previously generated pipelines mapped by hash.
   std::unordered_map<uint64_t, VkPipeline> cached_pipelines_;
 
+  // Background pipeline compilation, if enabled.
+  std::unique_ptr<xe::ThreadPool> compile_pool_;
+  std::vector<std::unique_ptr<xe::threading::Thread>> compile_threads_;
+  // Whether draws wait for their pipeline to finish compiling instead of
+  // being skipped (--vulkan_pending_pipeline_draws).
+  bool wait_for_pending_pipelines_ = false;
+  // Compiles not yet picked up by GetPipeline, mapped by hash.
+  std::unordered_map<uint64_t, std::unique_ptr<PipelineCompile>>
+      pending_pipelines_;
+  // Signaled when a compile finishes.
+  std::mutex compile_mutex_;
+  std::condition_variable compile_cond_;
+  uint32_t skipped_draw_count_ = 0;
+
   // Previously used pipeline. This matches our current state settings
   // and allows us to quickly(ish) reuse the pipeline if no registers have
   // changed.
@@ -162,6 +162,9 @@ TextureCache::TextureCache(Memory* memory, RegisterFile* register_file,
   invalidated_textures_ = &invalidated_textures_sets_[0];
 
   device_queue_ = device_->AcquireQueue();
+
+  texture_converter_ = std::make_unique<TextureConverter>(
+      std::max(FLAGS_texture_conversion_threads, 0));
 }
 
 TextureCache::~TextureCache() {
@@ -767,25 +770,6 @@ TextureCache::Texture* TextureCache::LookupAddress(uint32_t guest_address,
   return nullptr;
 }
 
-void TextureSwap(Endian endianness, void* dest, const void* src,
-                 size_t length) {
-  switch (endianness) {
-    case Endian::k8in16:
-      xe::copy_and_swap_16_aligned(dest, src, length / 2);
-      break;
-    case Endian::k8in32:
-      xe::copy_and_swap_32_aligned(dest, src, length / 4);
-      break;
-    case Endian::k16in32:  // Swap high and low 16 bits within a 32 bit word
-      xe::copy_and_swap_16_in_32_aligned(dest, src, length);
-      break;
-    default:
-    case Endian::kUnspecified:
-      std::memcpy(dest, src, length);
-      break;
-  }
-}
-
 void TextureCache::FlushPendingCommands(VkCommandBuffer command_buffer,
                                         VkFence completion_fence) {
   auto status = vkEndCommandBuffer(command_buffer);
@@ -822,120 +806,6 @@ void TextureCache::FlushPendingCommands(VkCommandBuffer command_buffer,
   vkBeginCommandBuffer(command_buffer, &begin_info);
 }
 
-void TextureCache::ConvertTexture2D(uint8_t* dest, const TextureInfo& src) {
-  void* host_address = memory_->TranslatePhysical(src.guest_address);
-  if (!src.is_tiled) {
-    if (src.size_2d.input_pitch == src.size_2d.output_pitch) {
-      // Fast path copy entire image.
-      TextureSwap(src.endianness, dest, host_address, src.output_length);
-    } else {
-      // Slow path copy row-by-row because strides differ.
-      // UNPACK_ROW_LENGTH only works for uncompressed images, and likely does
-      // this exact thing under the covers, so we just always do it here.
-      const uint8_t* src_mem = reinterpret_cast<const uint8_t*>(host_address);
-      uint32_t pitch =
-          std::min(src.size_2d.input_pitch, src.size_2d.output_pitch);
-      for (uint32_t y = 0;
-           y < std::min(src.size_2d.block_height, src.size_2d.logical_height);
-           y++) {
-        TextureSwap(src.endianness, dest, src_mem, pitch);
-        src_mem += src.size_2d.input_pitch;
-        dest += src.size_2d.output_pitch;
-      }
-    }
-  } else {
-    // Untile image.
-    // We could do this in a shader to speed things up, as this is pretty slow.
-
-    // TODO(benvanik): optimize this inner loop (or work by tiles).
-    const uint8_t* src_mem = reinterpret_cast<const uint8_t*>(host_address);
-    uint32_t bytes_per_block = src.format_info->block_width *
-                               src.format_info->block_height *
-                               src.format_info->bits_per_pixel / 8;
-
-    // Tiled textures can be packed; get the offset into the packed texture.
-    uint32_t offset_x;
-    uint32_t offset_y;
-    TextureInfo::GetPackedTileOffset(src, &offset_x, &offset_y);
-    auto bpp = (bytes_per_block >> 2) +
-               ((bytes_per_block >> 1) >> (bytes_per_block >> 2));
-    for (uint32_t y = 0, output_base_offset = 0;
-         y < std::min(src.size_2d.block_height, src.size_2d.logical_height);
-         y++, output_base_offset += src.size_2d.output_pitch) {
-      auto input_base_offset = TextureInfo::TiledOffset2DOuter(
-          offset_y + y,
-          (src.size_2d.input_width / src.format_info->block_width), bpp);
-      for (uint32_t x = 0, output_offset = output_base_offset;
-           x < src.size_2d.block_width; x++, output_offset += bytes_per_block) {
-        auto input_offset =
-            TextureInfo::TiledOffset2DInner(offset_x + x, offset_y + y, bpp,
-                                            input_base_offset) >>
-            bpp;
-        TextureSwap(src.endianness, dest + output_offset,
-                    src_mem + input_offset * bytes_per_block, bytes_per_block);
-      }
-    }
-  }
-}
-
-void TextureCache::ConvertTextureCube(uint8_t* dest, const TextureInfo& src) {
-  void* host_address = memory_->TranslatePhysical(src.guest_address);
-  if (!src.is_tiled) {
-    if (src.size_cube.input_pitch == src.size_cube.output_pitch) {
-      // Fast path copy entire image.
-      TextureSwap(src.endianness, dest, host_address, src.output_length);
-    } else {
-      // Slow path copy row-by-row because strides differ.
-      // UNPACK_ROW_LENGTH only works for uncompressed images, and likely does
-      // this exact thing under the covers, so we just always do it here.
-      const uint8_t* src_mem = reinterpret_cast<const uint8_t*>(host_address);
-      for (int face = 0; face < 6; ++face) {
-        uint32_t pitch =
-            std::min(src.size_cube.input_pitch, src.size_cube.output_pitch);
-        for (uint32_t y = 0; y < src.size_cube.block_height; y++) {
-          TextureSwap(src.endianness, dest, src_mem, pitch);
-          src_mem += src.size_cube.input_pitch;
-          dest += src.size_cube.output_pitch;
-        }
-      }
-    }
-  } else {
-    // TODO(benvanik): optimize this inner loop (or work by tiles).
-    const uint8_t* src_mem = reinterpret_cast<const uint8_t*>(host_address);
-    uint32_t bytes_per_block = src.format_info->block_width *
-                               src.format_info->block_height *
-                               src.format_info->bits_per_pixel / 8;
-    // Tiled textures can be packed; get the offset into the packed texture.
-    uint32_t offset_x;
-    uint32_t offset_y;
-    TextureInfo::GetPackedTileOffset(src, &offset_x, &offset_y);
-    auto bpp = (bytes_per_block >> 2) +
-               ((bytes_per_block >> 1) >> (bytes_per_block >> 2));
-    for (int face = 0; face < 6; ++face) {
-      for (uint32_t y = 0, output_base_offset = 0;
-           y < src.size_cube.block_height;
-           y++, output_base_offset += src.size_cube.output_pitch) {
-        auto input_base_offset = TextureInfo::TiledOffset2DOuter(
-            offset_y + y,
-            (src.size_cube.input_width / src.format_info->block_width), bpp);
-        for (uint32_t x = 0, output_offset = output_base_offset;
-             x < src.size_cube.block_width;
-             x++, output_offset += bytes_per_block) {
-          auto input_offset =
-              TextureInfo::TiledOffset2DInner(offset_x + x, offset_y + y, bpp,
-                                              input_base_offset) >>
-              bpp;
-          TextureSwap(src.endianness, dest + output_offset,
-                      src_mem + input_offset * bytes_per_block,
-                      bytes_per_block);
-        }
-      }
-      src_mem += src.size_cube.input_face_length;
-      dest += src.size_cube.output_face_length;
-    }
-  }
-}
-
 bool TextureCache::UploadTexture2D(VkCommandBuffer command_buffer,
                                    VkFence completion_fence, Texture* dest,
                                    const TextureInfo& src) {
@@ -971,7 +841,9 @@ bool TextureCache::UploadTexture2D(VkCommandBuffer command_buffer,
   // TODO: If the GPU supports it, we can submit a compute batch to convert the
   // texture and copy it to its destination. Otherwise, fallback to conversion
   // on the CPU.
-  ConvertTexture2D(reinterpret_cast<uint8_t*>(alloc->host_ptr), src);
+  texture_converter_->ConvertTexture(
+      reinterpret_cast<uint8_t*>(alloc->host_ptr),
+      memory_->TranslatePhysical<const uint8_t*>(src.guest_address), src);
   staging_buffer_.Flush(alloc);
 
   // Transition the texture into a transfer destination layout.
@@ -1048,7 +920,9 @@ bool TextureCache::UploadTextureCube(VkCommandBuffer command_buffer,
   // TODO: If the GPU supports it, we can submit a compute batch to convert the
   // texture and copy it to its destination. Otherwise, fallback to conversion
   // on the CPU.
-  ConvertTextureCube(reinterpret_cast<uint8_t*>(alloc->host_ptr), src);
+  texture_converter_->ConvertTexture(
+      reinterpret_cast<uint8_t*>(alloc->host_ptr),
+      memory_->TranslatePhysical<const uint8_t*>(src.guest_address), src);
   staging_buffer_.Flush(alloc);
 
   // Transition the texture into a transfer destination layout.
@@ -15,6 +15,7 @@
 #include "xenia/gpu/register_file.h"
 #include "xenia/gpu/sampler_info.h"
 #include "xenia/gpu/shader.h"
+#include "xenia/gpu/texture_conversion.h"
 #include "xenia/gpu/texture_info.h"
 #include "xenia/gpu/trace_writer.h"
 #include "xenia/gpu/vulkan/vulkan_command_processor.h"
@@ -148,9 +149,6 @@ class TextureCache {
   void FlushPendingCommands(VkCommandBuffer command_buffer,
                             VkFence completion_fence);
 
-  void ConvertTexture2D(uint8_t* dest, const TextureInfo& src);
-  void ConvertTextureCube(uint8_t* dest, const TextureInfo& src);
-
   // Queues commands to upload a texture from system memory, applying any
   // conversions necessary. This may flush the command buffer to the GPU if we
   // run out of staging memory.
@@ -182,6 +180,7 @@ class TextureCache {
   std::list<std::pair<VkDescriptorSet, VkFence>> in_flight_sets_;
 
   ui::vulkan::CircularBuffer staging_buffer_;
+  std::unique_ptr<TextureConverter> texture_converter_;
   std::unordered_map<uint64_t, Texture*> textures_;
   std::unordered_map<uint64_t, Sampler*> samplers_;
   std::vector<Texture*> resolve_textures_;
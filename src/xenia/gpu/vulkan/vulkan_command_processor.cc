@@ -52,6 +52,12 @@ void VulkanCommandProcessor::ClearCaches() {
   cache_clear_requested_ = true;
 }
 
+void VulkanCommandProcessor::InitializeShaderStorage(
+    const std::wstring& storage_root, uint32_t title_id) {
+  CommandProcessor::InitializeShaderStorage(storage_root, title_id);
+  pipeline_cache_->InitializeShaderStorage(storage_root, title_id);
+}
+
 bool VulkanCommandProcessor::SetupContext() {
   if (!CommandProcessor::SetupContext()) {
     XELOGE("Unable to initialize base command processor context");
@@ -73,8 +79,8 @@ bool VulkanCommandProcessor::SetupContext() {
       *device_, device_->queue_family_index(), VK_COMMAND_BUFFER_LEVEL_PRIMARY);
 
   // Initialize the state machine caches.
-  buffer_cache_ = std::make_unique<BufferCache>(register_file_, device_,
-                                                kDefaultBufferCacheCapacity);
+  buffer_cache_ = std::make_unique<BufferCache>(
+      register_file_, memory_, device_, kDefaultBufferCacheCapacity);
   texture_cache_ = std::make_unique<TextureCache>(memory_, register_file_,
                                                   &trace_writer_, device_);
   pipeline_cache_ = std::make_unique<PipelineCache>(
@@ -96,7 +102,13 @@ bool VulkanCommandProcessor::SetupContext() {
 }
 
 void VulkanCommandProcessor::ShutdownContext() {
-  // TODO(benvanik): wait until idle.
+  // The caches free resources that submitted work may still be using.
+  if (queue_mutex_) {
+    std::lock_guard<std::mutex> lock(*queue_mutex_);
+    vkQueueWaitIdle(queue_);
+  } else {
+    vkQueueWaitIdle(queue_);
+  }
 
   vkDestroySemaphore(*device_,
                      reinterpret_cast<VkSemaphore>(swap_state_.backend_data),
@@ -555,8 +567,13 @@ bool VulkanCommandProcessor::IssueDraw(PrimitiveType primitive_type,
   auto pipeline_status = pipeline_cache_->ConfigurePipeline(
       command_buffer, current_render_state_, vertex_shader, pixel_shader,
       primitive_type, &pipeline);
-  if (pipeline_status == PipelineCache::UpdateStatus::kMismatch ||
-      started_command_buffer) {
+  if (pipeline_status == PipelineCache::UpdateStatus::kPending) {
+    // Still compiling in the background - drop the draw rather than stall.
+    // Dynamic state is still set, as the next draw only sets what changed.
+    pipeline_cache_->SetDynamicState(command_buffer, started_command_buffer);
+    return true;
+  } else if (pipeline_status == PipelineCache::UpdateStatus::kMismatch ||
+             started_command_buffer) {
     vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
                       pipeline);
   } else if (pipeline_status == PipelineCache::UpdateStatus::kError) {
@@ -570,12 +587,19 @@ bool VulkanCommandProcessor::IssueDraw(PrimitiveType primitive_type,
   }
 
   // Upload and bind index buffer data (if we have any).
-  if (!PopulateIndexBuffer(command_buffer, index_buffer_info)) {
+  // Auto-indexed draws reference the first index_count vertices; indexed
+  // draws whichever their indices say.
+  uint32_t min_index = 0;
+  uint32_t max_index = index_buffer_info || !index_count ? UINT32_MAX
+                                                         : index_count - 1;
+  if (!PopulateIndexBuffer(command_buffer, setup_buffer, index_buffer_info,
+                           &min_index, &max_index)) {
     return false;
   }
 
   // Upload and bind all vertex buffer data.
-  if (!PopulateVertexBuffers(command_buffer, vertex_shader)) {
+  if (!PopulateVertexBuffers(command_buffer, setup_buffer, vertex_shader,
+                             max_index)) {
     return false;
   }
 
@@ -648,7 +672,9 @@ bool VulkanCommandProcessor::PopulateConstants(VkCommandBuffer command_buffer,
 }
 
 bool VulkanCommandProcessor::PopulateIndexBuffer(
-    VkCommandBuffer command_buffer, IndexBufferInfo* index_buffer_info) {
+    VkCommandBuffer command_buffer, VkCommandBuffer setup_buffer,
+    IndexBufferInfo* index_buffer_info, uint32_t* min_index,
+    uint32_t* max_index) {
   auto& regs = *register_file_;
   if (!index_buffer_info || !index_buffer_info->guest_base) {
     // No index buffer or auto draw.
@@ -662,10 +688,9 @@ bool VulkanCommandProcessor::PopulateIndexBuffer(
 
   // Min/max index ranges for clamping. This is often [0g,FFFF|FFFFFF].
   // All indices should be clamped to [min,max]. May be a way to do this in GL.
-  uint32_t min_index = regs[XE_GPU_REG_VGT_MIN_VTX_INDX].u32;
-  uint32_t max_index = regs[XE_GPU_REG_VGT_MAX_VTX_INDX].u32;
-  assert_true(min_index == 0);
-  assert_true(max_index == 0xFFFF || max_index == 0xFFFFFF);
+  assert_true(regs[XE_GPU_REG_VGT_MIN_VTX_INDX].u32 == 0);
+  assert_true(regs[XE_GPU_REG_VGT_MAX_VTX_INDX].u32 == 0xFFFF ||
+              regs[XE_GPU_REG_VGT_MAX_VTX_INDX].u32 == 0xFFFFFF);
 
   assert_true(info.endianness == Endian::k8in16 ||
               info.endianness == Endian::k8in32);
@@ -673,13 +698,18 @@ bool VulkanCommandProcessor::PopulateIndexBuffer(
   trace_writer_.WriteMemoryRead(info.guest_base, info.length);
 
   // Upload (or get a cached copy of) the buffer.
-  const void* source_ptr =
-      memory_->TranslatePhysical<const void*>(info.guest_base);
-  size_t source_length =
-      info.count * (info.format == IndexFormat::kInt32 ? sizeof(uint32_t)
-                                                       : sizeof(uint16_t));
+  uint32_t source_length = info.count * (info.format == IndexFormat::kInt32
+                                              ? sizeof(uint32_t)
+                                              : sizeof(uint16_t));
+  // Reset indices become the Vulkan primitive restart index (all ones), which
+  // the guest can't choose, on the way.
+  bool primitive_restart =
+      (regs[XE_GPU_REG_PA_SU_SC_MODE_CNTL].u32 & (1 << 21)) != 0;
+  uint32_t reset_index = regs[XE_GPU_REG_VGT_MULTI_PRIM_IB_RESET_INDX].u32;
   auto buffer_ref = buffer_cache_->UploadIndexBuffer(
-      source_ptr, source_length, info.format, current_batch_fence_);
+      setup_buffer, info.guest_base, source_length, info.format,
+      primitive_restart, reset_index, current_batch_fence_, min_index,
+      max_index);
   if (buffer_ref.second == VK_WHOLE_SIZE) {
     // Failed to upload buffer.
     return false;
@@ -696,7 +726,8 @@ bool VulkanCommandProcessor::PopulateIndexBuffer(
 }
 
 bool VulkanCommandProcessor::PopulateVertexBuffers(
-    VkCommandBuffer command_buffer, VulkanShader* vertex_shader) {
+    VkCommandBuffer command_buffer, VkCommandBuffer setup_buffer,
+    VulkanShader* vertex_shader, uint32_t max_index) {
   auto& regs = *register_file_;
 
 #if FINE_GRAINED_DRAW_SCOPES
@@ -709,6 +740,11 @@ bool VulkanCommandProcessor::PopulateVertexBuffers(
     return true;
   }
 
+  // Last vertex the draw can fetch. A draw with nothing but reset indices
+  // fetches nothing, but still needs something bound.
+  uint64_t max_vertex =
+      uint64_t(max_index) + regs[XE_GPU_REG_VGT_INDX_OFFSET].u32;
+
   assert_true(vertex_bindings.size() <= 32);
   VkBuffer all_buffers[32];
   VkDeviceSize all_buffer_offsets[32];
@@ -740,13 +776,17 @@ bool VulkanCommandProcessor::PopulateVertexBuffers(
     uint32_t physical_address = fetch->address << 2;
     trace_writer_.WriteMemoryRead(physical_address, valid_range);
 
+    // Skip the vertices past the last one referenced.
+    uint64_t referenced_range =
+        (max_vertex + 1) * (uint64_t(vertex_binding.stride_words) * 4);
+    if (referenced_range && referenced_range < valid_range) {
+      valid_range = size_t(referenced_range);
+    }
+
     // Upload (or get a cached copy of) the buffer.
-    const void* source_ptr =
-        memory_->TranslatePhysical<const void*>(physical_address);
-    size_t source_length = valid_range;
     auto buffer_ref = buffer_cache_->UploadVertexBuffer(
-        source_ptr, source_length, static_cast<Endian>(fetch->endian),
-        current_batch_fence_);
+        setup_buffer, physical_address, uint32_t(valid_range),
+        static_cast<Endian>(fetch->endian), current_batch_fence_);
     if (buffer_ref.second == VK_WHOLE_SIZE) {
       // Failed to upload buffer.
       return false;
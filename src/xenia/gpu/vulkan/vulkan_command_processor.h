@@ -51,6 +51,8 @@ class VulkanCommandProcessor : public CommandProcessor {
 
   virtual void RequestFrameTrace(const std::wstring& root_path) override;
   void ClearCaches() override;
+  void InitializeShaderStorage(const std::wstring& storage_root,
+                               uint32_t title_id) override;
 
   RenderCache* render_cache() { return render_cache_.get(); }
 
@@ -79,10 +81,15 @@ class VulkanCommandProcessor : public CommandProcessor {
   bool PopulateConstants(VkCommandBuffer command_buffer,
                          VulkanShader* vertex_shader,
                          VulkanShader* pixel_shader);
+  // Narrows [min_index, max_index] to the indices actually referenced.
   bool PopulateIndexBuffer(VkCommandBuffer command_buffer,
-                           IndexBufferInfo* index_buffer_info);
+                           VkCommandBuffer setup_buffer,
+                           IndexBufferInfo* index_buffer_info,
+                           uint32_t* min_index, uint32_t* max_index);
+  // Only vertices up to max_index (before the index offset) are uploaded.
   bool PopulateVertexBuffers(VkCommandBuffer command_buffer,
-                             VulkanShader* vertex_shader);
+                             VkCommandBuffer setup_buffer,
+                             VulkanShader* vertex_shader, uint32_t max_index);
   bool PopulateSamplers(VkCommandBuffer command_buffer,
                         VkCommandBuffer setup_buffer,
                         VulkanShader* vertex_shader,
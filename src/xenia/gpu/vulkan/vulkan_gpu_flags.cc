@@ -14,3 +14,13 @@ DEFINE_bool(vulkan_renderdoc_capture_all, false,
 DEFINE_bool(vulkan_native_msaa, false, "Use native MSAA");
 DEFINE_bool(vulkan_dump_disasm, false,
             "Dump shader disassembly. NVIDIA only supported.");
+DEFINE_bool(vulkan_cache_buffers, true,
+            "Keep index and vertex data the guest doesn't modify in GPU "
+            "memory across draws instead of uploading it for every draw.");
+DEFINE_int32(vulkan_pipeline_threads, 0,
+             "Threads compiling pipelines in the background. 0 compiles them "
+             "on the command processor thread when first drawn with.");
+DEFINE_string(vulkan_pending_pipeline_draws, "skip",
+              "What happens to draws whose pipeline is still being compiled "
+              "in the background: [skip, wait]. wait gives the same output "
+              "as compiling on the command processor thread.");
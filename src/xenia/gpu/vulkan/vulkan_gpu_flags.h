@@ -17,5 +17,8 @@
 DECLARE_bool(vulkan_renderdoc_capture_all);
 DECLARE_bool(vulkan_native_msaa);
 DECLARE_bool(vulkan_dump_disasm);
+DECLARE_bool(vulkan_cache_buffers);
+DECLARE_int32(vulkan_pipeline_threads);
+DECLARE_string(vulkan_pending_pipeline_draws);
 
 #endif  // XENIA_GPU_VULKAN_VULKAN_GPU_FLAGS_H_
@@ -117,7 +117,7 @@ uint32_t KernelModule::GetProcAddressByOrdinal(uint16_t ordinal) {
       cpu::GuestFunction::ExternHandler handler = nullptr;
       if (export_entry->function_data.trampoline) {
         handler = (cpu::GuestFunction::ExternHandler)
-                      export_entry->function_data.trampoline;
+                      export_entry->GetTrampoline();
       } else {
         handler =
             (cpu::GuestFunction::ExternHandler)export_entry->function_data.shim;
@@ -11,6 +11,8 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+#include <cinttypes>
 #include <string>
 
 #include "xenia/base/assert.h"
@@ -33,11 +35,16 @@ DEFINE_bool(headless, false,
             "Don't display any UI, using defaults for prompts as needed.");
 DEFINE_string(content_root, "content",
               "Root path for content (save/etc) storage.");
+DEFINE_int32(kernel_dispatch_threads, 4,
+             "Host threads completing deferred kernel work (such as "
+             "asynchronous overlapped I/O).");
 
 namespace xe {
 namespace kernel {
 
 constexpr uint32_t kDeferredOverlappedDelayMillis = 100;
+// Deferred work that may be pending at once before callers have to wait.
+constexpr size_t kDispatchTaskCapacity = 256;
 
 // This is a global object initialized with the XboxkrnlModule.
 // It references the current kernel state object that all kernel methods should
@@ -49,7 +56,6 @@ KernelState* kernel_state() { return shared_kernel_state_; }
 KernelState::KernelState(Emulator* emulator)
     : emulator_(emulator),
       memory_(emulator->memory()),
-      dispatch_thread_running_(false),
       dpc_list_(emulator->memory()) {
   processor_ = emulator->processor();
   file_system_ = emulator->file_system();
@@ -67,16 +73,29 @@ KernelState::KernelState(Emulator* emulator)
   // Hardcoded maximum of 2048 TLS slots.
   tls_bitmap_.Resize(2048);
 
+  // Deferred work can be submitted right away, though it only runs once the
+  // workers are started along with the executable module.
+  dispatch_pool_ = std::make_unique<ThreadPool>(
+      static_cast<size_t>(std::max(FLAGS_kernel_dispatch_threads, 1)),
+      kDispatchTaskCapacity);
+
   xam::AppManager::RegisterApps(this, app_manager_.get());
 }
 
 KernelState::~KernelState() {
   SetExecutableModule(nullptr);
 
-  if (dispatch_thread_running_) {
-    dispatch_thread_running_ = false;
-    dispatch_cond_.notify_all();
-    dispatch_thread_->Wait(0, 0, 0, nullptr);
+  if (dispatch_pool_) {
+    auto stats = dispatch_pool_->GetStats();
+    XELOGD("Kernel dispatch: %" PRIu64 " tasks completed, %" PRIu64
+           " stolen, at most %u pending",
+           stats.completed_count, stats.steal_count, stats.max_queue_depth);
+    dispatch_pool_->Shutdown();
+    for (auto& thread : dispatch_threads_) {
+      thread->Wait(0, 0, 0, nullptr);
+    }
+    dispatch_threads_.clear();
+    dispatch_pool_.reset();
   }
 
   executable_module_.reset();
@@ -323,32 +342,25 @@ void KernelState::SetExecutableModule(object_ref<UserModule> module) {
     *variable_ptr = executable_module_->hmodule_ptr();
   }
 
-  // Spin up deferred dispatch worker.
+  // Spin up deferred dispatch workers.
   // TODO(benvanik): move someplace more appropriate (out of ctor, but around
   // here).
-  if (!dispatch_thread_running_) {
-    dispatch_thread_running_ = true;
-    dispatch_thread_ =
-        object_ref<XHostThread>(new XHostThread(this, 128 * 1024, 0, [this]() {
-          // As we run guest callbacks the debugger must be able to suspend us.
-          dispatch_thread_->set_can_debugger_suspend(true);
-
-          while (dispatch_thread_running_) {
-            auto global_lock = global_critical_region_.Acquire();
-            if (dispatch_queue_.empty()) {
-              dispatch_cond_.wait(global_lock);
-              if (!dispatch_thread_running_) {
-                break;
-              }
-            }
-            auto fn = std::move(dispatch_queue_.front());
-            dispatch_queue_.pop_front();
-            fn();
-          }
-          return 0;
-        }));
-    dispatch_thread_->set_name("Kernel Dispatch Thread");
-    dispatch_thread_->Create();
+  if (dispatch_threads_.empty()) {
+    size_t thread_count =
+        static_cast<size_t>(std::max(FLAGS_kernel_dispatch_threads, 1));
+    for (size_t i = 0; i < thread_count; ++i) {
+      auto thread = object_ref<XHostThread>(
+          new XHostThread(this, 128 * 1024, 0, [this, i]() {
+            // As we run guest callbacks the debugger must be able to suspend
+            // us.
+            XThread::GetCurrentThread()->set_can_debugger_suspend(true);
+            dispatch_pool_->RunWorker(i);
+            return 0;
+          }));
+      thread->set_name(xe::format_string("Kernel Dispatch Thread %zu", i));
+      thread->Create();
+      dispatch_threads_.push_back(std::move(thread));
+    }
   }
 }
 
@@ -678,15 +690,17 @@ void KernelState::CompleteOverlappedDeferredEx(
   auto ptr = memory()->TranslateVirtual(overlapped_ptr);
   XOverlappedSetResult(ptr, X_ERROR_IO_PENDING);
   XOverlappedSetContext(ptr, XThread::GetCurrentThreadHandle());
-  auto global_lock = global_critical_region_.Acquire();
-  dispatch_queue_.push_back([this, completion_callback, overlapped_ptr, result,
-                             extended_error, length]() {
-    xe::threading::Sleep(
-        std::chrono::milliseconds(kDeferredOverlappedDelayMillis));
-    completion_callback();
-    CompleteOverlappedEx(overlapped_ptr, result, extended_error, length);
-  });
-  dispatch_cond_.notify_all();
+  // Keyed by the overlapped so that completions of the same one are seen by
+  // the guest in the order they were requested. The delay is kept by the pool
+  // and doesn't tie up a worker.
+  dispatch_pool_->Submit(
+      overlapped_ptr,
+      std::chrono::milliseconds(kDeferredOverlappedDelayMillis),
+      [this, completion_callback, overlapped_ptr, result, extended_error,
+       length]() {
+        completion_callback();
+        CompleteOverlappedEx(overlapped_ptr, result, extended_error, length);
+      });
 }
 
 bool KernelState::Save(ByteStream* stream) {
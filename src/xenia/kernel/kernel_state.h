@@ -13,14 +13,13 @@
 #include <gflags/gflags.h>
 
 #include <atomic>
-#include <condition_variable>
 #include <functional>
-#include <list>
 #include <memory>
 #include <vector>
 
 #include "xenia/base/bit_map.h"
 #include "xenia/base/mutex.h"
+#include "xenia/base/thread_pool.h"
 #include "xenia/cpu/export_resolver.h"
 #include "xenia/kernel/util/native_list.h"
 #include "xenia/kernel/util/object_table.h"
@@ -176,6 +175,9 @@ class KernelState {
                                     uint32_t overlapped_ptr, X_RESULT result,
                                     uint32_t extended_error, uint32_t length);
 
+  // Queue depth and latency of deferred completions.
+  ThreadPool::Stats GetDispatchStats() { return dispatch_pool_->GetStats(); }
+
   bool Save(ByteStream* stream);
   bool Restore(ByteStream* stream);
 
@@ -207,12 +209,10 @@ class KernelState {
 
   uint32_t process_info_block_address_ = 0;
 
-  std::atomic<bool> dispatch_thread_running_;
-  object_ref<XHostThread> dispatch_thread_;
+  std::unique_ptr<ThreadPool> dispatch_pool_;
+  std::vector<object_ref<XHostThread>> dispatch_threads_;
   // Must be guarded by the global critical region.
   util::NativeList dpc_list_;
-  std::condition_variable_any dispatch_cond_;
-  std::list<std::function<void()>> dispatch_queue_;
 
   BitMap tls_bitmap_;
 
@@ -24,3 +24,21 @@ project("xenia-kernel")
   files({
     "debug_visualizers.natvis",
   })
+
+test_suite("xenia-kernel-tests", project_root, ".", {
+  includedirs = {
+    project_root.."/third_party/gflags/src",
+  },
+  links = {
+    "xenia-apu",
+    "xenia-base",
+    "xenia-core",
+    "xenia-cpu",
+    "xenia-cpu-backend-x64",
+    "xenia-gpu",
+    "xenia-hid",
+    "xenia-kernel",
+    "xenia-ui",
+    "xenia-vfs",
+  },
+})
@@ -13,6 +13,7 @@
 #include <cstring>
 
 #include "xenia/base/byte_stream.h"
+#include "xenia/base/threading.h"
 #include "xenia/kernel/xobject.h"
 #include "xenia/kernel/xthread.h"
 
@@ -20,7 +21,14 @@ namespace xe {
 namespace kernel {
 namespace util {
 
-ObjectTable::ObjectTable() {}
+ObjectTable::ObjectTable() {
+  for (auto& segment : segments_) {
+    segment = nullptr;
+  }
+  // Never allow 0 handles.
+  next_unused_slot_ = 1;
+  free_list_head_ = 0;
+}
 
 ObjectTable::~ObjectTable() { Reset(); }
 
@@ -28,112 +36,156 @@ void ObjectTable::Reset() {
   auto global_lock = global_critical_region_.Acquire();
 
   // Release all objects.
-  for (uint32_t n = 0; n < table_capacity_; n++) {
-    ObjectTableEntry& entry = table_[n];
-    if (entry.object) {
-      entry.object->Release();
+  for (auto& segment_ptr : segments_) {
+    auto segment = segment_ptr.exchange(nullptr);
+    if (!segment) {
+      continue;
     }
+    for (uint32_t n = 0; n < kSegmentSlotCount; n++) {
+      auto object = segment[n].object.exchange(nullptr);
+      if (object) {
+        object->Release();
+      }
+    }
+    delete[] segment;
   }
 
-  table_capacity_ = 0;
-  last_free_entry_ = 0;
-  free(table_);
-  table_ = nullptr;
+  next_unused_slot_ = 1;
+  free_list_head_ = 0;
 }
 
 X_STATUS ObjectTable::FindFreeSlot(uint32_t* out_slot) {
-  // Find a free slot.
-  uint32_t slot = last_free_entry_;
-  uint32_t scan_count = 0;
-  while (scan_count < table_capacity_) {
-    ObjectTableEntry& entry = table_[slot];
-    if (!entry.object) {
+  // Reuse a freed slot if there is one.
+  uint64_t head = free_list_head_.load(std::memory_order_acquire);
+  while (uint32_t(head)) {
+    uint32_t slot = uint32_t(head);
+    uint32_t next = GetEntry(slot)->next_free.load(std::memory_order_relaxed);
+    uint64_t new_head = (((head >> 32) + 1) << 32) | next;
+    if (free_list_head_.compare_exchange_weak(head, new_head,
+                                              std::memory_order_acquire)) {
       *out_slot = slot;
       return X_STATUS_SUCCESS;
     }
-    scan_count++;
-    slot = (slot + 1) % table_capacity_;
-    if (slot == 0) {
-      // Never allow 0 handles.
-      scan_count++;
-      slot++;
-    }
   }
 
-  // Table out of slots, expand.
-  uint32_t new_table_capacity = std::max(16 * 1024u, table_capacity_ * 2);
-  if (!Resize(new_table_capacity)) {
+  // Otherwise take a new one, expanding the table as needed.
+  uint32_t slot = next_unused_slot_.fetch_add(1);
+  if (!Resize(slot + 1)) {
     return X_STATUS_NO_MEMORY;
   }
-
-  // Never allow 0 handles.
-  slot = ++last_free_entry_;
   *out_slot = slot;
-
   return X_STATUS_SUCCESS;
 }
 
+void ObjectTable::FreeSlot(uint32_t slot) {
+  auto entry = GetEntry(slot);
+  uint64_t head = free_list_head_.load(std::memory_order_relaxed);
+  uint64_t new_head;
+  do {
+    entry->next_free.store(uint32_t(head), std::memory_order_relaxed);
+    new_head = (((head >> 32) + 1) << 32) | slot;
+  } while (!free_list_head_.compare_exchange_weak(head, new_head,
+                                                  std::memory_order_release));
+}
+
 bool ObjectTable::Resize(uint32_t new_capacity) {
-  uint32_t new_size = new_capacity * sizeof(ObjectTableEntry);
-  uint32_t old_size = table_capacity_ * sizeof(ObjectTableEntry);
-  auto new_table =
-      reinterpret_cast<ObjectTableEntry*>(realloc(table_, new_size));
-  if (!new_table) {
+  uint32_t segment_count =
+      (new_capacity + kSegmentSlotCount - 1) / kSegmentSlotCount;
+  if (segment_count > kMaxSegmentCount) {
     return false;
   }
+  for (uint32_t i = 0; i < segment_count; ++i) {
+    if (segments_[i].load(std::memory_order_acquire)) {
+      continue;
+    }
+    // Zeroed, which is an empty slot.
+    auto segment = new ObjectTableEntry[kSegmentSlotCount]();
+    ObjectTableEntry* expected = nullptr;
+    if (!segments_[i].compare_exchange_strong(expected, segment)) {
+      // Another thread got there first.
+      delete[] segment;
+    }
+  }
+  return true;
+}
 
-  // Zero out new entries.
-  if (new_size > old_size) {
-    std::memset(reinterpret_cast<uint8_t*>(new_table) + old_size, 0,
-                new_size - old_size);
+uint32_t ObjectTable::table_capacity() const {
+  uint32_t segment_count = 0;
+  while (segment_count < kMaxSegmentCount &&
+         segments_[segment_count].load(std::memory_order_acquire)) {
+    ++segment_count;
   }
+  return segment_count * kSegmentSlotCount;
+}
 
-  last_free_entry_ = table_capacity_;
-  table_capacity_ = new_capacity;
-  table_ = new_table;
+ObjectTable::ObjectTableEntry* ObjectTable::GetEntry(uint32_t slot) const {
+  uint32_t segment_index = slot / kSegmentSlotCount;
+  if (segment_index >= kMaxSegmentCount) {
+    return nullptr;
+  }
+  auto segment = segments_[segment_index].load(std::memory_order_acquire);
+  return segment ? &segment[slot % kSegmentSlotCount] : nullptr;
+}
 
-  return true;
+XObject* ObjectTable::RetainEntryObject(ObjectTableEntry* entry) {
+  // The pin keeps the object from being released by the table until it is
+  // retained here. Sequentially consistent, as is ClearEntry, so that either
+  // the pin is seen there or the cleared slot is seen here.
+  entry->pin_count.fetch_add(1);
+  auto object = entry->object.load();
+  if (object) {
+    object->Retain();
+  }
+  entry->pin_count.fetch_sub(1, std::memory_order_release);
+  return object;
+}
+
+XObject* ObjectTable::ClearEntry(ObjectTableEntry* entry) {
+  auto object = entry->object.exchange(nullptr);
+  if (object) {
+    // Lookups only hold their pin for a few instructions.
+    while (entry->pin_count.load()) {
+      xe::threading::SpinPause();
+    }
+  }
+  return object;
 }
 
 X_STATUS ObjectTable::AddHandle(XObject* object, X_HANDLE* out_handle) {
-  X_STATUS result = X_STATUS_SUCCESS;
+  // Find a free slot.
+  uint32_t slot = 0;
+  X_STATUS result = FindFreeSlot(&slot);
+  if (XFAILED(result)) {
+    return result;
+  }
 
-  uint32_t handle = 0;
+  uint32_t handle = slot << 2;
   {
+    // The handle list of the object isn't threadsafe.
     auto global_lock = global_critical_region_.Acquire();
+    object->handles().push_back(handle);
+  }
 
-    // Find a free slot.
-    uint32_t slot = 0;
-    result = FindFreeSlot(&slot);
-
-    // Stash.
-    if (XSUCCEEDED(result)) {
-      ObjectTableEntry& entry = table_[slot];
-      entry.object = object;
-      entry.handle_ref_count = 1;
-
-      handle = slot << 2;
-      object->handles().push_back(handle);
+  // Retain so long as the object is in the table.
+  object->Retain();
 
-      // Retain so long as the object is in the table.
-      object->Retain();
-    }
-  }
+  // Stash.
+  auto entry = GetEntry(slot);
+  entry->handle_ref_count.store(1, std::memory_order_relaxed);
+  entry->object.store(object, std::memory_order_release);
 
-  if (XSUCCEEDED(result)) {
-    if (out_handle) {
-      *out_handle = handle;
-    }
+  if (out_handle) {
+    *out_handle = handle;
   }
 
-  return result;
+  return X_STATUS_SUCCESS;
 }
 
 X_STATUS ObjectTable::DuplicateHandle(X_HANDLE handle, X_HANDLE* out_handle) {
   X_STATUS result = X_STATUS_SUCCESS;
   handle = TranslateHandle(handle);
 
-  XObject* object = LookupObject(handle, false);
+  XObject* object = LookupAndRetainObject(handle);
   if (object) {
     result = AddHandle(object, out_handle);
     object->Release();  // Release the ref that LookupObject took
@@ -145,26 +197,35 @@ X_STATUS ObjectTable::DuplicateHandle(X_HANDLE handle, X_HANDLE* out_handle) {
 }
 
 X_STATUS ObjectTable::RetainHandle(X_HANDLE handle) {
-  auto global_lock = global_critical_region_.Acquire();
-
   ObjectTableEntry* entry = LookupTable(handle);
   if (!entry) {
     return X_STATUS_INVALID_HANDLE;
   }
 
-  entry->handle_ref_count++;
+  // Handles that already went away can't be brought back.
+  int32_t count = entry->handle_ref_count.load(std::memory_order_relaxed);
+  do {
+    if (count <= 0) {
+      return X_STATUS_INVALID_HANDLE;
+    }
+  } while (!entry->handle_ref_count.compare_exchange_weak(count, count + 1));
   return X_STATUS_SUCCESS;
 }
 
 X_STATUS ObjectTable::ReleaseHandle(X_HANDLE handle) {
-  auto global_lock = global_critical_region_.Acquire();
-
   ObjectTableEntry* entry = LookupTable(handle);
   if (!entry) {
     return X_STATUS_INVALID_HANDLE;
   }
 
-  if (--entry->handle_ref_count == 0) {
+  int32_t count = entry->handle_ref_count.load(std::memory_order_relaxed);
+  do {
+    if (count <= 0) {
+      return X_STATUS_INVALID_HANDLE;
+    }
+  } while (!entry->handle_ref_count.compare_exchange_weak(count, count - 1));
+
+  if (count == 1) {
     // No more references. Remove it from the table.
     return RemoveHandle(handle);
   }
@@ -175,8 +236,6 @@ X_STATUS ObjectTable::ReleaseHandle(X_HANDLE handle) {
 }
 
 X_STATUS ObjectTable::RemoveHandle(X_HANDLE handle) {
-  X_STATUS result = X_STATUS_SUCCESS;
-
   handle = TranslateHandle(handle);
   if (!handle) {
     return X_STATUS_INVALID_HANDLE;
@@ -187,19 +246,22 @@ X_STATUS ObjectTable::RemoveHandle(X_HANDLE handle) {
     return X_STATUS_INVALID_HANDLE;
   }
 
-  auto global_lock = global_critical_region_.Acquire();
-  if (entry->object) {
-    auto object = entry->object;
-    entry->object = nullptr;
-    entry->handle_ref_count = 0;
-
-    // Walk the object's handles and remove this one.
-    auto handle_entry =
-        std::find(object->handles().begin(), object->handles().end(), handle);
-    if (handle_entry != object->handles().end()) {
-      object->handles().erase(handle_entry);
+  auto object = ClearEntry(entry);
+  if (object) {
+    entry->handle_ref_count.store(0, std::memory_order_relaxed);
+
+    {
+      // Walk the object's handles and remove this one.
+      auto global_lock = global_critical_region_.Acquire();
+      auto handle_entry = std::find(object->handles().begin(),
+                                    object->handles().end(), handle);
+      if (handle_entry != object->handles().end()) {
+        object->handles().erase(handle_entry);
+      }
     }
 
+    FreeSlot(handle >> 2);
+
     // Release now that the object has been removed from the table.
     object->Release();
   }
@@ -208,16 +270,18 @@ X_STATUS ObjectTable::RemoveHandle(X_HANDLE handle) {
 }
 
 std::vector<object_ref<XObject>> ObjectTable::GetAllObjects() {
-  auto lock = global_critical_region_.Acquire();
   std::vector<object_ref<XObject>> results;
 
-  for (uint32_t slot = 0; slot < table_capacity_; slot++) {
-    auto& entry = table_[slot];
-    if (entry.object &&
-        std::find(results.begin(), results.end(), entry.object) ==
-            results.end()) {
-      entry.object->Retain();
-      results.push_back(object_ref<XObject>(entry.object));
+  uint32_t slot_count = std::min(next_unused_slot_.load(), table_capacity());
+  for (uint32_t slot = 0; slot < slot_count; slot++) {
+    auto object = RetainEntryObject(GetEntry(slot));
+    if (!object) {
+      continue;
+    }
+    if (std::find(results.begin(), results.end(), object) == results.end()) {
+      results.push_back(object_ref<XObject>(object));
+    } else {
+      object->Release();
     }
   }
 
@@ -225,15 +289,20 @@ std::vector<object_ref<XObject>> ObjectTable::GetAllObjects() {
 }
 
 void ObjectTable::PurgeAllObjects() {
-  auto lock = global_critical_region_.Acquire();
-  for (uint32_t slot = 0; slot < table_capacity_; slot++) {
-    auto& entry = table_[slot];
-    if (entry.object && !entry.object->is_host_object()) {
-      entry.handle_ref_count = 0;
-      entry.object->Release();
-
-      entry.object = nullptr;
+  uint32_t slot_count = std::min(next_unused_slot_.load(), table_capacity());
+  for (uint32_t slot = 0; slot < slot_count; slot++) {
+    auto entry = GetEntry(slot);
+    auto object = RetainEntryObject(entry);
+    if (!object) {
+      continue;
+    }
+    if (!object->is_host_object() && ClearEntry(entry) == object) {
+      entry->handle_ref_count.store(0, std::memory_order_relaxed);
+      FreeSlot(slot);
+      // The table's reference.
+      object->Release();
     }
+    object->Release();
   }
 }
 
@@ -243,69 +312,38 @@ ObjectTable::ObjectTableEntry* ObjectTable::LookupTable(X_HANDLE handle) {
     return nullptr;
   }
 
-  auto global_lock = global_critical_region_.Acquire();
-
   // Lower 2 bits are ignored.
-  uint32_t slot = handle >> 2;
-  if (slot <= table_capacity_) {
-    return &table_[slot];
-  }
-
-  return nullptr;
+  return GetEntry(handle >> 2);
 }
 
 // Generic lookup
 template <>
 object_ref<XObject> ObjectTable::LookupObject<XObject>(X_HANDLE handle) {
-  auto object = ObjectTable::LookupObject(handle, false);
+  auto object = ObjectTable::LookupAndRetainObject(handle);
   auto result = object_ref<XObject>(reinterpret_cast<XObject*>(object));
   return result;
 }
 
-XObject* ObjectTable::LookupObject(X_HANDLE handle, bool already_locked) {
-  handle = TranslateHandle(handle);
-  if (!handle) {
+XObject* ObjectTable::LookupAndRetainObject(X_HANDLE handle) {
+  auto entry = LookupTable(handle);
+  if (!entry) {
     return nullptr;
   }
-
-  XObject* object = nullptr;
-  if (!already_locked) {
-    global_critical_region_.mutex().lock();
-  }
-
-  // Lower 2 bits are ignored.
-  uint32_t slot = handle >> 2;
-
-  // Verify slot.
-  if (slot < table_capacity_) {
-    ObjectTableEntry& entry = table_[slot];
-    if (entry.object) {
-      object = entry.object;
-    }
-  }
-
-  // Retain the object pointer.
-  if (object) {
-    object->Retain();
-  }
-
-  if (!already_locked) {
-    global_critical_region_.mutex().unlock();
-  }
-
-  return object;
+  return RetainEntryObject(entry);
 }
 
 void ObjectTable::GetObjectsByType(XObject::Type type,
                                    std::vector<object_ref<XObject>>* results) {
-  auto global_lock = global_critical_region_.Acquire();
-  for (uint32_t slot = 0; slot < table_capacity_; ++slot) {
-    auto& entry = table_[slot];
-    if (entry.object) {
-      if (entry.object->type() == type) {
-        entry.object->Retain();
-        results->push_back(object_ref<XObject>(entry.object));
-      }
+  uint32_t slot_count = std::min(next_unused_slot_.load(), table_capacity());
+  for (uint32_t slot = 0; slot < slot_count; ++slot) {
+    auto object = RetainEntryObject(GetEntry(slot));
+    if (!object) {
+      continue;
+    }
+    if (object->type() == type) {
+      results->push_back(object_ref<XObject>(object));
+    } else {
+      object->Release();
     }
   }
 }
@@ -366,7 +404,7 @@ X_STATUS ObjectTable::GetObjectByName(const std::string& name,
   *out_handle = it->second;
 
   // We need to ref the handle. I think.
-  auto obj = LookupObject(it->second, true);
+  auto obj = LookupAndRetainObject(it->second);
   if (obj) {
     obj->RetainHandle();
     obj->Release();
@@ -376,21 +414,35 @@ X_STATUS ObjectTable::GetObjectByName(const std::string& name,
 }
 
 bool ObjectTable::Save(ByteStream* stream) {
-  stream->Write<uint32_t>(table_capacity_);
-  for (uint32_t i = 0; i < table_capacity_; i++) {
-    auto& entry = table_[i];
-    stream->Write<int32_t>(entry.handle_ref_count);
+  uint32_t capacity = table_capacity();
+  stream->Write<uint32_t>(capacity);
+  for (uint32_t i = 0; i < capacity; i++) {
+    auto entry = GetEntry(i);
+    stream->Write<int32_t>(entry->handle_ref_count);
   }
 
   return true;
 }
 
 bool ObjectTable::Restore(ByteStream* stream) {
-  Resize(stream->Read<uint32_t>());
-  for (uint32_t i = 0; i < table_capacity_; i++) {
-    auto& entry = table_[i];
+  uint32_t capacity = stream->Read<uint32_t>();
+  if (!Resize(capacity)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < capacity; i++) {
+    auto entry = GetEntry(i);
     // entry.object = nullptr;
-    entry.handle_ref_count = stream->Read<int32_t>();
+    entry->handle_ref_count = stream->Read<int32_t>();
+  }
+
+  // Slots without handles are free, the objects of all others are restored
+  // with RestoreHandle.
+  next_unused_slot_ = std::max(capacity, 1u);
+  free_list_head_ = 0;
+  for (uint32_t i = capacity; i-- > 1;) {
+    if (!GetEntry(i)->handle_ref_count) {
+      FreeSlot(i);
+    }
   }
 
   return true;
@@ -398,11 +450,11 @@ bool ObjectTable::Restore(ByteStream* stream) {
 
 X_STATUS ObjectTable::RestoreHandle(X_HANDLE handle, XObject* object) {
   uint32_t slot = handle >> 2;
-  assert_true(table_capacity_ >= slot);
+  assert_true(table_capacity() > slot);
 
-  if (table_capacity_ >= slot) {
-    auto& entry = table_[slot];
-    entry.object = object;
+  auto entry = GetEntry(slot);
+  if (entry) {
+    entry->object = object;
     object->Retain();
   }
 
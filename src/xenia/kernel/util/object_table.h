@@ -10,6 +10,7 @@
 #ifndef XENIA_KERNEL_UTIL_OBJECT_TABLE_H_
 #define XENIA_KERNEL_UTIL_OBJECT_TABLE_H_
 
+#include <atomic>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -26,6 +27,19 @@ namespace xe {
 namespace kernel {
 namespace util {
 
+// Handle -> object table.
+//
+// Lookups and handle reference counting are lock-free, so that the many
+// kernel calls taking handles (waits, signals, file I/O) don't serialize on
+// the global critical region:
+//   - Slots live in fixed segments that are allocated on demand and never
+//     move, so they can be read while the table grows.
+//   - A lookup pins its slot while it retains the object, and removal waits
+//     for pinned lookups to finish before dropping the table's reference.
+//   - Free slots are kept on a lock-free stack whose head is tagged with a
+//     generation that changes on every push and pop, against ABA.
+// Handle values are slot << 2 as before, as guest code and saved states hold
+// on to them.
 class ObjectTable {
  public:
   ObjectTable();
@@ -48,7 +62,7 @@ class ObjectTable {
 
   template <typename T>
   object_ref<T> LookupObject(X_HANDLE handle) {
-    auto object = LookupObject(handle, false);
+    auto object = LookupAndRetainObject(handle);
     if (object) {
       assert_true(object->type() == T::kType);
     }
@@ -81,24 +95,44 @@ class ObjectTable {
   void PurgeAllObjects();  // Purges the object table of all guest objects
 
  private:
-  typedef struct {
-    int handle_ref_count = 0;
-    XObject* object = nullptr;
-  } ObjectTableEntry;
+  // Slots per segment, and the most segments there can be (1M handles).
+  static const uint32_t kSegmentSlotCount = 16 * 1024;
+  static const uint32_t kMaxSegmentCount = 64;
+
+  struct ObjectTableEntry {
+    std::atomic<XObject*> object;
+    std::atomic<int32_t> handle_ref_count;
+    // Lookups currently retaining object.
+    std::atomic<uint32_t> pin_count;
+    // Next slot on the free list, 0 ending it (slot 0 is never used).
+    std::atomic<uint32_t> next_free;
+  };
 
   ObjectTableEntry* LookupTable(X_HANDLE handle);
-  XObject* LookupObject(X_HANDLE handle, bool already_locked);
+  ObjectTableEntry* GetEntry(uint32_t slot) const;
+  // Returns the object in the entry with a reference added, or null.
+  static XObject* RetainEntryObject(ObjectTableEntry* entry);
+  // Takes the object out of the entry and waits out lookups still retaining
+  // it. Returns the object (which the table still holds a reference on), or
+  // null if the entry was empty.
+  static XObject* ClearEntry(ObjectTableEntry* entry);
+  XObject* LookupAndRetainObject(X_HANDLE handle);
   void GetObjectsByType(XObject::Type type,
                         std::vector<object_ref<XObject>>* results);
 
   X_HANDLE TranslateHandle(X_HANDLE handle);
   X_STATUS FindFreeSlot(uint32_t* out_slot);
+  void FreeSlot(uint32_t slot);
+  // Makes sure slots [0, capacity) exist.
   bool Resize(uint32_t new_capacity);
+  uint32_t table_capacity() const;
 
   xe::global_critical_region global_critical_region_;
-  uint32_t table_capacity_ = 0;
-  ObjectTableEntry* table_ = nullptr;
-  uint32_t last_free_entry_ = 0;
+  std::atomic<ObjectTableEntry*> segments_[kMaxSegmentCount];
+  // Slots at and above this have never been handed out.
+  std::atomic<uint32_t> next_unused_slot_;
+  // Free list head: generation in the high dword, slot in the low dword.
+  std::atomic<uint64_t> free_list_head_;
   std::unordered_map<std::string, X_HANDLE> name_table_;
 };
 
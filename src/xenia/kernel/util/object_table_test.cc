@@ -0,0 +1,187 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/kernel/util/object_table.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace kernel {
+namespace util {
+namespace test {
+
+namespace {
+
+// Objects without a kernel state (as the tests have none) aren't added to a
+// table on creation.
+XObject* CreateObject(XObject::Type type = XObject::kTypeEvent) {
+  return new XObject(type);
+}
+
+}  // namespace
+
+TEST_CASE("ObjectTable_Handles", "[object_table]") {
+  ObjectTable table;
+  auto object = CreateObject();
+
+  X_HANDLE handle = 0;
+  REQUIRE(XSUCCEEDED(table.AddHandle(object, &handle)));
+  REQUIRE(handle != 0);
+  REQUIRE((handle & 3) == 0);
+  REQUIRE(object->handles().size() == 1);
+  REQUIRE(table.LookupObject<XObject>(handle).get() == object);
+  REQUIRE(!table.LookupObject<XObject>(handle + 4));
+
+  X_HANDLE duplicate = 0;
+  REQUIRE(XSUCCEEDED(table.DuplicateHandle(handle, &duplicate)));
+  REQUIRE(duplicate != handle);
+  REQUIRE(table.LookupObject<XObject>(duplicate).get() == object);
+
+  // The handle stays until its last reference goes.
+  REQUIRE(XSUCCEEDED(table.RetainHandle(handle)));
+  REQUIRE(XSUCCEEDED(table.ReleaseHandle(handle)));
+  REQUIRE(table.LookupObject<XObject>(handle));
+  REQUIRE(XSUCCEEDED(table.ReleaseHandle(handle)));
+  REQUIRE(!table.LookupObject<XObject>(handle));
+  REQUIRE(table.ReleaseHandle(handle) == X_STATUS_INVALID_HANDLE);
+  REQUIRE(table.RetainHandle(handle) == X_STATUS_INVALID_HANDLE);
+  REQUIRE(object->handles().size() == 1);
+
+  // Freed slots are reused.
+  auto other = CreateObject();
+  X_HANDLE other_handle = 0;
+  REQUIRE(XSUCCEEDED(table.AddHandle(other, &other_handle)));
+  REQUIRE(other_handle == handle);
+  other->Release();
+
+  REQUIRE(table.GetAllObjects().size() == 2);
+  REQUIRE(XSUCCEEDED(table.RemoveHandle(duplicate)));
+  REQUIRE(table.GetAllObjects().size() == 1);
+  // Only the table holds on to the objects now, and frees them on reset.
+  object->Release();
+  table.Reset();
+  REQUIRE(table.GetAllObjects().empty());
+}
+
+TEST_CASE("ObjectTable_Growth", "[object_table]") {
+  // More than one segment of slots.
+  const uint32_t kObjectCount = 40000;
+  ObjectTable table;
+  std::vector<X_HANDLE> handles;
+  for (uint32_t i = 0; i < kObjectCount; ++i) {
+    auto object = CreateObject(i & 1 ? XObject::kTypeEvent
+                                     : XObject::kTypeSemaphore);
+    X_HANDLE handle = 0;
+    REQUIRE(XSUCCEEDED(table.AddHandle(object, &handle)));
+    object->Release();
+    handles.push_back(handle);
+  }
+  for (uint32_t i = 0; i < kObjectCount; ++i) {
+    REQUIRE(table.LookupObject<XObject>(handles[i])->handle() == handles[i]);
+  }
+  REQUIRE(table.GetObjectsByType<XObject>(XObject::kTypeEvent).size() ==
+          kObjectCount / 2);
+}
+
+TEST_CASE("ObjectTable_Concurrent", "[object_table]") {
+  const int kThreadCount = 4;
+  const int kIterations = 20000;
+  ObjectTable table;
+
+  // A handle that is looked up while the others come and go.
+  auto shared = CreateObject();
+  X_HANDLE shared_handle = 0;
+  table.AddHandle(shared, &shared_handle);
+
+  std::atomic<int> failures(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreadCount; ++i) {
+    threads.emplace_back([&]() {
+      for (int j = 0; j < kIterations; ++j) {
+        auto object = CreateObject();
+        X_HANDLE handle = 0;
+        table.AddHandle(object, &handle);
+        if (table.LookupObject<XObject>(handle).get() != object) {
+          ++failures;
+        }
+        if (table.LookupObject<XObject>(shared_handle).get() != shared) {
+          ++failures;
+        }
+        object->Release();
+        table.RemoveHandle(handle);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  REQUIRE(failures == 0);
+  REQUIRE(table.GetAllObjects().size() == 1);
+  shared->Release();
+}
+
+// Lookups of a set of handles from several threads, against the same lookups
+// under one lock (as the table used to do them). Run explicitly with the
+// [benchmark] tag.
+TEST_CASE("ObjectTable_LookupThroughput", "[.][benchmark][object_table]") {
+  const uint32_t kObjectCount = 256;
+  const uint32_t kLookupCount = 1000000;
+  ObjectTable table;
+  std::vector<X_HANDLE> handles;
+  for (uint32_t i = 0; i < kObjectCount; ++i) {
+    auto object = CreateObject();
+    X_HANDLE handle = 0;
+    table.AddHandle(object, &handle);
+    object->Release();
+    handles.push_back(handle);
+  }
+
+  std::mutex lock;
+  for (uint32_t thread_count : {1, 2, 4, 8}) {
+    for (bool locked : {true, false}) {
+      auto start = std::chrono::high_resolution_clock::now();
+      std::vector<std::thread> threads;
+      for (uint32_t i = 0; i < thread_count; ++i) {
+        threads.emplace_back([&, i]() {
+          for (uint32_t j = 0; j < kLookupCount; ++j) {
+            auto handle = handles[(i * 7919 + j) % kObjectCount];
+            if (locked) {
+              std::lock_guard<std::mutex> guard(lock);
+              table.LookupObject<XObject>(handle);
+            } else {
+              table.LookupObject<XObject>(handle);
+            }
+          }
+        });
+      }
+      for (auto& thread : threads) {
+        thread.join();
+      }
+      auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::high_resolution_clock::now() - start)
+                          .count();
+      WARN(thread_count << " threads, " << (locked ? "locked" : "lock-free")
+                        << ": "
+                        << (uint64_t(kLookupCount) * thread_count /
+                            (duration + 1))
+                        << " lookups/us");
+    }
+  }
+}
+
+}  // namespace test
+}  // namespace util
+}  // namespace kernel
+}  // namespace xe
@@ -9,6 +9,9 @@
 
 #include "xenia/kernel/util/shim_utils.h"
 
+DEFINE_bool(log_kernel_calls, true,
+            "Log kernel calls. When disabled, exports are called through "
+            "trampolines without any logging code.");
 DEFINE_bool(log_high_frequency_kernel_calls, false,
             "Log kernel calls with the kHighFrequency tag.");
 
@@ -20,6 +23,15 @@ thread_local StringBuffer string_buffer_;
 
 StringBuffer* thread_local_string_buffer() { return &string_buffer_; }
 
+void SelectExportTrampolines(std::vector<xe::cpu::Export*>* exports) {
+  for (auto export_entry : *exports) {
+    if (export_entry && export_entry->function_data.quiet_trampoline &&
+        !IsKernelCallLogged(export_entry->tags)) {
+      export_entry->tags &= ~xe::cpu::ExportTag::kLog;
+    }
+  }
+}
+
 }  // namespace shim
 }  // namespace kernel
 }  // namespace xe
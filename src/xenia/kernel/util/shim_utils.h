@@ -14,6 +14,10 @@
 
 #include <cstring>
 #include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "xenia/base/byte_order.h"
 #include "xenia/base/logging.h"
@@ -23,6 +27,7 @@
 #include "xenia/cpu/ppc/ppc_context.h"
 #include "xenia/kernel/kernel_state.h"
 
+DECLARE_bool(log_kernel_calls);
 DECLARE_bool(log_high_frequency_kernel_calls);
 
 namespace xe {
@@ -111,7 +116,7 @@ class Param {
 
  protected:
   Param() : ordinal_(-1) {}
-  explicit Param(Init& init) : ordinal_(--init.ordinal) {}
+  explicit Param(Init& init) : ordinal_(init.ordinal++) {}
 
   template <typename V>
   void LoadValue(Init& init, V* out_value) {
@@ -446,63 +451,74 @@ auto KernelTrampoline(F&& f, Tuple&& t, std::index_sequence<I...>) {
   return std::forward<F>(f)(std::get<I>(std::forward<Tuple>(t))...);
 }
 
-template <KernelModuleId MODULE, uint16_t ORDINAL, typename R, typename... Ps>
-xe::cpu::Export* RegisterExport(R (*fn)(Ps&...), const char* name,
-                                xe::cpu::ExportTag::type tags) {
-  static const auto export_entry = new cpu::Export(
-      ORDINAL, xe::cpu::Export::Type::kFunction, name,
-      tags | xe::cpu::ExportTag::kImplemented | xe::cpu::ExportTag::kLog);
-  static R (*FN)(Ps & ...) = fn;
-  struct X {
-    static void Trampoline(PPCContext* ppc_context) {
-      ++export_entry->function_data.call_count;
-      Param::Init init = {
-          ppc_context, sizeof...(Ps), 0,
-      };
-      auto params = std::make_tuple<Ps...>(Ps(init)...);
-      if (export_entry->tags & xe::cpu::ExportTag::kLog &&
-          (!(export_entry->tags & xe::cpu::ExportTag::kHighFrequency) ||
-           FLAGS_log_high_frequency_kernel_calls)) {
-        PrintKernelCall(export_entry, params);
-      }
-      auto result =
-          KernelTrampoline(FN, std::forward<std::tuple<Ps...>>(params),
-                           std::make_index_sequence<sizeof...(Ps)>());
-      result.Store(ppc_context);
-      if (export_entry->tags &
-          (xe::cpu::ExportTag::kLog | xe::cpu::ExportTag::kLogResult)) {
-        // TODO(benvanik): log result.
-      }
-    }
-  };
-  export_entry->function_data.trampoline = &X::Trampoline;
-  return export_entry;
+// Whether calls to an export are logged with the current flags.
+inline bool IsKernelCallLogged(xe::cpu::ExportTag::type tags) {
+  return XE_OPTION_ENABLE_LOGGING && FLAGS_log_kernel_calls &&
+         (tags & xe::cpu::ExportTag::kLog) &&
+         (!(tags & xe::cpu::ExportTag::kHighFrequency) ||
+          FLAGS_log_high_frequency_kernel_calls);
 }
 
-template <KernelModuleId MODULE, uint16_t ORDINAL, typename... Ps>
-xe::cpu::Export* RegisterExport(void (*fn)(Ps&...), const char* name,
+// Drops kLog from exports whose calls won't be logged with the current flags,
+// so that their quiet trampolines are used. Must run after flags are parsed
+// and before imports are resolved.
+void SelectExportTrampolines(std::vector<xe::cpu::Export*>* exports);
+
+// Guest-callable shim for a single export, specialized at compile time on the
+// function so that it is called directly (and can be inlined) instead of
+// through a pointer. Trampoline<false> has no logging code at all.
+template <typename F, F FN>
+struct ExportShim;
+
+template <typename R, typename... Ps, R (*FN)(Ps&...)>
+struct ExportShim<R (*)(Ps&...), FN> {
+  static xe::cpu::Export* export_entry;
+
+  template <bool LOG_CALLS>
+  static void Trampoline(PPCContext* ppc_context) {
+    ++export_entry->function_data.call_count;
+    Param::Init init = {
+        ppc_context, 0, 0,
+    };
+    // Braced so that parameters are loaded left to right.
+    std::tuple<Ps...> params{Ps(init)...};
+    if (LOG_CALLS && IsKernelCallLogged(export_entry->tags)) {
+      PrintKernelCall(export_entry, params);
+    }
+    Call(ppc_context, params, std::is_void<R>());
+    if (LOG_CALLS &&
+        export_entry->tags &
+            (xe::cpu::ExportTag::kLog | xe::cpu::ExportTag::kLogResult)) {
+      // TODO(benvanik): log result.
+    }
+  }
+
+  static void Call(PPCContext* ppc_context, std::tuple<Ps...>& params,
+                   std::false_type) {
+    auto result = KernelTrampoline(FN, std::move(params),
+                                   std::make_index_sequence<sizeof...(Ps)>());
+    result.Store(ppc_context);
+  }
+  static void Call(PPCContext* ppc_context, std::tuple<Ps...>& params,
+                   std::true_type) {
+    KernelTrampoline(FN, std::move(params),
+                     std::make_index_sequence<sizeof...(Ps)>());
+  }
+};
+template <typename R, typename... Ps, R (*FN)(Ps&...)>
+xe::cpu::Export* ExportShim<R (*)(Ps&...), FN>::export_entry = nullptr;
+
+template <KernelModuleId MODULE, uint16_t ORDINAL, typename F, F FN>
+xe::cpu::Export* RegisterExport(const char* name,
                                 xe::cpu::ExportTag::type tags) {
+  typedef ExportShim<F, FN> Shim;
   static const auto export_entry = new cpu::Export(
       ORDINAL, xe::cpu::Export::Type::kFunction, name,
       tags | xe::cpu::ExportTag::kImplemented | xe::cpu::ExportTag::kLog);
-  static void (*FN)(Ps & ...) = fn;
-  struct X {
-    static void Trampoline(PPCContext* ppc_context) {
-      ++export_entry->function_data.call_count;
-      Param::Init init = {
-          ppc_context, sizeof...(Ps),
-      };
-      auto params = std::make_tuple<Ps...>(Ps(init)...);
-      if (export_entry->tags & xe::cpu::ExportTag::kLog &&
-          (!(export_entry->tags & xe::cpu::ExportTag::kHighFrequency) ||
-           FLAGS_log_high_frequency_kernel_calls)) {
-        PrintKernelCall(export_entry, params);
-      }
-      KernelTrampoline(FN, std::forward<std::tuple<Ps...>>(params),
-                       std::make_index_sequence<sizeof...(Ps)>());
-    }
-  };
-  export_entry->function_data.trampoline = &X::Trampoline;
+  Shim::export_entry = export_entry;
+  export_entry->function_data.trampoline = &Shim::template Trampoline<true>;
+  export_entry->function_data.quiet_trampoline =
+      &Shim::template Trampoline<false>;
   return export_entry;
 }
 
@@ -513,8 +529,8 @@ using xe::cpu::ExportTag;
 #define DECLARE_EXPORT(module_name, name, tags)                            \
   const auto EXPORT_##module_name##_##name = RegisterExport_##module_name( \
       xe::kernel::shim::RegisterExport<                                    \
-          xe::kernel::shim::KernelModuleId::module_name, ordinals::name>(  \
-          &name, #name, tags));
+          xe::kernel::shim::KernelModuleId::module_name, ordinals::name,   \
+          decltype(&name), &name>(#name, tags));
 
 #define DECLARE_XAM_EXPORT(name, tags) DECLARE_EXPORT(xam, name, tags)
 #define DECLARE_XBOXKRNL_EXPORT(name, tags) DECLARE_EXPORT(xboxkrnl, name, tags)
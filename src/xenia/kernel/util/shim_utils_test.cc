@@ -0,0 +1,166 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2017 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/kernel/util/shim_utils.h"
+
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace kernel {
+namespace shim {
+namespace test {
+
+// Test exports aren't in any export table, so they take ordinals past the
+// real ones.
+const uint16_t kTestOrdinalBase = 0x1000;
+
+uint32_t last_args[10];
+
+dword_result_t TestArgs(dword_t arg0, dword_t arg1, dword_t arg2, dword_t arg3,
+                        dword_t arg4, dword_t arg5, dword_t arg6, dword_t arg7,
+                        dword_t arg8, dword_t arg9) {
+  uint32_t args[] = {arg0, arg1, arg2, arg3, arg4,
+                     arg5, arg6, arg7, arg8, arg9};
+  std::memcpy(last_args, args, sizeof(args));
+  return static_cast<uint32_t>(-1);
+}
+
+uint32_t void_calls = 0;
+void TestVoid(lpdword_t out_value) {
+  ++void_calls;
+  *out_value = 0x12345678;
+}
+
+// As trivial as KeGetCurrentProcessType, without needing a kernel state.
+dword_result_t TestGetProcessType() { return X_PROCTYPE_USER; }
+
+// Guest memory for stack arguments and pointers.
+class TestContext {
+ public:
+  TestContext() : membase_(new uint8_t[kMemorySize]) {
+    std::memset(membase_.get(), 0, kMemorySize);
+    std::memset(&ppc_context_, 0, sizeof(ppc_context_));
+    ppc_context_.virtual_membase = membase_.get();
+    ppc_context_.r[1] = kStackAddress;
+  }
+
+  PPCContext* ppc_context() { return &ppc_context_; }
+  uint8_t* TranslateVirtual(uint32_t address) {
+    return membase_.get() + address;
+  }
+
+  static const uint32_t kMemorySize = 0x10000;
+  static const uint32_t kStackAddress = 0x8000;
+
+ private:
+  std::unique_ptr<uint8_t[]> membase_;
+  PPCContext ppc_context_;
+};
+
+TEST_CASE("KernelShim_Params", "[kernel_shim]") {
+  auto export_entry =
+      RegisterExport<KernelModuleId::xboxkrnl, kTestOrdinalBase + 0,
+                     decltype(&TestArgs), &TestArgs>(
+          "TestArgs", xe::cpu::ExportTag::kHighFrequency);
+  TestContext context;
+  auto ppc_context = context.ppc_context();
+  for (uint32_t i = 0; i < 8; ++i) {
+    ppc_context->r[3 + i] = 0x100 + i;
+  }
+  // Arguments past the eighth are in the caller's parameter save area.
+  for (uint32_t i = 0; i < 2; ++i) {
+    xe::store_and_swap<uint32_t>(
+        context.TranslateVirtual(TestContext::kStackAddress + 0x54 + i * 8),
+        0x108 + i);
+  }
+
+  export_entry->GetTrampoline()(ppc_context);
+  for (uint32_t i = 0; i < 10; ++i) {
+    REQUIRE(last_args[i] == 0x100 + i);
+  }
+  // Results are sign extended.
+  REQUIRE(ppc_context->r[3] == UINT64_MAX);
+  REQUIRE(export_entry->function_data.call_count == 1);
+}
+
+TEST_CASE("KernelShim_VoidResult", "[kernel_shim]") {
+  auto export_entry =
+      RegisterExport<KernelModuleId::xboxkrnl, kTestOrdinalBase + 1,
+                     decltype(&TestVoid), &TestVoid>(
+          "TestVoid", xe::cpu::ExportTag::kHighFrequency);
+  TestContext context;
+  auto ppc_context = context.ppc_context();
+  const uint32_t kValueAddress = 0x100;
+  ppc_context->r[3] = kValueAddress;
+
+  export_entry->GetTrampoline()(ppc_context);
+  REQUIRE(void_calls == 1);
+  REQUIRE(ppc_context->r[3] == kValueAddress);
+  REQUIRE(xe::load_and_swap<uint32_t>(
+              context.TranslateVirtual(kValueAddress)) == 0x12345678);
+}
+
+TEST_CASE("KernelShim_QuietTrampoline", "[kernel_shim]") {
+  auto export_entry =
+      RegisterExport<KernelModuleId::xboxkrnl, kTestOrdinalBase + 2,
+                     decltype(&TestGetProcessType), &TestGetProcessType>(
+          "TestGetProcessType", xe::cpu::ExportTag::kHighFrequency);
+  REQUIRE(export_entry->GetTrampoline() ==
+          export_entry->function_data.trampoline);
+
+  // High frequency calls aren't logged by default.
+  std::vector<xe::cpu::Export*> exports = {export_entry};
+  SelectExportTrampolines(&exports);
+  REQUIRE(!(export_entry->tags & xe::cpu::ExportTag::kLog));
+  REQUIRE(export_entry->GetTrampoline() ==
+          export_entry->function_data.quiet_trampoline);
+
+  TestContext context;
+  export_entry->GetTrampoline()(context.ppc_context());
+  REQUIRE(context.ppc_context()->r[3] == X_PROCTYPE_USER);
+}
+
+TEST_CASE("KernelShim_CallRate", "[.][benchmark]") {
+  const uint32_t kIterations = 100000000;
+  auto export_entry =
+      RegisterExport<KernelModuleId::xboxkrnl, kTestOrdinalBase + 3,
+                     decltype(&TestGetProcessType), &TestGetProcessType>(
+          "TestGetProcessType", xe::cpu::ExportTag::kHighFrequency);
+  TestContext context;
+  struct Variant {
+    const char* name;
+    xe::cpu::ExportTrampoline trampoline;
+  } variants[] = {
+      {"logging", export_entry->function_data.trampoline},
+      {"quiet", export_entry->function_data.quiet_trampoline},
+  };
+  for (auto& variant : variants) {
+    // Called through a pointer, as the guest-to-host thunk does.
+    volatile xe::cpu::ExportTrampoline trampoline = variant.trampoline;
+    auto start_time = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < kIterations; ++i) {
+      trampoline(context.ppc_context());
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now() - start_time)
+                       .count();
+    WARN(variant.name << ": " << kIterations * 1000.0 / elapsed
+                      << "M calls per second");
+  }
+}
+
+}  // namespace test
+}  // namespace shim
+}  // namespace kernel
+}  // namespace xe
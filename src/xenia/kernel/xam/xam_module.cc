@@ -13,6 +13,7 @@
 
 #include "xenia/base/math.h"
 #include "xenia/kernel/kernel_state.h"
+#include "xenia/kernel/util/shim_utils.h"
 #include "xenia/kernel/xam/xam_private.h"
 
 namespace xe {
@@ -62,6 +63,7 @@ void XamModule::RegisterExportTable(xe::cpu::ExportResolver* export_resolver) {
       xam_exports[export_entry.ordinal] = &export_entry;
     }
   }
+  shim::SelectExportTrampolines(&xam_exports);
   export_resolver->RegisterTable("xam.xex", &xam_exports);
 }
 
@@ -19,7 +19,9 @@
 #include "xenia/emulator.h"
 #include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/user_module.h"
+#include "xenia/kernel/util/shim_utils.h"
 #include "xenia/kernel/xboxkrnl/xboxkrnl_private.h"
+#include "xenia/kernel/xboxkrnl/xboxkrnl_rtl.h"
 
 namespace xe {
 namespace kernel {
@@ -165,10 +167,15 @@ void XboxkrnlModule::RegisterExportTable(
       xboxkrnl_exports[export_entry.ordinal] = &export_entry;
     }
   }
+  shim::SelectExportTrampolines(&xboxkrnl_exports);
   export_resolver->RegisterTable("xboxkrnl.exe", &xboxkrnl_exports);
 }
 
-XboxkrnlModule::~XboxkrnlModule() = default;
+XboxkrnlModule::~XboxkrnlModule() {
+  if (FLAGS_log_critical_section_stats) {
+    xeRtlLogCriticalSectionStats();
+  }
+}
 
 }  // namespace xboxkrnl
 }  // namespace kernel
@@ -9,11 +9,17 @@
 
 #include "xenia/kernel/xboxkrnl/xboxkrnl_rtl.h"
 
+#include <gflags/gflags.h>
+
 #include <algorithm>
+#include <atomic>
+#include <cinttypes>
 #include <string>
+#include <vector>
 
 #include "xenia/base/atomic.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/parking_lot.h"
 #include "xenia/base/string.h"
 #include "xenia/base/threading.h"
 #include "xenia/kernel/kernel_state.h"
@@ -30,6 +36,9 @@
 #define timegm _mkgmtime
 #endif
 
+DEFINE_bool(log_critical_section_stats, false,
+            "Log the most contended guest critical sections on shutdown.");
+
 namespace xe {
 namespace kernel {
 namespace xboxkrnl {
@@ -371,37 +380,131 @@ dword_result_t RtlInitializeCriticalSectionAndSpinCount(
 DECLARE_XBOXKRNL_EXPORT(RtlInitializeCriticalSectionAndSpinCount,
                         ExportTag::kImplemented);
 
-void RtlEnterCriticalSection(pointer_t<X_RTL_CRITICAL_SECTION> cs) {
-  uint32_t cur_thread = XThread::GetCurrentThread()->guest_object();
-  uint32_t spin_count = cs->header.absolute * 256;
+// Contention is tracked per critical section in a fixed table indexed by
+// section address, so that lookups take no locks and the table can't grow
+// with the number of sections a title creates. Sections that land in the same
+// slot take it over from each other, starting it afresh; that only costs the
+// adaptive spin limit a few entries to settle again.
+struct CriticalSectionStats {
+  // Address of the section the slot currently belongs to.
+  std::atomic<uint32_t> cs_ptr{0};
+  // Adaptive spin limit: the average number of spins it took to get the
+  // section recently, plus some headroom.
+  std::atomic<uint32_t> spin_estimate{0};
+  // Only counted with --log_critical_section_stats.
+  // Entries that found the section owned by another thread.
+  std::atomic<uint64_t> contended_count{0};
+  // Of those, how many got it by spinning and how many had to park.
+  std::atomic<uint64_t> spin_acquire_count{0};
+  std::atomic<uint64_t> park_count{0};
+};
+const uint32_t kCriticalSectionStatsSlotCountLog2 = 12;
+const uint32_t kCriticalSectionStatsSlotCount =
+    1 << kCriticalSectionStatsSlotCountLog2;
+CriticalSectionStats critical_section_stats_[kCriticalSectionStatsSlotCount];
+
+CriticalSectionStats* GetCriticalSectionStats(uint32_t cs_ptr) {
+  uint32_t slot = ((cs_ptr >> 2) * 0x9E3779B1u) >>
+                  (32 - kCriticalSectionStatsSlotCountLog2);
+  auto stats = &critical_section_stats_[slot];
+  if (stats->cs_ptr.load(std::memory_order_relaxed) != cs_ptr) {
+    stats->cs_ptr.store(cs_ptr, std::memory_order_relaxed);
+    stats->spin_estimate.store(0, std::memory_order_relaxed);
+    stats->contended_count.store(0, std::memory_order_relaxed);
+    stats->spin_acquire_count.store(0, std::memory_order_relaxed);
+    stats->park_count.store(0, std::memory_order_relaxed);
+  }
+  return stats;
+}
 
-  if (cs->owning_thread == cur_thread) {
-    // We already own the lock.
-    xe::atomic_inc(&cs->lock_count);
-    cs->recursion_count++;
-    return;
+// Host context switches cost far more than the 360 ones the guest spin counts
+// were tuned for, so every section spins a little before parking, up to an
+// adaptive limit. Sections the guest gave a spin count spin at least that
+// much, as they did before.
+const uint32_t kCriticalSectionMaxSpinCount = 128;
+const uint32_t kCriticalSectionMaxBackoff = 8;
+
+// Slow path of RtlEnterCriticalSection once the section is found owned.
+void EnterContendedCriticalSection(X_RTL_CRITICAL_SECTION* cs,
+                                   uint32_t cs_ptr, uint32_t cur_thread) {
+  auto stats = GetCriticalSectionStats(cs_ptr);
+  bool count_stats = FLAGS_log_critical_section_stats;
+  if (count_stats) {
+    ++stats->contended_count;
   }
 
-  // Spin loop
-  while (spin_count--) {
-    if (xe::atomic_cas(-1, 0, &cs->lock_count)) {
+  // Adaptive spinning (like glibc's adaptive mutexes): spin up to twice the
+  // recent average, backing off exponentially between attempts, and only try
+  // the (cache line stealing) exchange when the section looks free.
+  uint32_t spin_estimate = stats->spin_estimate.load(std::memory_order_relaxed);
+  // header.absolute holds the guest spin count / 256.
+  uint32_t max_spins =
+      std::max(std::min(spin_estimate * 2 + 10, kCriticalSectionMaxSpinCount),
+               uint32_t(cs->header.absolute) * 256);
+  uint32_t backoff = 1;
+  for (uint32_t spins = 0; spins < max_spins; ++spins) {
+    if (*reinterpret_cast<volatile int32_t*>(&cs->lock_count) == -1 &&
+        xe::atomic_cas(-1, 0, &cs->lock_count)) {
       // Acquired.
       cs->owning_thread = cur_thread;
       cs->recursion_count = 1;
+      if (count_stats) {
+        ++stats->spin_acquire_count;
+      }
+      stats->spin_estimate.store(
+          spin_estimate + (int32_t(spins) - int32_t(spin_estimate)) / 8,
+          std::memory_order_relaxed);
       return;
     }
+    for (uint32_t i = 0; i < backoff; ++i) {
+      xe::threading::SpinPause();
+    }
+    backoff = std::min(backoff * 2, kCriticalSectionMaxBackoff);
   }
+  stats->spin_estimate.store(
+      spin_estimate + (int32_t(max_spins) - int32_t(spin_estimate)) / 8,
+      std::memory_order_relaxed);
 
   if (xe::atomic_inc(&cs->lock_count) != 0) {
-    // Create a full waiter.
-    KeWaitForSingleObject(reinterpret_cast<void*>(cs.host_address()), 8, 0, 0,
-                          nullptr);
+    // Park until the owner hands the section over. A wakeup that comes in
+    // before we park is left in signal_state (like the auto reset event the
+    // header describes) and consumed here instead.
+    if (count_stats) {
+      ++stats->park_count;
+    }
+    xe::ParkingLot::Park(cs_ptr, [cs]() {
+      if (cs->header.signal_state) {
+        cs->header.signal_state = 0;
+        return false;
+      }
+      return true;
+    });
   }
 
   assert_true(cs->owning_thread == 0);
   cs->owning_thread = cur_thread;
   cs->recursion_count = 1;
 }
+
+void RtlEnterCriticalSection(pointer_t<X_RTL_CRITICAL_SECTION> cs) {
+  uint32_t cur_thread = XThread::GetCurrentThread()->guest_object();
+
+  if (cs->owning_thread == cur_thread) {
+    // We already own the lock.
+    xe::atomic_inc(&cs->lock_count);
+    cs->recursion_count++;
+    return;
+  }
+
+  if (xe::atomic_cas(-1, 0, &cs->lock_count)) {
+    // Acquired.
+    cs->owning_thread = cur_thread;
+    cs->recursion_count = 1;
+    return;
+  }
+
+  EnterContendedCriticalSection(cs, cs.guest_address(), cur_thread);
+}
 DECLARE_XBOXKRNL_EXPORT(RtlEnterCriticalSection,
                         ExportTag::kImplemented | ExportTag::kHighFrequency);
 
@@ -442,13 +545,52 @@ void RtlLeaveCriticalSection(pointer_t<X_RTL_CRITICAL_SECTION> cs) {
   // Not owned - unlock!
   cs->owning_thread = 0;
   if (xe::atomic_dec(&cs->lock_count) != -1) {
-    // There were waiters - wake one of them.
-    KeSetEvent(reinterpret_cast<X_KEVENT*>(cs.host_address()), 1, 0);
+    // There were waiters - hand the section to one of them. It may not have
+    // parked yet, in which case it picks the wakeup up from signal_state.
+    auto cs_ptr = cs.guest_address();
+    X_RTL_CRITICAL_SECTION* cs_host = cs;
+    xe::ParkingLot::UnparkOne(cs_ptr, [cs_host](bool woke_thread) {
+      if (!woke_thread) {
+        cs_host->header.signal_state = 1;
+      }
+    });
   }
 }
 DECLARE_XBOXKRNL_EXPORT(RtlLeaveCriticalSection,
                         ExportTag::kImplemented | ExportTag::kHighFrequency);
 
+void xeRtlLogCriticalSectionStats() {
+  struct Entry {
+    uint32_t cs_ptr;
+    uint64_t contended_count;
+    uint64_t spin_acquire_count;
+    uint64_t park_count;
+    uint32_t spin_estimate;
+  };
+  std::vector<Entry> entries;
+  for (auto& stats : critical_section_stats_) {
+    if (!stats.contended_count) {
+      continue;
+    }
+    entries.push_back({stats.cs_ptr, stats.contended_count,
+                       stats.spin_acquire_count, stats.park_count,
+                       stats.spin_estimate});
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry& a, const Entry& b) {
+              return a.contended_count > b.contended_count;
+            });
+  const size_t kMaxLogged = 16;
+  XELOGI("%zu guest critical sections were contended", entries.size());
+  for (size_t i = 0; i < std::min(entries.size(), kMaxLogged); ++i) {
+    auto& entry = entries[i];
+    XELOGI("  %.8X: %" PRIu64 " contended, %" PRIu64
+           " acquired spinning, %" PRIu64 " parked, spin estimate %u",
+           entry.cs_ptr, entry.contended_count, entry.spin_acquire_count,
+           entry.park_count, entry.spin_estimate);
+  }
+}
+
 struct X_TIME_FIELDS {
   xe::be<uint16_t> year;
   xe::be<uint16_t> month;
@@ -10,8 +10,12 @@
 #ifndef XENIA_KERNEL_XBOXKRNL_XBOXKRNL_RTL_H_
 #define XENIA_KERNEL_XBOXKRNL_XBOXKRNL_RTL_H_
 
+#include <gflags/gflags.h>
+
 #include "xenia/xbox.h"
 
+DECLARE_bool(log_critical_section_stats);
+
 namespace xe {
 namespace kernel {
 namespace xboxkrnl {
@@ -24,6 +28,9 @@ X_STATUS xeRtlInitializeCriticalSectionAndSpinCount(X_RTL_CRITICAL_SECTION* cs,
                                                     uint32_t cs_ptr,
                                                     uint32_t spin_count);
 
+// Logs the critical sections that were contended the most.
+void xeRtlLogCriticalSectionStats();
+
 }  // namespace xboxkrnl
 }  // namespace kernel
 }  // namespace xe
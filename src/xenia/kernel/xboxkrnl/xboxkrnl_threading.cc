@@ -314,15 +314,12 @@ SHIM_CALL KeSetDisableBoostThread_shim(PPCContext* ppc_context,
   SHIM_SET_RETURN_32(0);
 }
 
-SHIM_CALL KeGetCurrentProcessType_shim(PPCContext* ppc_context,
-                                       KernelState* kernel_state) {
-  // XELOGD(
-  //     "KeGetCurrentProcessType()");
-
-  // DWORD
-
-  SHIM_SET_RETURN_32(kernel_state->process_type());
+dword_result_t KeGetCurrentProcessType() {
+  return kernel_state()->process_type();
 }
+DECLARE_XBOXKRNL_EXPORT(KeGetCurrentProcessType,
+                        ExportTag::kThreading | ExportTag::kImplemented |
+                            ExportTag::kHighFrequency);
 
 SHIM_CALL KeSetCurrentProcessType_shim(PPCContext* ppc_context,
                                        KernelState* kernel_state) {
@@ -1330,7 +1327,6 @@ void RegisterThreadingExports(xe::cpu::ExportResolver* export_resolver,
   SHIM_SET_MAPPING("xboxkrnl.exe", KeSetBasePriorityThread, state);
   SHIM_SET_MAPPING("xboxkrnl.exe", KeSetDisableBoostThread, state);
 
-  SHIM_SET_MAPPING("xboxkrnl.exe", KeGetCurrentProcessType, state);
   SHIM_SET_MAPPING("xboxkrnl.exe", KeSetCurrentProcessType, state);
 
   SHIM_SET_MAPPING("xboxkrnl.exe", KeQueryPerformanceFrequency, state);
@@ -12,6 +12,7 @@
 #include <gflags/gflags.h>
 
 #include <algorithm>
+#include <cinttypes>
 #include <cstring>
 
 #include "xenia/base/byte_stream.h"
@@ -31,6 +32,10 @@ DEFINE_bool(protect_on_release, false,
 DEFINE_bool(scribble_heap, false,
             "Scribble 0xCD into all allocated heap memory.");
 
+DEFINE_bool(system_heap_slabs, true,
+            "Serve small system heap allocations from per-thread slab caches "
+            "instead of allocating whole pages.");
+
 namespace xe {
 
 uint32_t get_page_count(uint32_t value, uint32_t page_size) {
@@ -96,6 +101,9 @@ Memory::~Memory() {
   // requests.
   mmio_handler_.reset();
 
+  virtual_system_heap_pool_.reset();
+  physical_system_heap_pool_.reset();
+
   heaps_.v00000000.Dispose();
   heaps_.v40000000.Dispose();
   heaps_.v80000000.Dispose();
@@ -185,6 +193,9 @@ bool Memory::Initialize() {
       kMemoryAllocationReserve | kMemoryAllocationCommit,
       kMemoryProtectRead | kMemoryProtectWrite);
 
+  virtual_system_heap_pool_ = CreateSystemHeapPool(false);
+  physical_system_heap_pool_ = CreateSystemHeapPool(true);
+
   // Add handlers for MMIO.
   mmio_handler_ = cpu::MMIOHandler::Install(virtual_membase_, physical_membase_,
                                             physical_membase_ + 0x1FFFFFFF);
@@ -271,6 +282,9 @@ void Memory::UnmapViews() {
 }
 
 void Memory::Reset() {
+  // Slabs go back to their heaps first.
+  virtual_system_heap_pool_->Reset();
+  physical_system_heap_pool_->Reset();
   heaps_.v00000000.Reset();
   heaps_.v40000000.Reset();
   heaps_.v80000000.Reset();
@@ -390,16 +404,41 @@ void Memory::CancelAccessWatch(uintptr_t watch_handle) {
   mmio_handler_->CancelAccessWatch(watch_handle);
 }
 
+std::unique_ptr<SlabAllocator> Memory::CreateSystemHeapPool(bool physical) {
+  auto heap = LookupHeapByType(physical, 4096);
+  return std::unique_ptr<SlabAllocator>(new SlabAllocator(
+      virtual_membase_,
+      [heap]() {
+        uint32_t address;
+        if (!heap->Alloc(SlabAllocator::kSlabSize, SlabAllocator::kSlabSize,
+                         kMemoryAllocationReserve | kMemoryAllocationCommit,
+                         kMemoryProtectRead | kMemoryProtectWrite, false,
+                         &address)) {
+          return 0u;
+        }
+        return address;
+      },
+      [heap](uint32_t address) { heap->Release(address); }));
+}
+
 uint32_t Memory::SystemHeapAlloc(uint32_t size, uint32_t alignment,
                                  uint32_t system_heap_flags) {
-  // TODO(benvanik): lightweight pool.
   bool is_physical = !!(system_heap_flags & kSystemHeapPhysical);
-  auto heap = LookupHeapByType(is_physical, 4096);
-  uint32_t address;
-  if (!heap->Alloc(size, alignment,
-                   kMemoryAllocationReserve | kMemoryAllocationCommit,
-                   kMemoryProtectRead | kMemoryProtectWrite, false, &address)) {
-    return 0;
+  uint32_t address = 0;
+  if (FLAGS_system_heap_slabs &&
+      SlabAllocator::CanAllocate(size, alignment)) {
+    auto& pool =
+        is_physical ? physical_system_heap_pool_ : virtual_system_heap_pool_;
+    address = pool->Alloc(size, alignment);
+  }
+  if (!address) {
+    auto heap = LookupHeapByType(is_physical, 4096);
+    if (!heap->Alloc(size, alignment,
+                     kMemoryAllocationReserve | kMemoryAllocationCommit,
+                     kMemoryProtectRead | kMemoryProtectWrite, false,
+                     &address)) {
+      return 0;
+    }
   }
   Zero(address, size);
   return address;
@@ -409,11 +448,25 @@ void Memory::SystemHeapFree(uint32_t address) {
   if (!address) {
     return;
   }
-  // TODO(benvanik): lightweight pool.
+  if (virtual_system_heap_pool_->Free(address) ||
+      physical_system_heap_pool_->Free(address)) {
+    return;
+  }
   auto heap = LookupHeap(address);
   heap->Release(address);
 }
 
+static void DumpSystemHeapPool(const char* name, SlabAllocator* pool) {
+  XELOGE("%s:", name);
+  XELOGE("  Block Size  Slabs      In Use      Allocs    Refills    Flushes");
+  for (auto& stats : pool->GetStats()) {
+    XELOGE("  %10u %6u %11" PRId64 " %11" PRIu64 " %10" PRIu64 " %10" PRIu64,
+           stats.block_size, stats.slab_count,
+           int64_t(stats.alloc_count) - int64_t(stats.free_count),
+           stats.alloc_count, stats.refill_count, stats.flush_count);
+  }
+}
+
 void Memory::DumpMap() {
   XELOGE("==================================================================");
   XELOGE("Memory Dump");
@@ -440,10 +493,20 @@ void Memory::DumpMap() {
   heaps_.vC0000000.DumpMap();
   heaps_.vE0000000.DumpMap();
   XELOGE("");
+  XELOGE("------------------------------------------------------------------");
+  XELOGE("System Heap Pools");
+  XELOGE("------------------------------------------------------------------");
+  XELOGE("");
+  DumpSystemHeapPool("Virtual", virtual_system_heap_pool_.get());
+  DumpSystemHeapPool("Physical", physical_system_heap_pool_.get());
+  XELOGE("");
 }
 
 bool Memory::Save(ByteStream* stream) {
   XELOGD("Serializing memory...");
+  // Before the heaps, as this flushes thread caches into guest memory.
+  virtual_system_heap_pool_->Save(stream);
+  physical_system_heap_pool_->Save(stream);
   heaps_.v00000000.Save(stream);
   heaps_.v40000000.Save(stream);
   heaps_.v80000000.Save(stream);
@@ -455,6 +518,8 @@ bool Memory::Save(ByteStream* stream) {
 
 bool Memory::Restore(ByteStream* stream) {
   XELOGD("Restoring memory...");
+  virtual_system_heap_pool_->Restore(stream);
+  physical_system_heap_pool_->Restore(stream);
   heaps_.v00000000.Restore(stream);
   heaps_.v40000000.Restore(stream);
   heaps_.v80000000.Restore(stream);
@@ -487,6 +552,7 @@ void BaseHeap::Initialize(uint8_t* membase, uint32_t heap_base,
   heap_size_ = heap_size - 1;
   page_size_ = page_size;
   page_table_.resize(heap_size / page_size);
+  free_page_map_.Resize(page_table_.size());
 }
 
 void BaseHeap::Dispose() {
@@ -648,12 +714,20 @@ bool BaseHeap::Restore(ByteStream* stream) {
     }
   }
 
+  free_page_map_.Reset();
+  for (size_t i = 0; i < page_table_.size(); i++) {
+    if (page_table_[i].state) {
+      free_page_map_.SetUsed(i, 1);
+    }
+  }
+
   return true;
 }
 
 void BaseHeap::Reset() {
   // TODO(DrChat): protect pages.
   std::memset(page_table_.data(), 0, sizeof(PageEntry) * page_table_.size());
+  free_page_map_.Reset();
 }
 
 bool BaseHeap::Alloc(uint32_t size, uint32_t alignment,
@@ -742,6 +816,7 @@ bool BaseHeap::AllocFixed(uint32_t base_address, uint32_t size,
     page_entry.current_protect = protect;
     page_entry.state = kMemoryAllocationReserve | allocation_type;
   }
+  free_page_map_.SetUsed(start_page_number, page_count);
 
   return true;
 }
@@ -771,84 +846,18 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
   auto global_lock = global_critical_region_.Acquire();
 
   // Find a free page range.
-  // The base page must match the requested alignment, so we first scan for
-  // a free aligned page and only then check for continuous free pages.
-  // TODO(benvanik): optimized searching (free list buckets, bitmap, etc).
-  uint32_t start_page_number = UINT_MAX;
-  uint32_t end_page_number = UINT_MAX;
+  // The base page must match the requested alignment. Pages up to (but not
+  // including) high_page_number are usable.
   uint32_t page_scan_stride = alignment / page_size_;
   high_page_number = high_page_number - (high_page_number % page_scan_stride);
-  if (top_down) {
-    for (int64_t base_page_number =
-             high_page_number - xe::round_up(page_count, page_scan_stride);
-         base_page_number >= low_page_number;
-         base_page_number -= page_scan_stride) {
-      if (page_table_[base_page_number].state != 0) {
-        // Base page not free, skip to next usable page.
-        continue;
-      }
-      // Check requested range to ensure free.
-      start_page_number = uint32_t(base_page_number);
-      end_page_number = uint32_t(base_page_number) + page_count - 1;
-      assert_true(end_page_number < page_table_.size());
-      bool any_taken = false;
-      for (uint32_t page_number = uint32_t(base_page_number);
-           !any_taken && page_number <= end_page_number; ++page_number) {
-        bool is_free = page_table_[page_number].state == 0;
-        if (!is_free) {
-          // At least one page in the range is used, skip to next.
-          // We know we'll be starting at least before this page.
-          any_taken = true;
-          if (page_count > page_number) {
-            // Not enough space left to fit entire page range. Breaks outer
-            // loop.
-            base_page_number = -1;
-          } else {
-            base_page_number = page_number - page_count;
-            base_page_number -= base_page_number % page_scan_stride;
-            base_page_number += page_scan_stride;  // cancel out loop logic
-          }
-          break;
-        }
-      }
-      if (!any_taken) {
-        // Found our place.
-        break;
-      }
-      // Retry.
-      start_page_number = end_page_number = UINT_MAX;
-    }
-  } else {
-    for (uint32_t base_page_number = low_page_number;
-         base_page_number <= high_page_number - page_count;
-         base_page_number += page_scan_stride) {
-      if (page_table_[base_page_number].state != 0) {
-        // Base page not free, skip to next usable page.
-        continue;
-      }
-      // Check requested range to ensure free.
-      start_page_number = base_page_number;
-      end_page_number = base_page_number + page_count - 1;
-      bool any_taken = false;
-      for (uint32_t page_number = base_page_number;
-           !any_taken && page_number <= end_page_number; ++page_number) {
-        bool is_free = page_table_[page_number].state == 0;
-        if (!is_free) {
-          // At least one page in the range is used, skip to next.
-          // We know we'll be starting at least after this page.
-          any_taken = true;
-          base_page_number = xe::round_up(page_number + 1, page_scan_stride);
-          base_page_number -= page_scan_stride;  // cancel out loop logic
-          break;
-        }
-      }
-      if (!any_taken) {
-        // Found our place.
-        break;
-      }
-      // Retry.
-      start_page_number = end_page_number = UINT_MAX;
-    }
+  uint32_t start_page_number = UINT_MAX;
+  uint32_t end_page_number = UINT_MAX;
+  size_t free_page_number =
+      free_page_map_.FindFreeRange(low_page_number, high_page_number,
+                                   page_count, page_scan_stride, top_down);
+  if (free_page_number != HierarchicalBitMap::npos) {
+    start_page_number = uint32_t(free_page_number);
+    end_page_number = start_page_number + page_count - 1;
   }
   if (start_page_number == UINT_MAX || end_page_number == UINT_MAX) {
     // Out of memory.
@@ -887,6 +896,7 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
     page_entry.current_protect = protect;
     page_entry.state = kMemoryAllocationReserve | allocation_type;
   }
+  free_page_map_.SetUsed(start_page_number, page_count);
 
   *out_address = heap_base_ + (start_page_number * page_size_);
   return true;
@@ -973,6 +983,7 @@ bool BaseHeap::Release(uint32_t base_address, uint32_t* out_region_size) {
     auto& page_entry = page_table_[page_number];
     page_entry.qword = 0;
   }
+  free_page_map_.SetFree(base_page_number, base_page_entry.region_page_count);
 
   return true;
 }
@@ -15,8 +15,10 @@
 #include <string>
 #include <vector>
 
+#include "xenia/base/hierarchical_bit_map.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/mutex.h"
+#include "xenia/base/slab_allocator.h"
 #include "xenia/cpu/mmio_handler.h"
 
 namespace xe {
@@ -168,6 +170,8 @@ class BaseHeap {
   uint32_t page_size_;
   xe::global_critical_region global_critical_region_;
   std::vector<PageEntry> page_table_;
+  // Free (state == 0) pages of page_table_, for finding free ranges quickly.
+  HierarchicalBitMap free_page_map_;
 };
 
 // Normal heap allowing allocations from guest virtual address ranges.
@@ -318,6 +322,8 @@ class Memory {
   // System memory is kept separate from game memory but is still accessible
   // using normal guest virtual addresses. Kernel structures and other internal
   // 'system' allocations should come from this heap when possible.
+  // Small allocations are served from per-thread slab caches and don't take
+  // the global critical region.
   uint32_t SystemHeapAlloc(uint32_t size, uint32_t alignment = 0x20,
                            uint32_t system_heap_flags = kSystemHeapDefault);
 
@@ -338,6 +344,7 @@ class Memory {
 
  private:
   int MapViews(uint8_t* mapping_base);
+  std::unique_ptr<SlabAllocator> CreateSystemHeapPool(bool physical);
   void UnmapViews();
 
  private:
@@ -377,6 +384,11 @@ class Memory {
     PhysicalHeap vE0000000;
   } heaps_;
 
+  // Small SystemHeapAlloc blocks, carved out of 64KiB slabs of the virtual and
+  // physical 4KiB heaps.
+  std::unique_ptr<SlabAllocator> virtual_system_heap_pool_;
+  std::unique_ptr<SlabAllocator> physical_system_heap_pool_;
+
   friend class BaseHeap;
 };
 